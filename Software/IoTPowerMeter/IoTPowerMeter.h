@@ -41,17 +41,30 @@ enum DisplayFields {
   HEAP  = 0b10000000
 };
 
+// Bit field of the startup stages, in the order they are brought up
+enum BootStages {
+  BOOT_COUNTER = 0b0001,
+  BOOT_DISPLAY = 0b0010,
+  BOOT_SD      = 0b0100,
+  BOOT_NETWORK = 0b1000
+};
+
 void screenStatus(const char *);
 boolean setupWiFi();
+void networkConnected();
+bool bootSd();
+void bootStep();
 time_t syncTime();
 void blinkWatt();
 void buttonPress();
 void buttonPressLong();
-void logData(time_t, uint16_t);
-void logEvent(char *);
+void logData(time_t, uint32_t);
 void screenUpdate();
-uint16_t livePowerUsage();
-uint16_t todayPowerUsage();
+uint32_t livePowerUsage();
+uint32_t todayPowerUsage();
+uint16_t getMeterConstant();
+bool setMeterConstant(uint16_t);
+void loadMeterConstant();
 
 #endif
 
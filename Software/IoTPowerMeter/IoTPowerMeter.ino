@@ -37,8 +37,14 @@
 #include "config.h"
 #include "IoTPowerMeter.h"
 #include "ESP_SSD1306.h"
+#include "request.h"
 #include "server.h"
 #include "push.h"
+#include "series.h"
+#include "archive.h"
+#include "persist.h"
+#include "events.h"
+#include "memory.h"
 
 // Global instances
 IPAddress ip;
@@ -49,10 +55,18 @@ static GoogleSpreadsheets gs(googleSpreadSheetsScript);
 #endif
 
 // Global variables
-static volatile uint16_t powerCounter          = 0;  // Internal counter [Wh]
-static volatile uint16_t powerCounterNow       = 0;  // Instant power usage [Wh]
-static volatile uint16_t powerCounterToday     = 0;  // Total day power usage [Wh]
+static volatile uint32_t powerCounter          = 0;  // Internal counter [imp]
+static volatile uint32_t powerCounterToday     = 0;  // Total day power usage [imp]
+static volatile uint32_t blinkInterval         = 0;  // Time between the last two blinks [us]
 static volatile uint8_t screenUpdateFieldFlags = 0;
+static volatile uint32_t timeFirstBlink        = 0;  // Time of the first blink counted since boot [ms]
+static uint32_t timeBootCounter = 0; // Time at which the blinks started to be counted [ms]
+static uint8_t bootStages = 0; // Startup stages that are up and running, see BootStages
+static uint16_t meterConstant = METER_IMPULSES_PER_KWH; // Blinks per kWh, can be changed at runtime via the API [imp/kWh]
+static uint32_t powerCounterHour = 0; // Power counter for the current hour [Wh]
+static uint32_t powerRemainder = 0; // Blinks not worth a full Wh yet, carried over to the next minute [imp*Wh/kWh]
+static time_t restoredTime = 0; // Time of the checkpoint the counters were restored from, 0 if none [s]
+static uint32_t restoredMinute = 0; // Blinks of the minute in progress at the checkpoint, kept apart until the first minute is logged [imp]
 
 void setup(void)
 {
@@ -62,52 +76,53 @@ void setup(void)
   DEBUG_SERIAL.setDebugOutput(true);
   #endif
   
+  // Stage 1: counters and interrupts, nothing should delay counting the blinks
+  // Restore the counters saved before the reset, this must happen before the interrupts are attached
+  Checkpoint checkpoint;
+  if(persistRestore(&checkpoint))
+  {
+    restoredMinute = checkpoint.powerMinute;
+    powerCounterToday = checkpoint.powerToday;
+    powerCounterHour = checkpoint.powerHour;
+    powerRemainder = checkpoint.powerRemainder;
+    restoredTime = checkpoint.timestamp;
+  }
+  
+  // Attach the interrupt that counts the used Watts, both edges are used to measure the LED pulse width
+  attachInterrupt(SENSOR_PIN, blinkWatt, CHANGE);
+  // Attach the interrupt for the button press, attached to GPIO0
+  // GPIO0 has an external pull-up 
+  attachInterrupt(BUTTON_PIN, buttonPress, FALLING);
+  timeBootCounter = millis();
+  bootStages |= BOOT_COUNTER;
+  
+  // Stage 2: display
   // Initialise the screen
   display.begin();
   
   // Load a dummy screen
   display.blank();
   
-  #ifdef ENABLE_INTERNET
-  // Try to connect to the access point (AP)
-  if(WiFi.status() != WL_CONNECTED)
-  {
-    screenStatus("Connecting...");
-    while(!setupWiFi())
-    {
-      screenStatus("WiFi error");
-      ESP.restart();
-      delay(1000);
-    }
-    screenStatus("Connected");
-  }
+  // Reset the counters on the screen
+  screenUpdateFieldFlags |= TODAY | NOW;
+  bootStages |= BOOT_DISPLAY;
   
-  // Initialise the SD card
-  if(!SD.begin(SD_CS_PIN))
-  {
-    screenStatus("No SD card");
-    // Require a reset, inserting an SD card while in opertation does not work well
-    while(1){};
-  }
+  // Stage 3: SD card, without it the blinks are still counted and today's values kept in RAM
+  bootSd();
   
-  initServer();
+  // Stage 4: network, the connection is finished in the background by bootStep()
+  #ifdef ENABLE_INTERNET
+  screenStatus("Connecting...");
+  screenUpdateFieldFlags |= SSID;
   
-  // Set up the internal clock synchronizing function with a Network Time Protocol (NTP) server
-  setSyncProvider(syncTime);
-  setSyncInterval(TIME_SYNC_PERIOD);
+  #ifdef ENABLE_STATIC_IP
+  WiFi.config(wifi_ip, wifi_gateway, wifi_subnet);
+  #endif
+  WiFi.begin(wifi_ssid, wifi_password);
   #else
   // Turn off WiFi
   WiFi.disconnect(true);
   #endif
-  
-  // Reset the counters on the screen
-  screenUpdateFieldFlags |= TODAY | NOW;
-  
-  // Attach the interrupt that counts the used Watts
-  attachInterrupt(SENSOR_PIN, blinkWatt, FALLING);
-  // Attach the interrupt for the button press, attached to GPIO0
-  // GPIO0 has an external pull-up 
-  attachInterrupt(BUTTON_PIN, buttonPress, FALLING);
 }
 
 void loop(void)
@@ -116,27 +131,96 @@ void loop(void)
   static uint8_t currentMinute = 0xff;
   static uint8_t currentDay = 0xff;
   static uint8_t currentHour = 0xff;
-  static uint16_t powerCounterHour = 0; // Power counter for the current hour
-  static uint16_t powerCounterHourTemp = 0; // Temporary variable for pushing data to the internet
-  static uint16_t powerCounterTemp = 0; // Temporary variable for logging
+  static uint32_t powerCounterHourTemp = 0; // Temporary variable for pushing data to the internet [Wh]
+  static uint32_t powerCounterTemp = 0; // Temporary variable for logging [Wh]
+  static uint32_t persistTime = 0; // Time of the last checkpoint [ms]
+  static uint32_t persistJournalTime = 0; // Time of the last checkpoint written to the flash journal [ms]
   static bool uploadData = false; // Temporary variable indicating if data should be uploaded
-  static char buffer[32]; // Buffer for log messages
+  
+  // Bring up the startup stages that are not running yet
+  bootStep();
+  
+  memorySample();
   
   // Handle client connecting to server
   #ifdef ENABLE_INTERNET
-  handleClient();
+  if(bootStages & BOOT_NETWORK)
+  {
+    handleClient();
+  }
+  #endif
+
+  #ifdef ENABLE_ARCHIVE
+  // Fold closed days into the archive, a little at a time
+  if(bootStages & BOOT_SD)
+  {
+    archiveStep();
+  }
+  #endif
+
+  // Write the events logged since the last time to the SD card
+  if(bootStages & BOOT_SD)
+  {
+    eventsStep();
+  }
+
+  // Remove a directory deleted from the edit page, a few entries at a time
+  if(bootStages & BOOT_SD)
+  {
+    deleteStep();
+  }
+
+  // Until the time is synchronised the blinks are kept in the counters, they are logged with the first valid minute
+  bool timeValid = true;
+  #ifdef ENABLE_INTERNET
+  timeValid = timeStatus() != timeNotSet;
   #endif
 
   // A new minute has happened! Log, save and reset
-  if(currentMinute != minute())
+  if(currentMinute != minute() && timeValid)
   {
     currentMinute = minute();
     
+    // Right after boot the minute and hour restored from a checkpoint are only carried on from the same hour, or from
+    // the previous one which is then finished and uploaded as the last hour. An older checkpoint, or one taken before
+    // the time was known, would end up in the wrong hour, its hour and minute are dropped
+    if(currentHour == 0xff)
+    {
+      // The blinks counted until the time was known are logged with this minute, keep a record of how many there were
+      logEvent(EVENT_TIME_FIRST, powerCounter, millis() - timeBootCounter);
+      
+      uint32_t hourRestored = restoredTime / SECS_PER_HOUR;
+      uint32_t hourNow = now() / SECS_PER_HOUR;
+      if(restoredTime && (hourRestored == hourNow || hourRestored + 1 == hourNow))
+      {
+        noInterrupts();
+        powerCounter += restoredMinute;
+        interrupts();
+        
+        if(hourRestored == hourNow)
+        {
+          currentHour = hour();
+        }
+      }
+      else
+      {
+        powerCounterHour = 0;
+        currentHour = hour();
+      }
+      restoredMinute = 0;
+    }
+    
     // Log the last minute data to SD card
-    // Copy the counter to a temporary variable and reset it
-    // TODO: these actions should be atomic, a blink can potentially happen between these instructions and be lost
+    // Copy the counter to a temporary variable and reset it, without letting a blink slip in between
+    noInterrupts();
     powerCounterTemp = powerCounter;
     powerCounter = 0;
+    interrupts();
+
+    // Convert the blinks to Wh, the fraction of a Wh is kept for the next minute so nothing is lost over the day
+    uint64_t energy = (uint64_t)powerCounterTemp * 1000 + powerRemainder;
+    powerCounterTemp = energy / meterConstant;
+    powerRemainder = energy % meterConstant;
 
     // Cumulative hour counter to log data hourly
     powerCounterHour += powerCounterTemp;
@@ -145,15 +229,20 @@ void loop(void)
     // Second precision does not matter
     time_t timeLogEntry = now() - 60;
     logData(timeLogEntry, powerCounterTemp);
+    todaySeriesUpdate(timeLogEntry, powerCounterTemp);
 
     // Reset the today counter when the day changes
+    // Right after boot the counter restored from a checkpoint of the same day is kept, as well as the one of a checkpoint
+    // taken before the time was known and the blinks counted since boot, which cannot be placed on another day
     if(day() != currentDay)
     {
-      sprintf(buffer, "Day power usage: %dWh", powerCounterToday);
-      logEvent(buffer);
-      
+      if(currentDay != 0xff || (restoredTime && previousMidnight(restoredTime) != previousMidnight(now())))
+      {
+        logEvent(EVENT_DAY_POWER, todayPowerUsage());
+        
+        powerCounterToday = 0;
+      }
       currentDay = day();
-      powerCounterToday = 0;
     }
 
     // Hourly counter
@@ -168,8 +257,8 @@ void loop(void)
     }
 
     #ifdef ENABLE_INTERNET
-    // Check that the device is still connected to the WiFi
-    if(WiFi.status() != WL_CONNECTED)
+    // Check that the device is still connected to the WiFi, the first connection is handled by bootStep()
+    if(bootStages & BOOT_NETWORK && WiFi.status() != WL_CONNECTED)
     {
       screenStatus("Connecting...");
       if(!setupWiFi())
@@ -180,13 +269,6 @@ void loop(void)
 
     if(WiFi.status() == WL_CONNECTED)
     {
-      // Try to sync time if it is unsychronised (invalid time)
-      if(timeStatus() == timeNotSet)
-      {
-        // Will try to sync the time and set the appropriate state for timeStatus()
-        setSyncProvider(syncTime);
-      }
-      
       #if defined(PUSH_GOOGLE_SPREADSHEETS)
       if(uploadData)
       {
@@ -211,8 +293,7 @@ void loop(void)
             
             uploadComplete = true;
             
-            sprintf(buffer, "Data uploading tries: %d", MAX_TRIES_UPLOAD - retries);
-            logEvent(buffer);
+            logEvent(EVENT_UPLOAD, MAX_TRIES_UPLOAD - retries);
             
             break;
           }
@@ -221,7 +302,7 @@ void loop(void)
         if(!uploadComplete)
         {
           screenStatus("Upload failed");
-          logEvent("Upload failed");
+          logEvent(EVENT_UPLOAD_FAILED);
         }
       }
       #endif
@@ -229,6 +310,25 @@ void loop(void)
     #endif
   }
 
+  // Checkpoint the counters so that a reset or a power loss does not lose the day
+  if(millis() - persistTime > PERSIST_PERIOD || persistTime == 0)
+  {
+    persistTime = millis();
+    
+    bool journal = millis() - persistJournalTime > PERSIST_JOURNAL_PERIOD || persistJournalTime == 0;
+    if(journal)
+    {
+      persistJournalTime = millis();
+    }
+    
+    Checkpoint checkpoint;
+    checkpoint.powerMinute = powerCounter + restoredMinute;
+    checkpoint.powerToday = powerCounterToday;
+    checkpoint.powerHour = powerCounterHour;
+    checkpoint.powerRemainder = powerRemainder;
+    persistSave(&checkpoint, journal);
+  }
+
   // Detect long button press
   static uint32_t button_hold_time = 0;
   if(digitalRead(BUTTON_PIN) == LOW && button_hold_time == 0)
@@ -256,7 +356,8 @@ void loop(void)
   screenUpdate();
 }
 
-void ICACHE_FLASH_ATTR buttonPress()
+// Button interrupt, in RAM like blinkWatt()
+void ICACHE_RAM_ATTR buttonPress()
 {
   // Update all screen fields
   screenUpdateFieldFlags = 0xff;
@@ -290,9 +391,10 @@ void ICACHE_FLASH_ATTR screenUpdate()
   // Set invalid values so they are updated right away
   static unsigned char currentSecond = 0xff;
   static unsigned char currentDay = 0xff;
-  static uint16_t powerCounterNowTemp = 0;
-  static uint16_t powerCounterTodayTemp = 0;
+  static uint32_t powerCounterNowTemp = 0;
+  static uint32_t powerCounterTodayTemp = 0;
   static uint32_t heapTemp = 0;
+  static uint32_t blockTemp = 0;
   
   if(screenUpdateFieldFlags & SSID)
   {
@@ -330,30 +432,32 @@ void ICACHE_FLASH_ATTR screenUpdate()
     display.sendStrXY(buffer, SCREEN_ROW_TIME, SCREEN_START_COLUMN);
   }
   
-  if(powerCounterNow != powerCounterNowTemp || screenUpdateFieldFlags & NOW)
+  if(livePowerUsage() != powerCounterNowTemp || screenUpdateFieldFlags & NOW)
   {
-    powerCounterNowTemp = powerCounterNow;
+    powerCounterNowTemp = livePowerUsage();
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%dWh", powerCounterNowTemp);
+    sprintf(buffer, "%uW", powerCounterNowTemp);
     display.clear(SCREEN_ROW_NOW, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_NOW, SCREEN_START_COLUMN);
   }
   
-  if(powerCounterToday != powerCounterTodayTemp || screenUpdateFieldFlags & TODAY)
+  if(todayPowerUsage() != powerCounterTodayTemp || screenUpdateFieldFlags & TODAY)
   {
-    powerCounterTodayTemp = powerCounterToday;
+    powerCounterTodayTemp = todayPowerUsage();
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%dWh", powerCounterTodayTemp);
+    sprintf(buffer, "%uWh", powerCounterTodayTemp);
     display.clear(SCREEN_ROW_TODAY, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_TODAY, SCREEN_START_COLUMN);
   }
 
-  // Update the heap size information if it has changed
-  if(heapTemp != ESP.getFreeHeap() || screenUpdateFieldFlags & HEAP)
+  // Update the free heap, largest block and fragmentation if they have changed
+  const MemoryStats * memory = memoryStats();
+  if(heapTemp != memory->heapFree || blockTemp != memory->blockMax || screenUpdateFieldFlags & HEAP)
   {
-    heapTemp = ESP.getFreeHeap();
+    heapTemp = memory->heapFree;
+    blockTemp = memory->blockMax;
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%db", heapTemp);
+    snprintf(buffer, sizeof(buffer), "%u/%uk %u%%", heapTemp / 1024, blockTemp / 1024, memory->fragmentation);
     display.clear(SCREEN_ROW_HEAP, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_HEAP, SCREEN_START_COLUMN);
   }
@@ -365,9 +469,6 @@ void ICACHE_FLASH_ATTR screenUpdate()
 // Configure WiFi connection
 boolean ICACHE_FLASH_ATTR setupWiFi()
 {
-  // Buffer to store the temporary log message
-  char buffer[32];
-  
   if(WiFi.status() == WL_CONNECTED)
   {
     return true;
@@ -377,8 +478,7 @@ boolean ICACHE_FLASH_ATTR setupWiFi()
   screenUpdateFieldFlags |= SSID;
   screenUpdate();
   
-  sprintf(buffer, "Connecting to AP: %s", wifi_ssid);
-  logEvent(buffer);
+  logEvent(EVENT_WIFI_CONNECTING);
   
   #ifdef ENABLE_STATIC_IP
   WiFi.config(wifi_ip, wifi_gateway, wifi_subnet);
@@ -402,18 +502,24 @@ boolean ICACHE_FLASH_ATTR setupWiFi()
   
   if(WiFi.status() != WL_CONNECTED)
   {
-    logEvent("Failed to connect to WiFi");
+    logEvent(EVENT_WIFI_FAILED);
     return false;
   }
 
   // Save situation to log file
-  sprintf(buffer, "Wifi connect tries: %d", retries);
-  logEvent(buffer);
+  logEvent(EVENT_WIFI_CONNECTED, retries);
+  
+  networkConnected();
   
+  return true;
+}
+
+// Show the IP and register the host name once the WiFi is connected
+void ICACHE_FLASH_ATTR networkConnected()
+{
   ip = WiFi.localIP();
   
-  sprintf(buffer, "Device IP: %d.%d.%d.%d", ip[0], ip[1], ip[2], ip[3]);
-  logEvent(buffer);
+  logEvent(EVENT_IP, (uint32_t)ip);
   
   screenUpdateFieldFlags |= IP;
   screenUpdate();
@@ -423,11 +529,82 @@ boolean ICACHE_FLASH_ATTR setupWiFi()
   {
     MDNS.addService("http", "tcp", 80);
   }
+}
+
+// Initialise the SD card, returns false if there is none
+bool ICACHE_FLASH_ATTR bootSd()
+{
+  if(!SD.begin(SD_CS_PIN))
+  {
+    screenStatus("No SD card");
+    return false;
+  }
+  
+  bootStages |= BOOT_SD;
+  eventsBegin();
+  
+  // Finish replacing a file uploaded from the edit page if the device was reset in the middle
+  uploadRecover();
+  
+  // Restore the meter constant saved on the SD card, if any
+  loadMeterConstant();
   
   return true;
 }
 
+// Finish the startup stages that could not be completed in setup(), the blinks are counted all along
+void ICACHE_FLASH_ATTR bootStep()
+{
+  static uint32_t timeRetry = 0;
+  static bool bootReported = false;
+  
+  // Report how long it took to count blinks
+  if(!bootReported && timeFirstBlink)
+  {
+    bootReported = true;
+    logEvent(EVENT_BOOT, timeBootCounter, timeFirstBlink);
+  }
+  
+  #ifdef ENABLE_INTERNET
+  // The WiFi connection started in setup() went through, start the services that need it
+  if(!(bootStages & BOOT_NETWORK) && WiFi.status() == WL_CONNECTED)
+  {
+    bootStages |= BOOT_NETWORK;
+    screenStatus("Connected");
+    
+    networkConnected();
+    initServer();
+    
+    // Set up the internal clock synchronizing function with a Network Time Protocol (NTP) server
+    setSyncProvider(syncTime);
+    setSyncInterval(TIME_SYNC_PERIOD);
+  }
+  #endif
+  
+  if(millis() - timeRetry < BOOT_RETRY_PERIOD)
+  {
+    return;
+  }
+  timeRetry = millis();
+  
+  if(!(bootStages & BOOT_SD))
+  {
+    bootSd();
+  }
+  
+  #ifdef ENABLE_INTERNET
+  // Try to sync time if it is unsychronised (invalid time), or if the last periodic synchronisation failed
+  if(bootStages & BOOT_NETWORK && WiFi.status() == WL_CONNECTED && timeStatus() != timeSet)
+  {
+    // Will try to sync the time and set the appropriate state for timeStatus()
+    setSyncProvider(syncTime);
+  }
+  #endif
+}
+
 // Synchronise local time with an Network Time Protocol (NTP) server
+// A single request is sent and the answer is awaited for at most TIME_SYNC_TIMEOUT, so that the metering loop is never
+// held up for long, bootStep() tries again later when there was no answer
 time_t ICACHE_FLASH_ATTR syncTime()
 {
   WiFiUDP udp;
@@ -435,23 +612,16 @@ time_t ICACHE_FLASH_ATTR syncTime()
   
   byte packetBuffer[NTP_PACKET_SIZE] = {0};
   time_t currentTime = 0;
+  uint32_t timeStart = millis();
   
   screenStatus("Time sync.");
 
-  uint8_t retries = MAX_TRIES_TIME_SYNC;
-  while(retries--)
+  udp.begin(2390);
+  
+  // Get the IP from the address
+  if(WiFi.hostByName(ntpServerName, timeServerIP, TIME_SYNC_TIMEOUT))
   {
-    udp.begin(2390);
-
-    DEBUGV("Time sync try %d\n", MAX_TRIES_TIME_SYNC - retries);
-    
-    // Get the IP from the address
-    WiFi.hostByName(ntpServerName, timeServerIP);
-    
     // Send an NTP packet to a time server
-    // Clean the buffer
-    memset(packetBuffer, 0, NTP_PACKET_SIZE);
-    
     packetBuffer[0] = 0b11100011;  // LI, Version, Mode
     packetBuffer[1] = 0;           // Stratum, or type of clock
     packetBuffer[2] = 6;           // Polling Interval
@@ -470,14 +640,12 @@ time_t ICACHE_FLASH_ATTR syncTime()
     // Clear the buffer for the reply
     memset(packetBuffer, 0, NTP_PACKET_SIZE);
     
-    uint8_t waitResponse = MAX_TRIES_TIME_SYNC_RESPONSE;
-    while(waitResponse--)
+    // Wait for the answer in short steps, the WiFi stack runs in between
+    while(millis() - timeStart < TIME_SYNC_TIMEOUT)
     {
-      // No packet receieved yet, wait a second... and try again
       if(!udp.parsePacket())
       {
-        // Wait one second between next period
-        delay(1000);
+        delay(10);
         continue;
       }
       
@@ -488,79 +656,187 @@ time_t ICACHE_FLASH_ATTR syncTime()
       // Concatenate 4 bytes and remove 70 years since Unix time starts on Jan 1 1970 and we want 1900
       currentTime = ((packetBuffer[40] << 24) | (packetBuffer[41] << 16) | (packetBuffer[42] << 8) | packetBuffer[43]) - 2208988800UL;
       DEBUGV("Timestamp %d\n", currentTime);
-      
-      // Break both loops
-      retries = 0;
       break;
     }
-    
-    // Stop and release the resources
-    udp.stop();
   }
   
-  if(currentTime)
-  {
-    screenStatus("OK");
-  }
-  else
-  {
-    // Time synchronisation was unsuccessful
-    screenStatus("Time error");
-
-    // Wait one second to show the message on screen
-    delay(1000);
-  }
+  // Stop and release the resources
+  udp.stop();
+  
+  // Time synchronisation was unsuccessful otherwise, the message stays on screen until the next status
+  screenStatus(currentTime ? "OK" : "Time error");
   
   return currentTime;
 }
 
-// Blink interrupt, called every time the LED blinks
-void ICACHE_FLASH_ATTR blinkWatt()
+// Blink interrupt, called on both edges of every LED blink
+// Interrupt handlers must be in RAM, the flash cache may be busy when they are called
+void ICACHE_RAM_ATTR blinkWatt()
 {
-  static uint32_t timeBlinkCurrent = 0;
-  static uint32_t timeBlinkLast = 0;
-  static uint32_t timeDebounce = 0;
+  static uint32_t timeBlinkLast = 0;        // Time of the last accepted blink [us]
+  static uint32_t timeBlinkLastMillis = 0;  // Same, but in milliseconds for long intervals [ms]
+  static uint32_t timePulseEnd = 0;         // Time the LED turned off after the last accepted blink [us]
+  static uint32_t timeOffLast = 0;          // Time of the last rising edge, bounces included [us]
+  static uint32_t pulseWidthAverage = 0;    // Average time the LED stays on [us]
+  static uint8_t pulseWidthCount = 0;       // Pulse widths averaged so far, up to TIME_DEBOUNCE_SAMPLES
+  static uint32_t intervalAverage = 0;      // Average time between two accepted blinks, see TIME_DEBOUNCE_INTERVAL_DIVIDER [us]
+  static uint32_t timeDebounce = TIME_DEBOUNCE_MAX * 1000UL; // Current debounce window [us]
+  static bool pulseActive = false;          // An accepted blink is waiting for its pulse width to be averaged
+  static bool pulseEnded = false;           // The LED turned off since the last accepted blink
+
+  uint32_t timeBlinkCurrent = micros();
+
+  // Rising edge, the LED has turned off
+  // A bounce at the start of the pulse turns the LED off for a moment too, so the pulse ends at the last rising edge
+  // inside the debounce window, or at the first one when the pulse is longer than the window
+  if(digitalRead(SENSOR_PIN) == HIGH)
+  {
+    timeOffLast = timeBlinkCurrent;
+    if(pulseActive && (!pulseEnded || timeBlinkCurrent - timeBlinkLast < timeDebounce))
+    {
+      timePulseEnd = timeBlinkCurrent;
+      pulseEnded = true;
+    }
+    return;
+  }
+
+  // This is micros() rollover safe as (micros() - timeBlinkLast) is never negative
+  uint32_t interval = timeBlinkCurrent - timeBlinkLast;
+
+  // micros() rolls over after 71 minutes, use millis() for very long intervals (very low power)
+  // This must come first, after a rollover the micros() interval can be anything, even shorter than the debounce window
+  uint32_t intervalMillis = millis() - timeBlinkLastMillis;
+  if(intervalMillis > 60000UL)
+  {
+    interval = intervalMillis < 0xffffffffUL / 1000 ? intervalMillis * 1000 : 0xffffffffUL;
+  }
 
   // Debounce routine, because sometimes one LED blink gets detected multiple times
-  // This is millis() rollover safe as (millis() - timeDebounce) is never negative
-  if((uint32_t)(millis() - timeDebounce) < TIME_DEBOUNCE)
+  // Every edge inside the window learnt from the pulse widths is a bounce. Up to a fraction of the average interval,
+  // an edge that comes right after the LED turned off is one too: this holds when bounces at the start of the pulses
+  // made them look shorter than they are, while after a sudden load increase the LED still stays off between blinks
+  bool offShort = timeBlinkCurrent - timeOffLast < TIME_DEBOUNCE_MARGIN * 1000UL;
+  if(interval < timeDebounce || (offShort && interval < intervalAverage / TIME_DEBOUNCE_INTERVAL_DIVIDER))
   {
     return;
   }
-  
-  timeDebounce = millis();
-  
+
+  // The pulse of the previous blink is over, average its width
+  // Plain mean of the first samples, then an exponential moving average with a weight of 1/TIME_DEBOUNCE_SAMPLES
+  if(pulseActive && pulseEnded)
+  {
+    uint32_t width = timePulseEnd - timeBlinkLast;
+    if(pulseWidthCount < TIME_DEBOUNCE_SAMPLES)
+    {
+      pulseWidthCount++;
+    }
+    pulseWidthAverage = pulseWidthAverage - pulseWidthAverage / pulseWidthCount + width / pulseWidthCount;
+  }
+
+  timeBlinkLast = timeBlinkCurrent;
+  timeBlinkLastMillis = millis();
+  pulseActive = true;
+  pulseEnded = false;
+
   // Update the power counters
   powerCounter++;
   powerCounterToday++;
+  
+  if(timeFirstBlink == 0)
+  {
+    timeFirstBlink = millis();
+  }
 
-  // Evaluate the current power consumption 60 seconds * 60 minutes * 1000 milliseconds = h
-  timeBlinkCurrent = millis();
-  // Avoid dividing by zero (crashes the program otherwise)
-  if(timeBlinkCurrent != timeBlinkLast)
+  // The instant power is evaluated from the interval when it is read, keep the division out of the interrupt
+  blinkInterval = interval;
+
+  // Exponential moving average of the intervals with a weight of 1/8 for the new sample
+  intervalAverage = intervalAverage ? intervalAverage - intervalAverage / 8 + interval / 8 : interval;
+
+  // Adapt the debounce window to the observed blinks once enough pulse widths are known: the typical pulse plus a
+  // margin, the interval is not used so that a sudden load increase is not filtered out
+  if(pulseWidthCount >= TIME_DEBOUNCE_SAMPLES)
   {
-    powerCounterNow = 60 * 60 * 1000 / (timeBlinkCurrent - timeBlinkLast);
+    timeDebounce = pulseWidthAverage + TIME_DEBOUNCE_MARGIN * 1000UL;
+    timeDebounce = constrain(timeDebounce, TIME_DEBOUNCE_MIN * 1000UL, TIME_DEBOUNCE_MAX * 1000UL);
   }
-  timeBlinkLast = timeBlinkCurrent;
   
   // Always update the today and now fields on the display
   screenUpdateFieldFlags |= TODAY | NOW;
 }
 
-uint16_t ICACHE_FLASH_ATTR livePowerUsage()
+// Instant power usage evaluated from the time between the last two blinks [W]
+uint32_t ICACHE_FLASH_ATTR livePowerUsage()
+{
+  uint32_t interval = blinkInterval;
+  
+  // Avoid dividing by zero (crashes the program otherwise)
+  if(interval == 0)
+  {
+    return 0;
+  }
+  
+  // 60 seconds * 60 minutes * 1000 milliseconds * 1000 microseconds = h, 1000 Wh = kWh
+  return 3600000000000ULL / ((uint64_t)interval * meterConstant);
+}
+
+// Power used since midnight [Wh]
+uint32_t ICACHE_FLASH_ATTR todayPowerUsage()
 {
-  return powerCounterNow;
+  return (uint64_t)powerCounterToday * 1000 / meterConstant;
 }
 
-uint16_t ICACHE_FLASH_ATTR todayPowerUsage()
+uint16_t ICACHE_FLASH_ATTR getMeterConstant()
 {
-  return powerCounterToday;
+  return meterConstant;
 }
 
-void ICACHE_FLASH_ATTR logData(time_t timestamp, uint16_t power)
+// Change the number of blinks per kWh and save it to the SD card so it survives a reset
+bool ICACHE_FLASH_ATTR setMeterConstant(uint16_t constant)
 {
-  // Do not log anything if the time has not been properly synchronised
-  if(timeStatus() == timeNotSet)
+  if(constant == 0)
+  {
+    return false;
+  }
+  
+  meterConstant = constant;
+  
+  SD.remove(METER_CONSTANT_FILE);
+  File configFile = SD.open(METER_CONSTANT_FILE, FILE_WRITE);
+  if(!configFile)
+  {
+    return false;
+  }
+  configFile.println(constant);
+  configFile.close();
+  
+  logEvent(EVENT_METER_CONSTANT, constant);
+  
+  return true;
+}
+
+// Read the meter constant from the SD card, keep the default from config.h if it was never set
+void ICACHE_FLASH_ATTR loadMeterConstant()
+{
+  File configFile = SD.open(METER_CONSTANT_FILE);
+  if(!configFile)
+  {
+    return;
+  }
+  
+  uint16_t constant = configFile.parseInt();
+  configFile.close();
+  
+  if(constant != 0)
+  {
+    meterConstant = constant;
+  }
+}
+
+void ICACHE_FLASH_ATTR logData(time_t timestamp, uint32_t power)
+{
+  // Do not log anything if the time has not been properly synchronised or if there is no SD card
+  if(timeStatus() == timeNotSet || !(bootStages & BOOT_SD))
   {
     return;
   }
@@ -574,7 +850,7 @@ void ICACHE_FLASH_ATTR logData(time_t timestamp, uint16_t power)
   
   // Open/make the file name
   char buffer[32];
-  sprintf(buffer, "/power/%04d%02d%02d.csv", year(timestamp), month(timestamp), day(timestamp));
+  dayFileName(buffer, timestamp);
   
   // Open the current log file, or create it if it does not exist
   boolean addHeaders = false;
@@ -598,7 +874,7 @@ void ICACHE_FLASH_ATTR logData(time_t timestamp, uint16_t power)
   // Actually write the data to the file in the format of YYYY-MM-DDTHH:MMZ,W*min
   sprintf(
     buffer,
-    "%04d-%02d-%02dT%02d:%02dZ,%d",
+    "%04d-%02d-%02dT%02d:%02dZ,%u",
     year(timestamp),
     month(timestamp),
     day(timestamp),
@@ -611,29 +887,3 @@ void ICACHE_FLASH_ATTR logData(time_t timestamp, uint16_t power)
   // This commits the data, otherwise nothing appears in the file
   dataFile.close();
 }
-
-void ICACHE_FLASH_ATTR logEvent(char * event)
-{
-  #ifdef ENABLE_EVENT_LOGGING
-  // Open the file for writing (appends data if the file already exists)
-  File logFile = SD.open("/log.txt", FILE_WRITE);
-  
-  // Write the event to the file in the format of YYYY-MM-DDTHH:MMZ - <event>
-  char buffer[64];
-  sprintf(
-    buffer,
-    "%04d-%02d-%02dT%02d:%02dZ - %s",
-    year(),
-    month(),
-    day(),
-    hour(),
-    minute(),
-    event
-  );
-  
-  logFile.println(buffer);
-  // This commits the log, otherwise nothing appears in the file
-  logFile.close();
-  #endif
-}
-
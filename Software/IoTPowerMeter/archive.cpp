@@ -0,0 +1,382 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    archive.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Long-term storage of the minute values, one pair of files per month:
+// /archive/YYYYMM.bin holds the days one after the other, each minute is stored as the difference with the previous
+// minute, zigzag encoded (so that small negative differences stay small) and written as a variable length integer
+// /archive/YYYYMM.idx holds one entry per day: day of the month (1 byte), offset and length in the .bin file (4 bytes each)
+// Both files are only ever appended to, if a day is written twice the last entry is the valid one
+// A write that fails is cut back and the day log file is kept, so the day is archived again later
+
+#include <ESP8266WiFi.h>
+#include <TimeLib.h>
+#include <SPI.h>
+#include <SD.h>
+
+#include "config.h"
+#include "IoTPowerMeter.h"
+#include "series.h"
+#include "archive.h"
+#include "events.h"
+
+// Compaction job state, see archiveStep()
+static ArchiveState archiveState = ARCHIVE_IDLE;
+static uint32_t archiveTimeIdle = 0;
+static File archiveDir;
+static File archiveSource;
+static File archiveData;
+static char archiveSourcePath[32];
+static time_t archiveDay;
+static uint16_t archiveSeries[MINUTES_PER_DAY];
+static SeriesParser archiveParser;
+static uint16_t archiveMinute;
+static uint16_t archivePrevious;
+static uint32_t archiveOffset; // Size of the data file before the day was added
+static uint32_t archiveLength;
+static uint32_t archiveSourceSize;
+static uint32_t archiveTimeBusy; // Time spent working on the current day, excluding the time between the slices [us]
+
+// Write the difference between a minute and the previous one, returns the number of bytes (at most 3)
+uint8_t archiveEncode(uint8_t * buffer, uint16_t value, uint16_t previous)
+{
+  int32_t delta = (int32_t)value - previous;
+  uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+  uint8_t length = 0;
+  
+  while(zigzag >= 0x80)
+  {
+    buffer[length++] = zigzag | 0x80;
+    zigzag >>= 7;
+  }
+  buffer[length++] = zigzag;
+  return length;
+}
+
+// Start decoding a day into an array of MINUTES_PER_DAY values, minutes that are not decoded are set to 0
+void ArchiveDecoder::begin(uint16_t * _series)
+{
+  series = _series;
+  memset(series, 0, MINUTES_PER_DAY * sizeof(uint16_t));
+  previous = 0;
+  value = 0;
+  shift = 0;
+  minutes = 0;
+}
+
+// Decode the next part of the day, a variable length integer may be split between two calls
+void ArchiveDecoder::feed(const uint8_t * data, int length)
+{
+  for(int i = 0; i < length && minutes < MINUTES_PER_DAY; i++)
+  {
+    value |= (uint32_t)(data[i] & 0x7f) << shift;
+    shift += 7;
+    if(data[i] & 0x80)
+    {
+      continue;
+    }
+    
+    int32_t delta = (value >> 1) ^ -(int32_t)(value & 1);
+    previous += delta;
+    series[minutes++] = previous;
+    value = 0;
+    shift = 0;
+  }
+}
+
+// Name of the archive file for the month of the timestamp, extension is "bin" or "idx"
+void archiveFileName(char * buffer, time_t timestamp, const char * extension)
+{
+  sprintf(buffer, "/archive/%04d%02d.%s", year(timestamp), month(timestamp), extension);
+}
+
+// Fold closed day log files into the archive, one small slice of work per call so that loop() is never held up for long
+void archiveStep()
+{
+  uint32_t timeSlice = micros();
+  archiveSlice();
+  archiveTimeBusy += micros() - timeSlice;
+}
+
+void archiveSlice()
+{
+  switch(archiveState)
+  {
+    case ARCHIVE_IDLE:
+    {
+      // Look for closed days every ARCHIVE_PERIOD, starting right after boot
+      if((archiveTimeIdle && millis() - archiveTimeIdle < ARCHIVE_PERIOD) || timeStatus() == timeNotSet)
+      {
+        return;
+      }
+      
+      archiveDir = SD.open("/power");
+      if(!archiveDir)
+      {
+        archiveTimeIdle = millis() | 1;
+        return;
+      }
+      if(!SD.exists("/archive"))
+      {
+        SD.mkdir("/archive");
+      }
+      archiveDir.rewindDirectory();
+      archiveState = ARCHIVE_SCAN;
+      break;
+    }
+    
+    case ARCHIVE_SCAN:
+    {
+      // One directory entry per call
+      File entry = archiveDir.openNextFile();
+      if(!entry)
+      {
+        archiveDir.close();
+        archiveTimeIdle = millis() | 1;
+        archiveState = ARCHIVE_IDLE;
+        return;
+      }
+      
+      // Day log files are named YYYYMMDD.csv
+      const char * name = entry.name();
+      if(entry.isDirectory() || strlen(name) != 12 || strspn(name, "0123456789") != 8)
+      {
+        entry.close();
+        return;
+      }
+      
+      long date = atol(name);
+      tmElements_t elements = {0};
+      elements.Year = CalendarYrToTm(date / 10000);
+      elements.Month = date / 100 % 100;
+      elements.Day = date % 100;
+      archiveDay = makeTime(elements);
+      
+      // Leave today and the last hour of yesterday alone, they might still be written to
+      if(archiveDay >= previousMidnight(now() - SECS_PER_HOUR))
+      {
+        entry.close();
+        return;
+      }
+      
+      sprintf(archiveSourcePath, "/power/%s", name);
+      archiveSource = entry;
+      archiveSourceSize = entry.size();
+      archiveTimeBusy = 0;
+      archiveParser.begin(archiveSeries);
+      archiveState = ARCHIVE_READ;
+      break;
+    }
+    
+    case ARCHIVE_READ:
+    {
+      uint8_t block[ARCHIVE_SLICE_BYTES];
+      int length = archiveSource.read(block, sizeof(block));
+      if(length > 0)
+      {
+        archiveParser.feed(block, length);
+        return;
+      }
+      
+      archiveParser.finish();
+      archiveSource.close();
+      
+      // Nothing that looks like data, leave the file for someone to look at
+      if(!archiveParser.rows)
+      {
+        archiveState = ARCHIVE_SCAN;
+        return;
+      }
+      
+      char path[32];
+      archiveFileName(path, archiveDay, "bin");
+      archiveData = SD.open(path, FILE_WRITE);
+      if(!archiveData)
+      {
+        archiveAbort();
+        return;
+      }
+      
+      archiveOffset = archiveData.size();
+      archiveLength = 0;
+      archiveMinute = 0;
+      archivePrevious = 0;
+      archiveState = ARCHIVE_WRITE;
+      break;
+    }
+    
+    case ARCHIVE_WRITE:
+    {
+      // A difference takes at most 3 bytes
+      uint8_t block[ARCHIVE_SLICE_MINUTES * 3];
+      size_t length = 0;
+      uint16_t last = min(archiveMinute + ARCHIVE_SLICE_MINUTES, MINUTES_PER_DAY);
+      
+      for(; archiveMinute < last; archiveMinute++)
+      {
+        length += archiveEncode(block + length, archiveSeries[archiveMinute], archivePrevious);
+        archivePrevious = archiveSeries[archiveMinute];
+      }
+      
+      // A full or failing card, the day log file stays until the next try
+      if(archiveData.write(block, length) != length)
+      {
+        archiveData.truncate(archiveOffset);
+        archiveData.close();
+        archiveAbort();
+        return;
+      }
+      archiveLength += length;
+      
+      if(archiveMinute == MINUTES_PER_DAY)
+      {
+        archiveData.close();
+        archiveState = ARCHIVE_COMMIT;
+      }
+      break;
+    }
+    
+    case ARCHIVE_COMMIT:
+    {
+      // The index entry is only written once the data is complete, then the log file can go
+      char path[32];
+      archiveFileName(path, archiveDay, "idx");
+      File indexFile = SD.open(path, FILE_WRITE);
+      if(!indexFile)
+      {
+        archiveAbort();
+        return;
+      }
+      
+      uint8_t entry[ARCHIVE_INDEX_ENTRY];
+      entry[0] = day(archiveDay);
+      for(uint8_t i = 0; i < 4; i++)
+      {
+        entry[1 + i] = archiveOffset >> (8 * i);
+        entry[5 + i] = archiveLength >> (8 * i);
+      }
+      
+      // A partial entry would shift all the entries written after it
+      uint32_t indexSize = indexFile.size();
+      if(indexFile.write(entry, sizeof(entry)) != sizeof(entry))
+      {
+        indexFile.truncate(indexSize);
+        indexFile.close();
+        archiveAbort();
+        return;
+      }
+      indexFile.close();
+      SD.remove(archiveSourcePath);
+      
+      // Throughput of the parsing and encoding work alone, in kB/s
+      DEBUGV("Archived %s, %u>%uB\n", archiveSourcePath, archiveSourceSize, archiveLength);
+      logEvent(EVENT_ARCHIVED, archiveDay, archiveTimeBusy ? (uint64_t)archiveSourceSize * 1000 / archiveTimeBusy : 0);
+      
+      // Entries were removed from the directory, start over
+      archiveDir.rewindDirectory();
+      archiveState = ARCHIVE_SCAN;
+      break;
+    }
+  }
+}
+
+// Whether the job is working on a day, it reads from /power and writes to /archive meanwhile
+bool archiveBusy()
+{
+  return archiveState != ARCHIVE_IDLE;
+}
+
+// Stop the job after a failed write, it starts over after ARCHIVE_PERIOD
+void archiveAbort()
+{
+  DEBUGV("Archiving %s failed\n", archiveSourcePath);
+  logEvent(EVENT_ARCHIVE_FAILED, archiveDay);
+  archiveDir.close();
+  archiveTimeIdle = millis() | 1;
+  archiveState = ARCHIVE_IDLE;
+}
+
+// Decode one day from the archive into an array of MINUTES_PER_DAY values
+// Returns the number of minutes decoded: MINUTES_PER_DAY for a whole day, less if the data is cut short, 0 if the day was not found
+uint16_t archiveReadDay(time_t timestamp, uint16_t * series)
+{
+  memset(series, 0, MINUTES_PER_DAY * sizeof(uint16_t));
+  
+  // Find the last index entry of the day
+  char path[32];
+  archiveFileName(path, timestamp, "idx");
+  File indexFile = SD.open(path);
+  if(!indexFile)
+  {
+    return 0;
+  }
+  
+  uint8_t entry[ARCHIVE_INDEX_ENTRY];
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  bool found = false;
+  while(indexFile.read(entry, sizeof(entry)) == sizeof(entry))
+  {
+    if(entry[0] == day(timestamp))
+    {
+      offset = entry[1] | (uint32_t)entry[2] << 8 | (uint32_t)entry[3] << 16 | (uint32_t)entry[4] << 24;
+      length = entry[5] | (uint32_t)entry[6] << 8 | (uint32_t)entry[7] << 16 | (uint32_t)entry[8] << 24;
+      found = true;
+    }
+  }
+  indexFile.close();
+  
+  if(!found)
+  {
+    return 0;
+  }
+  
+  archiveFileName(path, timestamp, "bin");
+  File dataFile = SD.open(path);
+  if(!dataFile || !dataFile.seek(offset))
+  {
+    return 0;
+  }
+  
+  // Decode the variable length integers, they may be split between two blocks
+  ArchiveDecoder decoder;
+  decoder.begin(series);
+  uint8_t block[128];
+  while(length && decoder.minutes < MINUTES_PER_DAY)
+  {
+    int blockLength = dataFile.read(block, min(length, (uint32_t)sizeof(block)));
+    if(blockLength <= 0)
+    {
+      break;
+    }
+    length -= blockLength;
+    decoder.feed(block, blockLength);
+  }
+  
+  dataFile.close();
+  return decoder.minutes;
+}
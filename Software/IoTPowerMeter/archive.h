@@ -0,0 +1,66 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    archive.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#define ARCHIVE_INDEX_ENTRY 9 // Size of an index entry: day, offset, length
+
+// Steps of the compaction job
+enum ArchiveState {
+  ARCHIVE_IDLE,
+  ARCHIVE_SCAN,
+  ARCHIVE_READ,
+  ARCHIVE_WRITE,
+  ARCHIVE_COMMIT
+};
+
+// Incremental decoder for a day of the archive, so that it can be read in blocks
+class ArchiveDecoder
+{
+  private:
+  uint16_t * series;
+  uint16_t previous;
+  uint32_t value;
+  uint8_t shift;
+  
+  public:
+  uint16_t minutes;
+  void begin(uint16_t *);
+  void feed(const uint8_t *, int);
+};
+
+uint8_t archiveEncode(uint8_t *, uint16_t, uint16_t);
+void archiveFileName(char *, time_t, const char *);
+void archiveStep();
+void archiveSlice();
+void archiveAbort();
+bool archiveBusy();
+uint16_t archiveReadDay(time_t, uint16_t *);
+
+#endif
@@ -45,6 +45,12 @@
 #define PIN_SDA 4
 #define PIN_SCL 2
 
+// Meter constant printed on the power meter, number of LED blinks per kWh (1000imp/kWh means 1 blink = 1Wh)
+// This is only the default value, it can be changed with /api?request=constant&value=<imp/kWh>
+#define METER_IMPULSES_PER_KWH 1000
+// File on the SD card where the meter constant is saved when changed through the API
+#define METER_CONSTANT_FILE "/meter.txt"
+
 // How often the internal time is synchronised with the NTP server
 #define TIME_SYNC_PERIOD 12*60*60 // [s]
 // NTP server from which to fetch the time
@@ -71,16 +77,47 @@ static const char* localHostName = "power";
 static const char * http_username = "admin";
 static const char * http_password = "admin";
 
-// Events (time syncing, data uploading, wifi connections...) will be logged to /log.txt file, comment this out to disable event logging
+// Events (data uploading, wifi connections...) will be logged to /events0.bin and /events1.bin, comment this out to keep them in memory only
+// The events can be read with /api?request=events&since=<sequence number>
 #define ENABLE_EVENT_LOGGING
 
+// Closed day log files in /power are compacted to monthly files in /archive, comment this out to keep the CSV files
+#define ENABLE_ARCHIVE
+
 // Global constants, no magic numbers
 #define MAX_TRIES_UPLOAD 5 // Maximum times the system will try to upload data before abandoning
 #define MAX_TRIES_WIFI_CONNECT 5 // Maximum times the system will try to connect to Wi-Fi
-#define MAX_TRIES_TIME_SYNC 5 // Maximum times the system will try to synchronise time with an NTP server
-#define MAX_TRIES_TIME_SYNC_RESPONSE 5 // Maximum times the system will wait for a response from the NTP server
+#define TIME_SYNC_TIMEOUT 1000 // Time in milliseconds the system waits for the NTP server to resolve and answer, the metering loop is held up meanwhile, the next try comes BOOT_RETRY_PERIOD later
+#define BOOT_RETRY_PERIOD 30000 // Time in milliseconds between two tries to bring up the SD card or the time synchronisation after boot
+#define ARCHIVE_PERIOD 3600000UL // Time in milliseconds between two searches for day log files to archive
+#define ARCHIVE_SLICE_BYTES 512 // Bytes of a day log file read per loop when archiving
+#define ARCHIVE_SLICE_MINUTES 240 // Minutes encoded per loop when archiving
+#define PERSIST_PERIOD 10000 // Time in milliseconds between two checkpoints of the counters to RTC memory
+#define PERSIST_JOURNAL_PERIOD 600000UL // Time in milliseconds between two checkpoints of the counters to the flash journal, every write wears the flash
+#define EVENTS_RAM_RECORDS 32 // Events kept in memory, the oldest ones are lost if they could not be written to the SD card in time
+#define EVENTS_FLUSH_COUNT 8 // Number of events that triggers writing them to the SD card
+#define EVENTS_FLUSH_PERIOD 300000UL // Longest time in milliseconds an event waits in memory before it is written to the SD card
+#define EVENTS_FILE_RECORDS 1024UL // Events per log file, the log is limited to two files (20 bytes per event)
+#define EVENTS_MAX_RESPONSE 256 // Most events sent in one response to /api?request=events, ask again from the last one for more
+#define SERVER_PATH_LENGTH 64 // Longest path of a file on the SD card that can be requested, including the terminating null character
+#define PUSH_REQUEST_LENGTH 256 // Longest request sent to Google Spreadsheets
+#define DELETE_SLICE_ENTRIES 8 // Files or directories removed per loop when a directory is deleted from the edit page
+#define DELETE_DEPTH_MAX 8 // Deepest directory level that can be deleted from the edit page
+#define SD_SECTOR_SIZE 512 // Size of an SD card sector in bytes
+#define STREAM_BLOCK_SIZE 2048 // Bytes read from or written to the SD card at once when sending or receiving a file, a multiple of SD_SECTOR_SIZE
+#define STREAM_TIMEOUT 5000 // Time in milliseconds a download may go without sending anything before it is abandoned
+#define UPLOAD_TEMP_NAME "UPLOAD.TMP" // Name of the temporary file receiving an upload, in the same directory as the uploaded file
+#define UPLOAD_BACKUP_NAME "UPLOAD.BAK" // Name the file replaced by an upload has until the upload is in place, in the same directory
+#define UPLOAD_JOURNAL "/UPLOAD.JNL" // Holds the path of the file being replaced by an upload, to finish the job after a reset
+#define MEMORY_SAMPLE_PERIOD 1000 // Time in milliseconds between two samples of the largest free block, the fragmentation and the stack
+#define MEMORY_BLOCK_WARNING 8192 // An event is logged when the largest free block goes below this size in bytes, TLS needs large blocks
+#define RANGE_MAX_DAYS 7 // Longest range in days that can be requested with /api?request=range, the metering loop waits for the whole request so ask for longer periods in several requests
 #define TIME_BUTTON_PRESS_LONG 2000 // Time in milliseconds for the long button press routine to execute
-#define TIME_DEBOUNCE 200 // Time in milliseconds during which LED blinks are ignored when one was just detected
+#define TIME_DEBOUNCE_MIN 5 // Shortest time in milliseconds during which LED blinks are ignored when one was just detected
+#define TIME_DEBOUNCE_MAX 200 // Longest time in milliseconds during which LED blinks are ignored when one was just detected, also used until TIME_DEBOUNCE_SAMPLES pulse widths are known
+#define TIME_DEBOUNCE_MARGIN 2 // Time in milliseconds added to the average LED pulse width to get the debounce window, and shortest time the LED must stay off between two blinks, see TIME_DEBOUNCE_INTERVAL_DIVIDER
+#define TIME_DEBOUNCE_SAMPLES 8 // Number of LED pulse widths averaged before the debounce window adapts to them
+#define TIME_DEBOUNCE_INTERVAL_DIVIDER 8 // Up to the average time between blinks divided by this, an LED blink that comes less than TIME_DEBOUNCE_MARGIN after the LED turned off is a bounce, bounces at the start of a pulse make it look shorter
 #define SCREEN_TITLE_COLUMN 0 // Horizontal position from which the title should be displayed on screen
 #define SCREEN_START_COLUMN 6 // Horizontal position from which the data should be displayed on screen
 #define SCREEN_ROW_SSID  0
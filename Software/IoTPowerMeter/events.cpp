@@ -0,0 +1,264 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    events.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Event log made of fixed size records, see EventRecord
+// Events are first kept in a ring buffer in memory and written to the SD card in batches by eventsStep()
+// On the SD card the records are appended to /events0.bin or /events1.bin: once the file being written holds
+// EVENTS_FILE_RECORDS records the other one is emptied and used instead, so the log never takes more than two files
+
+#include <ESP8266WiFi.h>
+#include <TimeLib.h>
+#include <SPI.h>
+#include <SD.h>
+
+#include "config.h"
+#include "events.h"
+
+static const char * eventNames[] = {"boot", "day", "upload", "upload failed", "wifi", "wifi connected", "wifi failed", "ip", "constant", "archived", "memory low", "memory ok", "deleted", "delete failed", "uploaded", "archive failed", "edit upload failed", "time first"};
+
+static EventRecord eventsRam[EVENTS_RAM_RECORDS];
+static uint32_t eventsSequence = 0; // Sequence number of the next event
+static uint32_t eventsFlushed = 0; // Sequence number of the first event not written to the SD card yet
+static uint32_t eventsTimeFlush = 0;
+static bool eventsReady = false; // The SD card is available and the files were scanned
+static uint8_t eventsCurrent = 0; // File being appended to
+static uint32_t eventsCount[2] = {0, 0}; // Records in each file
+static uint32_t eventsLast[2] = {0, 0}; // Sequence number of the last record of each file
+
+static void eventsFileName(char * buffer, uint8_t file)
+{
+  sprintf(buffer, "/events%u.bin", file);
+}
+
+const char * eventName(uint32_t code)
+{
+  return code < EVENT_TYPES ? eventNames[code] : "unknown";
+}
+
+// Add an event to the log, it is written to the SD card later
+void logEvent(EventCode code, uint32_t arg1, uint32_t arg2)
+{
+  EventRecord * record = &eventsRam[eventsSequence % EVENTS_RAM_RECORDS];
+  record->sequence = eventsSequence;
+  record->timestamp = now();
+  record->code = code;
+  record->arg1 = arg1;
+  record->arg2 = arg2;
+  
+  DEBUGV("Event %u: %s %u %u\n", eventsSequence, eventName(code), arg1, arg2);
+  
+  eventsSequence++;
+  
+  // The oldest event that was not written yet was just overwritten
+  if(eventsSequence - eventsFlushed > EVENTS_RAM_RECORDS)
+  {
+    eventsFlushed = eventsSequence - EVENTS_RAM_RECORDS;
+  }
+}
+
+// Find where the log stopped before the reset, called once the SD card is available
+void eventsBegin()
+{
+  char path[16];
+  uint32_t last = 0;
+  bool found = false;
+  
+  for(uint8_t file = 0; file < 2; file++)
+  {
+    eventsFileName(path, file);
+    File eventsFile = SD.open(path);
+    if(!eventsFile)
+    {
+      continue;
+    }
+    
+    // A record cut short by a reset is ignored, the file is cut back to the last whole record below
+    uint32_t size = eventsFile.size();
+    eventsCount[file] = size / sizeof(EventRecord);
+    EventRecord record;
+    if(eventsCount[file] && eventsFile.seek((eventsCount[file] - 1) * sizeof(EventRecord)) && eventsFile.read((uint8_t *)&record, sizeof(record)) == sizeof(record))
+    {
+      eventsLast[file] = record.sequence;
+      if(!found || record.sequence > last)
+      {
+        last = record.sequence;
+        eventsCurrent = file;
+        found = true;
+      }
+    }
+    else
+    {
+      eventsCount[file] = 0;
+    }
+    eventsFile.close();
+    
+    // Appending after a partial record would shift all the following ones
+    if(size != eventsCount[file] * sizeof(EventRecord))
+    {
+      eventsFile = SD.open(path, FILE_WRITE);
+      eventsFile.truncate(eventsCount[file] * sizeof(EventRecord));
+      eventsFile.close();
+    }
+  }
+  
+  // Continue the numbering after the last saved event, the events logged since boot are moved after it
+  // The offset is a multiple of the ring size so the events stay in the same slots
+  if(found)
+  {
+    uint32_t offset = (last / EVENTS_RAM_RECORDS + 1) * EVENTS_RAM_RECORDS;
+    for(uint32_t sequence = eventsFlushed; sequence != eventsSequence; sequence++)
+    {
+      eventsRam[sequence % EVENTS_RAM_RECORDS].sequence += offset;
+    }
+    eventsSequence += offset;
+    eventsFlushed += offset;
+  }
+  
+  eventsReady = true;
+}
+
+// Write the pending events to the SD card once there are enough of them or they have waited long enough
+void eventsStep()
+{
+  #ifdef ENABLE_EVENT_LOGGING
+  uint32_t pending = eventsSequence - eventsFlushed;
+  if(!eventsReady || pending == 0 || (pending < EVENTS_FLUSH_COUNT && millis() - eventsTimeFlush < EVENTS_FLUSH_PERIOD))
+  {
+    return;
+  }
+  eventsTimeFlush = millis();
+  
+  char path[16];
+  
+  // The file is full, start over in the other one
+  if(eventsCount[eventsCurrent] >= EVENTS_FILE_RECORDS)
+  {
+    eventsCurrent ^= 1;
+    eventsFileName(path, eventsCurrent);
+    SD.remove(path);
+    eventsCount[eventsCurrent] = 0;
+  }
+  
+  eventsFileName(path, eventsCurrent);
+  File eventsFile = SD.open(path, FILE_WRITE);
+  if(!eventsFile)
+  {
+    return;
+  }
+  
+  // Records are appended, the file must end on a whole record
+  if(eventsFile.size() != eventsCount[eventsCurrent] * sizeof(EventRecord) && !eventsFile.truncate(eventsCount[eventsCurrent] * sizeof(EventRecord)))
+  {
+    eventsFile.close();
+    return;
+  }
+  
+  // Never go over the file size, the rest is written with the next batch
+  pending = min(pending, (uint32_t)(EVENTS_FILE_RECORDS - eventsCount[eventsCurrent]));
+  
+  // The ring buffer is written in at most two pieces
+  while(pending)
+  {
+    uint32_t slot = eventsFlushed % EVENTS_RAM_RECORDS;
+    uint32_t count = min(pending, EVENTS_RAM_RECORDS - slot);
+    if(eventsFile.write((const uint8_t *)&eventsRam[slot], count * sizeof(EventRecord)) != count * sizeof(EventRecord))
+    {
+      // Drop the part that was written, the events are written again with the next batch
+      eventsFile.truncate(eventsCount[eventsCurrent] * sizeof(EventRecord));
+      break;
+    }
+    eventsFlushed += count;
+    eventsCount[eventsCurrent] += count;
+    eventsLast[eventsCurrent] = eventsFlushed - 1;
+    pending -= count;
+  }
+  
+  eventsFile.close();
+  #endif
+}
+
+// Copy up to "count" events with a sequence number of at least "next", oldest first, returns how many were copied
+uint16_t eventsRead(uint32_t next, EventRecord * records, uint16_t count)
+{
+  uint16_t copied = 0;
+  
+  // Older file first, then the one being appended to
+  for(uint8_t i = 0; i < 2 && eventsReady && copied < count; i++)
+  {
+    uint8_t file = eventsCurrent ^ 1 ^ i;
+    if(eventsCount[file] == 0 || eventsLast[file] < next)
+    {
+      continue;
+    }
+    
+    char path[16];
+    eventsFileName(path, file);
+    File eventsFile = SD.open(path);
+    if(!eventsFile)
+    {
+      continue;
+    }
+    
+    // The sequence numbers grow along the file but can have gaps, find the first record to send by bisection
+    EventRecord record;
+    uint32_t low = 0;
+    uint32_t high = eventsCount[file] - 1;
+    while(low < high)
+    {
+      uint32_t middle = (low + high) / 2;
+      eventsFile.seek(middle * sizeof(EventRecord));
+      eventsFile.read((uint8_t *)&record, sizeof(record));
+      if(record.sequence < next)
+      {
+        low = middle + 1;
+      }
+      else
+      {
+        high = middle;
+      }
+    }
+    
+    eventsFile.seek(low * sizeof(EventRecord));
+    uint16_t available = min(eventsCount[file] - low, (uint32_t)(count - copied));
+    copied += eventsFile.read((uint8_t *)&records[copied], available * sizeof(EventRecord)) / sizeof(EventRecord);
+    eventsFile.close();
+  }
+  
+  // Then the events still in memory only
+  uint32_t sequence = max(next, eventsFlushed);
+  if(copied)
+  {
+    sequence = max(sequence, records[copied - 1].sequence + 1);
+  }
+  for(; sequence < eventsSequence && copied < count; sequence++)
+  {
+    records[copied++] = eventsRam[sequence % EVENTS_RAM_RECORDS];
+  }
+  
+  return copied;
+}
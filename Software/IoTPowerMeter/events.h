@@ -0,0 +1,70 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    events.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+// Events that are logged, the meaning of the arguments is given for each
+enum EventCode {
+  EVENT_BOOT,           // Time the blinks started to be counted [ms], time of the first blink [ms]
+  EVENT_DAY_POWER,      // Day power usage [Wh]
+  EVENT_UPLOAD,         // Tries needed to upload the hour to Google Spreadsheets
+  EVENT_UPLOAD_FAILED,
+  EVENT_WIFI_CONNECTING,
+  EVENT_WIFI_CONNECTED, // Tries needed to connect
+  EVENT_WIFI_FAILED,
+  EVENT_IP,             // Device IP, first byte in the lowest bits
+  EVENT_METER_CONSTANT, // New meter constant [imp/kWh]
+  EVENT_ARCHIVED,       // Day that was archived [s], throughput of the archiving [kB/s]
+  EVENT_MEMORY_LOW,     // Largest free block [B], free heap [B]
+  EVENT_MEMORY_OK,      // Largest free block [B], free heap [B]
+  EVENT_DELETED,        // Files and directories removed
+  EVENT_DELETE_FAILED,  // Files and directories removed before the failure
+  EVENT_UPLOADED,       // Size of the file uploaded from the edit page [B], throughput [kB/s]
+  EVENT_ARCHIVE_FAILED, // Day that could not be archived [s]
+  EVENT_EDIT_UPLOAD_FAILED, // Bytes received from the edit page before the upload failed [B]
+  EVENT_TIME_FIRST,     // Blinks counted before the time was known, logged in the first minute [imp], time since boot [ms]
+  EVENT_TYPES
+};
+
+// One entry of the event log, the same record is kept in memory and written to the SD card
+struct EventRecord {
+  uint32_t sequence;  // Incremented with every event, there can be gaps when events were lost
+  uint32_t timestamp; // [s]
+  uint32_t code;      // See EventCode
+  uint32_t arg1;
+  uint32_t arg2;
+};
+
+void logEvent(EventCode, uint32_t = 0, uint32_t = 0);
+const char * eventName(uint32_t);
+void eventsBegin();
+void eventsStep();
+uint16_t eventsRead(uint32_t, EventRecord *, uint16_t);
+
+#endif
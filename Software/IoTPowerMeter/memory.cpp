@@ -0,0 +1,72 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    memory.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <ESP8266WiFi.h>
+
+#include "config.h"
+#include "memory.h"
+#include "events.h"
+
+static MemoryStats stats = {0, 0xffffffff, 0, 0, 0, false};
+static uint32_t memoryTimeSample = 0;
+
+// Called from every loop(), the free heap is cheap to read and is followed closely, the rest is sampled every MEMORY_SAMPLE_PERIOD
+void memorySample()
+{
+  stats.heapFree = ESP.getFreeHeap();
+  stats.heapFreeMin = min(stats.heapFreeMin, stats.heapFree);
+  
+  if(millis() - memoryTimeSample < MEMORY_SAMPLE_PERIOD && memoryTimeSample != 0)
+  {
+    return;
+  }
+  memoryTimeSample = millis();
+  
+  // Walking the free blocks and the stack takes a little longer
+  stats.blockMax = ESP.getMaxFreeBlockSize();
+  stats.fragmentation = ESP.getHeapFragmentation();
+  stats.stackFree = ESP.getFreeContStack();
+  
+  // TLS connections fail when the largest block is too small, whatever the free heap is
+  // The block has to grow back by an eighth over the threshold before it is considered fine again, to avoid logging the same swing over and over
+  if(!stats.low && stats.blockMax < MEMORY_BLOCK_WARNING)
+  {
+    stats.low = true;
+    logEvent(EVENT_MEMORY_LOW, stats.blockMax, stats.heapFree);
+  }
+  else if(stats.low && stats.blockMax > MEMORY_BLOCK_WARNING + MEMORY_BLOCK_WARNING / 8)
+  {
+    stats.low = false;
+    logEvent(EVENT_MEMORY_OK, stats.blockMax, stats.heapFree);
+  }
+}
+
+const MemoryStats * memoryStats()
+{
+  return &stats;
+}
@@ -0,0 +1,45 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    memory.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+// State of the memory, updated by memorySample()
+struct MemoryStats {
+  uint32_t heapFree;      // [B]
+  uint32_t heapFreeMin;   // Lowest free heap seen since boot [B]
+  uint32_t blockMax;      // Largest block that can be allocated [B]
+  uint8_t fragmentation;  // [%]
+  uint32_t stackFree;     // Stack that was never used since boot, the high-water mark [B]
+  bool low;               // The largest block is below MEMORY_BLOCK_WARNING
+};
+
+void memorySample();
+const MemoryStats * memoryStats();
+
+#endif
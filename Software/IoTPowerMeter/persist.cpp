@@ -0,0 +1,146 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    persist.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// The counters are saved in two places:
+// RTC user memory survives a restart, a watchdog reset or a crash, it is written every PERSIST_PERIOD
+// The flash journal also survives a power loss, it is written every PERSIST_JOURNAL_PERIOD
+// The journal uses the sector reserved for the EEPROM: records are appended one after the other and the sector is
+// only erased once it is full, so a sector of 4096 bytes takes 128 checkpoints per erase cycle
+
+#include <ESP8266WiFi.h>
+#include <TimeLib.h>
+
+#include "config.h"
+#include "persist.h"
+
+extern "C" uint32_t _EEPROM_start;
+
+#define PERSIST_JOURNAL_SECTOR (((uintptr_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE)
+#define PERSIST_JOURNAL_RECORDS (SPI_FLASH_SEC_SIZE / sizeof(Checkpoint))
+
+static uint32_t persistSequence = 0;
+static uint32_t persistTimestamp = 0; // Time of the last checkpoint, kept while the time is not synchronised after a reset [s]
+static uint16_t persistJournalIndex = PERSIST_JOURNAL_RECORDS; // Next free record in the journal, the sector is erased before the first write if unknown
+
+static uint32_t persistCrc(const Checkpoint * checkpoint)
+{
+  const uint8_t * data = (const uint8_t *)checkpoint;
+  uint32_t crc = 0xffffffff;
+  for(uint8_t i = 0; i < offsetof(Checkpoint, crc); i++)
+  {
+    crc ^= data[i];
+    for(uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+  }
+  return ~crc;
+}
+
+static bool persistValid(const Checkpoint * checkpoint)
+{
+  return checkpoint->magic == PERSIST_MAGIC && checkpoint->crc == persistCrc(checkpoint);
+}
+
+// Read the newest valid checkpoint, returns false if there is none
+// Also finds where the next journal record goes, so this must be called once at boot before persistSave()
+bool persistRestore(Checkpoint * checkpoint)
+{
+  Checkpoint record;
+  bool found = false;
+
+  if(ESP.rtcUserMemoryRead(PERSIST_RTC_OFFSET, (uint32_t*)&record, sizeof(record)) && persistValid(&record))
+  {
+    *checkpoint = record;
+    found = true;
+  }
+
+  // Walk the journal up to the first blank record, the records are in writing order
+  uint32_t address = PERSIST_JOURNAL_SECTOR * SPI_FLASH_SEC_SIZE;
+  for(persistJournalIndex = 0; persistJournalIndex < PERSIST_JOURNAL_RECORDS; persistJournalIndex++)
+  {
+    if(!ESP.flashRead(address + persistJournalIndex * sizeof(record), (uint32_t*)&record, sizeof(record)))
+    {
+      break;
+    }
+    if(record.magic == 0xffffffff)
+    {
+      break;
+    }
+    if(persistValid(&record) && (!found || record.sequence > checkpoint->sequence))
+    {
+      *checkpoint = record;
+      found = true;
+    }
+  }
+
+  if(found)
+  {
+    persistSequence = checkpoint->sequence;
+    persistTimestamp = checkpoint->timestamp;
+    DEBUGV("Restored checkpoint %u, today: %u\n", checkpoint->sequence, checkpoint->powerToday);
+  }
+
+  return found;
+}
+
+// Write a checkpoint to RTC memory, and to the flash journal if asked
+void persistSave(Checkpoint * checkpoint, bool journal)
+{
+  checkpoint->magic = PERSIST_MAGIC;
+  checkpoint->sequence = ++persistSequence;
+  if(timeStatus() != timeNotSet)
+  {
+    persistTimestamp = now();
+  }
+  checkpoint->timestamp = persistTimestamp;
+  checkpoint->crc = persistCrc(checkpoint);
+
+  ESP.rtcUserMemoryWrite(PERSIST_RTC_OFFSET, (uint32_t*)checkpoint, sizeof(Checkpoint));
+
+  if(!journal)
+  {
+    return;
+  }
+
+  // Erase the sector once it is full, the RTC copy covers the short moment without a journal
+  if(persistJournalIndex >= PERSIST_JOURNAL_RECORDS)
+  {
+    if(!ESP.flashEraseSector(PERSIST_JOURNAL_SECTOR))
+    {
+      return;
+    }
+    persistJournalIndex = 0;
+  }
+
+  uint32_t address = PERSIST_JOURNAL_SECTOR * SPI_FLASH_SEC_SIZE + persistJournalIndex * sizeof(Checkpoint);
+  if(ESP.flashWrite(address, (uint32_t*)checkpoint, sizeof(Checkpoint)))
+  {
+    persistJournalIndex++;
+  }
+}
@@ -0,0 +1,50 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    persist.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+#define PERSIST_MAGIC 0x504d4331 // "PMC1", marks a checkpoint written by this firmware
+#define PERSIST_RTC_OFFSET 32 // First RTC user memory block used for the checkpoint, the blocks below are used by the OTA updater
+
+// Snapshot of the counters, the same record is written to RTC memory and to the flash journal
+struct Checkpoint {
+  uint32_t magic;
+  uint32_t sequence;       // Incremented on every checkpoint, the highest valid one is restored
+  uint32_t timestamp;      // Time at which the checkpoint was taken, 0 if the time was not set yet [s]
+  uint32_t powerToday;     // Day power usage [imp]
+  uint32_t powerMinute;    // Blinks of the current minute [imp]
+  uint32_t powerHour;      // Power usage of the current hour [Wh]
+  uint32_t powerRemainder; // Fraction of a Wh carried over to the next minute [imp*Wh/kWh]
+  uint32_t crc;            // CRC-32 of all the fields above
+};
+
+bool persistRestore(Checkpoint *);
+void persistSave(Checkpoint *, bool);
+
+#endif
@@ -39,7 +39,7 @@ GoogleSpreadsheets::GoogleSpreadsheets(const char * _script)
   script = _script;
 }
 
-bool GoogleSpreadsheets::submit(time_t time, uint16_t power)
+bool GoogleSpreadsheets::submit(time_t time, uint32_t power)
 {
   DEBUGV("Submitting data to Google Spreadsheets\n");
   
@@ -61,9 +61,25 @@ bool GoogleSpreadsheets::submit(time_t time, uint16_t power)
   }*/
 
   // Construct the GET request
-  String url = String(script) + "?time=" + time + "&power=" + power + "&token=" + googleSpreadSheetsToken;
+  char request[PUSH_REQUEST_LENGTH];
+  size_t length = snprintf(
+    request,
+    sizeof(request),
+    "GET %s?time=%u&power=%u&token=%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+    script,
+    (uint32_t)time,
+    power,
+    googleSpreadSheetsToken,
+    host
+  );
+  if(length >= sizeof(request))
+  {
+    DEBUGV("Request too long\n");
+    client.stop();
+    return false;
+  }
 
-  client.print(String("GET ") + url + " HTTP/1.1\r\nHost: " + host + "\r\nConnection: close\r\n\r\n");
+  client.write((const uint8_t *)request, length);
   
   // At this point we might as well assume the request was successful,
   // however for debugging one can view the server response by uncommending the following block:
@@ -36,7 +36,7 @@ class Push
   const char * host;
   
   public:
-  virtual bool submit(time_t time, uint16_t power) = 0;
+  virtual bool submit(time_t time, uint32_t power) = 0;
 };
 
 // Class to submit the power data to Google Spreadsheets
@@ -50,7 +50,7 @@ class GoogleSpreadsheets : public Push
   
   public:
   GoogleSpreadsheets(const char * _script);
-  bool submit(time_t time, uint16_t power);
+  bool submit(time_t time, uint32_t power);
 };
 
 #endif
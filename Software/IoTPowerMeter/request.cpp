@@ -0,0 +1,214 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    request.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Parts of the request handling that do not need the web server
+
+#include <ESP8266WiFi.h>
+
+#include "config.h"
+#include "request.h"
+
+// Add the time spent on one request to the statistics of its type [us]
+void requestRecord(RequestStats * stats, uint32_t duration)
+{
+  stats->count++;
+  stats->timeTotal += duration;
+  stats->timeMax = max(stats->timeMax, duration);
+  
+  // Histogram with power of two buckets in milliseconds: <1ms, <2ms, <4ms...
+  uint8_t bucket = 0;
+  for(uint32_t time = duration / 1000; time && bucket < REQUEST_STATS_BUCKETS - 1; time >>= 1)
+  {
+    bucket++;
+  }
+  stats->histogram[bucket]++;
+}
+
+// Upper bound of the histogram bucket holding the given percentile [ms]
+uint32_t requestPercentile(RequestStats * stats, uint8_t percentile)
+{
+  uint32_t threshold = ((uint64_t)stats->count * percentile + 99) / 100;
+  uint32_t count = 0;
+  for(uint8_t bucket = 0; bucket < REQUEST_STATS_BUCKETS; bucket++)
+  {
+    count += stats->histogram[bucket];
+    if(count >= threshold)
+    {
+      return 1UL << bucket;
+    }
+  }
+  return 1UL << (REQUEST_STATS_BUCKETS - 1);
+}
+
+// Type of the data sent for each file extension, files with other extensions are sent as plain text
+static const struct {
+  const char * extension;
+  const char * type;
+} mimeTypes[] = {
+  {".htm", "text/html"},
+  {".css", "text/css"},
+  {".js", "application/javascript"},
+  {".png", "image/png"},
+  {".gif", "image/gif"},
+  {".jpg", "image/jpeg"},
+  {".ico", "image/x-icon"}
+  /*{".xml", "text/xml"},
+  {".pdf", "application/pdf"},
+  {".zip", "application/zip"}*/
+};
+
+const char * mimeType(const char * path)
+{
+  const char * extension = strrchr(path, '.');
+  if(extension != NULL)
+  {
+    for(uint8_t i = 0; i < sizeof(mimeTypes) / sizeof(mimeTypes[0]); i++)
+    {
+      // File names on the SD card are upper case
+      if(strcasecmp(extension, mimeTypes[i].extension) == 0)
+      {
+        return mimeTypes[i].type;
+      }
+    }
+  }
+  return "text/plain";
+}
+
+// Read a "Range: bytes=" header for a file of the given size, only a single range is supported
+// Returns 206 with the first and last bytes to send, 416 if the range is outside of the file or 200 to send the whole file
+int parseRange(const char * header, uint32_t size, uint32_t * first, uint32_t * last)
+{
+  if(strncmp(header, "bytes=", 6) != 0 || strchr(header, ',') != NULL)
+  {
+    return 200;
+  }
+  header += 6;
+  
+  char * end;
+  if(*header == '-')
+  {
+    // Suffix range, the last given number of bytes
+    uint32_t length = strtoul(header + 1, &end, 10);
+    if(end == header + 1 || length == 0 || size == 0)
+    {
+      return 416;
+    }
+    *first = length < size ? size - length : 0;
+    *last = size - 1;
+    return 206;
+  }
+  
+  *first = strtoul(header, &end, 10);
+  if(end == header || *end != '-')
+  {
+    return 200;
+  }
+  header = end + 1;
+  
+  // The end can be left out to get everything from the first byte
+  *last = strtoul(header, &end, 10);
+  if(end == header)
+  {
+    *last = size - 1;
+  }
+  
+  if(*first >= size || *last < *first)
+  {
+    return 416;
+  }
+  *last = min(*last, size - 1);
+  
+  return 206;
+}
+
+// Copy a path given by the client, returns false if it is empty or does not fit in the buffer
+bool copyPath(char * path, const char * argument)
+{
+  size_t length = strlen(argument);
+  if(length == 0 || length >= SERVER_PATH_LENGTH)
+  {
+    return false;
+  }
+  memcpy(path, argument, length + 1);
+  return true;
+}
+
+// Whether a path names the given file or directory, with or without a trailing slash, SD card names ignore the case
+bool pathIs(const char * path, const char * name)
+{
+  size_t length = strlen(name);
+  return strncasecmp(path, name, length) == 0 && (path[length] == 0 || (path[length] == '/' && path[length + 1] == 0));
+}
+
+// Whether a path is the given directory or anything inside it
+bool pathWithin(const char * path, const char * directory)
+{
+  size_t length = strlen(directory);
+  return strncasecmp(path, directory, length) == 0 && (path[length] == 0 || path[length] == '/');
+}
+
+// Copy a text into a JSON string without the quotes, returns the length of the whole escaped text like snprintf()
+// The copy stops before an escape sequence that does not fit, the buffer is always terminated
+size_t jsonEscape(char * buffer, size_t size, const char * text)
+{
+  size_t length = 0;
+  size_t copied = 0;
+  for(; *text; text++)
+  {
+    char escaped[7];
+    uint8_t character = *text;
+    if(character == '"' || character == '\\')
+    {
+      sprintf(escaped, "\\%c", character);
+    }
+    else if(character < 0x20)
+    {
+      sprintf(escaped, "\\u%04x", character);
+    }
+    else
+    {
+      escaped[0] = character;
+      escaped[1] = 0;
+    }
+    
+    // Nothing more is copied once a sequence did not fit
+    size_t count = strlen(escaped);
+    if(copied == length && length + count < size)
+    {
+      memcpy(buffer + copied, escaped, count);
+      copied += count;
+    }
+    length += count;
+  }
+  
+  if(size)
+  {
+    buffer[copied] = 0;
+  }
+  return length;
+}
@@ -0,0 +1,64 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    request.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#define REQUEST_STATS_BUCKETS 16
+
+// Types of requests for which statistics are kept
+enum RequestType {
+  REQUEST_NONE,
+  REQUEST_LIVE,
+  REQUEST_TODAY,
+  REQUEST_VALUES,
+  REQUEST_API,
+  REQUEST_FILE,
+  REQUEST_LIST,
+  REQUEST_EDIT,
+  REQUEST_TYPES
+};
+
+// Time spent handling requests of one type, which is also the time the metering loop was stalled [us]
+struct RequestStats {
+  uint32_t count;
+  uint64_t timeTotal;
+  uint32_t timeMax;
+  uint32_t histogram[REQUEST_STATS_BUCKETS];
+};
+
+void requestRecord(RequestStats *, uint32_t);
+uint32_t requestPercentile(RequestStats *, uint8_t);
+const char * mimeType(const char *);
+int parseRange(const char *, uint32_t, uint32_t *, uint32_t *);
+bool copyPath(char *, const char *);
+bool pathIs(const char *, const char *);
+bool pathWithin(const char *, const char *);
+size_t jsonEscape(char *, size_t, const char *);
+
+#endif
@@ -0,0 +1,321 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    series.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <ESP8266WiFi.h>
+#include <TimeLib.h>
+#include <SPI.h>
+#include <SD.h>
+
+#include "config.h"
+#include "series.h"
+#include "archive.h"
+
+// Name of the log file for the day of the timestamp, the buffer must hold at least 20 characters
+void dayFileName(char * buffer, time_t timestamp)
+{
+  sprintf(buffer, "/power/%04d%02d%02d.csv", year(timestamp), month(timestamp), day(timestamp));
+}
+
+// Copy of todays minute values, so that the server never has to read todays file
+static uint16_t todayValues[MINUTES_PER_DAY];
+static time_t todayDate = 0;
+
+// Todays minute values [Wh], the SD card is never read here: the copy is kept up to date by todaySeriesUpdate()
+// Between midnight and the first minute of the new day the values are still the ones of the previous day, the callers
+// only use the minutes elapsed today
+const uint16_t * todaySeries()
+{
+  return todayValues;
+}
+
+// Called when a minute has been logged, the copy moves to the day of the timestamp here
+// After boot the minutes logged so far are read from the SD card once, a new day starts empty
+void todaySeriesUpdate(time_t timestamp, uint32_t power)
+{
+  if(timeStatus() == timeNotSet)
+  {
+    return;
+  }
+  
+  time_t date = previousMidnight(timestamp);
+  if(date != todayDate)
+  {
+    if(todayDate == 0)
+    {
+      readDay(date, todayValues);
+    }
+    else
+    {
+      memset(todayValues, 0, sizeof(todayValues));
+    }
+    todayDate = date;
+  }
+  todayValues[hour(timestamp) * 60 + minute(timestamp)] = min(power, (uint32_t)0xffff);
+}
+
+// Start parsing a new file into the given array, minutes without a row are set to 0
+void SeriesParser::begin(uint16_t * _series)
+{
+  series = _series;
+  rows = 0;
+  memset(series, 0, MINUTES_PER_DAY * sizeof(uint16_t));
+  reset();
+}
+
+// Forget the current row
+void SeriesParser::reset()
+{
+  field = FIELD_HOUR;
+  number = 0;
+  digits = 0;
+  value = 0;
+}
+
+// Parse the next part of the file in a single pass, without copying rows, rows may be split between two calls
+// Both "HH:MM,Wh" (old format) and "YYYY-MM-DDTHH:MMZ,Wh" rows are understood, headers and malformed rows are skipped
+void SeriesParser::feed(const uint8_t * data, int length)
+{
+  for(int i = 0; i < length; i++)
+  {
+    uint8_t c = data[i];
+    uint8_t digit = c - '0';
+    
+    if(c == '\n')
+    {
+      finish();
+      continue;
+    }
+    
+    switch(field)
+    {
+      case FIELD_HOUR:
+        // Only the last two digits before the colon are the hour, the date comes before
+        if(digit < 10)
+        {
+          number = (number * 10 + digit) % 100;
+          digits++;
+        }
+        else if(c == ':' && digits >= 2 && number < 24)
+        {
+          hour = number;
+          number = 0;
+          digits = 0;
+          field = FIELD_MINUTE;
+        }
+        else if(c == ',' || c == ':')
+        {
+          // Headers have no time before the comma
+          field = FIELD_INVALID;
+        }
+        else
+        {
+          number = 0;
+          digits = 0;
+        }
+        break;
+      
+      case FIELD_MINUTE:
+        // Two digits, possibly followed by a time zone
+        if(digit < 10 && digits < 2)
+        {
+          number = number * 10 + digit;
+          digits++;
+        }
+        else if(c == ',')
+        {
+          field = digits == 2 && number < 60 ? FIELD_VALUE : FIELD_INVALID;
+          digits = 0;
+        }
+        else if(digit < 10)
+        {
+          field = FIELD_INVALID;
+        }
+        break;
+      
+      case FIELD_VALUE:
+        if(digit < 10)
+        {
+          value = value * 10 + digit;
+          digits++;
+        }
+        else
+        {
+          // Ignore the carriage return and anything else until the end of the row
+          field = digits ? FIELD_DONE : FIELD_INVALID;
+        }
+        break;
+      
+      default:
+        break;
+    }
+  }
+}
+
+// Store the current row, also called for the last row when the file does not end with a new line
+void SeriesParser::finish()
+{
+  if((field == FIELD_VALUE && digits) || field == FIELD_DONE)
+  {
+    series[hour * 60 + number] = min(value, (uint32_t)0xffff);
+    rows++;
+  }
+  reset();
+}
+
+// Read a day log file into an array of MINUTES_PER_DAY values, minutes without a row are set to 0
+// Returns the number of rows found
+uint16_t readDaySeries(const char * path, uint16_t * series)
+{
+  SeriesParser parser;
+  parser.begin(series);
+  
+  File dataFile = SD.open(path);
+  if(!dataFile)
+  {
+    return 0;
+  }
+  
+  // Read the file in blocks instead of byte by byte, it is much faster on the SD card
+  uint8_t block[128];
+  int length;
+  while((length = dataFile.read(block, sizeof(block))) > 0)
+  {
+    parser.feed(block, length);
+    yield();
+  }
+  parser.finish();
+  
+  dataFile.close();
+  return parser.rows;
+}
+
+// Read a day from its log file, or from the archive once the log file has been compacted
+uint16_t readDay(time_t timestamp, uint16_t * series)
+{
+  char path[32];
+  dayFileName(path, timestamp);
+  if(SD.exists(path))
+  {
+    return readDaySeries(path, series);
+  }
+  return archiveReadDay(timestamp, series);
+}
+
+// Rollup kernels over minute series, unrolled by four as the ESP8266 has no vector instructions
+
+uint32_t seriesSum(const uint16_t * series, uint16_t length)
+{
+  uint32_t sum0 = 0, sum1 = 0, sum2 = 0, sum3 = 0;
+  uint16_t i = 0;
+  
+  for(; i + 4 <= length; i += 4)
+  {
+    sum0 += series[i];
+    sum1 += series[i + 1];
+    sum2 += series[i + 2];
+    sum3 += series[i + 3];
+  }
+  for(; i < length; i++)
+  {
+    sum0 += series[i];
+  }
+  
+  return sum0 + sum1 + sum2 + sum3;
+}
+
+// Four independent minimums like the sums above, the comparisons do not wait on each other
+uint16_t seriesMin(const uint16_t * series, uint16_t length)
+{
+  uint16_t min0 = 0xffff, min1 = 0xffff, min2 = 0xffff, min3 = 0xffff;
+  uint16_t i = 0;
+  
+  for(; i + 4 <= length; i += 4)
+  {
+    min0 = series[i] < min0 ? series[i] : min0;
+    min1 = series[i + 1] < min1 ? series[i + 1] : min1;
+    min2 = series[i + 2] < min2 ? series[i + 2] : min2;
+    min3 = series[i + 3] < min3 ? series[i + 3] : min3;
+  }
+  for(; i < length; i++)
+  {
+    min0 = series[i] < min0 ? series[i] : min0;
+  }
+  
+  min0 = min1 < min0 ? min1 : min0;
+  min2 = min3 < min2 ? min3 : min2;
+  return min2 < min0 ? min2 : min0;
+}
+
+uint16_t seriesMax(const uint16_t * series, uint16_t length)
+{
+  uint16_t max0 = 0, max1 = 0, max2 = 0, max3 = 0;
+  uint16_t i = 0;
+  
+  for(; i + 4 <= length; i += 4)
+  {
+    max0 = series[i] > max0 ? series[i] : max0;
+    max1 = series[i + 1] > max1 ? series[i + 1] : max1;
+    max2 = series[i + 2] > max2 ? series[i + 2] : max2;
+    max3 = series[i + 3] > max3 ? series[i + 3] : max3;
+  }
+  for(; i < length; i++)
+  {
+    max0 = series[i] > max0 ? series[i] : max0;
+  }
+  
+  max0 = max1 > max0 ? max1 : max0;
+  max2 = max3 > max2 ? max3 : max2;
+  return max2 > max0 ? max2 : max0;
+}
+
+// Sum a day of minute values into 24 hourly values
+void seriesHourly(const uint16_t * series, uint32_t * hours)
+{
+  for(uint8_t hour = 0; hour < 24; hour++)
+  {
+    hours[hour] = seriesSum(series + hour * 60, 60);
+  }
+}
+
+// Add a series to a running total, to combine several days minute by minute
+void seriesAccumulate(uint32_t * total, const uint16_t * series, uint16_t length)
+{
+  uint16_t i = 0;
+  
+  for(; i + 4 <= length; i += 4)
+  {
+    total[i] += series[i];
+    total[i + 1] += series[i + 1];
+    total[i + 2] += series[i + 2];
+    total[i + 3] += series[i + 3];
+  }
+  for(; i < length; i++)
+  {
+    total[i] += series[i];
+  }
+}
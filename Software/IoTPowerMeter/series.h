@@ -0,0 +1,73 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    series.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#ifndef SERIES_H
+#define SERIES_H
+
+#define MINUTES_PER_DAY 1440
+
+// Fields of a day log file row
+enum SeriesField {
+  FIELD_HOUR,
+  FIELD_MINUTE,
+  FIELD_VALUE,
+  FIELD_DONE,
+  FIELD_INVALID
+};
+
+// Incremental parser for day log files, so that a file can be read in several steps
+class SeriesParser
+{
+  private:
+  uint16_t * series;
+  SeriesField field;
+  uint16_t number;
+  uint8_t digits;
+  uint8_t hour;
+  uint32_t value;
+  void reset();
+  
+  public:
+  uint16_t rows;
+  void begin(uint16_t *);
+  void feed(const uint8_t *, int);
+  void finish();
+};
+
+void dayFileName(char *, time_t);
+const uint16_t * todaySeries();
+void todaySeriesUpdate(time_t, uint32_t);
+uint16_t readDaySeries(const char *, uint16_t *);
+uint16_t readDay(time_t, uint16_t *);
+uint32_t seriesSum(const uint16_t *, uint16_t);
+uint16_t seriesMin(const uint16_t *, uint16_t);
+uint16_t seriesMax(const uint16_t *, uint16_t);
+void seriesHourly(const uint16_t *, uint32_t *);
+void seriesAccumulate(uint32_t *, const uint16_t *, uint16_t);
+
+#endif
@@ -33,31 +33,123 @@
 #include <SD.h>
 
 #include "config.h"
+#include "request.h"
 #include "server.h"
 #include "IoTPowerMeter.h"
+#include "series.h"
+#include "archive.h"
+#include "events.h"
+#include "memory.h"
 
 ESP8266WebServer server(80);
 File uploadFile;
 
+// Blocks of whole SD card sectors used to send files and to receive uploads, only one request is handled at a time
+static uint8_t sectorBuffers[2][STREAM_BLOCK_SIZE];
+
+// Upload in progress, see handleFileUpload()
+static char uploadPath[SERVER_PATH_LENGTH];
+static char uploadTempPath[SERVER_PATH_LENGTH];
+static char uploadBackupPath[SERVER_PATH_LENGTH];
+static size_t uploadBuffered = 0;
+static bool uploadFailed = false; // The POST request is answered with an error
+static uint32_t uploadTimeStart = 0;
+
+// Request statistics, see handleClient()
+static const char * requestTypeNames[] = {"none", "live", "today", "values", "api", "file", "list", "edit"};
+static RequestStats requestStats[REQUEST_TYPES];
+static RequestType requestType = REQUEST_NONE;
+static DownloadStats downloadStats;
+
+// Background deletion, see deleteStep()
+static char deletePath[SERVER_PATH_LENGTH];
+static size_t deleteLengths[DELETE_DEPTH_MAX]; // Length of the path of the parent of each directory level
+static uint8_t deleteDepth = 0; // Directory levels from the deleted directory to the one being emptied
+static File deleteDir;
+static uint32_t deleteRemoved = 0;
+static DeleteState deleteState = DELETE_IDLE;
+
+// One day worth of minute values, static as it is too large for the stack
+static uint16_t series[MINUTES_PER_DAY];
+
 void initServer()
 {
-  server.on("/", [](){ loadFromSdCard("/"); }); // Serve the index.htm file for root
+  server.on("/", [](){ setRequestType(REQUEST_FILE); loadFromSdCard("/"); }); // Serve the index.htm file for root
   server.on("/list", HTTP_GET, printDirectory); // Fetch files in directory
   server.on("/edit", HTTP_DELETE, handleDelete); // Delete files and folders
   server.on("/edit", HTTP_PUT, handleCreate); // For uploads
   
   server.on("/api", HTTP_GET, serverApi);
-  server.on("/edit", HTTP_POST, [](){ returnOK(); }, handleFileUpload);
+  server.on("/edit", HTTP_POST, [](){ uploadFailed ? returnFail("UPLOAD FAILED") : returnOK(); }, handleFileUpload);
 
   // In case there is no handler try to serve a page from SD card
   server.onNotFound(handleNotFound);
   
+  // Keep the range header so that downloads can be resumed
+  static const char * headerKeys[] = {"Range"};
+  server.collectHeaders(headerKeys, sizeof(headerKeys) / sizeof(char *));
+  
   server.begin();
 }
 
 void handleClient()
 {
+  // Measure how long the metering loop is held up by each request, the handlers tell which type of request it was
+  requestType = REQUEST_NONE;
+  uint32_t timeStart = micros();
   server.handleClient();
+  uint32_t duration = micros() - timeStart;
+  
+  if(requestType == REQUEST_NONE)
+  {
+    return;
+  }
+  
+  requestRecord(&requestStats[requestType], duration);
+}
+
+void setRequestType(RequestType type)
+{
+  requestType = type;
+}
+
+// Send the request statistics as CSV for regression tracking
+void printRequestStats()
+{
+  char buffer[96];
+  uint32_t uptime = millis() / 1000;
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  server.sendContent(F("Type,Count,Requests per hour,Total [ms],Max [ms],p50 [ms],p99 [ms]\n"));
+  
+  for(uint8_t type = REQUEST_NONE + 1; type < REQUEST_TYPES; type++)
+  {
+    RequestStats * stats = &requestStats[type];
+    sprintf(
+      buffer,
+      "%s,%u,%u,%u,%u,%u,%u\n",
+      requestTypeNames[type],
+      stats->count,
+      uptime ? (uint32_t)((uint64_t)stats->count * 3600 / uptime) : 0,
+      (uint32_t)(stats->timeTotal / 1000),
+      stats->timeMax / 1000,
+      stats->count ? requestPercentile(stats, 50) : 0,
+      stats->count ? requestPercentile(stats, 99) : 0
+    );
+    server.sendContent(buffer);
+  }
+  
+  // File download throughput
+  sprintf(
+    buffer,
+    "# Downloads: %u, %ukB, average %ukB/s, last %ukB/s\n",
+    downloadStats.count,
+    (uint32_t)(downloadStats.bytes / 1024),
+    downloadStats.timeTotal ? (uint32_t)(downloadStats.bytes * 1000 / downloadStats.timeTotal) : 0,
+    downloadStats.rateLast
+  );
+  server.sendContent(buffer);
 }
 
 // Authentificate the user for server access
@@ -79,6 +171,37 @@ bool basicAuthentication()
   return true;
 }
 
+// Copy a request argument to a buffer, returns false if the argument was not given
+// A value that does not fit is left empty, which none of the callers accept as valid
+bool serverArg(const char * name, char * value, size_t size)
+{
+  value[0] = '\0';
+  if(!server.hasArg(name))
+  {
+    return false;
+  }
+  const String & argument = server.arg(name);
+  if(argument.length() < size)
+  {
+    memcpy(value, argument.c_str(), argument.length() + 1);
+  }
+  return true;
+}
+
+// Same for a request header, the value is empty if the header was not sent or does not fit
+void serverHeader(const char * name, char * value, size_t size)
+{
+  const String & header = server.header(name);
+  if(header.length() < size)
+  {
+    memcpy(value, header.c_str(), header.length() + 1);
+  }
+  else
+  {
+    value[0] = '\0';
+  }
+}
+
 // Application Programming Interface for the IoT Power Meter
 void serverApi()
 {
@@ -89,32 +212,95 @@ void serverApi()
   
   server.sendHeader(F("Connection"), F("close"));
 
-  // An API request must have a "request" parameter
-  if(!server.hasArg("request"))
+  // An API request must have a "request" parameter, it is copied once and compared without making any String
+  char request[12];
+  if(!serverArg("request", request, sizeof(request)))
   {
     server.send(400, F("text/plain"), F("Bad argument"));
     return;
   }
   
-  DEBUGV("API request: %s\n", (char *)server.arg("request").c_str());
+  DEBUGV("API request: %s\n", request);
   
-  if(server.arg("request") == "live")
+  char reply[12];
+  char since[12];
+  
+  if(strcmp(request, "live") == 0)
   {
+    setRequestType(REQUEST_LIVE);
     // Live power usage in [Wh]
-    server.send(200, F("text/plain"), (String)livePowerUsage());
+    snprintf(reply, sizeof(reply), "%u", livePowerUsage());
+    server.send(200, F("text/plain"), reply);
   }
-  else if(server.arg("request") == "today")
+  else if(strcmp(request, "today") == 0)
   {
+    setRequestType(REQUEST_TODAY);
     // Return today electricity usage so far [Wh]
-    server.send(200, F("text/plain"), (String)todayPowerUsage());
+    snprintf(reply, sizeof(reply), "%u", todayPowerUsage());
+    server.send(200, F("text/plain"), reply);
+  }
+  else if(strcmp(request, "constant") == 0)
+  {
+    setRequestType(REQUEST_API);
+    // Change the meter constant when a value is given [imp/kWh]
+    char value[8];
+    if(serverArg("value", value, sizeof(value)))
+    {
+      long constant = strtol(value, NULL, 10);
+      if(constant <= 0 || constant > 0xffff || !setMeterConstant(constant))
+      {
+        server.send(400, F("text/plain"), F("Bad value"));
+        return;
+      }
+    }
+    // Return the meter constant in use [imp/kWh]
+    snprintf(reply, sizeof(reply), "%u", getMeterConstant());
+    server.send(200, F("text/plain"), reply);
+  }
+  else if(strcmp(request, "values") == 0)
+  {
+    setRequestType(REQUEST_VALUES);
+    // Send todays values to build a graph, only the ones after the given minute of the day when "since" is set
+    // The binary format is an array of numbers, much smaller than the CSV rows
+    char format[4];
+    serverArg("format", format, sizeof(format));
+    serverValues(serverArg("since", since, sizeof(since)) ? strtol(since, NULL, 10) : -1, strcmp(format, "bin") == 0);
+  }
+  else if(strcmp(request, "summary") == 0)
+  {
+    setRequestType(REQUEST_API);
+    serverSummary();
+  }
+  else if(strcmp(request, "range") == 0)
+  {
+    // Power usage per day or per hour over a range of days
+    setRequestType(REQUEST_API);
+    serverRange();
+  }
+  else if(strcmp(request, "events") == 0)
+  {
+    // Events logged after the given sequence number, or all of them
+    setRequestType(REQUEST_API);
+    bool all = !serverArg("since", since, sizeof(since));
+    serverEvents(all ? 0 : strtoul(since, NULL, 10) + 1, all);
   }
-  else if(server.arg("request") == "values")
+  else if(strcmp(request, "memory") == 0)
   {
-    // Send all todays values to build a graph
-    char buffer[32];
-    sprintf(buffer, "/power/%04d%02d%02d.csv", year(), month(), day());
-    // Stream todays file
-    loadFromSdCard(buffer);
+    // Free heap, largest block, fragmentation and stack use
+    setRequestType(REQUEST_API);
+    serverMemory();
+  }
+  else if(strcmp(request, "delete") == 0)
+  {
+    // Progress of the directory deletion started from the edit page
+    setRequestType(REQUEST_API);
+    serverDelete();
+  }
+  else if(strcmp(request, "stats") == 0)
+  {
+    // Request count and time spent per request type since boot
+    setRequestType(REQUEST_API);
+    printRequestStats();
   }
   else
   {
@@ -122,87 +308,332 @@ void serverApi()
   }
 }
 
-void returnOK()
+// Send todays values after the given minute of the day (or all of them), as CSV or in binary
+// The values come from the copy of today kept in memory, the SD card is not used at all, and the minute of the day is
+// the position in that copy, so the cursor needs no index of offsets in the day log file
+void serverValues(long since, bool binary)
 {
-  server.sendHeader(F("Connection"), F("close"));
-  server.send(200, F("text/plain"), F("OK"));
+  time_t timeDay = previousMidnight(now());
+  const uint16_t * values = todaySeries();
+  
+  // Only the minutes that have already been logged
+  uint16_t last = elapsedSecsToday(now()) / SECS_PER_MIN;
+  uint16_t first = constrain(since + 1, 0, last);
+  
+  if(binary)
+  {
+    sendValuesBinary(values, timeDay, first, last);
+  }
+  else
+  {
+    sendValuesCsv(values, timeDay, first, last);
+  }
 }
 
-void returnFail(String msg)
+// Send the values from the first minute to the one before the last minute in binary, all numbers are little-endian:
+// [0..3] start of the first minute in seconds since 1970-01-01T00:00Z
+// [4..5] number of values
+// [6..7] minutes per value
+// [8..]  one 16-bit value per minute [Wh]
+void sendValuesBinary(const uint16_t * values, time_t timeDay, uint16_t first, uint16_t last)
 {
-  server.sendHeader(F("Connection"), F("close"));
-  server.send(500, F("text/plain"), msg + F("\r\n"));
+  uint16_t count = last - first;
+  uint32_t timeStart = timeDay + first * SECS_PER_MIN;
+  uint8_t header[8];
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    header[i] = timeStart >> (8 * i);
+  }
+  header[4] = count;
+  header[5] = count >> 8;
+  header[6] = 1;
+  header[7] = 0;
+  
+  server.setContentLength(sizeof(header) + count * sizeof(uint16_t));
+  server.send(200, F("application/octet-stream"), "");
+  server.client().write(header, sizeof(header));
+  // The ESP8266 is little-endian, the array can be sent as it is
+  server.client().write((const uint8_t *)(values + first), count * sizeof(uint16_t));
 }
 
-bool loadFromSdCard(String path)
+// Send the values from the first minute to the one before the last minute as rows of the day log file
+// The header is only sent with the whole day
+void sendValuesCsv(const uint16_t * values, time_t timeDay, uint16_t first, uint16_t last)
 {
-  if(!basicAuthentication())
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  
+  // Send the rows in blocks, one chunk per row would be very slow
+  char block[512];
+  size_t length = 0;
+  if(first == 0)
   {
-    return false;
+    length = sprintf(block, "Timestamp,Power [W*min]\r\n");
   }
   
-  // Default data return type is plain text
-  String dataType = F("text/plain");
-
-  // In case the user requests / or /*/ load the index.htm file by default
-  if(path.endsWith("/"))
+  for(uint16_t minuteOfDay = first; minuteOfDay < last; minuteOfDay++)
+  {
+    length += sprintf(
+      block + length,
+      "%04d-%02d-%02dT%02d:%02dZ,%u\r\n",
+      year(timeDay),
+      month(timeDay),
+      day(timeDay),
+      minuteOfDay / 60,
+      minuteOfDay % 60,
+      values[minuteOfDay]
+    );
+    
+    // Rows are at most 26 characters long
+    if(length > sizeof(block) - 32)
+    {
+      server.sendContent(block);
+      length = 0;
+    }
+  }
+  
+  if(length)
   {
-    path += "index.htm";
+    server.sendContent(block);
   }
+}
 
-  // Define the data type of the returned data from the file extention
-  if(path.endsWith(".src"))
+// Send the events from the given sequence number as CSV rows, oldest first, at most EVENTS_MAX_RESPONSE of them
+// To follow the log ask again with the sequence number of the last row as "since"
+void serverEvents(uint32_t next, bool header)
+{
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  
+  char block[512];
+  size_t length = 0;
+  if(header)
   {
-    path = path.substring(0, path.lastIndexOf("."));
+    length = sprintf(block, "Sequence,Timestamp,Event,Argument 1,Argument 2\r\n");
   }
-  else if(path.endsWith(".htm"))
+  
+  EventRecord records[16];
+  uint16_t sent = 0;
+  uint16_t count;
+  while(sent < EVENTS_MAX_RESPONSE && (count = eventsRead(next, records, sizeof(records) / sizeof(EventRecord))))
   {
-    dataType = F("text/html");
+    for(uint16_t i = 0; i < count; i++)
+    {
+      time_t timestamp = records[i].timestamp;
+      length += sprintf(
+        block + length,
+        "%u,%04d-%02d-%02dT%02d:%02d:%02dZ,%s,%u,%u\r\n",
+        records[i].sequence,
+        year(timestamp),
+        month(timestamp),
+        day(timestamp),
+        hour(timestamp),
+        minute(timestamp),
+        second(timestamp),
+        eventName(records[i].code),
+        records[i].arg1,
+        records[i].arg2
+      );
+      
+      // Rows are at most 72 characters long
+      if(length > sizeof(block) - 80)
+      {
+        server.sendContent(block);
+        length = 0;
+      }
+    }
+    next = records[count - 1].sequence + 1;
+    sent += count;
   }
-  else if(path.endsWith(".css"))
+  
+  if(length)
   {
-    dataType = F("text/css");
+    server.sendContent(block);
   }
-  else if(path.endsWith(".js"))
+}
+
+// Memory state as one CSV row, the lowest free heap and the free stack are the worst seen since boot
+void serverMemory()
+{
+  const MemoryStats * memory = memoryStats();
+  char buffer[160];
+  sprintf(
+    buffer,
+    "Free heap [B],Lowest free heap [B],Largest block [B],Fragmentation [%%],Free stack [B]\n%u,%u,%u,%u,%u\n",
+    memory->heapFree,
+    memory->heapFreeMin,
+    memory->blockMax,
+    memory->fragmentation,
+    memory->stackFree
+  );
+  server.send(200, F("text/plain"), buffer);
+}
+
+// Day summary from the copy of today kept in memory: total [Wh], minimum, maximum and average per minute [Wh]
+void serverSummary()
+{
+  const uint16_t * values = todaySeries();
+  uint16_t count = elapsedSecsToday(now()) / SECS_PER_MIN;
+  uint32_t total = seriesSum(values, count);
+  
+  char buffer[48];
+  sprintf(
+    buffer,
+    "%u,%u,%u,%u",
+    total,
+    count ? seriesMin(values, count) : 0,
+    seriesMax(values, count),
+    count ? total / count : 0
+  );
+  server.send(200, F("text/plain"), buffer);
+}
+
+// Convert a YYYYMMDD date to a timestamp at midnight, returns 0 if the date is not valid
+time_t parseDate(const char * date)
+{
+  if(strlen(date) != 8)
+  {
+    return 0;
+  }
+  for(uint8_t i = 0; i < 8; i++)
   {
-    dataType = F("application/javascript");
+    if(!isdigit(date[i]))
+    {
+      return 0;
+    }
   }
-  else if(path.endsWith(".png"))
+  
+  long value = strtol(date, NULL, 10);
+  tmElements_t elements = {0};
+  elements.Year = CalendarYrToTm(value / 10000);
+  elements.Month = value / 100 % 100;
+  elements.Day = value % 100;
+  if(elements.Month < 1 || elements.Month > 12 || elements.Day < 1 || elements.Day > 31)
   {
-    dataType = F("image/png");
+    return 0;
   }
-  else if(path.endsWith(".gif"))
+  return makeTime(elements);
+}
+
+// Aggregate the day log files between the "from" and "to" dates (YYYYMMDD, inclusive) per day or per hour ("group" argument)
+// The metering loop waits until the whole range is sent, so at most RANGE_MAX_DAYS days are read per request
+// The last line tells how many rows were read and how long each stage took
+void serverRange()
+{
+  char from[12], to[12], group[8];
+  serverArg("from", from, sizeof(from));
+  serverArg("group", group, sizeof(group));
+  time_t timeFrom = parseDate(from);
+  time_t timeTo = serverArg("to", to, sizeof(to)) ? parseDate(to) : timeFrom;
+  bool groupHour = strcmp(group, "hour") == 0;
+  
+  if(!timeFrom || !timeTo || timeTo < timeFrom || timeTo - timeFrom >= RANGE_MAX_DAYS * SECS_PER_DAY)
   {
-    dataType = F("image/gif");
+    server.send(400, F("text/plain"), F("Bad range"));
+    return;
   }
-  else if(path.endsWith(".jpg"))
+  
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("text/plain"), "");
+  server.sendContent(groupHour ? F("Timestamp,Power [Wh]\n") : F("Date,Power [Wh]\n"));
+  
+  uint32_t rowsScanned = 0;
+  uint32_t timeScan = 0;
+  uint32_t timeSend = 0;
+  uint32_t timeStage;
+  char buffer[64];
+  
+  for(time_t timeDay = timeFrom; timeDay <= timeTo; timeDay += SECS_PER_DAY)
   {
-    dataType = F("image/jpeg");
+    timeStage = micros();
+    uint16_t rows = readDay(timeDay, series);
+    rowsScanned += rows;
+    timeScan += micros() - timeStage;
+    
+    // Days without data are skipped
+    if(!rows)
+    {
+      continue;
+    }
+    
+    timeStage = micros();
+    if(groupHour)
+    {
+      uint32_t hourTotals[24];
+      seriesHourly(series, hourTotals);
+      for(uint8_t hours = 0; hours < 24; hours++)
+      {
+        sprintf(buffer, "%04d-%02d-%02dT%02d:00Z,%u\n", year(timeDay), month(timeDay), day(timeDay), hours, hourTotals[hours]);
+        server.sendContent(buffer);
+      }
+    }
+    else
+    {
+      sprintf(buffer, "%04d-%02d-%02d,%u\n", year(timeDay), month(timeDay), day(timeDay), seriesSum(series, MINUTES_PER_DAY));
+      server.sendContent(buffer);
+    }
+    timeSend += micros() - timeStage;
+    
+    // Let the Wi-Fi stack run between the days
+    yield();
   }
-  else if(path.endsWith(".ico"))
+  
+  snprintf(buffer, sizeof(buffer), "# %u rows, %ums scan, %ums send\n", rowsScanned, timeScan / 1000, timeSend / 1000);
+  server.sendContent(buffer);
+}
+
+void returnOK()
+{
+  server.sendHeader(F("Connection"), F("close"));
+  server.send(200, F("text/plain"), F("OK"));
+}
+
+void returnFail(const char * msg)
+{
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%s\r\n", msg);
+  server.sendHeader(F("Connection"), F("close"));
+  server.send(500, F("text/plain"), buffer);
+}
+
+bool loadFromSdCard(const char * uri)
+{
+  if(!basicAuthentication())
   {
-    dataType = F("image/x-icon");
+    return false;
   }
-  /*else if(path.endsWith(".xml"))
+  
+  // Leave room to add "/index.htm"
+  char path[SERVER_PATH_LENGTH];
+  size_t length = strlen(uri);
+  if(length == 0 || length >= sizeof(path) - 10)
   {
-    dataType = F("text/xml");
+    return false;
   }
-  else if(path.endsWith(".pdf"))
+  strcpy(path, uri);
+
+  // In case the user requests / or /*/ load the index.htm file by default
+  if(path[length - 1] == '/')
   {
-    dataType = F("application/pdf");
+    strcat(path, "index.htm");
   }
-  else if(path.endsWith(".zip"))
+
+  // Define the data type of the returned data from the file extention, .src files are sent as plain text
+  const char * dataType = mimeType(path);
+  char * extension = strrchr(path, '.');
+  if(extension != NULL && strcmp(extension, ".src") == 0)
   {
-    dataType = F("application/zip");
-  }*/
+    *extension = 0;
+  }
 
   // Try to find the file on the SD card
-  File dataFile = SD.open(path.c_str());
+  File dataFile = SD.open(path);
   if(dataFile.isDirectory())
   {
-    path += F("/index.htm");
-    dataType = F("text/html");
-    dataFile = SD.open(path.c_str());
+    dataFile.close();
+    strcat(path, "/index.htm");
+    dataType = "text/html";
+    dataFile = SD.open(path);
   }
 
   // File not found on the SD card
@@ -214,23 +645,224 @@ bool loadFromSdCard(String path)
   // Request was to download the file, so stream it
   if(server.hasArg("download"))
   {
-    dataType = F("application/octet-stream");
+    dataType = "application/octet-stream";
   }
   
-  DEBUGV("Streaming file: %s\n", (char *)path.c_str());
-
-  // Actually send the file, check that all data was sent
-  if(server.streamFile(dataFile, dataType) != dataFile.size())
+  DEBUGV("Streaming file: %s\n", path);
+  
+  server.sendHeader(F("Accept-Ranges"), F("bytes"));
+  
+  // Only a part of the file was asked for, like a resumed download or the end of a log file
+  uint32_t first, last;
+  char contentRange[40];
+  char range[40];
+  serverHeader("Range", range, sizeof(range));
+  switch(parseRange(range, dataFile.size(), &first, &last))
   {
-    DEBUGV("Sent less data than expected!\n");
+    case 206:
+      sprintf(contentRange, "bytes %u-%u/%u", first, last, dataFile.size());
+      server.sendHeader(F("Content-Range"), contentRange);
+      server.setContentLength(last - first + 1);
+      server.send(206, dataType, "");
+      if(!dataFile.seek(first) || streamFileRange(dataFile, last - first + 1) != last - first + 1)
+      {
+        DEBUGV("Sent less data than expected!\n");
+      }
+      break;
+    case 416:
+      sprintf(contentRange, "bytes */%u", dataFile.size());
+      server.sendHeader(F("Content-Range"), contentRange);
+      server.send(416, F("text/plain"), "");
+      break;
+    default:
+      // Actually send the file, check that all data was sent
+      server.setContentLength(dataFile.size());
+      server.send(200, dataType, "");
+      if(streamFileRange(dataFile, dataFile.size()) != dataFile.size())
+      {
+        DEBUGV("Sent less data than expected!\n");
+      }
   }
 
   dataFile.close();
   return true;
 }
 
+// Send the given number of bytes of a file from its current position, returns the number of bytes sent
+// The file is read in blocks of whole SD card sectors into two buffers: the network stack is only handed as much of
+// one block as it can take without waiting for the client, and the next block is read into the other buffer meanwhile
+uint32_t streamFileRange(File & dataFile, uint32_t length)
+{
+  WiFiClient client = server.client();
+  uint32_t counts[2] = {0, 0}; // Bytes in each buffer
+  uint8_t current = 0; // Buffer being sent
+  uint32_t offset = 0; // Bytes of the current buffer already sent
+  uint32_t sent = 0;
+  uint32_t loaded = 0; // Bytes read from the file
+  uint32_t timeStart = micros();
+  uint32_t timeProgress = millis();
+  
+  // The first block stops on a sector boundary so that the next ones are aligned, this matters for ranges
+  int count = dataFile.read(sectorBuffers[current], min((uint32_t)(STREAM_BLOCK_SIZE - dataFile.position() % SD_SECTOR_SIZE), length));
+  counts[current] = max(count, 0);
+  loaded = counts[current];
+  
+  while(offset < counts[current])
+  {
+    size_t space = client.availableForWrite();
+    if(space)
+    {
+      size_t written = client.write((const uint8_t *)sectorBuffers[current] + offset, min(space, (size_t)(counts[current] - offset)));
+      offset += written;
+      sent += written;
+      if(written)
+      {
+        timeProgress = millis();
+      }
+    }
+    
+    // Read the next block while the network stack is sending
+    if(!counts[current ^ 1] && loaded < length)
+    {
+      count = dataFile.read(sectorBuffers[current ^ 1], min((uint32_t)STREAM_BLOCK_SIZE, length - loaded));
+      counts[current ^ 1] = max(count, 0);
+      loaded += counts[current ^ 1];
+    }
+    
+    if(offset == counts[current])
+    {
+      // Go on with the other buffer, the loop ends if it is empty
+      counts[current] = 0;
+      current ^= 1;
+      offset = 0;
+    }
+    else if(!client.connected() || millis() - timeProgress > STREAM_TIMEOUT)
+    {
+      break;
+    }
+    
+    // Let the system tasks run, they send the data
+    yield();
+  }
+  
+  uint32_t duration = micros() - timeStart;
+  downloadStats.count++;
+  downloadStats.bytes += sent;
+  downloadStats.timeTotal += duration;
+  downloadStats.rateLast = duration ? (uint64_t)sent * 1000 / duration : 0;
+  DEBUGV("Sent %uB in %uus\n", sent, duration);
+  
+  return sent;
+}
+
+// Path of a file with the given name in the same directory as the file of the path, returns false if it does not fit
+bool uploadSiblingPath(char * buffer, const char * path, const char * name)
+{
+  const char * slash = strrchr(path, '/');
+  if(slash == NULL || slash - path + 1 + strlen(name) >= SERVER_PATH_LENGTH)
+  {
+    return false;
+  }
+  memcpy(buffer, path, slash - path + 1);
+  strcpy(buffer + (slash - path + 1), name);
+  return true;
+}
+
+// Drop the upload, the POST request is then answered with an error and the old file is kept
+void uploadFail(uint32_t received)
+{
+  if(uploadFile)
+  {
+    uploadFile.close();
+  }
+  if(uploadTempPath[0])
+  {
+    SD.remove(uploadTempPath);
+  }
+  uploadFailed = true;
+  logEvent(EVENT_EDIT_UPLOAD_FAILED, received);
+}
+
+// Put the complete upload in place of the old file
+// The path of the file is written to UPLOAD_JOURNAL first, then the old file is renamed to the backup, the upload
+// is renamed to the file and the backup is removed, so that uploadRecover() can finish the job after a reset
+bool uploadReplace()
+{
+  SD.remove(UPLOAD_JOURNAL);
+  File journal = SD.open(UPLOAD_JOURNAL, FILE_WRITE);
+  size_t length = strlen(uploadPath);
+  bool written = journal && journal.write((const uint8_t *)uploadPath, length) == length;
+  journal.close();
+  if(!written)
+  {
+    SD.remove(UPLOAD_JOURNAL);
+    return false;
+  }
+  
+  bool backup = SD.exists(uploadPath);
+  if(backup && ((SD.exists(uploadBackupPath) && !SD.remove(uploadBackupPath)) || !SD.rename(uploadPath, uploadBackupPath)))
+  {
+    SD.remove(UPLOAD_JOURNAL);
+    return false;
+  }
+  
+  if(!SD.rename(uploadTempPath, uploadPath))
+  {
+    // Put the old file back
+    if(backup)
+    {
+      SD.rename(uploadBackupPath, uploadPath);
+    }
+    SD.remove(UPLOAD_JOURNAL);
+    return false;
+  }
+  
+  if(backup)
+  {
+    SD.remove(uploadBackupPath);
+  }
+  SD.remove(UPLOAD_JOURNAL);
+  return true;
+}
+
+// Finish a replacement cut short by a reset, called once the SD card is available
+// The old file is put back if it was already moved to the backup, otherwise the complete upload takes its place
+void uploadRecover()
+{
+  File journal = SD.open(UPLOAD_JOURNAL);
+  if(!journal)
+  {
+    return;
+  }
+  int length = journal.read((uint8_t *)uploadPath, sizeof(uploadPath) - 1);
+  journal.close();
+  uploadPath[max(length, 0)] = 0;
+  
+  if(uploadSiblingPath(uploadTempPath, uploadPath, UPLOAD_TEMP_NAME) && uploadSiblingPath(uploadBackupPath, uploadPath, UPLOAD_BACKUP_NAME))
+  {
+    DEBUGV("Upload: recovering %s\n", uploadPath);
+    if(!SD.exists(uploadPath))
+    {
+      if(SD.exists(uploadBackupPath))
+      {
+        SD.rename(uploadBackupPath, uploadPath);
+      }
+      else if(SD.exists(uploadTempPath))
+      {
+        SD.rename(uploadTempPath, uploadPath);
+      }
+    }
+    SD.remove(uploadBackupPath);
+    SD.remove(uploadTempPath);
+  }
+  
+  SD.remove(UPLOAD_JOURNAL);
+}
+
 void handleFileUpload()
 {
+  setRequestType(REQUEST_EDIT);
+
   if(!basicAuthentication())
   {
     return;
@@ -244,52 +876,159 @@ void handleFileUpload()
   
   HTTPUpload& upload = server.upload();
   
+  // The upload goes to a temporary file in the same directory, which replaces the file only once it is complete
+  // The data is gathered in whole sectors so that the SD card is written a block at a time
   if(upload.status == UPLOAD_FILE_START)
   {
-    // Overwrite existing file
-    if(SD.exists((char *)upload.filename.c_str()))
+    if(uploadFile)
+    {
+      uploadFile.close();
+    }
+    uploadFailed = false;
+    uploadTempPath[0] = 0;
+    
+    if(!copyPath(uploadPath, upload.filename.c_str()) || !uploadSiblingPath(uploadTempPath, uploadPath, UPLOAD_TEMP_NAME) || !uploadSiblingPath(uploadBackupPath, uploadPath, UPLOAD_BACKUP_NAME))
     {
-      // Remove the existing file first
-      SD.remove((char *)upload.filename.c_str());
+      DEBUGV("Upload: bad file name\n");
+      uploadFail(0);
+      return;
     }
-    uploadFile = SD.open(upload.filename.c_str(), FILE_WRITE);
-    DEBUGV("Upload: START, filename: %s\n", (char *)upload.filename.c_str());
+    
+    SD.remove(uploadTempPath);
+    uploadFile = SD.open(uploadTempPath, FILE_WRITE);
+    if(!uploadFile)
+    {
+      uploadFail(0);
+      return;
+    }
+    uploadBuffered = 0;
+    uploadTimeStart = micros();
+    DEBUGV("Upload: START, filename: %s\n", uploadPath);
   }
   else if(upload.status == UPLOAD_FILE_WRITE)
   {
-    if(uploadFile)
+    if(!uploadFile)
     {
-      uploadFile.write(upload.buf, upload.currentSize);
+      return;
+    }
+    
+    const uint8_t * data = upload.buf;
+    size_t length = upload.currentSize;
+    while(length)
+    {
+      size_t count = min(length, sizeof(sectorBuffers[0]) - uploadBuffered);
+      memcpy(sectorBuffers[0] + uploadBuffered, data, count);
+      uploadBuffered += count;
+      data += count;
+      length -= count;
+      
+      if(uploadBuffered == sizeof(sectorBuffers[0]))
+      {
+        if(uploadFile.write(sectorBuffers[0], uploadBuffered) != uploadBuffered)
+        {
+          // Out of space or card error
+          uploadFail(upload.totalSize);
+          return;
+        }
+        uploadBuffered = 0;
+      }
     }
     DEBUGV("Upload: WRITE, Bytes: %d\n", upload.currentSize);
   }
   else if(upload.status == UPLOAD_FILE_END)
   {
-    if(uploadFile)
+    if(!uploadFile)
     {
-      uploadFile.close();
+      return;
     }
+    
+    bool complete = uploadFile.write(sectorBuffers[0], uploadBuffered) == uploadBuffered;
+    uploadFile.close();
+    
+    // Replace the old file only now, an interrupted upload leaves it untouched
+    if(!complete || !uploadReplace())
+    {
+      DEBUGV("Upload: could not replace %s\n", uploadPath);
+      uploadFail(upload.totalSize);
+      return;
+    }
+    
+    uint32_t duration = micros() - uploadTimeStart;
+    logEvent(EVENT_UPLOADED, upload.totalSize, duration ? (uint64_t)upload.totalSize * 1000 / duration : 0);
     DEBUGV("Upload: END, Size: %d\n", upload.totalSize);
   }
+  else if(upload.status == UPLOAD_FILE_ABORTED)
+  {
+    // The connection was lost, drop what was received
+    if(uploadFile)
+    {
+      uploadFail(upload.totalSize);
+    }
+    DEBUGV("Upload: ABORTED\n");
+  }
 }
 
-void deleteRecursive(String path)
+// Files and directories the firmware writes to cannot be deleted from the edit page
+// The log and archive directories and the event files are always in use, the day files only while they are written
+bool deleteInUse(const char * path)
 {
-  // This function is only called internally and does not need authentication
+  // The minute that just ended is logged in the file of the previous day right after midnight
+  char dayFile[24];
+  for(uint8_t i = 0; i < 2; i++)
+  {
+    dayFileName(dayFile, now() - i * 60);
+    if(pathIs(path, dayFile))
+    {
+      return true;
+    }
+  }
   
-  File file = SD.open((char *)path.c_str());
+  return pathIs(path, "/power") || pathIs(path, "/archive") || pathIs(path, "/events0.bin") || pathIs(path, "/events1.bin") ||
+    (archiveBusy() && (pathWithin(path, "/power") || pathWithin(path, "/archive")));
+}
+
+// Whether a file or directory is small enough to be deleted right away: a file or a directory without subdirectories
+// holding at most DELETE_SLICE_ENTRIES files, which costs about as much as one slice of the background deletion
+bool deleteIsSmall(const char * path)
+{
+  File dir = SD.open(path);
+  bool small = true;
+  if(dir.isDirectory())
+  {
+    for(uint8_t count = 0; small; count++)
+    {
+      File entry = dir.openNextFile();
+      if(!entry)
+      {
+        break;
+      }
+      small = !entry.isDirectory() && count < DELETE_SLICE_ENTRIES;
+      entry.close();
+    }
+  }
+  dir.close();
+  return small;
+}
+
+// Delete a file or a directory and everything in it, returns the number of files and directories removed
+// The paths of the entries are built in the path buffer itself, which holds "size" bytes, and it is restored on return
+// It runs until it is done, larger directories go through deleteStep()
+uint32_t deleteRecursive(char * path, size_t size)
+{
+  File file = SD.open(path);
   
-  DEBUGV("Deleting: %s\n", (char *)path.c_str());
+  DEBUGV("Deleting: %s\n", path);
   
   if(!file.isDirectory())
   {
     file.close();
-    SD.remove((char *)path.c_str());
-    return;
+    return SD.remove(path) ? 1 : 0;
   }
-
+  
   file.rewindDirectory();
   
+  uint32_t removed = 0;
+  size_t length = strlen(path);
   while(true)
   {
     File entry = file.openNextFile();
@@ -297,27 +1036,131 @@ void deleteRecursive(String path)
     {
       break;
     }
-    String entryPath = path + "/" + entry.name();
+    bool directory = entry.isDirectory();
+    size_t written = snprintf(path + length, size - length, "/%s", entry.name());
+    entry.close();
     
-    if(entry.isDirectory())
+    // Entries with a path too long for the buffer are left, so the directory will not be removed either
+    if(written < size - length)
     {
-      entry.close();
-      deleteRecursive(entryPath);
+      if(directory)
+      {
+        removed += deleteRecursive(path, size);
+      }
+      else if(SD.remove(path))
+      {
+        removed++;
+      }
     }
-    else
+    path[length] = 0;
+    yield();
+  }
+  
+  file.close();
+  if(SD.rmdir(path))
+  {
+    removed++;
+  }
+  return removed;
+}
+
+// Delete the directory in deletePath a few entries at a time, called from every loop()
+// The path of the directory being emptied is built in deletePath, deleteLengths keeps where to cut it to go back up a level
+// The directory is read from the start again after going back up, the emptied subdirectory is gone by then
+void deleteStep()
+{
+  if(deleteState != DELETE_RUNNING)
+  {
+    return;
+  }
+  
+  for(uint8_t i = 0; i < DELETE_SLICE_ENTRIES; i++)
+  {
+    if(!deleteDir)
     {
-      entry.close();
-      SD.remove((char *)entryPath.c_str());
+      deleteDir = SD.open(deletePath);
+      if(!deleteDir)
+      {
+        deleteFinish(DELETE_FAILED);
+        return;
+      }
     }
-    yield();
+    
+    File entry = deleteDir.openNextFile();
+    if(!entry)
+    {
+      // The directory is empty, remove it and go back to its parent
+      deleteDir.close();
+      if(!SD.rmdir(deletePath))
+      {
+        deleteFinish(DELETE_FAILED);
+        return;
+      }
+      deleteRemoved++;
+      
+      if(--deleteDepth == 0)
+      {
+        deleteFinish(DELETE_DONE);
+        return;
+      }
+      deletePath[deleteLengths[deleteDepth]] = 0;
+      continue;
+    }
+    
+    bool directory = entry.isDirectory();
+    size_t length = strlen(deletePath);
+    size_t written = snprintf(deletePath + length, sizeof(deletePath) - length, "/%s", entry.name());
+    entry.close();
+    
+    if(written >= sizeof(deletePath) - length || (directory && deleteDepth >= DELETE_DEPTH_MAX))
+    {
+      deletePath[length] = 0;
+      deleteFinish(DELETE_FAILED);
+      return;
+    }
+    
+    if(directory)
+    {
+      // Empty the subdirectory first
+      deleteDir.close();
+      deleteLengths[deleteDepth++] = length;
+      continue;
+    }
+    
+    if(!SD.remove(deletePath))
+    {
+      deleteFinish(DELETE_FAILED);
+      return;
+    }
+    deleteRemoved++;
+    deletePath[length] = 0;
   }
+}
 
-  SD.rmdir((char *)path.c_str());
-  file.close();
+void deleteFinish(DeleteState state)
+{
+  if(deleteDir)
+  {
+    deleteDir.close();
+  }
+  deleteState = state;
+  deleteDepth = 0;
+  logEvent(state == DELETE_DONE ? EVENT_DELETED : EVENT_DELETE_FAILED, deleteRemoved);
+}
+
+// Progress of the last deletion: state, path being deleted (where it stopped if it failed) and number of files and directories removed
+void serverDelete()
+{
+  static const char * deleteStateNames[] = {"idle", "running", "done", "failed"};
+  char buffer[SERVER_PATH_LENGTH + 48];
+  snprintf(buffer, sizeof(buffer), "State,Path,Removed\n%s,%s,%u\n", deleteStateNames[deleteState], deletePath, deleteRemoved);
+  server.send(200, F("text/plain"), buffer);
 }
 
 void handleDelete()
 {
+  setRequestType(REQUEST_EDIT);
+
   if(!basicAuthentication())
   {
     return;
@@ -327,19 +1170,54 @@ void handleDelete()
   {
     return returnFail("BAD ARGS");
   }
-  String path = server.arg(0);
   
-  if(path == "/" || !SD.exists((char *)path.c_str()))
+  // Only one directory is deleted at a time
+  if(deleteState == DELETE_RUNNING)
+  {
+    return returnFail("BUSY");
+  }
+  
+  char path[SERVER_PATH_LENGTH];
+  if(!copyPath(path, server.arg(0).c_str()) || strcmp(path, "/") == 0 || !SD.exists(path))
   {
     returnFail("BAD PATH");
     return;
   }
-  deleteRecursive(path);
-  returnOK();
+  
+  if(deleteInUse(path))
+  {
+    return returnFail("IN USE");
+  }
+  
+  // Files and small directories go right away
+  if(deleteIsSmall(path))
+  {
+    uint32_t removed = deleteRecursive(path, sizeof(path));
+    if(SD.exists(path))
+    {
+      logEvent(EVENT_DELETE_FAILED, removed);
+      return returnFail("DELETE FAILED");
+    }
+    logEvent(EVENT_DELETED, removed);
+    returnOK();
+    return;
+  }
+  
+  // A directory can hold many files, it is deleted in the background, follow it with /api?request=delete
+  DEBUGV("Deleting in the background: %s\n", path);
+  strcpy(deletePath, path);
+  deleteDepth = 1;
+  deleteRemoved = 0;
+  deleteState = DELETE_RUNNING;
+  
+  server.sendHeader(F("Connection"), F("close"));
+  server.send(202, F("text/plain"), F("Accepted"));
 }
 
 void handleCreate()
 {
+  setRequestType(REQUEST_EDIT);
+
   if(!basicAuthentication())
   {
     return;
@@ -350,18 +1228,18 @@ void handleCreate()
     return returnFail("BAD ARGS");
   }
   
-  String path = server.arg(0);
-  if(path == "/" || SD.exists((char *)path.c_str()))
+  char path[SERVER_PATH_LENGTH];
+  if(!copyPath(path, server.arg(0).c_str()) || strcmp(path, "/") == 0 || SD.exists(path))
   { 
     returnFail("BAD PATH");
     return;
   }
   
-  DEBUGV("Creating: %s\n", (char *)path.c_str());
+  DEBUGV("Creating: %s\n", path);
 
-  if(path.indexOf('.') > 0)
+  if(strchr(path + 1, '.') != NULL)
   {
-    File file = SD.open((char *)path.c_str(), FILE_WRITE);
+    File file = SD.open(path, FILE_WRITE);
     if(file)
     {
       file.write((const char *)0);
@@ -370,13 +1248,15 @@ void handleCreate()
   }
   else
   {
-    SD.mkdir((char *)path.c_str());
+    SD.mkdir(path);
   }
   returnOK();
 }
 
 void printDirectory()
 {
+  setRequestType(REQUEST_LIST);
+
   if(!basicAuthentication())
   {
     return;
@@ -387,18 +1267,21 @@ void printDirectory()
     return returnFail("BAD ARGS");
   }
   
-  String path = server.arg("dir");
+  char path[SERVER_PATH_LENGTH];
+  if(!copyPath(path, server.arg("dir").c_str()))
+  {
+    return returnFail("BAD PATH");
+  }
   
-  DEBUGV("Fetching list for: %s\n", (char *)path.c_str());
+  DEBUGV("Fetching list for: %s\n", path);
   
-  if(path != "/" && !SD.exists((char *)path.c_str()))
+  if(strcmp(path, "/") != 0 && !SD.exists(path))
   {
     return returnFail("BAD PATH");
   }
   
-  File dir = SD.open((char *)path.c_str());
+  File dir = SD.open(path);
   
-  path = String();
   if(!dir.isDirectory())
   {
     dir.close();
@@ -408,7 +1291,11 @@ void printDirectory()
   server.setContentLength(CONTENT_LENGTH_UNKNOWN);
   server.send(200, F("text/json"), "");
   
-  server.sendContent("[");
+  // The entries are sent in blocks, a block is sent before the entry that does not fit in it anymore
+  char block[512];
+  char entryText[160];
+  char name[128];
+  size_t length = sprintf(block, "[");
   for(unsigned int cnt = 0; true; ++cnt)
   {
     File entry = dir.openNextFile();
@@ -416,37 +1303,47 @@ void printDirectory()
     {
       break;
     }
-
-    String output;
-    if(cnt != 0)
+    
+    // Names too long for the buffer are cut, the entry always fits in its own buffer
+    jsonEscape(name, sizeof(name), entry.name());
+    int count = snprintf(
+      entryText,
+      sizeof(entryText),
+      "%s{\"type\":\"%s\",\"name\":\"%s\"}",
+      cnt != 0 ? "," : "",
+      entry.isDirectory() ? "dir" : "file",
+      name
+    );
+    entry.close();
+    size_t entryLength = constrain(count, 0, (int)sizeof(entryText) - 1);
+    
+    // Leave room for the closing "]"
+    if(length + entryLength + 2 > sizeof(block))
     {
-      output = ',';
+      server.sendContent(block);
+      length = 0;
     }
-
-    output += "{\"type\":\"";
-    output += (entry.isDirectory()) ? "dir" : "file";
-    output += "\",\"name\":\"";
-    output += entry.name();
-    output += "\"";
-    output += "}";
-    server.sendContent(output);
-    entry.close();
- }
- server.sendContent("]");
- dir.close();
+    memcpy(block + length, entryText, entryLength + 1);
+    length += entryLength;
+  }
+  strcpy(block + length, "]");
+  server.sendContent(block);
+  dir.close();
 }
 
 void handleNotFound()
 {
+  setRequestType(REQUEST_FILE);
+
   // Serve file from SD card if it has been found
-  if(loadFromSdCard(server.uri()))
+  if(loadFromSdCard(server.uri().c_str()))
   {
     return;
   }
 
   // loadFromSdCard() already does authentication
   
-  DEBUGV("File not found: %s\n", (char *)server.uri().c_str());
+  DEBUGV("File not found: %s\n", server.uri().c_str());
 
   // Otherwise reply with a standard 404 error
   server.send(404, F("text/plain"), F("Not found"));
@@ -29,6 +29,24 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+// State of the background deletion
+enum DeleteState {
+  DELETE_IDLE,
+  DELETE_RUNNING,
+  DELETE_DONE,
+  DELETE_FAILED
+};
+
+// Bytes and time spent sending files, to follow the download throughput
+struct DownloadStats {
+  uint32_t count;
+  uint64_t bytes;
+  uint64_t timeTotal; // [us]
+  uint32_t rateLast;  // Throughput of the last download [kB/s]
+};
+
+bool serverArg(const char *, char *, size_t);
+void serverHeader(const char *, char *, size_t);
 void serverApi();
 void initServer();
 void printDirectory();
@@ -38,8 +56,30 @@ void handleCreate();
 void returnOK();
 void handleNotFound();
 void handleFileUpload();
-bool loadFromSdCard(String);
+bool uploadSiblingPath(char *, const char *, const char *);
+void uploadFail(uint32_t);
+bool uploadReplace();
+void uploadRecover();
+bool loadFromSdCard(const char *);
+bool deleteInUse(const char *);
+bool deleteIsSmall(const char *);
+uint32_t deleteRecursive(char *, size_t);
+void deleteStep();
+void deleteFinish(DeleteState);
+void serverDelete();
+void returnFail(const char *);
+uint32_t streamFileRange(File &, uint32_t);
 bool basicAuthentication();
+void setRequestType(RequestType);
+void printRequestStats();
+void serverValues(long, bool);
+void sendValuesBinary(const uint16_t *, time_t, uint16_t, uint16_t);
+void sendValuesCsv(const uint16_t *, time_t, uint16_t, uint16_t);
+void serverEvents(uint32_t, bool);
+void serverMemory();
+void serverSummary();
+time_t parseDate(const char *);
+void serverRange();
 
 #endif
 
@@ -30,6 +30,9 @@
 
 #include <c_types.h>
 
+#define SEQUENCE_RTC_OFFSET 32 // RTC user memory block where the record sequence number is kept, the blocks below are used by the OTA updater
+#define SEQUENCE_RTC_MAGIC 0x53455131
+
 // Transition structure
 struct transition_t
 {
@@ -38,17 +41,61 @@ struct transition_t
     STATUS (*state_destination)(void);
 };
 
+// Minute or hour record kept while the broker cannot be reached
+struct log_record_t
+{
+    time_t timestamp;
+    uint32_t power;
+    uint32_t sequence;
+};
+
+// Ring buffer of records that could not be published, replayed when the broker is back
+struct log_buffer_t
+{
+    log_record_t * records;
+    uint16_t size;
+    uint16_t head;  // Index of the oldest record
+    uint16_t count; // Number of records waiting to be published
+    uint32_t lost;  // Records overwritten because the buffer was full
+};
+
+// Live value published via MQTT with a deadband and rate limiting
+struct publish_topic_t
+{
+    const char * topic;
+    const char * format;
+    uint32_t (*value)(void);
+    uint32_t interval;          // Minimum time between two publishes [ms]
+    uint32_t deadband;          // Smallest change worth publishing, absolute
+    uint32_t deadband_percent;  // Smallest change worth publishing, relative to the last value [%]
+    uint32_t heartbeat;         // Publish anyway after this time without change [ms]
+    uint32_t value_last;
+    uint32_t time_last;
+    bool published;
+};
+
 void interrupt_blink(void);
 
 void helper_set_status(const char *);
 void helper_button_short(void);
 void helper_button_long(void);
+uint32_t helper_power_now(void);
+uint32_t helper_power_today(void);
+void helper_memory_sample(void);
+void helper_mqtt_receive(char *, byte *, unsigned int);
+void helper_buffer_push(log_buffer_t *, const log_record_t *);
+void helper_buffer_replay(log_buffer_t *, const char *, size_t (*)(uint8_t *, const log_record_t *));
+uint32_t helper_sequence_next(void);
+size_t helper_format_minute(uint8_t *, const log_record_t *);
+size_t helper_format_hour(uint8_t *, const log_record_t *);
+bool helper_publish(const char *, const uint8_t *, unsigned int, bool);
 
 STATUS state_wifi_connect(void);
 STATUS state_ota(void);
 STATUS state_time_sync(void);
 STATUS state_mqtt(void);
 STATUS state_log(void);
+STATUS state_publish(void);
 STATUS state_button_check(void);
 STATUS state_display_update(void);
 
@@ -35,6 +35,7 @@
 #include "config.h"
 #include "IoTPowerMeterMQTT.h"
 #include "ESP_SSD1306.h"
+#include "payload.h"
 
 // Global instances
 ESP_SSD1306 display;
@@ -42,31 +43,56 @@ WiFiClient espClient;
 PubSubClient client(espClient);
 
 // Global variables
-static volatile uint16_t powerCounterMinute = 0;  // Counter used for logs
-static volatile uint16_t powerCounterNow    = 0;  // Counter used for display
-static volatile uint16_t powerCounterToday  = 0;  // Counter used for display
-static volatile uint16_t powerCounterHour   = 0;  // Counter used for upload
+static volatile uint32_t powerCounterMinute = 0;  // Counter used for logs [imp]
+static volatile uint32_t powerCounterToday  = 0;  // Counter used for display [imp]
+static volatile uint32_t blinkInterval      = 0;  // Time between the last two blinks [us]
+static uint16_t meterConstant = METER_IMPULSES_PER_KWH; // Blinks per kWh, can be changed at runtime via MQTT [imp/kWh]
+
+// Minute and hour records that could not be published, replayed when the broker is back
+static log_record_t minuteRecords[MQTT_BUFFER_MINUTES];
+static log_record_t hourRecords[MQTT_BUFFER_HOURS];
+static log_buffer_t minuteBuffer = {minuteRecords, MQTT_BUFFER_MINUTES, 0, 0, 0};
+static log_buffer_t hourBuffer = {hourRecords, MQTT_BUFFER_HOURS, 0, 0, 0};
+static uint32_t recordSequence = 0; // Sequence number of the next minute or hour record, see helper_sequence_next()
+
+// Memory state, see helper_memory_sample()
+static uint32_t memoryHeapFree    = 0;          // [B]
+static uint32_t memoryHeapFreeMin = 0xffffffff; // Lowest free heap seen since boot [B]
+static uint32_t memoryBlockMax    = 0;          // Largest block that can be allocated [B]
+static uint8_t memoryFragmentation = 0;         // [%]
+static uint32_t memoryStackFree   = 0;          // Stack that was never used since boot [B]
+static bool memoryLow = false;                  // The largest block is below MEMORY_BLOCK_WARNING
+
+// Topics are published under "<prefix>/" so that several meters can share a broker
+static char topicPrefix[24];
 
 // State transition matrix
 const transition_t state_transitions[] = {
   {state_wifi_connect,   OK,   state_ota},
-  {state_wifi_connect,   BUSY, state_display_update},
-  {state_wifi_connect,   FAIL, state_display_update},
+  {state_wifi_connect,   BUSY, state_log},
+  {state_wifi_connect,   FAIL, state_log},
   {state_ota,            OK,   state_time_sync},
   {state_time_sync,      OK,   state_mqtt},
-  {state_time_sync,      BUSY, state_display_update},
-  {state_time_sync,      FAIL, state_display_update},
+  {state_time_sync,      BUSY, state_log},
+  {state_time_sync,      FAIL, state_log},
   {state_mqtt,           OK,   state_log},
-  {state_mqtt,           BUSY, state_mqtt},
-  {state_log,            OK,   state_display_update},
+  {state_mqtt,           BUSY, state_log},
+  {state_log,            OK,   state_publish},
   {state_log,            BUSY, state_log},
   {state_log,            FAIL, state_display_update},
+  {state_publish,        OK,   state_display_update},
   {state_display_update, OK,   state_button_check},
   {state_button_check,   OK,   state_wifi_connect}
 };
 
 #define START_STATE state_wifi_connect
 
+// Live values published independently from the display, see state_publish()
+publish_topic_t publish_topics[] = {
+  {"powerCounterNow",   "%uW",  helper_power_now,   PUBLISH_NOW_INTERVAL,   PUBLISH_NOW_DEADBAND,   PUBLISH_NOW_DEADBAND_PERCENT,   PUBLISH_NOW_HEARTBEAT},
+  {"powerCounterToday", "%uWh", helper_power_today, PUBLISH_TODAY_INTERVAL, PUBLISH_TODAY_DEADBAND, PUBLISH_TODAY_DEADBAND_PERCENT, PUBLISH_TODAY_HEARTBEAT}
+};
+
 void setup(void)
 {
   // See config.h file to enable/disable debugging
@@ -82,8 +108,26 @@ void setup(void)
   // Define time syncing periodicity
   setSyncInterval(TIME_SYNC_PERIOD);
 
-  // Attach the interrupt that counts the used Watts
-  attachInterrupt(SENSOR_PIN, interrupt_blink, FALLING);
+  // Name the topics after the chip ID, which is unique even when all meters have the same configuration, or after the
+  // host name when it was made unique
+  #ifdef MQTT_TOPIC_HOST_NAME
+  strncpy(topicPrefix, hostName, sizeof(topicPrefix) - 1);
+  #else
+  sprintf(topicPrefix, "%08x", ESP.getChipId());
+  #endif
+
+  // Receive the meter constant from the broker
+  client.setCallback(helper_mqtt_receive);
+
+  // Continue the record numbering after a reset, it only starts over after a power loss
+  uint32_t sequenceSaved[2];
+  if(ESP.rtcUserMemoryRead(SEQUENCE_RTC_OFFSET, sequenceSaved, sizeof(sequenceSaved)) && sequenceSaved[0] == SEQUENCE_RTC_MAGIC)
+  {
+    recordSequence = sequenceSaved[1];
+  }
+
+  // Attach the interrupt that counts the used Watts, both edges are used to measure the LED pulse width
+  attachInterrupt(SENSOR_PIN, interrupt_blink, CHANGE);
   
   // Show the new firmware upload progress on the display in percent
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total)
@@ -106,6 +150,8 @@ void loop()
   static const size_t transitions = sizeof(state_transitions) / sizeof(state_transitions[0]);
   static size_t i;
 
+  helper_memory_sample();
+
   // Run the state machine
   for(i = 0; i < transitions; i++)
   {
@@ -271,13 +317,69 @@ STATUS ICACHE_FLASH_ATTR state_time_sync()
 
 STATUS ICACHE_FLASH_ATTR state_mqtt()
 {
+  // Time of the last connection attempt, backoff without jitter and time to wait before the next attempt
+  static uint32_t time_attempt = 0;
+  static uint32_t time_backoff = 0;
+  static uint32_t time_wait = 0;
+  // Disconnection statistics, published once the connection is back, the first connection counts from boot
+  static uint32_t time_disconnected = millis();
+  static uint32_t mqtt_attempts = 0;
+  static uint32_t mqtt_attempts_total = 0;
+  static uint32_t mqtt_disconnected_total = 0; // [s]
+  static bool mqtt_connected = false;
+
   if(!client.connected())
   {
-    if(client.connect(hostName))
+    if(mqtt_connected)
+    {
+      // Connection was just lost
+      mqtt_connected = false;
+      time_disconnected = millis();
+      time_backoff = 0;
+      time_wait = 0;
+    }
+
+    // Do not hammer a dead broker, each attempt blocks for up to the connection timeout
+    if(millis() - time_attempt < time_wait)
+    {
+      return BUSY;
+    }
+
+    helper_set_status("MQTT connect");
+    time_attempt = millis();
+    mqtt_attempts++;
+    mqtt_attempts_total++;
+
+    // Keep the blocking part of the connection short
+    espClient.setTimeout(TIME_MQTT_CONNECT);
+    client.setSocketTimeout(TIME_MQTT_CONNECT / 1000);
+
+    if(!client.connect(topicPrefix))
     {
-      // Subscribe to topics here
+      // Exponential backoff with up to 25% of random jitter so that meters do not reconnect all at the same time
+      // The jitter only applies to this wait, added to the backoff it would pile up from one attempt to the next
+      time_backoff = time_backoff ? min(time_backoff * 2, (uint32_t)TIME_MQTT_BACKOFF_MAX) : TIME_MQTT_BACKOFF_MIN;
+      time_wait = time_backoff + random(time_backoff / 4);
+      helper_set_status("MQTT error");
+      return BUSY;
     }
-    return BUSY;
+
+    // Subscribe to topics here
+    char topic[48];
+    sprintf(topic, "%s/powerMeterConstant", topicPrefix);
+    client.subscribe(topic);
+
+    // Report how long and how many attempts it took to reconnect
+    mqtt_disconnected_total += (millis() - time_disconnected) / 1000;
+    char data[40];
+    sprintf(data, "%u,%u,%u\n", mqtt_attempts, mqtt_attempts_total, mqtt_disconnected_total);
+    helper_publish("powerCounterMqtt", (uint8_t *)data, strlen(data), true);
+
+    helper_set_status("OK");
+    mqtt_connected = true;
+    mqtt_attempts = 0;
+    time_backoff = 0;
+    time_wait = 0;
   }
   client.loop();
   
@@ -286,27 +388,47 @@ STATUS ICACHE_FLASH_ATTR state_mqtt()
 
 STATUS ICACHE_FLASH_ATTR state_log()
 {
+  // Nothing can be logged before the time has been synchronised once
+  if(timeStatus() == timeNotSet)
+  {
+    return FAIL;
+  }
+
   // Start logging at the beginning of the next minute/hour
   static uint8_t currentHour = hour();
   static uint8_t currentMinute = minute();
-  static uint16_t powerCounterHourTemp = 0;
-  static uint16_t powerCounterMinuteTemp = 0;
-  static bool fileRemoved = false;
+  static uint32_t powerCounterHour = 0; // Power counter for the current hour [Wh]
+  static uint32_t powerCounterHourTemp = 0;
+  static uint32_t powerCounterMinuteTemp = 0;
+  static uint32_t powerRemainder = 0; // Blinks not worth a full Wh yet, carried over to the next minute [imp*Wh/kWh]
+  static uint32_t time_replay = 0; // Time of the last replayed batch
 
   if(minute() != currentMinute)
   {
     helper_set_status("Logging");
 
-    // TODO These two lines should be atomic, a blink might occur between them
+    // Copy and reset the counter without letting a blink slip in between
+    noInterrupts();
     powerCounterMinuteTemp = powerCounterMinute;
     powerCounterMinute = 0;
+    interrupts();
+
+    // Convert the blinks to Wh, the fraction of a Wh is kept for the next minute so nothing is lost over the day
+    uint64_t energy = (uint64_t)powerCounterMinuteTemp * 1000 + powerRemainder;
+    powerCounterMinuteTemp = energy / meterConstant;
+    powerRemainder = energy % meterConstant;
+    powerCounterHour += powerCounterMinuteTemp;
 
     // Remove 60 seconds as data is valid for the previous minute
     time_t timestamp = now() - 60;
-    uint16_t minuteOfTheDay = hour(timestamp) * 60 + minute(timestamp);
-    char data[16];
-    sprintf(data, "%d,%d\n", minuteOfTheDay, powerCounterMinuteTemp);
-    client.publish("powerCounterMinute", data);
+    log_record_t record = {timestamp, powerCounterMinuteTemp, helper_sequence_next()};
+    uint8_t data[20];
+    size_t length = helper_format_minute(data, &record);
+    // Keep the record for later if the broker cannot be reached
+    if(!client.connected() || !helper_publish("powerCounterMinute", data, length, false))
+    {
+      helper_buffer_push(&minuteBuffer, &record);
+    }
 
     currentMinute = minute();
 
@@ -317,10 +439,13 @@ STATUS ICACHE_FLASH_ATTR state_log()
       // Reset the counter for the next hour
       powerCounterHour = 0;
 
-      // Clear the buffer
-      memset(data, 0, sizeof(data));
-      sprintf(data, "%d,%d\n", hour(timestamp), powerCounterHourTemp);
-      client.publish("powerCounterHour", data);
+      // The record starts at the beginning of the hour that just ended
+      log_record_t hourRecord = {timestamp - timestamp % SECS_PER_HOUR, powerCounterHourTemp, helper_sequence_next()};
+      length = helper_format_hour(data, &hourRecord);
+      if(!client.connected() || !helper_publish("powerCounterHour", data, length, false))
+      {
+        helper_buffer_push(&hourBuffer, &hourRecord);
+      }
 
       currentHour = hour();
     }
@@ -328,6 +453,72 @@ STATUS ICACHE_FLASH_ATTR state_log()
     // Logging successful
     helper_set_status("OK");
   }
+  else if((minuteBuffer.count || hourBuffer.count) && client.connected() && millis() - time_replay > TIME_MQTT_REPLAY)
+  {
+    // Replay one batch of unsent records at a time so live publishes keep going through, the minutes first
+    if(minuteBuffer.count)
+    {
+      helper_buffer_replay(&minuteBuffer, "powerCounterMinute", helper_format_minute);
+    }
+    else
+    {
+      helper_buffer_replay(&hourBuffer, "powerCounterHour", helper_format_hour);
+    }
+    time_replay = millis();
+  }
+
+  return OK;
+}
+
+STATUS ICACHE_FLASH_ATTR state_publish()
+{
+  static const size_t topics = sizeof(publish_topics) / sizeof(publish_topics[0]);
+
+  if(!client.connected())
+  {
+    return OK;
+  }
+
+  for(size_t i = 0; i < topics; i++)
+  {
+    publish_topic_t * topic = &publish_topics[i];
+    uint32_t value = topic->value();
+    uint32_t elapsed = millis() - topic->time_last;
+
+    // Ignore changes smaller than the absolute or relative deadband, whichever is larger
+    uint32_t deadband = max(topic->deadband, topic->value_last * topic->deadband_percent / 100);
+    uint32_t change = value > topic->value_last ? value - topic->value_last : topic->value_last - value;
+
+    // Publish on a significant change no more often than the minimum interval, or anyway when the heartbeat is due
+    if(!topic->published
+      || elapsed >= topic->heartbeat
+      || (elapsed >= topic->interval && change > deadband))
+    {
+      char buffer[16];
+      sprintf(buffer, topic->format, value);
+      // Retained so that new subscribers get the latest value right away
+      if(helper_publish(topic->topic, (uint8_t *)buffer, strlen(buffer), true))
+      {
+        topic->value_last = value;
+        topic->time_last = millis();
+        topic->published = true;
+      }
+    }
+  }
+
+  // Memory state, right away when the largest block crossed the warning threshold
+  static uint32_t time_memory = 0;
+  static bool memory_low_published = false;
+  if(millis() - time_memory >= PUBLISH_MEMORY_INTERVAL || memoryLow != memory_low_published)
+  {
+    char buffer[48];
+    sprintf(buffer, "%u,%u,%u,%u,%u,%u", memoryHeapFree, memoryHeapFreeMin, memoryBlockMax, memoryFragmentation, memoryStackFree, memoryLow);
+    if(helper_publish("powerCounterMemory", (uint8_t *)buffer, strlen(buffer), true))
+    {
+      time_memory = millis();
+      memory_low_published = memoryLow;
+    }
+  }
 
   return OK;
 }
@@ -369,9 +560,10 @@ STATUS ICACHE_FLASH_ATTR state_display_update()
   // Initilise with invalid values so they are updated right away
   static uint8_t currentSecond = 0xff;
   static uint8_t currentDay = 0xff;
-  static uint16_t powerCounterNowTemp = 0;
-  static uint16_t powerCounterTodayTemp = 0;
+  static uint32_t powerCounterNowTemp = 0;
+  static uint32_t powerCounterTodayTemp = 0;
   static uint32_t heapTemp = 0;
+  static uint32_t blockTemp = 0;
   static uint32_t sizeTemp = 0;
   static IPAddress ip;
 
@@ -408,37 +600,32 @@ STATUS ICACHE_FLASH_ATTR state_display_update()
 
   // Auto-update current power counter if it has changed
 
-  if(powerCounterNow != powerCounterNowTemp)
+  if(helper_power_now() != powerCounterNowTemp)
   {
-    powerCounterNowTemp = powerCounterNow;
+    powerCounterNowTemp = helper_power_now();
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%dW", powerCounterNowTemp);
+    sprintf(buffer, "%uW", powerCounterNowTemp);
     display.clear(SCREEN_ROW_NOW, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_NOW, SCREEN_START_COLUMN);
-
-    // Publish the counter via MQTT
-    client.publish("powerCounterNow", buffer);
   }
 
   // Auto-update day power counter if it has changed
-  if(powerCounterToday != powerCounterTodayTemp)
+  if(helper_power_today() != powerCounterTodayTemp)
   {
-    powerCounterTodayTemp = powerCounterToday;
+    powerCounterTodayTemp = helper_power_today();
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%dWh", powerCounterTodayTemp);
+    sprintf(buffer, "%uWh", powerCounterTodayTemp);
     display.clear(SCREEN_ROW_TODAY, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_TODAY, SCREEN_START_COLUMN);
-    
-    // Publish the counter via MQTT
-    client.publish("powerCounterToday", buffer);
   }
 
-  // Auto-update the heap size information if it has changed
-  if(heapTemp != ESP.getFreeHeap())
+  // Auto-update the free heap, largest block and fragmentation if they have changed
+  if(heapTemp != memoryHeapFree || blockTemp != memoryBlockMax)
   {
-    heapTemp = ESP.getFreeHeap();
+    heapTemp = memoryHeapFree;
+    blockTemp = memoryBlockMax;
     memset(buffer, 0, sizeof(buffer));
-    sprintf(buffer, "%db", heapTemp);
+    snprintf(buffer, sizeof(buffer), "%u/%uk %u%%", heapTemp / 1024, blockTemp / 1024, memoryFragmentation);
     display.clear(SCREEN_ROW_HEAP, SCREEN_START_COLUMN);
     display.sendStrXY(buffer, SCREEN_ROW_HEAP, SCREEN_START_COLUMN);
   }
@@ -449,13 +636,165 @@ STATUS ICACHE_FLASH_ATTR state_display_update()
 void ICACHE_FLASH_ATTR helper_button_short()
 {
   helper_set_status("Short press");
-  client.publish("powerCounterButton", "button press short");
+  helper_publish("powerCounterButton", (uint8_t *)"button press short", 18, false);
 }
 
 void ICACHE_FLASH_ATTR helper_button_long()
 {
   helper_set_status("Long press");
-  client.publish("powerCounterButton", "button press long");
+  helper_publish("powerCounterButton", (uint8_t *)"button press long", 17, false);
+}
+
+// Instant power usage evaluated from the time between the last two blinks [W]
+uint32_t ICACHE_FLASH_ATTR helper_power_now()
+{
+  uint32_t interval = blinkInterval;
+
+  // Avoid dividing by zero (crashes the program otherwise)
+  if(interval == 0)
+  {
+    return 0;
+  }
+
+  // 60 seconds * 60 minutes * 1000 milliseconds * 1000 microseconds = h, 1000 Wh = kWh
+  return 3600000000000ULL / ((uint64_t)interval * meterConstant);
+}
+
+// Power used since midnight [Wh]
+uint32_t ICACHE_FLASH_ATTR helper_power_today()
+{
+  return (uint64_t)powerCounterToday * 1000 / meterConstant;
+}
+
+// Called on every loop, the free heap is cheap to read and is followed closely, the rest is sampled every MEMORY_SAMPLE_PERIOD
+void ICACHE_FLASH_ATTR helper_memory_sample()
+{
+  static uint32_t time_sample = 0;
+
+  memoryHeapFree = ESP.getFreeHeap();
+  memoryHeapFreeMin = min(memoryHeapFreeMin, memoryHeapFree);
+
+  if(millis() - time_sample < MEMORY_SAMPLE_PERIOD && time_sample != 0)
+  {
+    return;
+  }
+  time_sample = millis();
+
+  memoryBlockMax = ESP.getMaxFreeBlockSize();
+  memoryFragmentation = ESP.getHeapFragmentation();
+  memoryStackFree = ESP.getFreeContStack();
+
+  // The block has to grow back by an eighth over the threshold before it is considered fine again
+  if(!memoryLow && memoryBlockMax < MEMORY_BLOCK_WARNING)
+  {
+    memoryLow = true;
+  }
+  else if(memoryLow && memoryBlockMax > MEMORY_BLOCK_WARNING + MEMORY_BLOCK_WARNING / 8)
+  {
+    memoryLow = false;
+  }
+}
+
+// Handle messages from subscribed topics
+void ICACHE_FLASH_ATTR helper_mqtt_receive(char * topic, byte * payload, unsigned int length)
+{
+  // Only the last part of the topic matters, the prefix is the one of this meter
+  const char * name = strrchr(topic, '/');
+  name = name ? name + 1 : topic;
+
+  if(strcmp(name, "powerMeterConstant") == 0)
+  {
+    // Payload is the number of blinks per kWh in ASCII, it is not null terminated
+    char buffer[8] = {0};
+    memcpy(buffer, payload, min(length, (unsigned int)sizeof(buffer) - 1));
+    long constant = atol(buffer);
+    if(constant > 0 && constant <= 0xffff)
+    {
+      meterConstant = constant;
+    }
+  }
+}
+
+// Save a record to a ring buffer, the oldest record is dropped when it is full
+void ICACHE_FLASH_ATTR helper_buffer_push(log_buffer_t * buffer, const log_record_t * record)
+{
+  if(buffer->count == buffer->size)
+  {
+    buffer->head = (buffer->head + 1) % buffer->size;
+    buffer->count--;
+    buffer->lost++;
+  }
+
+  buffer->records[(buffer->head + buffer->count) % buffer->size] = *record;
+  buffer->count++;
+}
+
+// Publish as many buffered records as fit in one MQTT packet to "<prefix>/<topic>", records are simply put one after the other
+void ICACHE_FLASH_ATTR helper_buffer_replay(log_buffer_t * buffer, const char * topic, size_t (*format)(uint8_t *, const log_record_t *))
+{
+  // The packet also holds the fixed header, the topic length and the topic itself
+  uint8_t payload[MQTT_MAX_PACKET_SIZE];
+  size_t payloadMax = MQTT_MAX_PACKET_SIZE - 5 - 2 - strlen(topicPrefix) - 1 - strlen(topic);
+  size_t length = 0;
+  uint16_t records = 0;
+
+  while(records < buffer->count)
+  {
+    uint8_t data[20];
+    size_t dataLength = format(data, &buffer->records[(buffer->head + records) % buffer->size]);
+    if(length + dataLength > payloadMax)
+    {
+      break;
+    }
+    memcpy(payload + length, data, dataLength);
+    length += dataLength;
+    records++;
+  }
+
+  // Only drop the records once the broker has accepted them
+  if(records && helper_publish(topic, payload, length, false))
+  {
+    buffer->head = (buffer->head + records) % buffer->size;
+    buffer->count -= records;
+  }
+}
+
+// Sequence number for a new record, the next one is saved in RTC memory which survives resets but not power losses
+uint32_t ICACHE_FLASH_ATTR helper_sequence_next()
+{
+  uint32_t sequenceSaved[2] = {SEQUENCE_RTC_MAGIC, recordSequence + 1};
+  ESP.rtcUserMemoryWrite(SEQUENCE_RTC_OFFSET, sequenceSaved, sizeof(sequenceSaved));
+  return recordSequence++;
+}
+
+// Write a minute record as "<minute of the day>,<Wh>\n" or in the binary format of payload.h, returns the length
+size_t ICACHE_FLASH_ATTR helper_format_minute(uint8_t * buffer, const log_record_t * record)
+{
+  #ifdef MQTT_BINARY_PAYLOAD
+  payload_record_t payload = {record->sequence, (uint32_t)(record->timestamp / 60), record->power};
+  return payload_encode(buffer, &payload);
+  #else
+  return sprintf((char *)buffer, "%d,%u\n", hour(record->timestamp) * 60 + minute(record->timestamp), record->power);
+  #endif
+}
+
+// Write an hour record as "<hour>,<Wh>\n" or in the binary format of payload.h, returns the length
+size_t ICACHE_FLASH_ATTR helper_format_hour(uint8_t * buffer, const log_record_t * record)
+{
+  #ifdef MQTT_BINARY_PAYLOAD
+  payload_record_t payload = {record->sequence, (uint32_t)(record->timestamp / 60), record->power};
+  return payload_encode(buffer, &payload);
+  #else
+  return sprintf((char *)buffer, "%d,%u\n", hour(record->timestamp), record->power);
+  #endif
+}
+
+// Publish to "<prefix>/<name>"
+bool ICACHE_FLASH_ATTR helper_publish(const char * name, const uint8_t * payload, unsigned int length, bool retained)
+{
+  char topic[48];
+  snprintf(topic, sizeof(topic), "%s/%s", topicPrefix, name);
+  return client.publish(topic, payload, length, retained);
 }
 
 // Show the current action in the STAT field on the screen
@@ -465,31 +804,90 @@ void ICACHE_FLASH_ATTR helper_set_status(const char * status)
   display.sendStrXY(status, SCREEN_ROW_STAT, SCREEN_START_COLUMN);
 }
 
-// Blink interrupt, called every time the LED blinks
-void ICACHE_FLASH_ATTR interrupt_blink()
+// Blink interrupt, called on both edges of every LED blink
+// Interrupt handlers must be in RAM, the flash cache may be busy when they are called
+void ICACHE_RAM_ATTR interrupt_blink()
 {
-  static uint32_t timeBlinkLast = 0;
-  static uint32_t timeBlinkCurrent = 0;
+  static uint32_t timeBlinkLast = 0;        // Time of the last accepted blink [us]
+  static uint32_t timeBlinkLastMillis = 0;  // Same, but in milliseconds for long intervals [ms]
+  static uint32_t timePulseEnd = 0;         // Time the LED turned off after the last accepted blink [us]
+  static uint32_t timeOffLast = 0;          // Time of the last rising edge, bounces included [us]
+  static uint32_t pulseWidthAverage = 0;    // Average time the LED stays on [us]
+  static uint8_t pulseWidthCount = 0;       // Pulse widths averaged so far, up to TIME_DEBOUNCE_SAMPLES
+  static uint32_t intervalAverage = 0;      // Average time between two accepted blinks, see TIME_DEBOUNCE_INTERVAL_DIVIDER [us]
+  static uint32_t timeDebounce = TIME_DEBOUNCE_MAX * 1000UL; // Current debounce window [us]
+  static bool pulseActive = false;          // An accepted blink is waiting for its pulse width to be averaged
+  static bool pulseEnded = false;           // The LED turned off since the last accepted blink
+
+  uint32_t timeBlinkCurrent = micros();
+
+  // Rising edge, the LED has turned off
+  // A bounce at the start of the pulse turns the LED off for a moment too, so the pulse ends at the last rising edge
+  // inside the debounce window, or at the first one when the pulse is longer than the window
+  if(digitalRead(SENSOR_PIN) == HIGH)
+  {
+    timeOffLast = timeBlinkCurrent;
+    if(pulseActive && (!pulseEnded || timeBlinkCurrent - timeBlinkLast < timeDebounce))
+    {
+      timePulseEnd = timeBlinkCurrent;
+      pulseEnded = true;
+    }
+    return;
+  }
+
+  // This is micros() rollover safe as (micros() - timeBlinkLast) is never negative
+  uint32_t interval = timeBlinkCurrent - timeBlinkLast;
+
+  // micros() rolls over after 71 minutes, use millis() for very long intervals (very low power)
+  // This must come first, after a rollover the micros() interval can be anything, even shorter than the debounce window
+  uint32_t intervalMillis = millis() - timeBlinkLastMillis;
+  if(intervalMillis > 60000UL)
+  {
+    interval = intervalMillis < 0xffffffffUL / 1000 ? intervalMillis * 1000 : 0xffffffffUL;
+  }
 
   // Debounce routine, because sometimes one LED blink gets detected multiple times
-  // This is millis() rollover safe as (millis() - timeBlinkCurrent) is never negative
-  if((uint32_t)(millis() - timeBlinkLast) < TIME_DEBOUNCE)
+  // Every edge inside the window learnt from the pulse widths is a bounce. Up to a fraction of the average interval,
+  // an edge that comes right after the LED turned off is one too: this holds when bounces at the start of the pulses
+  // made them look shorter than they are, while after a sudden load increase the LED still stays off between blinks
+  bool offShort = timeBlinkCurrent - timeOffLast < TIME_DEBOUNCE_MARGIN * 1000UL;
+  if(interval < timeDebounce || (offShort && interval < intervalAverage / TIME_DEBOUNCE_INTERVAL_DIVIDER))
   {
-    // Do not accept blinks more often than TIME_DEBOUNCE (milliseconds)
     return;
   }
 
+  // The pulse of the previous blink is over, average its width
+  // Plain mean of the first samples, then an exponential moving average with a weight of 1/TIME_DEBOUNCE_SAMPLES
+  if(pulseActive && pulseEnded)
+  {
+    uint32_t width = timePulseEnd - timeBlinkLast;
+    if(pulseWidthCount < TIME_DEBOUNCE_SAMPLES)
+    {
+      pulseWidthCount++;
+    }
+    pulseWidthAverage = pulseWidthAverage - pulseWidthAverage / pulseWidthCount + width / pulseWidthCount;
+  }
+
+  timeBlinkLast = timeBlinkCurrent;
+  timeBlinkLastMillis = millis();
+  pulseActive = true;
+  pulseEnded = false;
+
   // Update the power counters
   powerCounterMinute++;
-  powerCounterHour++;
   powerCounterToday++;
 
-  // Avoid dividing by zero (crashes the program otherwise)
-  timeBlinkCurrent = millis();
-  if(timeBlinkCurrent != timeBlinkLast)
+  // The instant power is evaluated from the interval when it is read, keep the division out of the interrupt
+  blinkInterval = interval;
+
+  // Exponential moving average of the intervals with a weight of 1/8 for the new sample
+  intervalAverage = intervalAverage ? intervalAverage - intervalAverage / 8 + interval / 8 : interval;
+
+  // Adapt the debounce window to the observed blinks once enough pulse widths are known: the typical pulse plus a
+  // margin, the interval is not used so that a sudden load increase is not filtered out
+  if(pulseWidthCount >= TIME_DEBOUNCE_SAMPLES)
   {
-    // Evaluate the current power consumption 60 seconds * 60 minutes * 1000 milliseconds = h
-    powerCounterNow = 60 * 60 * 1000 / (timeBlinkCurrent - timeBlinkLast);
+    timeDebounce = pulseWidthAverage + TIME_DEBOUNCE_MARGIN * 1000UL;
+    timeDebounce = constrain(timeDebounce, TIME_DEBOUNCE_MIN * 1000UL, TIME_DEBOUNCE_MAX * 1000UL);
   }
-  timeBlinkLast = timeBlinkCurrent;
 }
@@ -42,6 +42,10 @@
 #define PIN_SDA 4
 #define PIN_SCL 2
 
+// Meter constant printed on the power meter, number of LED blinks per kWh (1000imp/kWh means 1 blink = 1Wh)
+// This is only the default value, publish a retained message to the "powerMeterConstant" topic to change it
+#define METER_IMPULSES_PER_KWH 1000
+
 // How often the internal time is synchronised with the NTP server
 #define TIME_SYNC_PERIOD 12*60*60 // [s]
 // NTP server from which to fetch the time
@@ -55,13 +59,38 @@ static const char * wifi_password = "...";
 static const char * mqtt_server = "192.168.1.3";
 static const unsigned int mqtt_port = 1883;
 static const char * hostName = "IoTPowerMeter";
+// Live values are published when they change by more than the absolute or the relative deadband (whichever is larger),
+// no more often than the interval, and at least once every heartbeat [ms]
+#define PUBLISH_NOW_INTERVAL 5000
+#define PUBLISH_NOW_DEADBAND 10 // [W]
+#define PUBLISH_NOW_DEADBAND_PERCENT 5
+#define PUBLISH_NOW_HEARTBEAT 60000
+#define PUBLISH_TODAY_INTERVAL 10000
+#define PUBLISH_TODAY_DEADBAND 10 // [Wh]
+#define PUBLISH_TODAY_DEADBAND_PERCENT 0
+#define PUBLISH_TODAY_HEARTBEAT 300000
+#define PUBLISH_MEMORY_INTERVAL 60000 // Time in milliseconds between two publishes of the memory state
+#define MQTT_BUFFER_MINUTES 360 // Number of minute records kept in memory while the broker cannot be reached (12 bytes each)
+#define MQTT_BUFFER_HOURS 24 // Number of hour records kept in memory while the broker cannot be reached (12 bytes each)
+//#define MQTT_TOPIC_HOST_NAME // Uncomment to prefix the topics with the host name instead of the chip ID, only when every meter on the broker has its own host name
+//#define MQTT_BINARY_PAYLOAD // Uncomment to publish minute and hour records in the binary format of payload.h instead of text
 
 // Global constants, no magic numbers
 #define TIME_WIFI_CONNECT 5000 // Maximum waiting time in seconds for Wi-Fi connection
 #define TIME_SYNC_RESPONSE 3000 // Maximum time the system will wait for a response from the NTP server (milliseconds)
+#define TIME_MQTT_CONNECT 2000 // Maximum time in milliseconds a connection attempt to the MQTT broker may block
+#define TIME_MQTT_BACKOFF_MIN 1000 // Waiting time in milliseconds after the first failed MQTT connection attempt, doubled after every failure
+#define TIME_MQTT_BACKOFF_MAX 60000 // Longest waiting time in milliseconds between two MQTT connection attempts
+#define TIME_MQTT_REPLAY 500 // Minimum time in milliseconds between two batches of buffered minute records sent to the broker
+#define MEMORY_SAMPLE_PERIOD 1000 // Time in milliseconds between two samples of the largest free block, the fragmentation and the stack
+#define MEMORY_BLOCK_WARNING 8192 // The memory state is published right away when the largest free block goes below this size in bytes
 #define TIME_BUTTON_PRESS_SHORT 100 // Time in milliseconds for the short button press routine to execute
 #define TIME_BUTTON_PRESS_LONG 2000 // Time in milliseconds for the long button press routine to execute
-#define TIME_DEBOUNCE 200 // Time in milliseconds during which LED blinks are ignored when one was just detected
+#define TIME_DEBOUNCE_MIN 5 // Shortest time in milliseconds during which LED blinks are ignored when one was just detected
+#define TIME_DEBOUNCE_MAX 200 // Longest time in milliseconds during which LED blinks are ignored when one was just detected, also used until TIME_DEBOUNCE_SAMPLES pulse widths are known
+#define TIME_DEBOUNCE_MARGIN 2 // Time in milliseconds added to the average LED pulse width to get the debounce window, and shortest time the LED must stay off between two blinks, see TIME_DEBOUNCE_INTERVAL_DIVIDER
+#define TIME_DEBOUNCE_SAMPLES 8 // Number of LED pulse widths averaged before the debounce window adapts to them
+#define TIME_DEBOUNCE_INTERVAL_DIVIDER 8 // Up to the average time between blinks divided by this, an LED blink that comes less than TIME_DEBOUNCE_MARGIN after the LED turned off is a bounce, bounces at the start of a pulse make it look shorter
 #define SCREEN_TITLE_COLUMN 0 // Horizontal position from which the title should be displayed on screen
 #define SCREEN_START_COLUMN 6 // Horizontal position from which the data should be displayed on screen
 #define SCREEN_ROW_STAT  0
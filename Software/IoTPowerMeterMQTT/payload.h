@@ -0,0 +1,102 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * File:    payload.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Compact binary payload for the minute and hour records published via MQTT
+// This file has no Arduino dependency so that it can be used as is to decode the messages on a server
+
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Increment when the record layout changes, decoders reject versions they do not know
+#define PAYLOAD_VERSION 1
+// Size of one encoded record, a message holds one or more records back to back
+#define PAYLOAD_RECORD_SIZE 13
+
+// Record layout, all fields little-endian:
+// [0]     version
+// [1..4]  sequence number, incremented for every record a device produces, starts over at 0 after a power loss
+// [5..8]  start of the period in minutes since 1970-01-01T00:00Z
+// [9..12] energy used during the period [Wh]
+struct payload_record_t
+{
+    uint32_t sequence;
+    uint32_t epoch_minute;
+    uint32_t power;
+};
+
+static inline void payload_put32(uint8_t * buffer, uint32_t value)
+{
+    buffer[0] = value;
+    buffer[1] = value >> 8;
+    buffer[2] = value >> 16;
+    buffer[3] = value >> 24;
+}
+
+static inline uint32_t payload_get32(const uint8_t * buffer)
+{
+    return buffer[0] | (uint32_t)buffer[1] << 8 | (uint32_t)buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+}
+
+// Write one record to the buffer, which must hold PAYLOAD_RECORD_SIZE bytes, returns the number of bytes written
+static inline size_t payload_encode(uint8_t * buffer, const payload_record_t * record)
+{
+    buffer[0] = PAYLOAD_VERSION;
+    payload_put32(buffer + 1, record->sequence);
+    payload_put32(buffer + 5, record->epoch_minute);
+    payload_put32(buffer + 9, record->power);
+    return PAYLOAD_RECORD_SIZE;
+}
+
+// Number of records in a message
+static inline size_t payload_count(size_t length)
+{
+    return length / PAYLOAD_RECORD_SIZE;
+}
+
+// Read the record at the given index of a message, returns false if it is missing or has an unknown version
+static inline bool payload_decode(const uint8_t * message, size_t length, size_t index, payload_record_t * record)
+{
+    // Check the index before pointing into the message, the pointer would be out of bounds otherwise
+    if(index >= payload_count(length))
+    {
+        return false;
+    }
+    const uint8_t * buffer = message + index * PAYLOAD_RECORD_SIZE;
+    if(buffer[0] != PAYLOAD_VERSION)
+    {
+        return false;
+    }
+    record->sequence = payload_get32(buffer + 1);
+    record->epoch_minute = payload_get32(buffer + 5);
+    record->power = payload_get32(buffer + 9);
+    return true;
+}
+
+#endif
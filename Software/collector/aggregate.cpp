@@ -0,0 +1,331 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    aggregate.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "aggregate.h"
+#include "store.h"
+
+static double milliseconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+AggregatePool::AggregatePool(unsigned count)
+{
+  count = count ? count : 1;
+  for(unsigned i = 0; i < count; i++)
+  {
+    workers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+  for(unsigned i = 0; i < count; i++)
+  {
+    threads.push_back(std::thread(&AggregatePool::loop, this, i));
+  }
+}
+
+AggregatePool::~AggregatePool()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for(size_t i = 0; i < threads.size(); i++)
+  {
+    threads[i].join();
+  }
+}
+
+// The next block of a worker from the back of its own queue, or the oldest one of another worker
+bool AggregatePool::take(unsigned index, std::pair<size_t, size_t> & block)
+{
+  for(unsigned i = 0; i < workers.size(); i++)
+  {
+    Worker * worker = workers[(index + i) % workers.size()].get();
+    std::lock_guard<std::mutex> guard(worker->lock);
+    if(worker->blocks.empty())
+    {
+      continue;
+    }
+    if(i == 0)
+    {
+      block = worker->blocks.back();
+      worker->blocks.pop_back();
+    }
+    else
+    {
+      block = worker->blocks.front();
+      worker->blocks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void AggregatePool::loop(unsigned index)
+{
+  uint64_t seen = 0;
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [&]{ return stopping || generation != seen; });
+      if(stopping)
+      {
+        return;
+      }
+      seen = generation;
+    }
+    
+    std::pair<size_t, size_t> block;
+    while(take(index, block))
+    {
+      for(size_t item = block.first; item < block.second; item++)
+      {
+        task(index, item);
+      }
+    }
+    
+    std::lock_guard<std::mutex> guard(lock);
+    if(--busy == 0)
+    {
+      done.notify_all();
+    }
+  }
+}
+
+// Call the task for every item from 0 to the count, on all the threads, and wait until they are all done
+// The task gets the index of the thread, so that it can add into the totals of that thread without locking
+void AggregatePool::run(size_t count, const std::function<void(unsigned, size_t)> & _task)
+{
+  task = _task;
+  // Neighbouring items go to the same thread, they are the days of the same meter in the same directory
+  size_t blocks = (count + AGGREGATE_BLOCK - 1) / AGGREGATE_BLOCK;
+  size_t perWorker = (blocks + workers.size() - 1) / workers.size();
+  for(size_t block = 0; block < blocks; block++)
+  {
+    Worker * worker = workers[block / perWorker].get();
+    std::lock_guard<std::mutex> guard(worker->lock);
+    worker->blocks.push_back(std::make_pair(block * AGGREGATE_BLOCK, std::min(count, (block + 1) * AGGREGATE_BLOCK)));
+  }
+  
+  std::unique_lock<std::mutex> guard(lock);
+  busy = workers.size();
+  generation++;
+  wake.notify_all();
+  done.wait(guard, [&]{ return busy == 0; });
+}
+
+// Add a day file into the 24 hour totals, the minutes of an hour when any was received, the hour value otherwise
+// Returns the number of minutes with a value, or 0 when the file is missing or is not that day
+uint32_t aggregateDay(const char * path, uint32_t day, uint64_t * hours)
+{
+  int file = open(path, O_RDONLY);
+  if(file < 0)
+  {
+    return 0;
+  }
+  StoreDay values;
+  ssize_t length = pread(file, &values, sizeof(values), 0);
+  close(file);
+  if(length != (ssize_t)sizeof(values) || values.magic != STORE_MAGIC || values.day != day)
+  {
+    return 0;
+  }
+  
+  uint32_t rows = 0;
+  for(uint8_t hour = 0; hour < STORE_HOURS; hour++)
+  {
+    const uint32_t * minutes = values.minutes + hour * 60;
+    uint64_t sum = 0;
+    uint32_t count = 0;
+    for(uint8_t minute = 0; minute < 60; minute++)
+    {
+      if(minutes[minute] != STORE_EMPTY)
+      {
+        sum += minutes[minute];
+        count++;
+      }
+    }
+    if(!count && values.hours[hour] != STORE_EMPTY)
+    {
+      sum = values.hours[hour];
+    }
+    hours[hour] += sum;
+    rows += count;
+  }
+  // A day with only hour values still counts as read
+  return rows ? rows : 1;
+}
+
+// Meters of the collector, the directories with a valid meter name, sorted
+static void listMeters(const char * directory, std::vector<std::string> & meters)
+{
+  DIR * dir = opendir(directory);
+  if(!dir)
+  {
+    return;
+  }
+  struct dirent * entry;
+  while((entry = readdir(dir)) != NULL)
+  {
+    if(!storeMeterName(entry->d_name, strlen(entry->d_name)))
+    {
+      continue;
+    }
+    std::string path = std::string(directory) + "/" + entry->d_name;
+    struct stat info;
+    if(stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+    {
+      meters.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(meters.begin(), meters.end());
+}
+
+// Run a query over the collector directory, the rows are sorted by key, or by power with the top meters
+// Only the keys for which a day file was read get a row, returns false when the query is not valid
+bool aggregateRun(const char * directory, const AggregateQuery & query, AggregatePool & pool, std::vector<AggregateRow> & rows,
+  std::vector<std::string> & meters, AggregateStats & stats)
+{
+  rows.clear();
+  meters.clear();
+  stats = AggregateStats();
+  if(query.to < query.from || query.to - query.from >= AGGREGATE_DAYS_MAX
+    || (query.meter.size() && !storeMeterName(query.meter.c_str(), query.meter.size())))
+  {
+    return false;
+  }
+  
+  std::chrono::steady_clock::time_point timeStage = std::chrono::steady_clock::now();
+  if(query.meter.size())
+  {
+    meters.push_back(query.meter);
+  }
+  else
+  {
+    listMeters(directory, meters);
+  }
+  stats.list = milliseconds(timeStage);
+  
+  uint32_t days = query.to - query.from + 1;
+  size_t keys = query.group == AGGREGATE_TOTAL ? 1 : query.group == AGGREGATE_DAY ? days : query.group == AGGREGATE_HOUR
+    ? days * STORE_HOURS : meters.size();
+  
+  // Totals of each thread, with the number of days read for each key
+  struct Partial
+  {
+    std::vector<uint64_t> power;
+    std::vector<uint32_t> read;
+    uint64_t days;
+    uint64_t rows;
+  };
+  std::vector<Partial> partials(pool.size());
+  for(size_t i = 0; i < partials.size(); i++)
+  {
+    partials[i].power.assign(keys, 0);
+    partials[i].read.assign(keys, 0);
+    partials[i].days = 0;
+    partials[i].rows = 0;
+  }
+  
+  timeStage = std::chrono::steady_clock::now();
+  pool.run(meters.size() * days, [&](unsigned worker, size_t item)
+  {
+    uint32_t meter = item / days;
+    uint32_t day = item % days;
+    char path[512];
+    storeFileName(path, sizeof(path), directory, meters[meter].c_str(), query.from + day);
+    uint64_t hours[STORE_HOURS] = {0};
+    uint32_t read = aggregateDay(path, query.from + day, hours);
+    if(!read)
+    {
+      return;
+    }
+    Partial & partial = partials[worker];
+    partial.days++;
+    partial.rows += read;
+    size_t key = query.group == AGGREGATE_DAY ? day : query.group == AGGREGATE_METER ? meter : 0;
+    if(query.group == AGGREGATE_HOUR)
+    {
+      for(uint8_t hour = 0; hour < STORE_HOURS; hour++)
+      {
+        partial.power[day * STORE_HOURS + hour] += hours[hour];
+        partial.read[day * STORE_HOURS + hour]++;
+      }
+      return;
+    }
+    for(uint8_t hour = 0; hour < STORE_HOURS; hour++)
+    {
+      partial.power[key] += hours[hour];
+    }
+    partial.read[key]++;
+  });
+  stats.scan = milliseconds(timeStage);
+  
+  timeStage = std::chrono::steady_clock::now();
+  for(size_t key = 0; key < keys; key++)
+  {
+    AggregateRow row = {(uint32_t)key, 0};
+    uint32_t read = 0;
+    for(size_t i = 0; i < partials.size(); i++)
+    {
+      row.power += partials[i].power[key];
+      read += partials[i].read[key];
+    }
+    if(read)
+    {
+      rows.push_back(row);
+    }
+  }
+  for(size_t i = 0; i < partials.size(); i++)
+  {
+    stats.days += partials[i].days;
+    stats.rows += partials[i].rows;
+  }
+  if(query.group == AGGREGATE_METER && query.top)
+  {
+    std::vector<AggregateRow>::iterator end = rows.begin() + std::min((size_t)query.top, rows.size());
+    std::partial_sort(rows.begin(), end, rows.end(), [](const AggregateRow & a, const AggregateRow & b)
+    {
+      return a.power > b.power || (a.power == b.power && a.key < b.key);
+    });
+    rows.erase(end, rows.end());
+  }
+  stats.merge = milliseconds(timeStage);
+  return true;
+}
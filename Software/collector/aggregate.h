@@ -0,0 +1,117 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    aggregate.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Aggregates over the day files of the collector, for reports across meters and days: totals per day, per hour or per
+// meter over a range of days. The meter-days are read by a pool of threads, each adding into its own totals, which are
+// merged at the end. The pool balances the work by stealing: every thread has its own queue of blocks of meter-days and
+// takes from the others once it is empty, so that a thread slowed down by the disk does not hold up the query.
+
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define AGGREGATE_DAYS_MAX 3660 // Longest range of a query, about ten years
+#define AGGREGATE_BLOCK 16 // Meter-days in a block of work
+
+enum AggregateGroup
+{
+  AGGREGATE_TOTAL, // One total over the whole range
+  AGGREGATE_DAY,
+  AGGREGATE_HOUR,
+  AGGREGATE_METER
+};
+
+struct AggregateQuery
+{
+  uint32_t from;      // First day, in days since 1970-01-01
+  uint32_t to;        // Last day, included
+  uint8_t group;
+  std::string meter;  // Only this meter, all of them when empty
+  uint32_t top;       // With AGGREGATE_METER: only the meters that used the most, all of them when 0
+};
+
+// What a query went through, and the time of each stage [ms]
+struct AggregateStats
+{
+  uint64_t days;      // Day files read
+  uint64_t rows;      // Minute slots with a value
+  double list;        // Listing the meters
+  double scan;        // Reading and adding the days, in parallel
+  double merge;       // Adding the totals of the threads and sorting
+};
+
+struct AggregateRow
+{
+  uint32_t key;       // Day, hour since the first day, or meter, after the group
+  uint64_t power;     // [Wh]
+};
+
+class AggregatePool
+{
+  private:
+  struct Worker
+  {
+    std::mutex lock;
+    std::deque<std::pair<size_t, size_t>> blocks;
+  };
+  
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  std::function<void(unsigned, size_t)> task;
+  uint64_t generation = 0;
+  unsigned busy = 0;
+  bool stopping = false;
+  
+  bool take(unsigned, std::pair<size_t, size_t> &);
+  void loop(unsigned);
+  
+  public:
+  AggregatePool(unsigned);
+  ~AggregatePool();
+  unsigned size() { return workers.size(); }
+  void run(size_t, const std::function<void(unsigned, size_t)> &);
+};
+
+uint32_t aggregateDay(const char *, uint32_t, uint64_t *);
+bool aggregateRun(const char *, const AggregateQuery &, AggregatePool &, std::vector<AggregateRow> &,
+  std::vector<std::string> &, AggregateStats &);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    bench_aggregate.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Speed of the aggregate queries in meter-days per second, on one thread and on all of them
+// The day files of a fleet of meters are written straight in the layout of store.h, with a few minutes missing and an
+// hour received only as an hour value. Every group is run on one thread and on the pool, and checked against the
+// values written.
+// bench_aggregate [--meters N] [--days D] [--threads T] [--dir DIR]
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "aggregate.h"
+#include "store.h"
+
+#define BENCH_FIRST_DAY 18262 // 2020-01-01
+#define BENCH_HOUR_ONLY 5 // Hour of every day with no minute, only the hour value
+
+static uint32_t energy(uint32_t meter, uint32_t day, uint32_t minute)
+{
+  return (meter * 7 + day * 3 + minute * 13) % 900;
+}
+
+// Minutes that were not received
+static bool missing(uint32_t meter, uint32_t minute)
+{
+  return minute / 60 == BENCH_HOUR_ONLY || (minute + meter) % 97 == 0;
+}
+
+static uint64_t hourEnergy(uint32_t meter, uint32_t day, uint32_t hour)
+{
+  uint64_t sum = 0;
+  for(uint32_t minute = hour * 60; minute < hour * 60 + 60; minute++)
+  {
+    sum += hour == BENCH_HOUR_ONLY || !missing(meter, minute) ? energy(meter, day, minute) : 0;
+  }
+  return sum;
+}
+
+static int removeEntry(const char * path, const struct stat *, int, struct FTW *)
+{
+  return remove(path);
+}
+
+static void meterName(char * name, size_t size, uint32_t meter)
+{
+  snprintf(name, size, "%08x", 0x00100000 + meter);
+}
+
+static bool writeDays(const char * directory, uint32_t meters, uint32_t days)
+{
+  StoreDay values;
+  char name[16];
+  char path[512];
+  for(uint32_t meter = 0; meter < meters; meter++)
+  {
+    meterName(name, sizeof(name), meter);
+    snprintf(path, sizeof(path), "%s/%s", directory, name);
+    mkdir(path, 0755);
+    for(uint32_t day = 0; day < days; day++)
+    {
+      memset(&values, 0, sizeof(values));
+      values.magic = STORE_MAGIC;
+      values.day = BENCH_FIRST_DAY + day;
+      for(uint32_t minute = 0; minute < STORE_MINUTES; minute++)
+      {
+        values.minutes[minute] = missing(meter, minute) ? STORE_EMPTY : energy(meter, day, minute);
+      }
+      for(uint32_t hour = 0; hour < STORE_HOURS; hour++)
+      {
+        values.hours[hour] = hourEnergy(meter, day, hour);
+      }
+      storeFileName(path, sizeof(path), directory, name, BENCH_FIRST_DAY + day);
+      FILE * file = fopen(path, "wb");
+      if(!file || fwrite(&values, sizeof(values), 1, file) != 1)
+      {
+        perror(path);
+        if(file)
+        {
+          fclose(file);
+        }
+        return false;
+      }
+      fclose(file);
+    }
+  }
+  return true;
+}
+
+// Totals the query should give, from the values written
+static void expected(const AggregateQuery & query, uint32_t meters, std::vector<uint64_t> & totals)
+{
+  uint32_t days = query.to - query.from + 1;
+  totals.assign(query.group == AGGREGATE_TOTAL ? 1 : query.group == AGGREGATE_DAY ? days : query.group == AGGREGATE_HOUR
+    ? days * STORE_HOURS : meters, 0);
+  for(uint32_t meter = 0; meter < meters; meter++)
+  {
+    for(uint32_t day = 0; day < days; day++)
+    {
+      for(uint32_t hour = 0; hour < STORE_HOURS; hour++)
+      {
+        uint64_t power = hourEnergy(meter, query.from - BENCH_FIRST_DAY + day, hour);
+        size_t key = query.group == AGGREGATE_DAY ? day : query.group == AGGREGATE_HOUR ? day * STORE_HOURS + hour
+          : query.group == AGGREGATE_METER ? meter : 0;
+        totals[key] += power;
+      }
+    }
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t meters = 1000;
+  uint32_t days = 7;
+  unsigned threads = std::thread::hardware_concurrency();
+  const char * directory = NULL;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--meters") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      meters = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--days") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      days = value > 0 && value <= AGGREGATE_DAYS_MAX ? value : 1;
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      threads = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+    {
+      directory = argv[++i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--meters N] [--days D] [--threads T] [--dir DIR]\n", argv[0]);
+      return 2;
+    }
+  }
+  threads = threads ? threads : 1;
+  
+  char temporary[] = "/tmp/aggregateXXXXXX";
+  if(!directory)
+  {
+    directory = mkdtemp(temporary);
+    if(!directory)
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+  }
+  if(!writeDays(directory, meters, days))
+  {
+    return 1;
+  }
+  
+  static const char * groups[] = {"total", "day", "hour", "meter"};
+  AggregatePool single(1);
+  AggregatePool pool(threads);
+  AggregatePool * pools[] = {&single, &pool};
+  std::vector<AggregateRow> rows;
+  std::vector<std::string> names;
+  std::vector<uint64_t> totals;
+  AggregateStats stats;
+  int failures = 0;
+  printf("%u meters, %u days, %.1f MB of day files\n", meters, days, (double)meters * days * sizeof(StoreDay) / 1e6);
+  printf("%-6s %8s %12s %10s %10s %10s %14s\n", "Group", "Threads", "Rows", "List ms", "Scan ms", "Merge ms", "Meter-days/s");
+  for(uint8_t group = AGGREGATE_TOTAL; group <= AGGREGATE_METER; group++)
+  {
+    AggregateQuery query;
+    query.from = BENCH_FIRST_DAY;
+    query.to = BENCH_FIRST_DAY + days - 1;
+    query.group = group;
+    query.top = 0;
+    expected(query, meters, totals);
+    
+    for(uint8_t p = 0; p < 2; p++)
+    {
+      if(!aggregateRun(directory, query, *pools[p], rows, names, stats) || rows.size() != totals.size())
+      {
+        printf("%s on %u threads: %zu rows, expected %zu\n", groups[group], pools[p]->size(), rows.size(), totals.size());
+        failures++;
+        continue;
+      }
+      for(size_t i = 0; i < rows.size(); i++)
+      {
+        if(rows[i].key != i || rows[i].power != totals[i])
+        {
+          printf("%s on %u threads: row %zu is %llu, expected %llu\n", groups[group], pools[p]->size(), i,
+            (unsigned long long)rows[i].power, (unsigned long long)totals[i]);
+          failures++;
+          break;
+        }
+      }
+      failures += stats.days != (uint64_t)meters * days;
+      printf("%-6s %8u %12llu %10.1f %10.1f %10.1f %14.0f\n", groups[group], pools[p]->size(), (unsigned long long)stats.rows,
+        stats.list, stats.scan, stats.merge, stats.days / (stats.list + stats.scan + stats.merge) * 1000);
+    }
+  }
+  
+  // The largest meters first, and one meter alone
+  AggregateQuery query;
+  query.from = BENCH_FIRST_DAY;
+  query.to = BENCH_FIRST_DAY + days - 1;
+  query.group = AGGREGATE_METER;
+  query.top = 3;
+  expected(query, meters, totals);
+  if(aggregateRun(directory, query, pool, rows, names, stats) && rows.size() == std::min(3U, meters))
+  {
+    for(size_t i = 0; i < rows.size(); i++)
+    {
+      for(size_t meter = 0; meter < totals.size(); meter++)
+      {
+        failures += totals[meter] > rows[i].power && (i == 0 || totals[meter] < rows[i - 1].power);
+      }
+      failures += totals[rows[i].key] != rows[i].power;
+    }
+  }
+  else
+  {
+    failures++;
+  }
+  char name[16];
+  meterName(name, sizeof(name), meters - 1);
+  query.meter = name;
+  query.top = 0;
+  failures += !aggregateRun(directory, query, pool, rows, names, stats) || rows.size() != 1 || rows[0].power != totals[meters - 1];
+  query.meter = "../etc";
+  failures += aggregateRun(directory, query, pool, rows, names, stats);
+  
+  if(directory == temporary)
+  {
+    nftw(temporary, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  printf("bench_aggregate: %s\n", failures ? "FAIL" : "OK");
+  return failures ? 1 : 0;
+}
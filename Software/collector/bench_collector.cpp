@@ -0,0 +1,240 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    bench_collector.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Ingest throughput of the collector in messages per second, for a fleet of simulated meters
+// Every meter publishes one minute message per minute and one hour message per hour, all the messages are encoded as
+// MQTT packets first and then fed to the reader and the store in blocks, like they come from the socket. The days of
+// a few meters are read back in place and checked.
+// bench_collector [--devices N] [--minutes M] [--cache DAYS] [--binary] [--dir DIR]
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <vector>
+
+#include "mqtt.h"
+#include "payload.h"
+#include "store.h"
+
+#define BENCH_BLOCK 4096 // Bytes read from the socket at a time
+#define BENCH_START 1577836800 // 2020-01-01T00:00Z
+
+struct Bench
+{
+  Store * store;
+  time_t received;
+  uint64_t packets;
+};
+
+static void handlePacket(void * context, uint8_t header, const uint8_t * body, size_t length)
+{
+  Bench * bench = (Bench *)context;
+  const char * topic;
+  const uint8_t * payload;
+  size_t topicLength, payloadLength;
+  if((header & 0xf0) == MQTT_PUBLISH && mqttPublishParse(header, body, length, &topic, &topicLength, &payload, &payloadLength))
+  {
+    bench->store->ingest(topic, topicLength, payload, payloadLength, bench->received);
+    bench->packets++;
+  }
+}
+
+static uint32_t energy(uint32_t device, uint32_t minute)
+{
+  return (device * 7 + minute * 13) % 900;
+}
+
+static double seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int removeEntry(const char * path, const struct stat *, int, struct FTW *)
+{
+  return remove(path);
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t devices = 5000;
+  uint32_t minutes = 60;
+  size_t cache = 8192;
+  bool binary = false;
+  const char * directory = NULL;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--devices") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      devices = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--minutes") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      minutes = value > 0 && value <= STORE_MINUTES ? value : STORE_MINUTES;
+    }
+    else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      cache = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--binary") == 0)
+    {
+      binary = true;
+    }
+    else if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+    {
+      directory = argv[++i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--devices N] [--minutes M] [--cache DAYS] [--binary] [--dir DIR]\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  char temporary[] = "/tmp/collectorXXXXXX";
+  if(!directory)
+  {
+    directory = mkdtemp(temporary);
+    if(!directory)
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+  }
+  
+  // Every minute of every meter as it would come from the broker, the hour is published with the last minute
+  std::vector<uint8_t> stream;
+  std::vector<size_t> minuteEnd;
+  uint8_t packet[128];
+  char topic[48];
+  char text[24];
+  uint8_t record[PAYLOAD_RECORD_SIZE];
+  uint32_t epochStart = BENCH_START / 60;
+  for(uint32_t minute = 0; minute < minutes; minute++)
+  {
+    for(uint32_t device = 0; device < devices; device++)
+    {
+      for(uint8_t hourly = 0; hourly < 2; hourly++)
+      {
+        if(hourly && minute % 60 != 59)
+        {
+          continue;
+        }
+        snprintf(topic, sizeof(topic), "%08x/%s", 0x00100000 + device, hourly ? "powerCounterHour" : "powerCounterMinute");
+        uint32_t value = hourly ? energy(device, minute) * 60 : energy(device, minute);
+        const uint8_t * payload;
+        size_t payloadLength;
+        if(binary)
+        {
+          payload_record_t fields = {minute, epochStart + (hourly ? minute - 59 : minute), value};
+          payloadLength = payload_encode(record, &fields);
+          payload = record;
+        }
+        else
+        {
+          payloadLength = snprintf(text, sizeof(text), "%u,%u\n", hourly ? minute / 60 : minute, value);
+          payload = (const uint8_t *)text;
+        }
+        size_t length = mqttPublish(packet, sizeof(packet), topic, payload, payloadLength, false);
+        stream.insert(stream.end(), packet, packet + length);
+      }
+    }
+    minuteEnd.push_back(stream.size());
+  }
+  
+  Store store(directory, cache);
+  MqttReader reader;
+  Bench bench = {&store, 0, 0};
+  double timeStart = seconds();
+  size_t position = 0;
+  for(uint32_t minute = 0; minute < minutes; minute++)
+  {
+    // The messages of a minute arrive during the next one
+    bench.received = BENCH_START + (minute + 1) * 60 + 1;
+    while(position < minuteEnd[minute])
+    {
+      size_t length = minuteEnd[minute] - position < BENCH_BLOCK ? minuteEnd[minute] - position : BENCH_BLOCK;
+      reader.feed(stream.data() + position, length, handlePacket, &bench);
+      position += length;
+    }
+  }
+  double duration = seconds() - timeStart;
+  
+  // Read back the first and the last meters
+  int failures = 0;
+  uint32_t day = BENCH_START / 86400;
+  for(uint32_t device = 0; device < devices; device += devices > 1 ? devices - 1 : 1)
+  {
+    char name[16];
+    snprintf(name, sizeof(name), "%08x", 0x00100000 + device);
+    const StoreDay * values = store.read(name, day);
+    for(uint32_t minute = 0; values && minute < minutes; minute++)
+    {
+      if(values->minutes[minute] != energy(device, minute))
+      {
+        printf("%s: minute %u is %u, expected %u\n", name, minute, values->minutes[minute], energy(device, minute));
+        failures++;
+        break;
+      }
+    }
+    if(!values || (minutes >= 60 && values->hours[0] != energy(device, 59) * 60))
+    {
+      printf("%s: day or hour missing\n", name);
+      failures++;
+    }
+  }
+  if(store.stats.messages != bench.packets || store.stats.rejected)
+  {
+    printf("%llu of %llu messages stored, %llu rejected\n", (unsigned long long)store.stats.messages,
+      (unsigned long long)bench.packets, (unsigned long long)store.stats.rejected);
+    failures++;
+  }
+  
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  printf("%u meters, %u minutes, %s payload, %zu days mapped at most\n", devices, minutes, binary ? "binary" : "text", cache);
+  printf("%llu messages in %.3f s: %.0f messages/s, %.1f MB/s\n", (unsigned long long)bench.packets, duration,
+    bench.packets / duration, stream.size() / duration / 1e6);
+  printf("%llu day files mapped, %llu unmapped, peak RSS %ld MB (%zu MB of packets)\n", (unsigned long long)store.stats.mapped,
+    (unsigned long long)store.stats.evicted, usage.ru_maxrss / 1024, stream.size() >> 20);
+  
+  if(directory == temporary)
+  {
+    nftw(temporary, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  }
+  printf("bench_collector: %s\n", failures ? "FAIL" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,373 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    broker.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "broker.h"
+
+// Topic against a subscription filter, '+' matches one level and '#' the rest of the topic
+bool brokerMatch(const char * topic, size_t length, const std::string & filter)
+{
+  size_t t = 0;
+  size_t f = 0;
+  while(f < filter.size())
+  {
+    if(filter[f] == '#')
+    {
+      return true;
+    }
+    if(filter[f] == '+')
+    {
+      while(t < length && topic[t] != '/')
+      {
+        t++;
+      }
+      f++;
+    }
+    else
+    {
+      if(t >= length || topic[t] != filter[f])
+      {
+        return false;
+      }
+      t++;
+      f++;
+    }
+    // "a/#" also matches "a"
+    if(t == length && f + 2 == filter.size() && filter[f] == '/' && filter[f + 1] == '#')
+    {
+      return true;
+    }
+  }
+  return t == length;
+}
+
+Broker::~Broker()
+{
+  stop();
+}
+
+// Listen on 127.0.0.1 at the given port, 0 for any free one, returns the port or 0 on failure
+uint16_t Broker::start(uint16_t port)
+{
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 1024) != 0
+    || getsockname(listener, (struct sockaddr *)&address, &length) != 0)
+  {
+    if(listener >= 0)
+    {
+      close(listener);
+      listener = -1;
+    }
+    return 0;
+  }
+  fcntl(listener, F_SETFL, O_NONBLOCK);
+  
+  running = true;
+  thread = std::thread(&Broker::run, this);
+  return ntohs(address.sin_port);
+}
+
+void Broker::stop()
+{
+  if(!running)
+  {
+    return;
+  }
+  running = false;
+  thread.join();
+  for(size_t i = 0; i < sessions.size(); i++)
+  {
+    close(sessions[i]->socket);
+  }
+  sessions.clear();
+  exact.clear();
+  wildcards.clear();
+  close(listener);
+  listener = -1;
+}
+
+// Blocking send, a subscriber that cannot keep up slows the whole broker down like a full TCP window would
+void Broker::send(Session * session, const uint8_t * data, size_t length)
+{
+  while(length && !session->closing)
+  {
+    ssize_t sent = ::send(session->socket, data, length, MSG_NOSIGNAL);
+    if(sent <= 0)
+    {
+      if(sent < 0 && (errno == EINTR || errno == EAGAIN))
+      {
+        struct pollfd descriptor = {session->socket, POLLOUT, 0};
+        poll(&descriptor, 1, 100);
+        continue;
+      }
+      session->closing = true;
+      return;
+    }
+    data += sent;
+    length -= sent;
+  }
+}
+
+void Broker::deliver(Session * session, size_t length)
+{
+  if(session->closing || session->delivered == message)
+  {
+    return;
+  }
+  session->delivered = message;
+  send(session, packet.data(), length);
+  delivered++;
+}
+
+// Send a message to the sessions with a matching filter, or only to the given one for retained messages
+void Broker::forward(Session * only, const char * topic, size_t topicLength, const uint8_t * payload, size_t length, bool retain)
+{
+  std::string name(topic, topicLength);
+  packet.resize(8 + topicLength + length);
+  size_t packetLength = mqttPublish(packet.data(), packet.size(), name.c_str(), payload, length, retain);
+  message++;
+  if(only)
+  {
+    deliver(only, packetLength);
+    return;
+  }
+  std::unordered_map<std::string, std::vector<Session *>>::iterator subscribers = exact.find(name);
+  if(subscribers != exact.end())
+  {
+    for(size_t i = 0; i < subscribers->second.size(); i++)
+    {
+      deliver(subscribers->second[i], packetLength);
+    }
+  }
+  for(size_t i = 0; i < wildcards.size(); i++)
+  {
+    if(brokerMatch(topic, topicLength, wildcards[i].first))
+    {
+      deliver(wildcards[i].second, packetLength);
+    }
+  }
+}
+
+// Forget the subscriptions of a closed session
+void Broker::remove(Session * session)
+{
+  for(std::unordered_map<std::string, std::vector<Session *>>::iterator filter = exact.begin(); filter != exact.end();)
+  {
+    std::vector<Session *> & subscribers = filter->second;
+    subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), session), subscribers.end());
+    filter = subscribers.empty() ? exact.erase(filter) : std::next(filter);
+  }
+  for(size_t i = 0; i < wildcards.size();)
+  {
+    if(wildcards[i].second == session)
+    {
+      wildcards.erase(wildcards.begin() + i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+}
+
+void Broker::handlePacket(void * context, uint8_t header, const uint8_t * body, size_t length)
+{
+  Session * session = (Session *)context;
+  Broker * broker = session->broker;
+  uint8_t reply[4];
+  switch(header & 0xf0)
+  {
+    case MQTT_CONNECT:
+      reply[0] = MQTT_CONNACK;
+      reply[1] = 2;
+      reply[2] = 0;
+      reply[3] = 0;
+      broker->send(session, reply, 4);
+      broker->connections++;
+      break;
+    case MQTT_SUBSCRIBE & 0xf0:
+    {
+      // Packet identifier, then filters each followed by the requested QoS, all granted with QoS 0
+      std::vector<uint8_t> ack;
+      ack.push_back(MQTT_SUBACK);
+      ack.push_back(0);
+      ack.push_back(length >= 2 ? body[0] : 0);
+      ack.push_back(length >= 2 ? body[1] : 0);
+      size_t position = 2;
+      while(position + 2 <= length)
+      {
+        size_t filterLength = body[position] << 8 | body[position + 1];
+        if(position + 2 + filterLength + 1 > length)
+        {
+          break;
+        }
+        std::string filter((const char *)body + position + 2, filterLength);
+        if(filter.find_first_of("+#") == std::string::npos)
+        {
+          broker->exact[filter].push_back(session);
+        }
+        else
+        {
+          broker->wildcards.push_back(std::make_pair(filter, session));
+        }
+        ack.push_back(0);
+        position += 2 + filterLength + 1;
+        
+        for(std::map<std::string, std::string>::iterator message = broker->retained.begin(); message != broker->retained.end(); ++message)
+        {
+          if(brokerMatch(message->first.c_str(), message->first.size(), filter))
+          {
+            broker->forward(session, message->first.c_str(), message->first.size(), (const uint8_t *)message->second.data(), message->second.size(), true);
+          }
+        }
+      }
+      ack[1] = ack.size() - 2;
+      // The acknowledgement goes before the retained messages on a real broker, the order does not matter to the tools
+      broker->send(session, ack.data(), ack.size());
+      break;
+    }
+    case MQTT_PUBLISH:
+    {
+      const char * topic;
+      const uint8_t * payload;
+      size_t topicLength, payloadLength;
+      if(!mqttPublishParse(header, body, length, &topic, &topicLength, &payload, &payloadLength))
+      {
+        session->closing = true;
+        break;
+      }
+      broker->received++;
+      if(header & 0x01)
+      {
+        std::string name(topic, topicLength);
+        if(payloadLength)
+        {
+          broker->retained[name].assign((const char *)payload, payloadLength);
+        }
+        else
+        {
+          broker->retained.erase(name);
+        }
+      }
+      broker->forward(NULL, topic, topicLength, payload, payloadLength, false);
+      break;
+    }
+    case MQTT_PINGREQ:
+      reply[0] = MQTT_PINGRESP;
+      reply[1] = 0;
+      broker->send(session, reply, 2);
+      break;
+    case MQTT_DISCONNECT:
+      session->closing = true;
+      break;
+  }
+}
+
+void Broker::run()
+{
+  std::vector<struct pollfd> descriptors;
+  static uint8_t buffer[65536];
+  while(running)
+  {
+    descriptors.resize(sessions.size() + 1);
+    descriptors[0].fd = listener;
+    descriptors[0].events = POLLIN;
+    for(size_t i = 0; i < sessions.size(); i++)
+    {
+      descriptors[i + 1].fd = sessions[i]->socket;
+      descriptors[i + 1].events = POLLIN;
+    }
+    if(poll(descriptors.data(), descriptors.size(), 50) <= 0)
+    {
+      continue;
+    }
+    
+    for(size_t i = 0; i < sessions.size(); i++)
+    {
+      if(!(descriptors[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+      {
+        continue;
+      }
+      ssize_t count = recv(sessions[i]->socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+      if(count > 0)
+      {
+        sessions[i]->reader.feed(buffer, count, handlePacket, sessions[i].get());
+      }
+      else if(count == 0 || (errno != EAGAIN && errno != EINTR))
+      {
+        sessions[i]->closing = true;
+      }
+    }
+    
+    // New sessions once the existing ones were served
+    int client;
+    while((client = accept(listener, NULL, NULL)) >= 0)
+    {
+      int enable = 1;
+      setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+      Session * session = new Session();
+      session->broker = this;
+      session->socket = client;
+      session->closing = false;
+      session->delivered = 0;
+      sessions.push_back(std::unique_ptr<Session>(session));
+    }
+    
+    for(size_t i = 0; i < sessions.size();)
+    {
+      if(sessions[i]->closing)
+      {
+        close(sessions[i]->socket);
+        remove(sessions[i].get());
+        sessions.erase(sessions.begin() + i);
+      }
+      else
+      {
+        i++;
+      }
+    }
+  }
+}
@@ -0,0 +1,90 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    broker.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Minimal MQTT 3.1.1 broker for the tests of the Linux tools: QoS 0, retained messages, '+' and '#' filters, one
+// thread and 127.0.0.1 only. It has none of the limits and checks a real broker needs, use it only for tests.
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mqtt.h"
+
+class Broker
+{
+  private:
+  struct Session
+  {
+    Broker * broker;
+    int socket;
+    bool closing;
+    MqttReader reader;
+    uint64_t delivered;      // Last message sent to it, so that a session matching twice gets it once
+  };
+  
+  int listener = -1;
+  std::atomic<bool> running;
+  std::thread thread;
+  std::vector<std::unique_ptr<Session>> sessions;
+  std::map<std::string, std::string> retained;
+  // Filters without wildcards are looked up by topic, the few others are matched one by one
+  std::unordered_map<std::string, std::vector<Session *>> exact;
+  std::vector<std::pair<std::string, Session *>> wildcards;
+  uint64_t message = 0;
+  std::vector<uint8_t> packet;
+  
+  static void handlePacket(void *, uint8_t, const uint8_t *, size_t);
+  void forward(Session *, const char *, size_t, const uint8_t *, size_t, bool);
+  void deliver(Session *, size_t);
+  void send(Session *, const uint8_t *, size_t);
+  void remove(Session *);
+  void run();
+  
+  public:
+  uint64_t received = 0;   // PUBLISH packets received
+  uint64_t delivered = 0;  // PUBLISH packets sent to subscribers
+  uint64_t connections = 0;
+  
+  Broker() : running(false) {}
+  ~Broker();
+  uint16_t start(uint16_t);
+  void stop();
+};
+
+bool brokerMatch(const char *, size_t, const std::string &);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    collector.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Collector of the MQTT meters: subscribes to the minute and hour topics of every meter on a broker and writes each
+// value to its slot in the day file of the meter, see store.h
+// collector [--broker HOST] [--port PORT] [--dir DIR] [--cache DAYS] [--stats S]
+// collector [--dir DIR] --dump METER YYYYMMDD prints a day as CSV
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqtt.h"
+#include "store.h"
+
+#define COLLECTOR_KEEPALIVE 60 // [s]
+#define COLLECTOR_BACKOFF_MAX 30 // Longest wait between two connection attempts [s]
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int)
+{
+  running = 0;
+}
+
+struct Collector
+{
+  Store * store;
+  bool connected;
+};
+
+static void handlePacket(void * context, uint8_t header, const uint8_t * body, size_t length)
+{
+  Collector * collector = (Collector *)context;
+  switch(header & 0xf0)
+  {
+    case MQTT_PUBLISH:
+    {
+      const char * topic;
+      const uint8_t * payload;
+      size_t topicLength, payloadLength;
+      if(mqttPublishParse(header, body, length, &topic, &topicLength, &payload, &payloadLength))
+      {
+        collector->store->ingest(topic, topicLength, payload, payloadLength, time(NULL));
+      }
+      break;
+    }
+    case MQTT_CONNACK:
+      collector->connected = length >= 2 && body[1] == 0;
+      break;
+  }
+}
+
+// Print a day from its file in place, "HH:MM,Wh" for every minute that was received
+static int dump(Store & store, const char * meter, const char * date)
+{
+  struct tm elements = {};
+  if(strlen(date) != 8 || sscanf(date, "%4d%2d%2d", &elements.tm_year, &elements.tm_mon, &elements.tm_mday) != 3)
+  {
+    fprintf(stderr, "Bad date %s, expected YYYYMMDD\n", date);
+    return 2;
+  }
+  elements.tm_year -= 1900;
+  elements.tm_mon -= 1;
+  const StoreDay * day = storeMeterName(meter, strlen(meter)) ? store.read(meter, timegm(&elements) / 86400) : NULL;
+  if(!day)
+  {
+    fprintf(stderr, "No data for %s on %s\n", meter, date);
+    return 1;
+  }
+  printf("Time,Power [Wh]\n");
+  for(uint16_t minute = 0; minute < STORE_MINUTES; minute++)
+  {
+    if(day->minutes[minute] != STORE_EMPTY)
+    {
+      printf("%02u:%02u,%u\n", minute / 60, minute % 60, day->minutes[minute]);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char ** argv)
+{
+  const char * broker = "localhost";
+  uint16_t port = 1883;
+  const char * directory = "data";
+  size_t cache = 8192;
+  uint32_t statsPeriod = 60;
+  const char * dumpMeter = NULL;
+  const char * dumpDate = NULL;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+    {
+      broker = argv[++i];
+    }
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+    {
+      port = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+    {
+      directory = argv[++i];
+    }
+    else if(strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      cache = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+    {
+      statsPeriod = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--dump") == 0 && i + 2 < argc)
+    {
+      dumpMeter = argv[++i];
+      dumpDate = argv[++i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--broker HOST] [--port PORT] [--dir DIR] [--cache DAYS] [--stats S]\n", argv[0]);
+      fprintf(stderr, "       %s [--dir DIR] --dump METER YYYYMMDD\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  Store store(directory, cache);
+  if(dumpMeter)
+  {
+    return dump(store, dumpMeter, dumpDate);
+  }
+  
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  
+  Collector collector = {&store, false};
+  MqttConnection connection;
+  MqttReader reader;
+  static uint8_t buffer[MQTT_PACKET_MAX];
+  uint32_t backoff = 0;
+  time_t timeSent = 0;
+  time_t timeStats = time(NULL);
+  StoreStats statsLast = store.stats;
+  
+  while(running)
+  {
+    if(!connection.connected())
+    {
+      if(backoff)
+      {
+        sleep(backoff);
+      }
+      backoff = backoff ? (backoff * 2 < COLLECTOR_BACKOFF_MAX ? backoff * 2 : COLLECTOR_BACKOFF_MAX) : 1;
+      
+      char clientId[32];
+      snprintf(clientId, sizeof(clientId), "collector-%d", (int)getpid());
+      size_t length = 0;
+      if(connection.open(broker, port))
+      {
+        length = mqttConnect(buffer, sizeof(buffer), clientId, COLLECTOR_KEEPALIVE);
+        length += mqttSubscribe(buffer + length, sizeof(buffer) - length, 1, "+/powerCounterMinute");
+        length += mqttSubscribe(buffer + length, sizeof(buffer) - length, 2, "+/powerCounterHour");
+      }
+      if(!length || !connection.send(buffer, length))
+      {
+        fprintf(stderr, "Cannot reach the broker at %s:%u, next try in %u s\n", broker, port, backoff);
+        continue;
+      }
+      reader.reset();
+      collector.connected = false;
+      timeSent = time(NULL);
+      printf("Connected to %s:%u, storing in %s\n", broker, port, directory);
+      fflush(stdout);
+    }
+    
+    int count = connection.receive(buffer, sizeof(buffer), 1000);
+    if(count > 0)
+    {
+      reader.feed(buffer, count, handlePacket, &collector);
+      if(collector.connected)
+      {
+        backoff = 0;
+      }
+    }
+    else if(count < 0)
+    {
+      fprintf(stderr, "Connection to the broker lost\n");
+    }
+    
+    // Keep the connection alive when nothing is sent
+    time_t timeNow = time(NULL);
+    if(connection.connected() && timeNow - timeSent >= COLLECTOR_KEEPALIVE / 2)
+    {
+      uint8_t ping[2];
+      connection.send(ping, mqttPing(ping, sizeof(ping)));
+      timeSent = timeNow;
+    }
+    
+    if(statsPeriod && timeNow - timeStats >= (time_t)statsPeriod)
+    {
+      printf("%llu messages, %.1f messages/s, %llu rejected, %llu days mapped, %llu unmapped\n",
+        (unsigned long long)store.stats.messages, (store.stats.messages - statsLast.messages) / (double)(timeNow - timeStats),
+        (unsigned long long)store.stats.rejected, (unsigned long long)store.stats.mapped, (unsigned long long)store.stats.evicted);
+      fflush(stdout);
+      statsLast = store.stats;
+      timeStats = timeNow;
+      store.flush();
+    }
+  }
+  
+  store.flush();
+  return 0;
+}
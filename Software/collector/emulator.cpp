@@ -0,0 +1,833 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    emulator.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Fleet of emulated MQTT meters, to size a broker and a collector before the real meters are installed
+// Every meter has its own connection and publishes like the MQTT firmware with its default configuration: the minute
+// and hour records, then powerCounterNow and powerCounterToday with the same interval, deadband and heartbeat rules,
+// retained. The minutes come from the CSV files the SD firmware writes to /power, shifted by up to half an hour and
+// scaled between 70% and 130% so that the meters differ. The clock of the meters runs --speed times faster than real
+// time; the network side keeps real time: the reconnection backoff, the pacing of the replayed batches and the
+// keepalive, so that a storm looks to the broker like it would with real meters.
+// A separate connection subscribes to the same topics and measures how long every message took through the broker.
+// emulator [--devices N] [--broker HOST] [--port PORT] [--profile CSV]... [--speed X] [--duration S] [--storm S]
+//   [--storm-fraction F] [--binary] [--local-broker]
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "broker.h"
+#include "mqtt.h"
+#include "payload.h"
+
+// Same values as config_dummy.h and PubSubClient of the MQTT firmware
+#define EMULATOR_NOW_INTERVAL 5000
+#define EMULATOR_NOW_DEADBAND 10 // [W]
+#define EMULATOR_NOW_DEADBAND_PERCENT 5
+#define EMULATOR_NOW_HEARTBEAT 60000
+#define EMULATOR_TODAY_INTERVAL 10000
+#define EMULATOR_TODAY_DEADBAND 10 // [Wh]
+#define EMULATOR_TODAY_DEADBAND_PERCENT 0
+#define EMULATOR_TODAY_HEARTBEAT 300000
+#define EMULATOR_BUFFER_MINUTES 360
+#define EMULATOR_BUFFER_HOURS 24
+#define EMULATOR_CONNECT 2.0 // Longest wait for the CONNACK [s]
+#define EMULATOR_BACKOFF_MIN 1000 // [ms]
+#define EMULATOR_BACKOFF_MAX 60000 // [ms]
+#define EMULATOR_REPLAY 0.5 // [s]
+#define EMULATOR_KEEPALIVE 15 // [s]
+#define EMULATOR_PACKET_SIZE 128 // MQTT_MAX_PACKET_SIZE
+#define EMULATOR_MINUTES 1440
+#define EMULATOR_STEP 2 // Longest wait for the sockets between two rounds over the meters [ms]
+#define EMULATOR_DRAIN 1.0 // Time left to the broker to deliver the last messages [s]
+
+enum
+{
+  TOPIC_MINUTE,
+  TOPIC_HOUR,
+  TOPIC_NOW,
+  TOPIC_TODAY,
+  TOPIC_MQTT,
+  TOPIC_COUNT
+};
+
+static const char * topics[TOPIC_COUNT] = {"powerCounterMinute", "powerCounterHour", "powerCounterNow", "powerCounterToday", "powerCounterMqtt"};
+
+enum
+{
+  DEVICE_OFFLINE,
+  DEVICE_CONNECTING,
+  DEVICE_ONLINE
+};
+
+struct Record
+{
+  uint32_t epochMinute; // Start of the minute or the hour
+  uint32_t power;       // [Wh]
+  uint32_t sequence;
+};
+
+// Last value published on a topic and when, on the clock of the meter
+struct Publisher
+{
+  bool published;
+  uint64_t time; // [ms]
+  uint32_t value;
+};
+
+struct Device
+{
+  uint32_t index;
+  char name[16];
+  MqttConnection connection;
+  MqttReader reader;
+  uint8_t state = DEVICE_OFFLINE;
+  bool accepted = false;     // CONNACK received
+  double timeAttempt = 0;    // Next connection attempt, or start of the current one [s]
+  double timeSent = 0;       // For the keepalive [s]
+  double timeReplay = 0;     // [s]
+  double timeDisconnected = 0;
+  double disconnectedTotal = 0;
+  uint32_t backoff = EMULATOR_BACKOFF_MIN; // [ms]
+  uint32_t attempts = 0;
+  uint32_t attemptsTotal = 0;
+  const std::vector<uint16_t> * profile;
+  int32_t shift;             // [min]
+  uint32_t scale;            // [%]
+  uint32_t phase;            // Offset of the clock of the meter, like NTP gives [ms]
+  uint64_t minute = 0;       // Minutes logged since the start
+  uint32_t powerHour = 0;
+  uint32_t powerToday = 0;
+  uint32_t sequence = 0;
+  std::deque<Record> minutes;
+  std::deque<Record> hours;
+  Publisher now = {};
+  Publisher today = {};
+};
+
+// Send time of a message not seen by the monitor yet, recognised by its payload
+struct Pending
+{
+  double time;
+  uint32_t hash;
+};
+
+struct Emulator
+{
+  uint32_t devices = 100;
+  const char * broker = "localhost";
+  uint16_t port = 1883;
+  double speed = 60;
+  double duration = 10;
+  double storm = 0;
+  double stormFraction = 1;
+  bool binary = false;
+  bool localBroker = false;
+  time_t dayStart = 0;
+  
+  uint64_t sent[TOPIC_COUNT] = {};
+  uint64_t connects = 0;
+  uint64_t failures = 0;
+  uint64_t dropped = 0;
+  uint64_t lost = 0;     // Records dropped from a full buffer
+  
+  // Shared with the monitor thread
+  std::mutex lock;
+  std::vector<std::deque<Pending>> pending;
+  std::vector<float> latencies; // [ms]
+  uint64_t received[TOPIC_COUNT] = {};
+  uint64_t unmatched = 0;
+  std::atomic<bool> monitoring;
+  std::atomic<int> subscribed;
+};
+
+static Emulator emulator;
+static struct timespec realStart;
+
+static double seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - realStart.tv_sec) + (now.tv_nsec - realStart.tv_nsec) / 1e9;
+}
+
+static uint32_t mix(uint32_t value)
+{
+  value ^= value >> 16;
+  value *= 0x7feb352d;
+  value ^= value >> 15;
+  value *= 0x846ca68b;
+  value ^= value >> 16;
+  return value;
+}
+
+static uint32_t hashPayload(const uint8_t * data, size_t length)
+{
+  uint32_t hash = 2166136261u;
+  for(size_t i = 0; i < length; i++)
+  {
+    hash = (hash ^ data[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// "HH:MM,Wh" rows of a day log, missing minutes are 0
+static bool readProfile(const char * path, std::vector<uint16_t> & profile)
+{
+  FILE * file = fopen(path, "r");
+  if(!file)
+  {
+    return false;
+  }
+  profile.assign(EMULATOR_MINUTES, 0);
+  char line[64];
+  uint32_t rows = 0;
+  while(fgets(line, sizeof(line), file))
+  {
+    unsigned hours, minutes, power;
+    if(sscanf(line, "%2u:%2u,%u", &hours, &minutes, &power) == 3 && hours < 24 && minutes < 60)
+    {
+      profile[hours * 60 + minutes] = power > 0xffff ? 0xffff : power;
+      rows++;
+    }
+  }
+  fclose(file);
+  return rows > 0;
+}
+
+// Midnight of the date the file name starts with, or of today
+static time_t profileDate(const char * path)
+{
+  const char * name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  struct tm date = {};
+  if(sscanf(name, "%4d%2d%2d", &date.tm_year, &date.tm_mon, &date.tm_mday) == 3)
+  {
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    return timegm(&date);
+  }
+  time_t now = time(NULL);
+  return now - now % 86400;
+}
+
+// Energy of a minute counted from the start, as the meter logs it [Wh]
+static uint32_t minuteEnergy(const Device * device, uint64_t minute)
+{
+  uint32_t index = (minute + device->shift + EMULATOR_MINUTES) % EMULATOR_MINUTES;
+  return (*device->profile)[index] * device->scale / 100;
+}
+
+static uint64_t deviceClock(const Device * device, double time)
+{
+  return (uint64_t)(time * emulator.speed * 1000) + device->phase;
+}
+
+static void deviceLost(Device * device, double time)
+{
+  device->connection.close();
+  device->reader.reset();
+  device->state = DEVICE_OFFLINE;
+  device->timeDisconnected = time;
+  // The first attempt right away, like the firmware
+  device->timeAttempt = time;
+  device->backoff = EMULATOR_BACKOFF_MIN;
+}
+
+static bool devicePublish(Device * device, uint8_t topic, const uint8_t * payload, size_t length, bool retain, double time)
+{
+  char name[48];
+  snprintf(name, sizeof(name), "%s/%s", device->name, topics[topic]);
+  uint8_t packet[EMULATOR_PACKET_SIZE + 16];
+  size_t packetLength = mqttPublish(packet, sizeof(packet), name, payload, length, retain);
+  if(topic != TOPIC_MQTT)
+  {
+    std::lock_guard<std::mutex> guard(emulator.lock);
+    emulator.pending[device->index * 4 + topic].push_back({time, hashPayload(payload, length)});
+  }
+  if(!device->connection.send(packet, packetLength))
+  {
+    deviceLost(device, time);
+    return false;
+  }
+  device->timeSent = time;
+  emulator.sent[topic]++;
+  return true;
+}
+
+static size_t formatRecord(uint8_t * buffer, const Record * record, bool hourly)
+{
+  if(emulator.binary)
+  {
+    payload_record_t payload = {record->sequence, record->epochMinute, record->power};
+    return payload_encode(buffer, &payload);
+  }
+  uint32_t minuteOfDay = record->epochMinute % EMULATOR_MINUTES;
+  return sprintf((char *)buffer, "%u,%u\n", hourly ? minuteOfDay / 60 : minuteOfDay, record->power);
+}
+
+// Live record, kept for later when the broker cannot be reached
+static void deviceRecord(Device * device, const Record & record, bool hourly, double time)
+{
+  uint8_t data[24];
+  size_t length = formatRecord(data, &record, hourly);
+  if(device->state == DEVICE_ONLINE && devicePublish(device, hourly ? TOPIC_HOUR : TOPIC_MINUTE, data, length, false, time))
+  {
+    return;
+  }
+  std::deque<Record> & buffer = hourly ? device->hours : device->minutes;
+  if(buffer.size() == (hourly ? EMULATOR_BUFFER_HOURS : EMULATOR_BUFFER_MINUTES))
+  {
+    buffer.pop_front();
+    emulator.lost++;
+  }
+  buffer.push_back(record);
+}
+
+// As many buffered records as fit in one packet, the minutes first
+static void deviceReplay(Device * device, double time)
+{
+  bool hourly = device->minutes.empty();
+  std::deque<Record> & buffer = hourly ? device->hours : device->minutes;
+  uint8_t payload[EMULATOR_PACKET_SIZE];
+  size_t payloadMax = EMULATOR_PACKET_SIZE - 5 - 2 - strlen(device->name) - 1 - strlen(topics[hourly ? TOPIC_HOUR : TOPIC_MINUTE]);
+  size_t length = 0;
+  size_t records = 0;
+  while(records < buffer.size())
+  {
+    uint8_t data[24];
+    size_t dataLength = formatRecord(data, &buffer[records], hourly);
+    if(length + dataLength > payloadMax)
+    {
+      break;
+    }
+    memcpy(payload + length, data, dataLength);
+    length += dataLength;
+    records++;
+  }
+  if(records && devicePublish(device, hourly ? TOPIC_HOUR : TOPIC_MINUTE, payload, length, false, time))
+  {
+    buffer.erase(buffer.begin(), buffer.begin() + records);
+  }
+  device->timeReplay = time;
+}
+
+// Publish when the value changed enough since the last publish, or when the heartbeat is due
+static void devicePublishValue(Device * device, Publisher * publisher, uint8_t topic, uint32_t value, uint64_t clock,
+  uint32_t interval, uint32_t deadband, uint32_t percent, uint32_t heartbeat, double time)
+{
+  uint64_t elapsed = clock - publisher->time;
+  uint32_t change = value > publisher->value ? value - publisher->value : publisher->value - value;
+  uint32_t threshold = std::max(deadband, publisher->value * percent / 100);
+  if(publisher->published && elapsed < heartbeat && (elapsed < interval || change <= threshold))
+  {
+    return;
+  }
+  char payload[16];
+  int length = snprintf(payload, sizeof(payload), topic == TOPIC_NOW ? "%uW" : "%uWh", value);
+  if(devicePublish(device, topic, (const uint8_t *)payload, length, true, time))
+  {
+    publisher->published = true;
+    publisher->time = clock;
+    publisher->value = value;
+  }
+}
+
+static void deviceAttempt(Device * device, double time)
+{
+  device->attempts++;
+  device->attemptsTotal++;
+  uint8_t packet[64];
+  if(device->connection.open(emulator.broker, emulator.port)
+    && device->connection.send(packet, mqttConnect(packet, sizeof(packet), device->name, EMULATOR_KEEPALIVE)))
+  {
+    device->state = DEVICE_CONNECTING;
+    device->accepted = false;
+    device->timeAttempt = time;
+    device->timeSent = time;
+    return;
+  }
+  device->connection.close();
+  emulator.failures++;
+  device->timeAttempt = time + (device->backoff + rand() % (device->backoff / 4)) / 1000.0;
+  device->backoff = std::min(device->backoff * 2, (uint32_t)EMULATOR_BACKOFF_MAX);
+}
+
+static void deviceOnline(Device * device, double time)
+{
+  device->state = DEVICE_ONLINE;
+  emulator.connects++;
+  device->disconnectedTotal += time - device->timeDisconnected;
+  
+  uint8_t packet[64];
+  char topic[48];
+  snprintf(topic, sizeof(topic), "%s/powerMeterConstant", device->name);
+  if(!device->connection.send(packet, mqttSubscribe(packet, sizeof(packet), 1, topic)))
+  {
+    deviceLost(device, time);
+    return;
+  }
+  char data[48];
+  int length = snprintf(data, sizeof(data), "%u,%u,%u", device->attempts, device->attemptsTotal, (uint32_t)device->disconnectedTotal);
+  if(devicePublish(device, TOPIC_MQTT, (const uint8_t *)data, length, true, time))
+  {
+    device->attempts = 0;
+    device->backoff = EMULATOR_BACKOFF_MIN;
+  }
+}
+
+static void handleDevicePacket(void * context, uint8_t header, const uint8_t * body, size_t length)
+{
+  Device * device = (Device *)context;
+  if((header & 0xf0) == MQTT_CONNACK)
+  {
+    device->accepted = length >= 2 && body[1] == 0;
+  }
+}
+
+// One round of a meter: its connection, the minutes its clock went through and the live values
+static void deviceStep(Device * device, double time)
+{
+  if(device->state == DEVICE_OFFLINE && time >= device->timeAttempt)
+  {
+    deviceAttempt(device, time);
+  }
+  if(device->state == DEVICE_CONNECTING)
+  {
+    if(device->accepted)
+    {
+      deviceOnline(device, time);
+    }
+    else if(time - device->timeAttempt > EMULATOR_CONNECT)
+    {
+      device->connection.close();
+      device->state = DEVICE_OFFLINE;
+      emulator.failures++;
+      device->timeAttempt = time + (device->backoff + rand() % (device->backoff / 4)) / 1000.0;
+      device->backoff = std::min(device->backoff * 2, (uint32_t)EMULATOR_BACKOFF_MAX);
+    }
+  }
+  
+  uint64_t clock = deviceClock(device, time);
+  uint64_t minute = clock / 60000;
+  uint32_t epochStart = emulator.dayStart / 60;
+  for(; device->minute < minute; device->minute++)
+  {
+    uint32_t power = minuteEnergy(device, device->minute);
+    device->powerHour += power;
+    device->powerToday += power;
+    Record record = {epochStart + (uint32_t)device->minute, power, device->sequence++};
+    deviceRecord(device, record, false, time);
+    if(device->minute % 60 == 59)
+    {
+      Record hourRecord = {epochStart + (uint32_t)device->minute - 59, device->powerHour, device->sequence++};
+      deviceRecord(device, hourRecord, true, time);
+      device->powerHour = 0;
+    }
+    if(device->minute % EMULATOR_MINUTES == EMULATOR_MINUTES - 1)
+    {
+      device->powerToday = 0;
+    }
+  }
+  
+  if(device->state != DEVICE_ONLINE)
+  {
+    return;
+  }
+  
+  if((device->minutes.size() || device->hours.size()) && time - device->timeReplay > EMULATOR_REPLAY)
+  {
+    deviceReplay(device, time);
+  }
+  
+  // The power from the blink interval wavers a little from one second to the next
+  uint32_t power = minuteEnergy(device, minute);
+  uint32_t wobble = mix(device->index * 86400 + clock / 1000) % 11;
+  uint32_t powerNow = power * 60 * (95 + wobble) / 100;
+  uint32_t powerToday = device->powerToday + power * (clock % 60000) / 60000;
+  devicePublishValue(device, &device->now, TOPIC_NOW, powerNow, clock, EMULATOR_NOW_INTERVAL, EMULATOR_NOW_DEADBAND,
+    EMULATOR_NOW_DEADBAND_PERCENT, EMULATOR_NOW_HEARTBEAT, time);
+  if(device->state == DEVICE_ONLINE)
+  {
+    devicePublishValue(device, &device->today, TOPIC_TODAY, powerToday, clock, EMULATOR_TODAY_INTERVAL, EMULATOR_TODAY_DEADBAND,
+      EMULATOR_TODAY_DEADBAND_PERCENT, EMULATOR_TODAY_HEARTBEAT, time);
+  }
+  
+  if(device->state == DEVICE_ONLINE && time - device->timeSent >= EMULATOR_KEEPALIVE)
+  {
+    uint8_t packet[2];
+    if(device->connection.send(packet, mqttPing(packet, sizeof(packet))))
+    {
+      device->timeSent = time;
+    }
+    else
+    {
+      deviceLost(device, time);
+    }
+  }
+}
+
+// Match a message from the broker with the one sent, retained messages are from before the subscription
+static void handleMonitorPacket(void *, uint8_t header, const uint8_t * body, size_t length)
+{
+  if((header & 0xf0) == MQTT_SUBACK)
+  {
+    emulator.subscribed++;
+    return;
+  }
+  const char * topic;
+  const uint8_t * payload;
+  size_t topicLength, payloadLength;
+  if((header & 0xf0) != MQTT_PUBLISH || (header & 0x01) || !mqttPublishParse(header, body, length, &topic, &topicLength, &payload, &payloadLength))
+  {
+    return;
+  }
+  double time = seconds();
+  
+  char name[64];
+  snprintf(name, sizeof(name), "%.*s", (int)topicLength, topic);
+  unsigned index;
+  char suffix[32];
+  if(sscanf(name, "emu%5u/%31s", &index, suffix) != 2 || index >= emulator.devices)
+  {
+    return;
+  }
+  uint8_t type = 0;
+  while(type < 4 && strcmp(suffix, topics[type]) != 0)
+  {
+    type++;
+  }
+  if(type == 4)
+  {
+    return;
+  }
+  
+  uint32_t hash = hashPayload(payload, payloadLength);
+  std::lock_guard<std::mutex> guard(emulator.lock);
+  emulator.received[type]++;
+  std::deque<Pending> & queue = emulator.pending[index * 4 + type];
+  // Messages lost with a dropped connection are never seen, the broker keeps the order of the others
+  std::deque<Pending>::iterator match = queue.begin();
+  while(match != queue.end() && match->hash != hash)
+  {
+    match++;
+  }
+  if(match == queue.end())
+  {
+    emulator.unmatched++;
+    return;
+  }
+  emulator.latencies.push_back((time - match->time) * 1000);
+  queue.erase(queue.begin(), match + 1);
+}
+
+static void monitor(MqttConnection * connection)
+{
+  MqttReader reader;
+  static uint8_t buffer[65536];
+  while(emulator.monitoring && connection->connected())
+  {
+    int count = connection->receive(buffer, sizeof(buffer), 100);
+    if(count > 0)
+    {
+      reader.feed(buffer, count, handleMonitorPacket, NULL);
+    }
+  }
+}
+
+static float percentile(std::vector<float> & values, double rank)
+{
+  if(values.empty())
+  {
+    return 0;
+  }
+  size_t index = (size_t)(rank * (values.size() - 1));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+int main(int argc, char ** argv)
+{
+  std::vector<const char *> profilePaths;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--devices") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      emulator.devices = value > 0 && value < 100000 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+    {
+      emulator.broker = argv[++i];
+    }
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+    {
+      emulator.port = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+    {
+      profilePaths.push_back(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+    {
+      double value = atof(argv[++i]);
+      emulator.speed = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--duration") == 0 && i + 1 < argc)
+    {
+      double value = atof(argv[++i]);
+      emulator.duration = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--storm") == 0 && i + 1 < argc)
+    {
+      emulator.storm = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--storm-fraction") == 0 && i + 1 < argc)
+    {
+      double value = atof(argv[++i]);
+      emulator.stormFraction = value > 0 && value < 1 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--binary") == 0)
+    {
+      emulator.binary = true;
+    }
+    else if(strcmp(argv[i], "--local-broker") == 0)
+    {
+      emulator.localBroker = true;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--devices N] [--broker HOST] [--port PORT] [--profile CSV]... [--speed X] [--duration S] "
+        "[--storm S] [--storm-fraction F] [--binary] [--local-broker]\n", argv[0]);
+      return 2;
+    }
+  }
+  if(profilePaths.empty())
+  {
+    profilePaths.push_back(EMULATOR_PROFILE);
+  }
+  
+  std::vector<std::vector<uint16_t>> profiles(profilePaths.size());
+  for(size_t i = 0; i < profilePaths.size(); i++)
+  {
+    if(!readProfile(profilePaths[i], profiles[i]))
+    {
+      fprintf(stderr, "%s: no rows could be read\n", profilePaths[i]);
+      return 1;
+    }
+  }
+  emulator.dayStart = profileDate(profilePaths[0]);
+  
+  Broker broker;
+  if(emulator.localBroker)
+  {
+    emulator.broker = "127.0.0.1";
+    emulator.port = broker.start(0);
+    if(!emulator.port)
+    {
+      perror("broker");
+      return 1;
+    }
+  }
+  
+  clock_gettime(CLOCK_MONOTONIC, &realStart);
+  srand(1);
+  
+  // The monitor subscribes before the meters start, so that it sees their first messages
+  emulator.pending.resize(emulator.devices * 4);
+  emulator.monitoring = true;
+  emulator.subscribed = 0;
+  MqttConnection monitorConnection;
+  uint8_t packet[128];
+  bool subscribed = monitorConnection.open(emulator.broker, emulator.port)
+    && monitorConnection.send(packet, mqttConnect(packet, sizeof(packet), "emulator-monitor", 60));
+  for(uint8_t topic = 0; subscribed && topic < 4; topic++)
+  {
+    char filter[48];
+    snprintf(filter, sizeof(filter), "+/%s", topics[topic]);
+    subscribed = monitorConnection.send(packet, mqttSubscribe(packet, sizeof(packet), topic + 1, filter));
+  }
+  if(!subscribed)
+  {
+    fprintf(stderr, "%s:%u: broker cannot be reached\n", emulator.broker, emulator.port);
+    return 1;
+  }
+  std::thread monitorThread(monitor, &monitorConnection);
+  while(emulator.subscribed < 4 && seconds() < EMULATOR_CONNECT)
+  {
+    struct timespec wait = {0, 1000000};
+    nanosleep(&wait, NULL);
+  }
+  
+  std::unique_ptr<Device[]> devices(new Device[emulator.devices]);
+  for(uint32_t i = 0; i < emulator.devices; i++)
+  {
+    Device * device = &devices[i];
+    device->index = i;
+    snprintf(device->name, sizeof(device->name), "emu%05u", i);
+    device->profile = &profiles[i % profiles.size()];
+    device->shift = (int32_t)(mix(i) % 61) - 30;
+    device->scale = 70 + mix(i + 0x10000) % 61;
+    device->phase = mix(i + 0x20000) % 1000;
+  }
+  
+  double timeStart = seconds();
+  double timeStorm = timeStart + emulator.storm;
+  uint64_t storms = 0;
+  std::vector<struct pollfd> descriptors;
+  std::vector<Device *> polled;
+  static uint8_t buffer[16384];
+  double time;
+  while((time = seconds()) - timeStart < emulator.duration)
+  {
+    // Drop the connections of the storm, all the meters then come back at once
+    if(emulator.storm > 0 && time >= timeStorm)
+    {
+      for(uint32_t i = 0; i < emulator.devices; i++)
+      {
+        if(devices[i].state == DEVICE_ONLINE && rand() < emulator.stormFraction * RAND_MAX)
+        {
+          deviceLost(&devices[i], time);
+          emulator.dropped++;
+        }
+      }
+      storms++;
+      timeStorm += emulator.storm;
+    }
+    
+    descriptors.clear();
+    polled.clear();
+    for(uint32_t i = 0; i < emulator.devices; i++)
+    {
+      if(devices[i].connection.connected())
+      {
+        descriptors.push_back({devices[i].connection.descriptor(), POLLIN, 0});
+        polled.push_back(&devices[i]);
+      }
+    }
+    if(poll(descriptors.data(), descriptors.size(), EMULATOR_STEP) > 0)
+    {
+      for(size_t i = 0; i < descriptors.size(); i++)
+      {
+        if(!descriptors[i].revents)
+        {
+          continue;
+        }
+        int count = polled[i]->connection.receive(buffer, sizeof(buffer), 0);
+        if(count > 0)
+        {
+          polled[i]->reader.feed(buffer, count, handleDevicePacket, polled[i]);
+        }
+        else if(count < 0)
+        {
+          deviceLost(polled[i], seconds());
+        }
+      }
+    }
+    
+    time = seconds();
+    for(uint32_t i = 0; i < emulator.devices; i++)
+    {
+      deviceStep(&devices[i], time);
+    }
+  }
+  double duration = seconds() - timeStart;
+  
+  // The last messages still go through the broker
+  uint64_t received = ~0ULL;
+  for(double timeDrain = seconds(); seconds() - timeDrain < EMULATOR_DRAIN;)
+  {
+    struct timespec wait = {0, 100000000};
+    nanosleep(&wait, NULL);
+    std::lock_guard<std::mutex> guard(emulator.lock);
+    uint64_t total = emulator.received[0] + emulator.received[1] + emulator.received[2] + emulator.received[3];
+    if(total == received)
+    {
+      break;
+    }
+    received = total;
+  }
+  emulator.monitoring = false;
+  monitorThread.join();
+  for(uint32_t i = 0; i < emulator.devices; i++)
+  {
+    devices[i].connection.close();
+  }
+  broker.stop();
+  
+  uint32_t online = 0;
+  uint64_t buffered = 0;
+  for(uint32_t i = 0; i < emulator.devices; i++)
+  {
+    online += devices[i].state == DEVICE_ONLINE;
+    buffered += devices[i].minutes.size() + devices[i].hours.size();
+  }
+  printf("%u meters, %zu profile(s), %s payload, %.0f times real time: %.1f s, %.0f minutes of meter time\n", emulator.devices,
+    profiles.size(), emulator.binary ? "binary" : "text", emulator.speed, duration, duration * emulator.speed / 60);
+  printf("%-20s %10s %10s %10s\n", "Topic", "Sent", "Sent/s", "Received");
+  int failures = 0;
+  for(uint8_t topic = 0; topic < TOPIC_COUNT; topic++)
+  {
+    printf("%-20s %10llu %10.0f", topics[topic], (unsigned long long)emulator.sent[topic], emulator.sent[topic] / duration);
+    if(topic < 4)
+    {
+      printf(" %10llu", (unsigned long long)emulator.received[topic]);
+      failures += emulator.sent[topic] && !emulator.received[topic];
+    }
+    printf("\n");
+  }
+  printf("%llu connections, %llu failed attempts, %llu storms dropped %llu connections, %u online at the end\n",
+    (unsigned long long)emulator.connects, (unsigned long long)emulator.failures, (unsigned long long)storms,
+    (unsigned long long)emulator.dropped, online);
+  printf("%llu records still buffered, %llu lost from full buffers, %llu messages not matched\n", (unsigned long long)buffered,
+    (unsigned long long)emulator.lost, (unsigned long long)emulator.unmatched);
+  std::vector<float> & latencies = emulator.latencies;
+  float p50 = percentile(latencies, 0.5);
+  float p99 = percentile(latencies, 0.99);
+  float maximum = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+  printf("Broker latency: %zu messages, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", latencies.size(), p50, p99, maximum);
+  if(emulator.localBroker)
+  {
+    printf("Local broker: %llu messages received, %llu delivered\n", (unsigned long long)broker.received,
+      (unsigned long long)broker.delivered);
+  }
+  
+  failures += latencies.empty() || !emulator.connects;
+  printf("emulator: %s\n", failures ? "FAIL" : "OK");
+  return failures ? 1 : 0;
+}
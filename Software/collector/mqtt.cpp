@@ -0,0 +1,345 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    mqtt.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "mqtt.h"
+
+// Fixed header: the packet type and the remaining length in 1 to 4 bytes, returns its size or 0 if it does not fit
+static size_t mqttHeader(uint8_t * buffer, size_t size, uint8_t header, size_t length)
+{
+  if(size < 5 || length > 268435455)
+  {
+    return 0;
+  }
+  size_t position = 0;
+  buffer[position++] = header;
+  do
+  {
+    uint8_t digit = length % 128;
+    length /= 128;
+    buffer[position++] = length ? digit | 0x80 : digit;
+  } while(length);
+  return position;
+}
+
+static size_t mqttString(uint8_t * buffer, const char * text, size_t length)
+{
+  buffer[0] = length >> 8;
+  buffer[1] = length;
+  memcpy(buffer + 2, text, length);
+  return length + 2;
+}
+
+// The sizes below are those of the whole packet, 0 when it does not fit in the buffer
+size_t mqttConnect(uint8_t * buffer, size_t size, const char * clientId, uint16_t keepAlive)
+{
+  size_t idLength = strlen(clientId);
+  size_t length = 10 + 2 + idLength;
+  size_t position = mqttHeader(buffer, size, MQTT_CONNECT, length);
+  if(!position || position + length > size)
+  {
+    return 0;
+  }
+  position += mqttString(buffer + position, "MQTT", 4);
+  buffer[position++] = 4;    // Protocol level 3.1.1
+  buffer[position++] = 0x02; // Clean session
+  buffer[position++] = keepAlive >> 8;
+  buffer[position++] = keepAlive;
+  position += mqttString(buffer + position, clientId, idLength);
+  return position;
+}
+
+size_t mqttSubscribe(uint8_t * buffer, size_t size, uint16_t packetId, const char * filter)
+{
+  size_t filterLength = strlen(filter);
+  size_t length = 2 + 2 + filterLength + 1;
+  size_t position = mqttHeader(buffer, size, MQTT_SUBSCRIBE, length);
+  if(!position || position + length > size)
+  {
+    return 0;
+  }
+  buffer[position++] = packetId >> 8;
+  buffer[position++] = packetId;
+  position += mqttString(buffer + position, filter, filterLength);
+  buffer[position++] = 0; // QoS 0
+  return position;
+}
+
+size_t mqttPublish(uint8_t * buffer, size_t size, const char * topic, const uint8_t * payload, size_t payloadLength, bool retain)
+{
+  size_t topicLength = strlen(topic);
+  size_t length = 2 + topicLength + payloadLength;
+  size_t position = mqttHeader(buffer, size, MQTT_PUBLISH | (retain ? 1 : 0), length);
+  if(!position || position + length > size)
+  {
+    return 0;
+  }
+  position += mqttString(buffer + position, topic, topicLength);
+  memcpy(buffer + position, payload, payloadLength);
+  return position + payloadLength;
+}
+
+size_t mqttPing(uint8_t * buffer, size_t size)
+{
+  return mqttHeader(buffer, size, MQTT_PINGREQ, 0);
+}
+
+// Topic and payload of a PUBLISH packet, they point into the body
+bool mqttPublishParse(uint8_t header, const uint8_t * body, size_t length, const char ** topic, size_t * topicLength, const uint8_t ** payload, size_t * payloadLength)
+{
+  if(length < 2)
+  {
+    return false;
+  }
+  size_t position = 2 + (body[0] << 8 | body[1]);
+  *topic = (const char *)body + 2;
+  *topicLength = position - 2;
+  
+  // QoS 1 and 2 have a packet identifier after the topic
+  if(header & 0x06)
+  {
+    position += 2;
+  }
+  if(position > length)
+  {
+    return false;
+  }
+  *payload = body + position;
+  *payloadLength = length - position;
+  return true;
+}
+
+MqttReader::MqttReader()
+{
+  partial = NULL;
+}
+
+MqttReader::~MqttReader()
+{
+  free(partial);
+}
+
+// Length of the packet at the start of the data, returns false while the fixed header is not complete
+static bool mqttPacketLength(const uint8_t * data, size_t length, size_t * headerLength, size_t * bodyLength)
+{
+  size_t value = 0;
+  for(size_t i = 1; i < 5; i++)
+  {
+    if(i >= length)
+    {
+      return false;
+    }
+    value |= (size_t)(data[i] & 0x7f) << (7 * (i - 1));
+    if(!(data[i] & 0x80))
+    {
+      *headerLength = i + 1;
+      *bodyLength = value;
+      return true;
+    }
+  }
+  // A length on more than 4 bytes is not valid, it is skipped as a packet that is too long
+  *headerLength = 5;
+  *bodyLength = (size_t)-1 / 2;
+  return true;
+}
+
+// Split the data into packets, the ones that arrived whole are handed over in place
+void MqttReader::feed(const uint8_t * data, size_t length, MqttHandler handler, void * context)
+{
+  while(length)
+  {
+    // Finish the packet started by a previous read first, byte by byte for its header
+    if(partialLength)
+    {
+      size_t headerLength, bodyLength;
+      size_t copy = 1;
+      if(mqttPacketLength(partial, partialLength, &headerLength, &bodyLength))
+      {
+        if(bodyLength > MQTT_PACKET_MAX)
+        {
+          // Skip what is left of a packet that is too long
+          size_t remaining = headerLength + bodyLength - partialLength;
+          size_t skip = remaining < length ? remaining : length;
+          partialLength += skip;
+          data += skip;
+          length -= skip;
+          if(partialLength == headerLength + bodyLength)
+          {
+            partialLength = 0;
+            skipped++;
+          }
+          continue;
+        }
+        copy = headerLength + bodyLength - partialLength;
+        copy = copy < length ? copy : length;
+      }
+      if(partialLength + copy > partialSize)
+      {
+        partialSize = partialLength + copy > 256 ? partialLength + copy : 256;
+        partial = (uint8_t *)realloc(partial, partialSize);
+      }
+      memcpy(partial + partialLength, data, copy);
+      partialLength += copy;
+      data += copy;
+      length -= copy;
+      if(mqttPacketLength(partial, partialLength, &headerLength, &bodyLength) && bodyLength <= MQTT_PACKET_MAX && partialLength == headerLength + bodyLength)
+      {
+        handler(context, partial[0], partial + headerLength, bodyLength);
+        partialLength = 0;
+      }
+      continue;
+    }
+    
+    // Whole packets straight from the data
+    size_t headerLength, bodyLength;
+    if(mqttPacketLength(data, length, &headerLength, &bodyLength) && bodyLength <= length - headerLength)
+    {
+      handler(context, data[0], data + headerLength, bodyLength);
+      data += headerLength + bodyLength;
+      length -= headerLength + bodyLength;
+      continue;
+    }
+    
+    // The rest is the start of a packet, the header is taken over by the code above
+    if(partialSize < 256)
+    {
+      partialSize = 256;
+      partial = (uint8_t *)realloc(partial, partialSize);
+    }
+    partial[0] = data[0];
+    partialLength = 1;
+    data++;
+    length--;
+  }
+}
+
+MqttConnection::~MqttConnection()
+{
+  close();
+}
+
+// Connect to the broker, returns false when it cannot be reached
+bool MqttConnection::open(const char * host, uint16_t port)
+{
+  close();
+  
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  struct addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo * addresses;
+  if(getaddrinfo(host, service, &hints, &addresses) != 0)
+  {
+    return false;
+  }
+  for(struct addrinfo * address = addresses; address; address = address->ai_next)
+  {
+    socket = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if(socket < 0)
+    {
+      continue;
+    }
+    if(connect(socket, address->ai_addr, address->ai_addrlen) == 0)
+    {
+      break;
+    }
+    ::close(socket);
+    socket = -1;
+  }
+  freeaddrinfo(addresses);
+  
+  if(socket >= 0)
+  {
+    int enable = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+  }
+  return socket >= 0;
+}
+
+void MqttConnection::close()
+{
+  if(socket >= 0)
+  {
+    ::close(socket);
+    socket = -1;
+  }
+}
+
+// Send the whole buffer, the connection is closed on failure
+bool MqttConnection::send(const uint8_t * data, size_t length)
+{
+  while(length && socket >= 0)
+  {
+    ssize_t sent = ::send(socket, data, length, MSG_NOSIGNAL);
+    if(sent <= 0)
+    {
+      if(sent < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      close();
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return socket >= 0;
+}
+
+// Wait up to the timeout for data, returns the number of bytes read, 0 on timeout and -1 when the connection is lost
+int MqttConnection::receive(uint8_t * buffer, size_t size, int timeout)
+{
+  if(socket < 0)
+  {
+    return -1;
+  }
+  struct pollfd descriptor = {socket, POLLIN, 0};
+  int ready = poll(&descriptor, 1, timeout);
+  if(ready <= 0)
+  {
+    return ready < 0 && errno != EINTR ? -1 : 0;
+  }
+  ssize_t count = recv(socket, buffer, size, 0);
+  if(count <= 0)
+  {
+    close();
+    return -1;
+  }
+  return count;
+}
@@ -0,0 +1,91 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    mqtt.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// MQTT 3.1.1 packets for the Linux tools, QoS 0 only: encoding into a buffer, a reader that splits a byte stream into
+// packets without copying them when they arrive whole, and a blocking TCP connection to a broker
+
+#ifndef MQTT_H
+#define MQTT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xc0
+#define MQTT_PINGRESP 0xd0
+#define MQTT_DISCONNECT 0xe0
+#define MQTT_PACKET_MAX 65536 // Longest packet the reader keeps, longer ones are skipped
+
+size_t mqttConnect(uint8_t *, size_t, const char *, uint16_t);
+size_t mqttSubscribe(uint8_t *, size_t, uint16_t, const char *);
+size_t mqttPublish(uint8_t *, size_t, const char *, const uint8_t *, size_t, bool);
+size_t mqttPing(uint8_t *, size_t);
+bool mqttPublishParse(uint8_t, const uint8_t *, size_t, const char **, size_t *, const uint8_t **, size_t *);
+
+// Called for every whole packet with its first byte and the bytes after the length
+typedef void (*MqttHandler)(void * context, uint8_t header, const uint8_t * body, size_t length);
+
+class MqttReader
+{
+  private:
+  uint8_t * partial;    // Packet split between two reads
+  size_t partialLength = 0;
+  size_t partialSize = 0;
+  
+  public:
+  uint64_t skipped = 0; // Packets longer than MQTT_PACKET_MAX
+  
+  MqttReader();
+  ~MqttReader();
+  MqttReader(const MqttReader &) = delete;
+  MqttReader & operator=(const MqttReader &) = delete;
+  void reset() { partialLength = 0; }
+  void feed(const uint8_t *, size_t, MqttHandler, void *);
+};
+
+// TCP connection to a broker
+class MqttConnection
+{
+  private:
+  int socket = -1;
+  
+  public:
+  ~MqttConnection();
+  bool open(const char *, uint16_t);
+  void close();
+  bool connected() { return socket >= 0; }
+  int descriptor() { return socket; }
+  bool send(const uint8_t *, size_t);
+  int receive(uint8_t *, size_t, int);
+};
+
+#endif
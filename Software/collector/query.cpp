@@ -0,0 +1,368 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    query.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// HTTP query service over the day files of the collector, see aggregate.h
+// GET /query?from=YYYYMMDD[&to=YYYYMMDD][&group=total|day|hour|meter][&meter=NAME][&top=N]
+// The result is CSV, streamed in chunks, and ends with a comment line that gives the day files read, the minutes
+// scanned and the time of each stage. "Top 20 meters yesterday" is group=meter&top=20 with the date of yesterday.
+// Requests are served one at a time, each of them on all the threads of the pool.
+// query [--dir DIR] [--port PORT] [--threads N]
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "aggregate.h"
+#include "store.h"
+
+#define QUERY_REQUEST_SIZE 2048 // Longest request line and headers
+#define QUERY_TIMEOUT 5 // Longest wait for the request [s]
+#define QUERY_CHUNK 4096 // Bytes of CSV sent at a time
+
+static volatile sig_atomic_t running = 1;
+
+static void stop(int)
+{
+  running = 0;
+}
+
+// Value of an argument of the target, empty when it is missing or too long, returns whether it was given
+static bool queryArg(const char * target, const char * name, char * value, size_t size)
+{
+  value[0] = '\0';
+  const char * arguments = strchr(target, '?');
+  size_t nameLength = strlen(name);
+  for(const char * argument = arguments; argument; argument = strchr(argument + 1, '&'))
+  {
+    argument++;
+    if(strncmp(argument, name, nameLength) != 0 || argument[nameLength] != '=')
+    {
+      continue;
+    }
+    const char * start = argument + nameLength + 1;
+    size_t length = strcspn(start, "& ");
+    if(length >= size)
+    {
+      return false;
+    }
+    memcpy(value, start, length);
+    value[length] = '\0';
+    return true;
+  }
+  return false;
+}
+
+// Days since 1970-01-01 of a YYYYMMDD date, 0 when it is not one
+static uint32_t parseDay(const char * date)
+{
+  struct tm elements = {};
+  if(strlen(date) != 8 || strspn(date, "0123456789") != 8 || sscanf(date, "%4d%2d%2d", &elements.tm_year, &elements.tm_mon, &elements.tm_mday) != 3
+    || elements.tm_mon < 1 || elements.tm_mon > 12 || elements.tm_mday < 1 || elements.tm_mday > 31)
+  {
+    return 0;
+  }
+  elements.tm_year -= 1900;
+  elements.tm_mon -= 1;
+  return timegm(&elements) / 86400;
+}
+
+static bool sendAll(int client, const char * data, size_t length)
+{
+  while(length)
+  {
+    ssize_t sent = send(client, data, length, MSG_NOSIGNAL);
+    if(sent <= 0)
+    {
+      return false;
+    }
+    data += sent;
+    length -= sent;
+  }
+  return true;
+}
+
+static void sendError(int client, const char * message)
+{
+  char response[256];
+  int length = snprintf(response, sizeof(response), "HTTP/1.1 400 Bad Request\r\nContent-Type: text/plain\r\nContent-Length: %zu\r\n"
+    "Connection: close\r\n\r\n%s", strlen(message), message);
+  sendAll(client, response, length);
+}
+
+// Rows are gathered in a block and sent as one chunk once it is nearly full
+struct Chunked
+{
+  int client;
+  char block[QUERY_CHUNK];
+  size_t length;
+  bool failed;
+};
+
+static void chunkFlush(Chunked * chunked)
+{
+  if(!chunked->length || chunked->failed)
+  {
+    return;
+  }
+  char header[16];
+  int headerLength = snprintf(header, sizeof(header), "%zx\r\n", chunked->length);
+  chunked->failed = !sendAll(chunked->client, header, headerLength) || !sendAll(chunked->client, chunked->block, chunked->length)
+    || !sendAll(chunked->client, "\r\n", 2);
+  chunked->length = 0;
+}
+
+static void chunkPrintf(Chunked * chunked, const char * format, ...) __attribute__((format(printf, 2, 3)));
+static void chunkPrintf(Chunked * chunked, const char * format, ...)
+{
+  // Rows are at most 64 characters long
+  if(chunked->length > sizeof(chunked->block) - 64)
+  {
+    chunkFlush(chunked);
+  }
+  va_list arguments;
+  va_start(arguments, format);
+  int length = vsnprintf(chunked->block + chunked->length, sizeof(chunked->block) - chunked->length, format, arguments);
+  va_end(arguments);
+  if(length > 0)
+  {
+    chunked->length += std::min((size_t)length, sizeof(chunked->block) - chunked->length - 1);
+  }
+}
+
+static void formatDay(char * buffer, size_t size, uint32_t day)
+{
+  time_t timestamp = (time_t)day * 86400;
+  struct tm date;
+  gmtime_r(&timestamp, &date);
+  snprintf(buffer, size, "%04d-%02d-%02d", date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+}
+
+static void serveQuery(int client, const char * target, const char * directory, AggregatePool & pool)
+{
+  char from[12], to[12], group[8], meter[STORE_NAME_LENGTH + 1], top[8];
+  AggregateQuery query;
+  queryArg(target, "from", from, sizeof(from));
+  query.from = parseDay(from);
+  query.to = queryArg(target, "to", to, sizeof(to)) ? parseDay(to) : query.from;
+  if(!queryArg(target, "group", group, sizeof(group)) || strcmp(group, "day") == 0)
+  {
+    query.group = AGGREGATE_DAY;
+  }
+  else if(strcmp(group, "total") == 0)
+  {
+    query.group = AGGREGATE_TOTAL;
+  }
+  else if(strcmp(group, "hour") == 0)
+  {
+    query.group = AGGREGATE_HOUR;
+  }
+  else if(strcmp(group, "meter") == 0)
+  {
+    query.group = AGGREGATE_METER;
+  }
+  else
+  {
+    sendError(client, "Bad group\n");
+    return;
+  }
+  bool meterGiven = queryArg(target, "meter", meter, sizeof(meter));
+  query.meter = meter;
+  query.top = queryArg(target, "top", top, sizeof(top)) ? strtoul(top, NULL, 10) : 0;
+  
+  std::vector<AggregateRow> rows;
+  std::vector<std::string> meters;
+  AggregateStats stats;
+  if(!query.from || !query.to || (meterGiven && query.meter.empty())
+    || !aggregateRun(directory, query, pool, rows, meters, stats))
+  {
+    sendError(client, "Bad range\n");
+    return;
+  }
+  
+  std::chrono::steady_clock::time_point timeSend = std::chrono::steady_clock::now();
+  static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+  Chunked chunked;
+  chunked.client = client;
+  chunked.length = 0;
+  chunked.failed = !sendAll(client, header, sizeof(header) - 1);
+  
+  char date[16];
+  switch(query.group)
+  {
+    case AGGREGATE_TOTAL:
+      chunkPrintf(&chunked, "From,To,Power [Wh]\n");
+      formatDay(date, sizeof(date), query.from);
+      chunkPrintf(&chunked, "%s,", date);
+      formatDay(date, sizeof(date), query.to);
+      chunkPrintf(&chunked, "%s,%llu\n", date, (unsigned long long)(rows.size() ? rows[0].power : 0));
+      break;
+    case AGGREGATE_DAY:
+      chunkPrintf(&chunked, "Date,Power [Wh]\n");
+      for(size_t i = 0; i < rows.size() && !chunked.failed; i++)
+      {
+        formatDay(date, sizeof(date), query.from + rows[i].key);
+        chunkPrintf(&chunked, "%s,%llu\n", date, (unsigned long long)rows[i].power);
+      }
+      break;
+    case AGGREGATE_HOUR:
+      chunkPrintf(&chunked, "Timestamp,Power [Wh]\n");
+      for(size_t i = 0; i < rows.size() && !chunked.failed; i++)
+      {
+        formatDay(date, sizeof(date), query.from + rows[i].key / STORE_HOURS);
+        chunkPrintf(&chunked, "%sT%02u:00Z,%llu\n", date, rows[i].key % STORE_HOURS, (unsigned long long)rows[i].power);
+      }
+      break;
+    case AGGREGATE_METER:
+      chunkPrintf(&chunked, "Meter,Power [Wh]\n");
+      for(size_t i = 0; i < rows.size() && !chunked.failed; i++)
+      {
+        chunkPrintf(&chunked, "%s,%llu\n", meters[rows[i].key].c_str(), (unsigned long long)rows[i].power);
+      }
+      break;
+  }
+  double send = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - timeSend).count();
+  chunkPrintf(&chunked, "# %llu days, %llu rows, %zu meters, %.1fms list, %.1fms scan on %u threads, %.1fms merge, %.1fms send\n",
+    (unsigned long long)stats.days, (unsigned long long)stats.rows, meters.size(), stats.list, stats.scan, pool.size(),
+    stats.merge, send);
+  chunkFlush(&chunked);
+  if(!chunked.failed)
+  {
+    sendAll(client, "0\r\n\r\n", 5);
+  }
+}
+
+static void serve(int client, const char * directory, AggregatePool & pool)
+{
+  struct timeval timeout = {QUERY_TIMEOUT, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  char request[QUERY_REQUEST_SIZE];
+  size_t length = 0;
+  while(length < sizeof(request) - 1)
+  {
+    ssize_t count = recv(client, request + length, sizeof(request) - 1 - length, 0);
+    if(count <= 0)
+    {
+      return;
+    }
+    length += count;
+    request[length] = '\0';
+    if(strstr(request, "\r\n\r\n"))
+    {
+      break;
+    }
+  }
+  
+  // Only the path and the arguments of the request line are used
+  char target[QUERY_REQUEST_SIZE];
+  if(sscanf(request, "GET %2047s HTTP/", target) != 1)
+  {
+    sendError(client, "Bad request\n");
+  }
+  else if(strncmp(target, "/query", 6) == 0 && (target[6] == '\0' || target[6] == '?'))
+  {
+    serveQuery(client, target, directory, pool);
+  }
+  else
+  {
+    sendError(client, "Unknown path, use /query?from=YYYYMMDD&to=YYYYMMDD&group=total|day|hour|meter\n");
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  const char * directory = "data";
+  uint16_t port = 8081;
+  unsigned threads = std::thread::hardware_concurrency();
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+    {
+      directory = argv[++i];
+    }
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+    {
+      port = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      threads = value > 0 ? value : 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--dir DIR] [--port PORT] [--threads N]\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  if(listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 16) != 0)
+  {
+    perror("query");
+    return 1;
+  }
+  
+  // SIGINT stops accept() without SA_RESTART
+  struct sigaction action = {};
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  
+  AggregatePool pool(threads ? threads : 1);
+  printf("Queries of %s on http://0.0.0.0:%u/query with %u threads\n", directory, port, pool.size());
+  fflush(stdout);
+  while(running)
+  {
+    int client = accept(listener, NULL, NULL);
+    if(client < 0)
+    {
+      continue;
+    }
+    serve(client, directory, pool);
+    close(client);
+  }
+  close(listener);
+  return 0;
+}
@@ -0,0 +1,323 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    store.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "payload.h"
+#include "store.h"
+
+#define SECS_PER_DAY 86400UL
+
+// A meter name becomes a directory name, only letters, digits, '-' and '_' are accepted
+bool storeMeterName(const char * name, size_t length)
+{
+  if(length == 0 || length > STORE_NAME_LENGTH)
+  {
+    return false;
+  }
+  for(size_t i = 0; i < length; i++)
+  {
+    char c = name[i];
+    if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-' || c == '_'))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Path of the file of a meter-day: <directory>/<meter>/YYYYMMDD.bin
+void storeFileName(char * buffer, size_t size, const char * directory, const char * meter, uint32_t day)
+{
+  time_t timestamp = (time_t)day * SECS_PER_DAY;
+  struct tm date;
+  gmtime_r(&timestamp, &date);
+  snprintf(buffer, size, "%s/%s/%04d%02d%02d.bin", directory, meter, date.tm_year + 1900, date.tm_mon + 1, date.tm_mday);
+}
+
+// Days are written under the directory, at most the given number of them stay mapped
+Store::Store(const char * _directory, size_t capacity)
+{
+  directory = _directory;
+  mappings.reserve(capacity ? capacity : 1);
+  mappingIndex.reserve(capacity ? capacity : 1);
+}
+
+Store::~Store()
+{
+  for(size_t i = 0; i < mappings.size(); i++)
+  {
+    munmap(mappings[i].day, sizeof(StoreDay));
+  }
+}
+
+// Map the file of a meter-day, it is created with empty slots when asked, returns NULL on failure
+StoreDay * Store::map(const char * meter, size_t meterLength, uint32_t day, bool create)
+{
+  clock++;
+  
+  std::string name(meter, meterLength);
+  std::unordered_map<std::string, uint32_t>::iterator meterFound = meterIndex.find(name);
+  uint32_t number;
+  if(meterFound == meterIndex.end())
+  {
+    number = meterNames.size();
+    meterIndex[name] = number;
+    meterNames.push_back(name);
+  }
+  else
+  {
+    number = meterFound->second;
+  }
+  
+  uint64_t key = (uint64_t)number << 32 | day;
+  std::unordered_map<uint64_t, size_t>::iterator found = mappingIndex.find(key);
+  if(found != mappingIndex.end())
+  {
+    mappings[found->second].used = clock;
+    return mappings[found->second].day;
+  }
+  
+  char path[512];
+  if(create)
+  {
+    snprintf(path, sizeof(path), "%s/%s", directory.c_str(), name.c_str());
+    if(mkdir(path, 0755) != 0 && errno != EEXIST)
+    {
+      return NULL;
+    }
+  }
+  storeFileName(path, sizeof(path), directory.c_str(), name.c_str(), day);
+  int file = open(path, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+  if(file < 0)
+  {
+    return NULL;
+  }
+  
+  // A file shorter than a day was just created, or cut short: it starts over with empty slots
+  struct stat status;
+  bool empty = fstat(file, &status) != 0 || status.st_size < (off_t)sizeof(StoreDay);
+  if(empty && (!create || ftruncate(file, sizeof(StoreDay)) != 0))
+  {
+    close(file);
+    return NULL;
+  }
+  void * address = mmap(NULL, sizeof(StoreDay), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  close(file);
+  if(address == MAP_FAILED)
+  {
+    return NULL;
+  }
+  
+  StoreDay * mapped = (StoreDay *)address;
+  if(empty)
+  {
+    mapped->magic = STORE_MAGIC;
+    mapped->day = day;
+    memset(mapped->minutes, 0xff, sizeof(mapped->minutes));
+    memset(mapped->hours, 0xff, sizeof(mapped->hours));
+  }
+  else if(mapped->magic != STORE_MAGIC || mapped->day != day)
+  {
+    munmap(address, sizeof(StoreDay));
+    return NULL;
+  }
+  stats.mapped++;
+  
+  // Make room by unmapping the day that was used the longest time ago
+  size_t slot = mappings.size();
+  if(slot == mappings.capacity())
+  {
+    slot = 0;
+    for(size_t i = 1; i < mappings.size(); i++)
+    {
+      if(mappings[i].used < mappings[slot].used)
+      {
+        slot = i;
+      }
+    }
+    munmap(mappings[slot].day, sizeof(StoreDay));
+    mappingIndex.erase(mappings[slot].key);
+    stats.evicted++;
+  }
+  else
+  {
+    mappings.push_back(Mapping());
+  }
+  mappings[slot].key = key;
+  mappings[slot].day = mapped;
+  mappings[slot].used = clock;
+  mappingIndex[key] = slot;
+  return mapped;
+}
+
+// "<index>,<Wh>" lines, the minute (or hour) of the day without a date: a slot later in the day than the time the
+// message was received was sent before midnight, it was replayed after the connection came back
+bool Store::parseText(const char * meter, size_t meterLength, bool hourly, const uint8_t * payload, size_t length, time_t received)
+{
+  uint32_t today = received / SECS_PER_DAY;
+  uint32_t secondOfDay = received % SECS_PER_DAY;
+  uint32_t slots = hourly ? STORE_HOURS : STORE_MINUTES;
+  uint32_t latest = hourly ? secondOfDay / 3600 : secondOfDay / 60 + STORE_SLACK;
+  
+  size_t i = 0;
+  while(i < length)
+  {
+    uint32_t numbers[2] = {0, 0};
+    for(uint8_t field = 0; field < 2; field++)
+    {
+      size_t start = i;
+      while(i < length && payload[i] >= '0' && payload[i] <= '9' && i - start < 9)
+      {
+        numbers[field] = numbers[field] * 10 + payload[i] - '0';
+        i++;
+      }
+      char separator = field == 0 ? ',' : '\n';
+      if(i == start || (i < length && payload[i] != separator) || (field == 0 && i == length))
+      {
+        return false;
+      }
+      i++;
+    }
+    
+    if(numbers[0] >= slots)
+    {
+      return false;
+    }
+    StoreDay * day = map(meter, meterLength, numbers[0] > latest ? today - 1 : today, true);
+    if(!day)
+    {
+      return false;
+    }
+    (hourly ? day->hours : day->minutes)[numbers[0]] = numbers[1];
+    stats.values++;
+  }
+  return true;
+}
+
+// Records of payload.h, each one tells the minute since 1970 at which its period starts
+bool Store::parseBinary(const char * meter, size_t meterLength, bool hourly, const uint8_t * payload, size_t length)
+{
+  size_t count = payload_count(length);
+  for(size_t i = 0; i < count; i++)
+  {
+    payload_record_t record;
+    if(!payload_decode(payload, length, i, &record))
+    {
+      return false;
+    }
+    StoreDay * day = map(meter, meterLength, record.epoch_minute / STORE_MINUTES, true);
+    if(!day)
+    {
+      return false;
+    }
+    uint32_t minute = record.epoch_minute % STORE_MINUTES;
+    if(hourly)
+    {
+      day->hours[minute / 60] = record.power;
+    }
+    else
+    {
+      day->minutes[minute] = record.power;
+    }
+    stats.values++;
+  }
+  return true;
+}
+
+// Store a message received at the given time, "<meter>/powerCounterMinute" and "<meter>/powerCounterHour" are kept
+// and the other topics ignored. Returns false when the message could not be stored.
+bool Store::ingest(const char * topic, size_t topicLength, const uint8_t * payload, size_t length, time_t received)
+{
+  const char * slash = (const char *)memrchr(topic, '/', topicLength);
+  if(!slash || !storeMeterName(topic, slash - topic))
+  {
+    stats.rejected++;
+    return false;
+  }
+  
+  const char * name = slash + 1;
+  size_t nameLength = topic + topicLength - name;
+  bool hourly;
+  if(nameLength == 18 && memcmp(name, "powerCounterMinute", 18) == 0)
+  {
+    hourly = false;
+  }
+  else if(nameLength == 16 && memcmp(name, "powerCounterHour", 16) == 0)
+  {
+    hourly = true;
+  }
+  else
+  {
+    stats.ignored++;
+    return true;
+  }
+  
+  // Text always starts with a digit, binary records with their version
+  bool stored;
+  if(length && payload[0] == PAYLOAD_VERSION && length % PAYLOAD_RECORD_SIZE == 0)
+  {
+    stored = parseBinary(topic, slash - topic, hourly, payload, length);
+  }
+  else
+  {
+    stored = length && parseText(topic, slash - topic, hourly, payload, length, received);
+  }
+  
+  if(stored)
+  {
+    stats.messages++;
+  }
+  else
+  {
+    stats.rejected++;
+  }
+  return stored;
+}
+
+// The day of a meter as it is on disk, NULL if nothing was received for it
+// The data is not copied: it stays valid until the store has mapped as many other days as it can hold
+const StoreDay * Store::read(const char * meter, uint32_t day)
+{
+  return map(meter, strlen(meter), day, false);
+}
+
+// Ask the kernel to write the mapped days to disk, they are written in the background anyway
+void Store::flush()
+{
+  for(size_t i = 0; i < mappings.size(); i++)
+  {
+    msync(mappings[i].day, sizeof(StoreDay), MS_ASYNC);
+  }
+}
@@ -0,0 +1,107 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    store.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Storage of the collector: every meter-day is a file of fixed slots, one per minute and one per hour, mapped in
+// memory. A message is written straight to its slots and a day is read in place, without copying or parsing.
+// Only a bounded number of days stay mapped, the least recently used one is unmapped to make room for another.
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define STORE_MAGIC 0x504d4431 // "PMD1", marks a day file of the collector
+#define STORE_MINUTES 1440
+#define STORE_HOURS 24
+#define STORE_EMPTY 0xffffffffUL // Slot for which no value was received
+#define STORE_NAME_LENGTH 32 // Longest meter name, the topic prefix: the chip ID or the host name
+#define STORE_SLACK 5 // Minutes a meter clock may be ahead of the collector before a minute is taken for yesterday's
+
+// Layout of a day file, in the byte order of the collector
+struct StoreDay
+{
+  uint32_t magic;
+  uint32_t day;                     // Days since 1970-01-01
+  uint32_t reserved[2];
+  uint32_t minutes[STORE_MINUTES];  // Energy of each minute of the day [Wh]
+  uint32_t hours[STORE_HOURS];      // Energy of each hour of the day [Wh]
+};
+
+// Counters of what was received, for the statistics of the collector and the benchmark
+struct StoreStats
+{
+  uint64_t messages;  // Minute and hour messages stored
+  uint64_t values;    // Slots written
+  uint64_t ignored;   // Messages of other topics
+  uint64_t rejected;  // Messages with a bad topic or payload
+  uint64_t mapped;    // Day files mapped
+  uint64_t evicted;   // Day files unmapped to make room
+};
+
+class Store
+{
+  private:
+  struct Mapping
+  {
+    uint64_t key;   // Meter number in the high half, day in the low half
+    StoreDay * day;
+    uint64_t used;  // Time of the last use, in calls to the store
+  };
+  
+  std::string directory;
+  std::vector<Mapping> mappings;
+  std::unordered_map<uint64_t, size_t> mappingIndex;
+  std::unordered_map<std::string, uint32_t> meterIndex;
+  std::vector<std::string> meterNames;
+  uint64_t clock = 0;
+  
+  StoreDay * map(const char *, size_t, uint32_t, bool);
+  bool parseText(const char *, size_t, bool, const uint8_t *, size_t, time_t);
+  bool parseBinary(const char *, size_t, bool, const uint8_t *, size_t);
+  
+  public:
+  StoreStats stats = {};
+  
+  Store(const char *, size_t);
+  ~Store();
+  
+  bool ingest(const char *, size_t, const uint8_t *, size_t, time_t);
+  const StoreDay * read(const char *, uint32_t);
+  void flush();
+};
+
+bool storeMeterName(const char *, size_t);
+void storeFileName(char *, size_t, const char *, const char *, uint32_t);
+
+#endif
@@ -0,0 +1,72 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    alloc.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <new>
+#include <stdlib.h>
+
+#include "alloc.h"
+
+unsigned long allocations = 0;
+
+extern "C" void * __real_malloc(size_t);
+extern "C" void * __real_calloc(size_t, size_t);
+extern "C" void * __real_realloc(void *, size_t);
+
+extern "C" void * __wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+extern "C" void * __wrap_calloc(size_t count, size_t size)
+{
+  allocations++;
+  return __real_calloc(count, size);
+}
+
+extern "C" void * __wrap_realloc(void * pointer, size_t size)
+{
+  allocations++;
+  return __real_realloc(pointer, size);
+}
+
+void * operator new(size_t size)
+{
+  allocations++;
+  void * pointer = __real_malloc(size ? size : 1);
+  if(!pointer)
+  {
+    throw std::bad_alloc();
+  }
+  return pointer;
+}
+
+void operator delete(void * pointer) noexcept
+{
+  free(pointer);
+}
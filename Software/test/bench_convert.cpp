@@ -0,0 +1,158 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    bench_convert.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Throughput of the day log converter in MB/s, on one thread and on all of them
+// The day log files are written in both dialects, converted into a new card each time, and every day is read back
+// with readDay() of the firmware, from the archive alone.
+// bench_convert [--days N] [--threads T]
+
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Arduino.h>
+#include <TimeLib.h>
+
+#include "series.h"
+#include "convert.h"
+#include "test.h"
+
+#define BENCH_FIRST_DAY 1577836800 // 2020-01-01T00:00Z
+
+static uint16_t energy(uint32_t day, uint16_t minute)
+{
+  return (day * 31 + minute * 7) % 1200;
+}
+
+static int removeEntry(const char * path, const struct stat *, int, struct FTW *)
+{
+  return remove(path);
+}
+
+// Even days in the current dialect of logData(), odd days in the old one
+static bool writeDays(const char * directory, uint32_t days, std::vector<std::string> & paths)
+{
+  char path[256];
+  for(uint32_t day = 0; day < days; day++)
+  {
+    time_t timestamp = BENCH_FIRST_DAY + day * SECS_PER_DAY;
+    snprintf(path, sizeof(path), "%s/%04d%02d%02d.csv", directory, year(timestamp), month(timestamp), ::day(timestamp));
+    FILE * file = fopen(path, "wb");
+    if(!file)
+    {
+      perror(path);
+      return false;
+    }
+    bool current = day % 2 == 0;
+    fputs(current ? "Timestamp,Power [W*min]\r\n" : "Time,Wh\n", file);
+    for(uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+    {
+      if(current)
+      {
+        fprintf(file, "%04d-%02d-%02dT%02d:%02dZ,%u\r\n", year(timestamp), month(timestamp), ::day(timestamp), minute / 60,
+          minute % 60, energy(day, minute));
+      }
+      else
+      {
+        fprintf(file, "%02d:%02d,%u\n", minute / 60, minute % 60, energy(day, minute));
+      }
+    }
+    fclose(file);
+    paths.push_back(path);
+  }
+  return true;
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t days = 365;
+  unsigned threads = std::thread::hardware_concurrency();
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--days") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      days = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      threads = value > 0 ? value : 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--days N] [--threads T]\n", argv[0]);
+      return 2;
+    }
+  }
+  threads = threads ? threads : 1;
+  
+  char source[] = "/tmp/convertXXXXXX";
+  std::vector<std::string> paths;
+  if(!mkdtemp(source) || !writeDays(source, days, paths))
+  {
+    return 1;
+  }
+  
+  static uint16_t series[MINUTES_PER_DAY];
+  unsigned counts[] = {1, threads};
+  for(uint8_t run = 0; run < 2; run++)
+  {
+    // A new card for every run, as the archive is appended to
+    const char * card = testCard();
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ConvertStats stats;
+    CHECK(convertFiles(paths, card, counts[run], stats));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%u threads: %u days, %.1f MB in %.3f s: %.1f MB/s, %.1f MB archived\n", counts[run], stats.days,
+      stats.bytesRead / 1e6, seconds, stats.bytesRead / 1e6 / seconds, stats.bytesWritten / 1e6);
+    CHECK_EQUAL(days, stats.days);
+    CHECK_EQUAL(0, stats.skipped);
+    
+    // The card has no /power, every day comes from the archive
+    for(uint32_t day = 0; day < days; day++)
+    {
+      CHECK_EQUAL(MINUTES_PER_DAY, readDay(BENCH_FIRST_DAY + day * SECS_PER_DAY, series));
+      uint16_t differences = 0;
+      for(uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+      {
+        differences += series[minute] != energy(day, minute);
+      }
+      CHECK_EQUAL(0, differences);
+    }
+  }
+  
+  nftw(source, removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+  return testResult("bench_convert");
+}
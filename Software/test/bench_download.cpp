@@ -0,0 +1,182 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    bench_download.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Download throughput of the web server of the SD firmware on the host, in KB/s
+// The files are sent by streamFileRange(), through the server of the firmware, and compared with a plain copy in small
+// blocks like the generic streamFile() of the core does. Every byte received is checked.
+// The network stack of the stand-in takes at most TCP_SND_BUF bytes at a time like the one of the ESP8266, but the SD
+// card is a file of the host, so the figures only compare the two paths on the same machine.
+// bench_download [--size KB] [--count N]
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <SD.h>
+
+#include "request.h"
+#include "server.h"
+#include "test.h"
+#include "http.h"
+
+#define BENCH_COPY_BLOCK 128 // Block of the plain copy [B]
+
+extern ESP8266WebServer server;
+
+static std::atomic<bool> running(true);
+
+static uint64_t realMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Plain copy from the card to the client, one small block after the other
+static void copyFile()
+{
+  File dataFile = SD.open("/bench.bin");
+  server.setContentLength(dataFile.size());
+  server.send(200, "application/octet-stream", "");
+  
+  WiFiClient client = server.client();
+  uint8_t block[BENCH_COPY_BLOCK];
+  int count;
+  while((count = dataFile.read(block, sizeof(block))) > 0)
+  {
+    if(client.write(block, count) != (size_t)count)
+    {
+      break;
+    }
+  }
+  dataFile.close();
+}
+
+struct BenchCase
+{
+  const char * name;
+  const char * target;
+  const char * headers;
+  uint32_t first; // Part of the file expected
+  uint32_t length;
+};
+
+// Download each case a number of times, returns the number of failed downloads
+static int bench(const BenchCase * cases, uint8_t caseCount, uint8_t count, const std::vector<uint8_t> & content)
+{
+  int failures = 0;
+  std::vector<uint8_t> body(content.size());
+  
+  printf("%-8s %10s %10s %10s\n", "Path", "Size [KB]", "Downloads", "KB/s");
+  for(uint8_t i = 0; i < caseCount; i++)
+  {
+    const BenchCase & c = cases[i];
+    uint64_t bytes = 0;
+    uint64_t timeStart = realMicros();
+    for(uint8_t n = 0; n < count; n++)
+    {
+      HttpResponse response;
+      if(!httpGet(c.target, c.headers, body.data(), body.size(), &response) || response.status / 100 != 2
+        || response.length != c.length || memcmp(body.data(), content.data() + c.first, c.length) != 0)
+      {
+        printf("%s: download %u failed, status %d, %llu bytes\n", c.name, n, response.status, (unsigned long long)response.length);
+        failures++;
+      }
+      bytes += response.length;
+    }
+    double seconds = (realMicros() - timeStart) / 1e6;
+    printf("%-8s %10u %10u %10.0f\n", c.name, c.length / 1024, count, bytes / 1024.0 / seconds);
+  }
+  return failures;
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t size = 1024;
+  uint8_t count = 10;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+    {
+      size = max(atoi(argv[++i]), 1);
+    }
+    else if(strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      count = constrain(value, 1, 255);
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--size KB] [--count N]\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  // A file that is not a multiple of the sector size, with a different byte at every position of a sector
+  testCard();
+  std::vector<uint8_t> content(size * 1024 + 100);
+  for(size_t i = 0; i < content.size(); i++)
+  {
+    content[i] = i * 7 + i / 251;
+  }
+  File file = SD.open("/bench.bin", FILE_WRITE);
+  file.write(content.data(), content.size());
+  file.close();
+  
+  hostPortMap(80, 0);
+  initServer();
+  server.on("/copy", HTTP_GET, copyFile);
+  httpBegin(hostPortBound(80));
+  
+  // The firmware serves the requests on this thread, like its loop does
+  std::thread firmware([]()
+  {
+    while(running)
+    {
+      handleClient();
+    }
+  });
+  
+  // A range that starts and ends in the middle of sectors, like a resumed download
+  uint32_t length = content.size();
+  char range[48];
+  snprintf(range, sizeof(range), "Range: bytes=1000-%u\r\n", length - 1001);
+  const BenchCase cases[] = {
+    {"stream", "/bench.bin", NULL, 0, length},
+    {"range", "/bench.bin", range, 1000, length - 2000},
+    {"copy", "/copy", NULL, 0, length}
+  };
+  testFailures = bench(cases, sizeof(cases) / sizeof(cases[0]), count, content);
+  
+  running = false;
+  firmware.join();
+  return testResult("bench_download");
+}
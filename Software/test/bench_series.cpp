@@ -0,0 +1,200 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    bench_series.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Time of the rollup kernels of series.cpp against plain loops, in nanoseconds per day of minutes
+// Both are built with -Os like the firmware, on the PC, so only the ratio tells something about the ESP8266. Every
+// kernel is checked against its plain loop on random days.
+// bench_series [--count N]
+
+#include <time.h>
+
+#include <Arduino.h>
+
+#include "series.h"
+#include "test.h"
+
+#define BENCH_DAYS 16 // Different days in the working set
+
+static uint16_t days[BENCH_DAYS][MINUTES_PER_DAY];
+static uint32_t total[MINUTES_PER_DAY];
+
+static uint64_t realNanos()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// The plain loops the kernels replace
+__attribute__((noinline)) static uint32_t scalarSum(const uint16_t * series, uint16_t length)
+{
+  uint32_t sum = 0;
+  for(uint16_t i = 0; i < length; i++)
+  {
+    sum += series[i];
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static uint16_t scalarMin(const uint16_t * series, uint16_t length)
+{
+  uint16_t minimum = 0xffff;
+  for(uint16_t i = 0; i < length; i++)
+  {
+    if(series[i] < minimum)
+    {
+      minimum = series[i];
+    }
+  }
+  return minimum;
+}
+
+__attribute__((noinline)) static uint16_t scalarMax(const uint16_t * series, uint16_t length)
+{
+  uint16_t maximum = 0;
+  for(uint16_t i = 0; i < length; i++)
+  {
+    if(series[i] > maximum)
+    {
+      maximum = series[i];
+    }
+  }
+  return maximum;
+}
+
+__attribute__((noinline)) static void scalarHourly(const uint16_t * series, uint32_t * hours)
+{
+  for(uint8_t hour = 0; hour < 24; hour++)
+  {
+    hours[hour] = scalarSum(series + hour * 60, 60);
+  }
+}
+
+__attribute__((noinline)) static void scalarAccumulate(uint32_t * total, const uint16_t * series, uint16_t length)
+{
+  for(uint16_t i = 0; i < length; i++)
+  {
+    total[i] += series[i];
+  }
+}
+
+// Result of every call, so that none of them is left out by the compiler
+static volatile uint32_t sink;
+
+enum
+{
+  KERNEL_SUM,
+  KERNEL_MIN,
+  KERNEL_MAX,
+  KERNEL_HOURLY,
+  KERNEL_ACCUMULATE,
+  KERNEL_COUNT
+};
+
+static const char * names[KERNEL_COUNT] = {"sum", "min", "max", "hourly", "accumulate"};
+
+static uint32_t call(uint8_t kernel, bool scalar, const uint16_t * series)
+{
+  uint32_t hours[24];
+  switch(kernel)
+  {
+    case KERNEL_SUM:
+      return scalar ? scalarSum(series, MINUTES_PER_DAY) : seriesSum(series, MINUTES_PER_DAY);
+    case KERNEL_MIN:
+      return scalar ? scalarMin(series, MINUTES_PER_DAY) : seriesMin(series, MINUTES_PER_DAY);
+    case KERNEL_MAX:
+      return scalar ? scalarMax(series, MINUTES_PER_DAY) : seriesMax(series, MINUTES_PER_DAY);
+    case KERNEL_HOURLY:
+      scalar ? scalarHourly(series, hours) : seriesHourly(series, hours);
+      return hours[0] ^ hours[11] ^ hours[23];
+    default:
+      scalar ? scalarAccumulate(total, series, MINUTES_PER_DAY) : seriesAccumulate(total, series, MINUTES_PER_DAY);
+      return total[0] ^ total[MINUTES_PER_DAY - 1];
+  }
+}
+
+// Nanoseconds per day
+static double measure(uint8_t kernel, bool scalar, uint32_t count)
+{
+  uint64_t start = realNanos();
+  for(uint32_t i = 0; i < count; i++)
+  {
+    sink = call(kernel, scalar, days[i % BENCH_DAYS]);
+  }
+  return (double)(realNanos() - start) / count;
+}
+
+int main(int argc, char ** argv)
+{
+  uint32_t count = 100000;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      count = value > 0 ? value : 1;
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--count N]\n", argv[0]);
+      return 2;
+    }
+  }
+  
+  // Random days, with a few short extremes so that the minimum and the maximum are not at the ends
+  srand(1);
+  for(uint8_t day = 0; day < BENCH_DAYS; day++)
+  {
+    for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+    {
+      days[day][i] = 1000 + rand() % 60000;
+    }
+    days[day][rand() % MINUTES_PER_DAY] = rand() % 1000;
+    days[day][rand() % MINUTES_PER_DAY] = 61000 + rand() % 4536;
+  }
+  
+  printf("%-12s %12s %12s %8s\n", "Kernel", "Plain ns", "Kernel ns", "Ratio");
+  for(uint8_t kernel = 0; kernel < KERNEL_COUNT; kernel++)
+  {
+    // Both give the same results, the running total starts from the same values
+    for(uint8_t day = 0; day < BENCH_DAYS; day++)
+    {
+      memset(total, 0, sizeof(total));
+      uint32_t scalar = call(kernel, true, days[day]);
+      memset(total, 0, sizeof(total));
+      CHECK_EQUAL(scalar, call(kernel, false, days[day]));
+    }
+    
+    // Warm up the caches, then the plain loop and the kernel one after the other
+    measure(kernel, true, count / 10 + 1);
+    double plain = measure(kernel, true, count);
+    double unrolled = measure(kernel, false, count);
+    printf("%-12s %12.1f %12.1f %7.2fx\n", names[kernel], plain, unrolled, plain / unrolled);
+  }
+  return testResult("bench_series");
+}
@@ -0,0 +1,238 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    convert.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Day log files of /power become days of the archive like the compaction job of the SD firmware writes them, with
+// the parser of series.cpp and the encoder of archive.cpp. The files are mapped in memory and parsed in place. The
+// months are shared between the threads, so that every archive file is written by a single thread in the order of the
+// days; a month already in the output is appended to, like on the card.
+
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+#include <Arduino.h>
+
+#include "series.h"
+#include "archive.h"
+#include "convert.h"
+
+struct ConvertDay
+{
+  uint8_t day;         // Day of the month
+  std::string path;
+};
+
+struct ConvertMonth
+{
+  std::string data;    // Paths of the .bin and .idx files
+  std::string index;
+  std::vector<ConvertDay> days;
+};
+
+// Date of a day log file from its name, YYYYMMDD.csv, false when it has none
+static bool fileDate(const std::string & path, struct tm * date)
+{
+  size_t slash = path.rfind('/');
+  const char * name = path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  memset(date, 0, sizeof(*date));
+  if(strlen(name) < 8 || strspn(name, "0123456789") < 8 || sscanf(name, "%4d%2d%2d", &date->tm_year, &date->tm_mon, &date->tm_mday) != 3
+    || date->tm_mon < 1 || date->tm_mon > 12 || date->tm_mday < 1 || date->tm_mday > 31)
+  {
+    return false;
+  }
+  return true;
+}
+
+// Parse a whole file in place, returns the number of rows
+static uint16_t parseFile(const char * path, uint16_t * series, uint64_t * size)
+{
+  SeriesParser parser;
+  parser.begin(series);
+  int file = open(path, O_RDONLY);
+  if(file < 0)
+  {
+    return 0;
+  }
+  struct stat info;
+  if(fstat(file, &info) != 0 || info.st_size == 0)
+  {
+    close(file);
+    return 0;
+  }
+  void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if(data == MAP_FAILED)
+  {
+    return 0;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+  parser.feed((const uint8_t *)data, info.st_size);
+  parser.finish();
+  munmap(data, info.st_size);
+  *size = info.st_size;
+  return parser.rows;
+}
+
+// Append the days of a month to its archive files, the index entry of a day only once its data is written
+static void convertMonth(const ConvertMonth & month, ConvertStats & stats)
+{
+  FILE * data = fopen(month.data.c_str(), "ab");
+  FILE * index = fopen(month.index.c_str(), "ab");
+  if(!data || !index)
+  {
+    stats.skipped += month.days.size();
+    if(data)
+    {
+      fclose(data);
+    }
+    if(index)
+    {
+      fclose(index);
+    }
+    return;
+  }
+  
+  static thread_local uint16_t series[MINUTES_PER_DAY];
+  // A difference takes at most 3 bytes
+  static thread_local uint8_t block[MINUTES_PER_DAY * 3];
+  uint32_t offset = ftell(data);
+  for(size_t i = 0; i < month.days.size(); i++)
+  {
+    uint64_t size = 0;
+    if(!parseFile(month.days[i].path.c_str(), series, &size))
+    {
+      stats.skipped++;
+      continue;
+    }
+    
+    uint32_t length = 0;
+    uint16_t previous = 0;
+    for(uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+    {
+      length += archiveEncode(block + length, series[minute], previous);
+      previous = series[minute];
+    }
+    uint8_t entry[ARCHIVE_INDEX_ENTRY];
+    entry[0] = month.days[i].day;
+    for(uint8_t b = 0; b < 4; b++)
+    {
+      entry[1 + b] = offset >> (8 * b);
+      entry[5 + b] = length >> (8 * b);
+    }
+    if(fwrite(block, 1, length, data) != length || fwrite(entry, 1, sizeof(entry), index) != sizeof(entry))
+    {
+      stats.skipped++;
+      break;
+    }
+    offset += length;
+    stats.days++;
+    stats.bytesRead += size;
+    stats.bytesWritten += length + sizeof(entry);
+  }
+  fclose(data);
+  fclose(index);
+}
+
+// Archive the given day log files under output/archive, on the given number of threads
+bool convertFiles(const std::vector<std::string> & paths, const char * output, unsigned threads, ConvertStats & stats)
+{
+  memset(&stats, 0, sizeof(stats));
+  stats.files = paths.size();
+  std::string directory = std::string(output) + "/archive";
+  mkdir(output, 0755);
+  mkdir(directory.c_str(), 0755);
+  struct stat info;
+  if(stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+  {
+    return false;
+  }
+  
+  // Every month with its days in order, days given twice are archived twice and the last one counts, like on the card
+  std::map<uint32_t, ConvertMonth> byMonth;
+  for(size_t i = 0; i < paths.size(); i++)
+  {
+    struct tm date;
+    if(!fileDate(paths[i], &date))
+    {
+      stats.skipped++;
+      continue;
+    }
+    ConvertMonth & month = byMonth[date.tm_year * 100 + date.tm_mon];
+    if(month.data.empty())
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "/%04d%02d.", date.tm_year, date.tm_mon);
+      month.data = directory + name + "bin";
+      month.index = directory + name + "idx";
+    }
+    month.days.push_back({(uint8_t)date.tm_mday, paths[i]});
+  }
+  std::vector<ConvertMonth *> months;
+  for(std::map<uint32_t, ConvertMonth>::iterator month = byMonth.begin(); month != byMonth.end(); ++month)
+  {
+    std::stable_sort(month->second.days.begin(), month->second.days.end(), [](const ConvertDay & a, const ConvertDay & b)
+    {
+      return a.day < b.day;
+    });
+    months.push_back(&month->second);
+  }
+  
+  // Each thread takes the next month, with its own counters
+  threads = std::max(1U, std::min(threads, (unsigned)months.size()));
+  std::vector<ConvertStats> counters(threads, ConvertStats());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for(unsigned t = 0; t < threads; t++)
+  {
+    workers.push_back(std::thread([&, t]
+    {
+      size_t month;
+      while((month = next++) < months.size())
+      {
+        convertMonth(*months[month], counters[t]);
+      }
+    }));
+  }
+  for(unsigned t = 0; t < threads; t++)
+  {
+    workers[t].join();
+    stats.days += counters[t].days;
+    stats.skipped += counters[t].skipped;
+    stats.bytesRead += counters[t].bytesRead;
+    stats.bytesWritten += counters[t].bytesWritten;
+  }
+  return true;
+}
@@ -0,0 +1,50 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    convert.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Conversion of day log files to the archive of the SD firmware on a PC, see convert_main.cpp
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+struct ConvertStats
+{
+  uint32_t files;      // Day log files given
+  uint32_t days;       // Days archived
+  uint32_t skipped;    // Files without a date in their name or without any row
+  uint64_t bytesRead;  // Size of the day log files archived
+  uint64_t bytesWritten; // Data and index written to the archive
+};
+
+bool convertFiles(const std::vector<std::string> &, const char *, unsigned, ConvertStats &);
+
+#endif
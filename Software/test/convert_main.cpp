@@ -0,0 +1,119 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    convert_main.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Archive day log files on a PC, for the cards of many meters at once. The output directory gets archive/YYYYMM.bin
+// and .idx files that can be copied to the root of a card, they are read like the ones the firmware writes.
+// Directories are searched for .csv files, whose names start with the date as YYYYMMDD like in /power.
+// convert [--threads N] [--output DIR] FILE|DIR...
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <thread>
+
+#include "convert.h"
+
+static void addPath(const std::string & path, std::vector<std::string> & paths)
+{
+  struct stat info;
+  if(stat(path.c_str(), &info) != 0)
+  {
+    fprintf(stderr, "%s: not found\n", path.c_str());
+    return;
+  }
+  if(!S_ISDIR(info.st_mode))
+  {
+    paths.push_back(path);
+    return;
+  }
+  DIR * dir = opendir(path.c_str());
+  struct dirent * entry;
+  while(dir && (entry = readdir(dir)) != NULL)
+  {
+    size_t length = strlen(entry->d_name);
+    if(length > 4 && strcasecmp(entry->d_name + length - 4, ".csv") == 0)
+    {
+      paths.push_back(path + "/" + entry->d_name);
+    }
+  }
+  if(dir)
+  {
+    closedir(dir);
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned threads = std::thread::hardware_concurrency();
+  const char * output = ".";
+  std::vector<std::string> paths;
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      threads = value > 0 ? value : 1;
+    }
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      output = argv[++i];
+    }
+    else if(argv[i][0] != '-')
+    {
+      addPath(argv[i], paths);
+    }
+    else
+    {
+      paths.clear();
+      break;
+    }
+  }
+  if(paths.empty())
+  {
+    fprintf(stderr, "Usage: %s [--threads N] [--output DIR] FILE|DIR...\n", argv[0]);
+    return 2;
+  }
+  
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ConvertStats stats;
+  if(!convertFiles(paths, output, threads ? threads : 1, stats))
+  {
+    fprintf(stderr, "%s/archive cannot be created\n", output);
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%u files, %u days archived, %u skipped, %.1f MB read in %.3f s: %.1f MB/s, %.1f MB written\n", stats.files,
+    stats.days, stats.skipped, stats.bytesRead / 1e6, seconds, stats.bytesRead / 1e6 / seconds, stats.bytesWritten / 1e6);
+  return stats.skipped ? 1 : 0;
+}
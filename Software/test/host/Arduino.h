@@ -0,0 +1,100 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    Arduino.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the parts of the ESP8266 Arduino core used by the firmware built on the host, see CMakeLists.txt
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "host.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+// The core takes min() and max() from the standard library, so both arguments must have the same type
+using std::min;
+using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+#define PGM_P const char *
+#define F(string) (string)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+
+#ifndef DEBUGV
+#define DEBUGV(...)
+#endif
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+
+uint32_t millis();
+uint32_t micros();
+void yield();
+void delay(unsigned long);
+
+void pinMode(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+void attachInterrupt(uint8_t, void (*)(void), int);
+void detachInterrupt(uint8_t);
+// The interrupts run on the thread that calls hostPin(), so there is nothing to mask
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+long random(long);
+long random(long, long);
+void randomSeed(unsigned long);
+
+inline bool isDigit(int c)
+{
+  return isdigit(c);
+}
+
+#include "WString.h"
+#include "Stream.h"
+#include "Esp.h"
+
+#endif
@@ -0,0 +1,1006 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    ESP8266WebServer.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "ESP8266WebServer.h"
+
+void hostPortListening(uint16_t, uint16_t);
+
+// Requests are read through this buffer, the server handles one at a time
+static uint8_t input[HTTP_LINE_LENGTH];
+static size_t inputStart = 0;
+static size_t inputEnd = 0;
+
+// Target of the request being handled and who to tell when it is done, see hostRequestHook()
+static char requestTarget[HTTP_LINE_LENGTH];
+static HostRequestHook requestHook = NULL;
+
+// Time of the host, the waits for the network are real ones [us]
+static uint64_t wallMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t wallMillis()
+{
+  return wallMicros() / 1000;
+}
+
+void hostRequestHook(HostRequestHook hook)
+{
+  requestHook = hook;
+}
+
+// Read more of the request into the buffer, waits until the deadline, returns false if nothing came
+static bool inputFill(WiFiClient & client, uint64_t deadline)
+{
+  if(inputStart == inputEnd)
+  {
+    inputStart = inputEnd = 0;
+  }
+  else if(inputStart > 0)
+  {
+    memmove(input, input + inputStart, inputEnd - inputStart);
+    inputEnd -= inputStart;
+    inputStart = 0;
+  }
+  if(inputEnd == sizeof(input))
+  {
+    return false;
+  }
+  
+  while(true)
+  {
+    int count = client.read(input + inputEnd, sizeof(input) - inputEnd);
+    if(count > 0)
+    {
+      inputEnd += count;
+      return true;
+    }
+    if(!client.connected() || wallMillis() >= deadline)
+    {
+      return false;
+    }
+    usleep(100);
+  }
+}
+
+static int hexDigit(char c)
+{
+  if(c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if(c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if(c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// Decode %XX and + in place
+static void urlDecode(char * text, bool plus)
+{
+  char * out = text;
+  for(char * c = text; *c; c++)
+  {
+    if(*c == '%' && hexDigit(c[1]) >= 0 && hexDigit(c[2]) >= 0)
+    {
+      *out++ = hexDigit(c[1]) << 4 | hexDigit(c[2]);
+      c += 2;
+    }
+    else
+    {
+      *out++ = plus && *c == '+' ? ' ' : *c;
+    }
+  }
+  *out = 0;
+}
+
+static void base64Encode(char * out, const uint8_t * data, size_t length)
+{
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for(size_t i = 0; i < length; i += 3)
+  {
+    uint32_t block = data[i] << 16 | (i + 1 < length ? data[i + 1] << 8 : 0) | (i + 2 < length ? data[i + 2] : 0);
+    *out++ = alphabet[block >> 18 & 0x3f];
+    *out++ = alphabet[block >> 12 & 0x3f];
+    *out++ = i + 1 < length ? alphabet[block >> 6 & 0x3f] : '=';
+    *out++ = i + 2 < length ? alphabet[block & 0x3f] : '=';
+  }
+  *out = 0;
+}
+
+static const char * statusText(int code)
+{
+  switch(code)
+  {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 206: return "Partial Content";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 404: return "Not Found";
+    case 409: return "Conflict";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "";
+  }
+}
+
+ESP8266WebServer::ESP8266WebServer(int _port) : port(_port)
+{
+  // Everything that holds a part of a request is allocated once here
+  currentUri.reserve(HTTP_VALUE_LENGTH);
+  for(uint8_t i = 0; i < HTTP_MAX_ARGS; i++)
+  {
+    arguments[i].name.reserve(HTTP_VALUE_LENGTH);
+    arguments[i].value.reserve(HTTP_VALUE_LENGTH);
+  }
+  for(uint8_t i = 0; i < HTTP_MAX_HEADERS; i++)
+  {
+    headers[i].value.reserve(HTTP_VALUE_LENGTH);
+  }
+  currentUpload.filename.reserve(HTTP_VALUE_LENGTH);
+  currentUpload.name.reserve(HTTP_VALUE_LENGTH);
+  currentUpload.type.reserve(HTTP_VALUE_LENGTH);
+}
+
+ESP8266WebServer::~ESP8266WebServer()
+{
+  close();
+}
+
+void ESP8266WebServer::begin()
+{
+  close();
+  listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if(listener < 0)
+  {
+    return;
+  }
+  int reuse = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(hostPort(port));
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if(bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 64) != 0 || getsockname(listener, (struct sockaddr *)&address, &length) != 0)
+  {
+    fprintf(stderr, "Web server: cannot listen on port %u: %s\n", hostPort(port), strerror(errno));
+    ::close(listener);
+    listener = -1;
+    return;
+  }
+  hostPortListening(port, ntohs(address.sin_port));
+}
+
+void ESP8266WebServer::close()
+{
+  if(listener >= 0)
+  {
+    ::close(listener);
+    listener = -1;
+  }
+}
+
+void ESP8266WebServer::on(const String & uri, THandlerFunction handler)
+{
+  on(uri, HTTP_ANY, handler);
+}
+
+void ESP8266WebServer::on(const String & uri, HTTPMethod method, THandlerFunction handler)
+{
+  on(uri, method, handler, NULL);
+}
+
+void ESP8266WebServer::on(const String & uri, HTTPMethod method, THandlerFunction handler, THandlerFunction upload)
+{
+  if(routeCount < HTTP_MAX_ROUTES)
+  {
+    routes[routeCount].uri = uri;
+    routes[routeCount].method = method;
+    routes[routeCount].handler = handler;
+    routes[routeCount].upload = upload;
+    routeCount++;
+  }
+}
+
+void ESP8266WebServer::collectHeaders(const char * keys[], const size_t count)
+{
+  headerCount = min(count, (size_t)HTTP_MAX_HEADERS);
+  for(uint8_t i = 0; i < headerCount; i++)
+  {
+    headers[i].name = keys[i];
+  }
+}
+
+const String & ESP8266WebServer::arg(const String & name) const
+{
+  for(uint8_t i = 0; i < argumentCount; i++)
+  {
+    if(arguments[i].name == name)
+    {
+      return arguments[i].value;
+    }
+  }
+  return emptyString;
+}
+
+const String & ESP8266WebServer::arg(int index) const
+{
+  return index >= 0 && index < argumentCount ? arguments[index].value : emptyString;
+}
+
+const String & ESP8266WebServer::argName(int index) const
+{
+  return index >= 0 && index < argumentCount ? arguments[index].name : emptyString;
+}
+
+bool ESP8266WebServer::hasArg(const String & name) const
+{
+  for(uint8_t i = 0; i < argumentCount; i++)
+  {
+    if(arguments[i].name == name)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+const String & ESP8266WebServer::header(const String & name) const
+{
+  for(uint8_t i = 0; i < headerCount; i++)
+  {
+    if(headers[i].name.equalsIgnoreCase(name))
+    {
+      return headers[i].value;
+    }
+  }
+  return emptyString;
+}
+
+bool ESP8266WebServer::hasHeader(const String & name) const
+{
+  return header(name).length() > 0;
+}
+
+// Accept one connection if there is one, wait for the whole request and answer it
+void ESP8266WebServer::handleClient()
+{
+  if(listener < 0)
+  {
+    return;
+  }
+  int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+  if(fd < 0)
+  {
+    return;
+  }
+  
+  uint64_t timeStart = wallMicros();
+  requestTarget[0] = 0;
+  currentClient = WiFiClient(fd);
+  currentClient.setTimeout(HTTP_MAX_DATA_WAIT);
+  inputStart = inputEnd = 0;
+  responseHeadersLength = 0;
+  responseLength = CONTENT_LENGTH_NOT_SET;
+  chunked = false;
+  
+  if(parseRequest())
+  {
+    const Route * route = findRoute();
+    if(route)
+    {
+      route->handler();
+    }
+    else if(notFound)
+    {
+      notFound();
+    }
+    else
+    {
+      send(404, "text/plain", "Not found");
+    }
+  }
+  else
+  {
+    send(400, "text/plain", "Bad request");
+  }
+  
+  finishResponse();
+  currentClient.stop();
+  
+  if(requestHook)
+  {
+    requestHook(requestTarget, wallMicros() - timeStart);
+  }
+}
+
+const ESP8266WebServer::Route * ESP8266WebServer::findRoute()
+{
+  for(uint8_t i = 0; i < routeCount; i++)
+  {
+    if(routes[i].uri == currentUri && (routes[i].method == HTTP_ANY || routes[i].method == currentMethod))
+    {
+      return &routes[i];
+    }
+  }
+  return NULL;
+}
+
+// One line of the request without the line ending, longer lines are cut
+bool ESP8266WebServer::readLine(char * line, size_t size, uint32_t timeout)
+{
+  uint64_t deadline = wallMillis() + timeout;
+  size_t length = 0;
+  while(true)
+  {
+    while(inputStart < inputEnd)
+    {
+      char c = input[inputStart++];
+      if(c == '\n')
+      {
+        if(length && line[length - 1] == '\r')
+        {
+          length--;
+        }
+        line[length] = 0;
+        return true;
+      }
+      if(length < size - 1)
+      {
+        line[length++] = c;
+      }
+    }
+    if(!inputFill(currentClient, deadline))
+    {
+      return false;
+    }
+  }
+}
+
+void ESP8266WebServer::addArgument(const char * name, const char * value)
+{
+  if(argumentCount < HTTP_MAX_ARGS)
+  {
+    arguments[argumentCount].name = name;
+    arguments[argumentCount].value = value;
+    argumentCount++;
+  }
+}
+
+// "a=1&b=2", decoded in place
+void ESP8266WebServer::parseArguments(char * query)
+{
+  while(query && *query)
+  {
+    char * next = strchr(query, '&');
+    if(next)
+    {
+      *next++ = 0;
+    }
+    char * value = strchr(query, '=');
+    if(value)
+    {
+      *value++ = 0;
+    }
+    urlDecode(query, true);
+    if(value)
+    {
+      urlDecode(value, true);
+    }
+    if(*query)
+    {
+      addArgument(query, value ? value : "");
+    }
+    query = next;
+  }
+}
+
+bool ESP8266WebServer::parseRequest()
+{
+  static char line[HTTP_LINE_LENGTH];
+  argumentCount = 0;
+  authorization[0] = 0;
+  contentType[0] = 0;
+  contentLength = 0;
+  for(uint8_t i = 0; i < headerCount; i++)
+  {
+    headers[i].value = "";
+  }
+  
+  if(!readLine(line, sizeof(line), HTTP_MAX_DATA_WAIT))
+  {
+    return false;
+  }
+  
+  // "GET /api?request=live HTTP/1.1"
+  char * uri = strchr(line, ' ');
+  if(!uri)
+  {
+    return false;
+  }
+  *uri++ = 0;
+  char * version = strchr(uri, ' ');
+  if(version)
+  {
+    *version = 0;
+  }
+  
+  static const char * methods[] = {"ANY", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"};
+  currentMethod = HTTP_GET;
+  for(uint8_t i = 0; i < sizeof(methods) / sizeof(methods[0]); i++)
+  {
+    if(strcmp(line, methods[i]) == 0)
+    {
+      currentMethod = (HTTPMethod)i;
+    }
+  }
+  
+  strcpy(requestTarget, uri);
+  char * query = strchr(uri, '?');
+  if(query)
+  {
+    *query++ = 0;
+  }
+  urlDecode(uri, false);
+  currentUri = uri;
+  parseArguments(query);
+  
+  // Headers up to the empty line
+  while(true)
+  {
+    if(!readLine(line, sizeof(line), HTTP_MAX_DATA_WAIT))
+    {
+      return false;
+    }
+    if(line[0] == 0)
+    {
+      break;
+    }
+    char * value = strchr(line, ':');
+    if(!value)
+    {
+      continue;
+    }
+    *value++ = 0;
+    while(*value == ' ')
+    {
+      value++;
+    }
+    
+    if(strcasecmp(line, "Content-Length") == 0)
+    {
+      contentLength = strtoul(value, NULL, 10);
+    }
+    else if(strcasecmp(line, "Content-Type") == 0)
+    {
+      snprintf(contentType, sizeof(contentType), "%s", value);
+    }
+    else if(strcasecmp(line, "Authorization") == 0)
+    {
+      snprintf(authorization, sizeof(authorization), "%s", value);
+    }
+    for(uint8_t i = 0; i < headerCount; i++)
+    {
+      if(strcasecmp(line, headers[i].name.c_str()) == 0)
+      {
+        headers[i].value = value;
+      }
+    }
+  }
+  
+  if(contentLength == 0)
+  {
+    return true;
+  }
+  
+  const char * boundary = strstr(contentType, "boundary=");
+  if(strncasecmp(contentType, "multipart/form-data", 19) == 0 && boundary)
+  {
+    return parseMultipart(boundary + 9, contentLength, findRoute());
+  }
+  return parseForm(contentLength);
+}
+
+// Body of up to the given length from the buffer and the connection, returns the number of bytes or -1
+int ESP8266WebServer::readBody(uint8_t * buffer, size_t size, size_t & remaining, uint32_t timeout)
+{
+  size_t length = min(size, remaining);
+  if(length == 0)
+  {
+    return 0;
+  }
+  if(inputStart == inputEnd && !inputFill(currentClient, wallMillis() + timeout))
+  {
+    return -1;
+  }
+  length = min(length, inputEnd - inputStart);
+  memcpy(buffer, input + inputStart, length);
+  inputStart += length;
+  remaining -= length;
+  return length;
+}
+
+// A form body is parsed like the query, anything else is kept whole as the "plain" argument
+bool ESP8266WebServer::parseForm(size_t length)
+{
+  static char body[HTTP_LINE_LENGTH];
+  size_t size = 0;
+  size_t remaining = length;
+  while(remaining)
+  {
+    uint8_t * into = (uint8_t *)body + min(size, sizeof(body) - 1);
+    size_t room = size < sizeof(body) - 1 ? sizeof(body) - 1 - size : sizeof(body) - 1;
+    int count = readBody(into, room, remaining, HTTP_MAX_DATA_WAIT);
+    if(count < 0)
+    {
+      return false;
+    }
+    // The rest of a body that is too long is dropped
+    size = min(size + count, sizeof(body) - 1);
+  }
+  body[size] = 0;
+  
+  if(strncasecmp(contentType, "application/x-www-form-urlencoded", 33) == 0)
+  {
+    parseArguments(body);
+  }
+  else
+  {
+    addArgument("plain", body);
+  }
+  return true;
+}
+
+// Fields of a multipart form are arguments, files are handed to the upload handler of the route in blocks of
+// HTTP_UPLOAD_BUFLEN bytes
+bool ESP8266WebServer::parseMultipart(const char * boundaryValue, size_t length, const Route * route)
+{
+  static char line[HTTP_LINE_LENGTH];
+  static char delimiter[HTTP_VALUE_LENGTH];
+  static char field[HTTP_LINE_LENGTH];
+  size_t remaining = length;
+  
+  // The delimiter before each part is "\r\n--boundary", the first one comes without the line break
+  snprintf(delimiter, sizeof(delimiter), "\r\n--%s", boundaryValue);
+  char * quote = strchr(delimiter + 4, '"');
+  if(delimiter[4] == '"')
+  {
+    memmove(delimiter + 4, delimiter + 5, strlen(delimiter + 4));
+    quote = strchr(delimiter + 4, '"');
+  }
+  if(quote)
+  {
+    *quote = 0;
+  }
+  size_t delimiterLength = strlen(delimiter);
+  
+  // The lines are read from the buffer, which always holds what was received of the body
+  auto bodyLine = [&](char * into, size_t size) -> bool
+  {
+    size_t used = 0;
+    while(true)
+    {
+      while(inputStart < inputEnd && remaining)
+      {
+        char c = input[inputStart++];
+        remaining--;
+        if(c == '\n')
+        {
+          if(used && into[used - 1] == '\r')
+          {
+            used--;
+          }
+          into[used] = 0;
+          return true;
+        }
+        if(used < size - 1)
+        {
+          into[used++] = c;
+        }
+      }
+      if(!remaining || !inputFill(currentClient, wallMillis() + HTTP_MAX_DATA_WAIT))
+      {
+        return false;
+      }
+    }
+  };
+  
+  // Skip to the first delimiter
+  do
+  {
+    if(!bodyLine(line, sizeof(line)))
+    {
+      return false;
+    }
+  } while(strcmp(line, delimiter + 2) != 0);
+  
+  while(true)
+  {
+    // Part headers
+    char name[HTTP_VALUE_LENGTH] = "";
+    char filename[HTTP_VALUE_LENGTH] = "";
+    bool isFile = false;
+    while(true)
+    {
+      if(!bodyLine(line, sizeof(line)))
+      {
+        return false;
+      }
+      if(line[0] == 0)
+      {
+        break;
+      }
+      if(strncasecmp(line, "Content-Disposition:", 20) == 0)
+      {
+        const char * value = strstr(line, " name=\"");
+        if(!value)
+        {
+          value = strstr(line, ";name=\"");
+        }
+        if(value)
+        {
+          snprintf(name, sizeof(name), "%s", value + 7);
+          char * end = strchr(name, '"');
+          if(end)
+          {
+            *end = 0;
+          }
+        }
+        value = strstr(line, "filename=\"");
+        if(value)
+        {
+          isFile = true;
+          snprintf(filename, sizeof(filename), "%s", value + 10);
+          char * end = strchr(filename, '"');
+          if(end)
+          {
+            *end = 0;
+          }
+        }
+      }
+    }
+    
+    if(isFile)
+    {
+      currentUpload.status = UPLOAD_FILE_START;
+      currentUpload.filename = filename;
+      currentUpload.name = name;
+      currentUpload.type = "";
+      currentUpload.totalSize = 0;
+      currentUpload.currentSize = 0;
+      if(route && route->upload)
+      {
+        route->upload();
+      }
+      else if(fileUpload)
+      {
+        fileUpload();
+      }
+    }
+    
+    // Content up to the next delimiter, it may be split between two reads
+    size_t fieldLength = 0;
+    bool found = false;
+    while(!found)
+    {
+      if(inputEnd - inputStart < delimiterLength + 2 && remaining > inputEnd - inputStart)
+      {
+        if(!inputFill(currentClient, wallMillis() + HTTP_MAX_DATA_WAIT))
+        {
+          break;
+        }
+        continue;
+      }
+      
+      // Look for the delimiter in what is buffered, what cannot be part of it is content
+      size_t available = min(inputEnd - inputStart, remaining);
+      size_t take = available;
+      for(size_t i = 0; i < available; i++)
+      {
+        if(input[inputStart + i] != '\r')
+        {
+          continue;
+        }
+        size_t compare = min(delimiterLength, available - i);
+        if(memcmp(input + inputStart + i, delimiter, compare) == 0)
+        {
+          take = i;
+          found = compare == delimiterLength;
+          break;
+        }
+      }
+      if(take == 0 && !found && available == remaining)
+      {
+        // The end of the body without a delimiter
+        break;
+      }
+      if(take == 0 && !found)
+      {
+        // The start of a delimiter at the end of the buffer, read more
+        if(!inputFill(currentClient, wallMillis() + HTTP_MAX_DATA_WAIT))
+        {
+          break;
+        }
+        continue;
+      }
+      
+      const uint8_t * data = input + inputStart;
+      while(take)
+      {
+        size_t count;
+        if(isFile)
+        {
+          count = min(take, HTTP_UPLOAD_BUFLEN - currentUpload.currentSize);
+          memcpy(currentUpload.buf + currentUpload.currentSize, data, count);
+          currentUpload.currentSize += count;
+          if(currentUpload.currentSize == HTTP_UPLOAD_BUFLEN)
+          {
+            currentUpload.status = UPLOAD_FILE_WRITE;
+            currentUpload.totalSize += currentUpload.currentSize;
+            if(route && route->upload)
+            {
+              route->upload();
+            }
+            else if(fileUpload)
+            {
+              fileUpload();
+            }
+            currentUpload.currentSize = 0;
+          }
+        }
+        else
+        {
+          count = min(take, sizeof(field) - 1 - fieldLength);
+          memcpy(field + fieldLength, data, count);
+          fieldLength += count;
+          if(count == 0)
+          {
+            // The rest of a field that is too long is dropped
+            count = take;
+          }
+        }
+        data += count;
+        inputStart += count;
+        remaining -= count;
+        take -= count;
+      }
+      
+      if(found)
+      {
+        inputStart += delimiterLength;
+        remaining -= delimiterLength;
+      }
+    }
+    
+    if(isFile)
+    {
+      if(currentUpload.currentSize)
+      {
+        currentUpload.status = UPLOAD_FILE_WRITE;
+        currentUpload.totalSize += currentUpload.currentSize;
+        if(route && route->upload)
+        {
+          route->upload();
+        }
+        else if(fileUpload)
+        {
+          fileUpload();
+        }
+        currentUpload.currentSize = 0;
+      }
+      currentUpload.status = found ? UPLOAD_FILE_END : UPLOAD_FILE_ABORTED;
+      if(route && route->upload)
+      {
+        route->upload();
+      }
+      else if(fileUpload)
+      {
+        fileUpload();
+      }
+    }
+    else
+    {
+      field[fieldLength] = 0;
+      addArgument(name, field);
+    }
+    
+    if(!found)
+    {
+      return false;
+    }
+    
+    // "--" after the delimiter ends the body, otherwise a line break comes before the next part
+    if(!bodyLine(line, sizeof(line)) || strcmp(line, "--") == 0)
+    {
+      return true;
+    }
+  }
+}
+
+bool ESP8266WebServer::authenticate(const char * username, const char * password)
+{
+  char credentials[HTTP_VALUE_LENGTH];
+  char encoded[HTTP_VALUE_LENGTH * 4 / 3 + 4];
+  if(strncmp(authorization, "Basic ", 6) != 0)
+  {
+    return false;
+  }
+  int length = snprintf(credentials, sizeof(credentials), "%s:%s", username, password);
+  if(length < 0 || length >= (int)sizeof(credentials))
+  {
+    return false;
+  }
+  base64Encode(encoded, (const uint8_t *)credentials, length);
+  return strcmp(authorization + 6, encoded) == 0;
+}
+
+void ESP8266WebServer::requestAuthentication(HTTPAuthMethod, const char * realm, const String & message)
+{
+  char value[HTTP_VALUE_LENGTH];
+  snprintf(value, sizeof(value), "Basic realm=\"%s\"", realm ? realm : "Login Required");
+  sendHeader("WWW-Authenticate", value);
+  send(401, "text/html", message);
+}
+
+void ESP8266WebServer::sendHeader(const String & name, const String & value, bool first)
+{
+  char header[HTTP_LINE_LENGTH];
+  int length = snprintf(header, sizeof(header), "%s: %s\r\n", name.c_str(), value.c_str());
+  if(length < 0 || responseHeadersLength + length >= sizeof(responseHeaders))
+  {
+    return;
+  }
+  if(first)
+  {
+    memmove(responseHeaders + length, responseHeaders, responseHeadersLength);
+    memcpy(responseHeaders, header, length);
+  }
+  else
+  {
+    memcpy(responseHeaders + responseHeadersLength, header, length);
+  }
+  responseHeadersLength += length;
+}
+
+void ESP8266WebServer::writeRaw(const char * data, size_t length)
+{
+  currentClient.write((const uint8_t *)data, length);
+}
+
+// Status line and headers, the length is the one of the content given to send() unless setContentLength() was called
+void ESP8266WebServer::sendStatus(int code, const char * type, size_t length)
+{
+  char header[HTTP_LINE_LENGTH * 2];
+  size_t size = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n", code, statusText(code), type ? type : "text/html");
+  
+  if(responseLength == CONTENT_LENGTH_UNKNOWN)
+  {
+    chunked = true;
+    size += snprintf(header + size, sizeof(header) - size, "Transfer-Encoding: chunked\r\n");
+  }
+  else
+  {
+    size += snprintf(header + size, sizeof(header) - size, "Content-Length: %zu\r\n", responseLength == CONTENT_LENGTH_NOT_SET ? length : responseLength);
+  }
+  
+  responseHeaders[responseHeadersLength] = 0;
+  size += snprintf(header + size, sizeof(header) - size, "%s", responseHeaders);
+  if(!strcasestr(responseHeaders, "Connection:"))
+  {
+    size += snprintf(header + size, sizeof(header) - size, "Connection: close\r\n");
+  }
+  size += snprintf(header + size, sizeof(header) - size, "\r\n");
+  writeRaw(header, min(size, sizeof(header) - 1));
+  
+  responseHeadersLength = 0;
+  responseLength = CONTENT_LENGTH_NOT_SET;
+}
+
+void ESP8266WebServer::send(int code, const char * type, const String & content)
+{
+  send_P(code, type, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, char * type, const String & content)
+{
+  send_P(code, type, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, const String & type, const String & content)
+{
+  send_P(code, type.c_str(), content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send_P(int code, PGM_P type, PGM_P content)
+{
+  send_P(code, type, content, strlen(content));
+}
+
+void ESP8266WebServer::send_P(int code, PGM_P type, PGM_P content, size_t length)
+{
+  sendStatus(code, type, length);
+  if(length)
+  {
+    sendContent_P(content, length);
+  }
+}
+
+void ESP8266WebServer::sendContent(const String & content)
+{
+  sendContent_P(content.c_str(), content.length());
+}
+
+void ESP8266WebServer::sendContent_P(PGM_P content)
+{
+  sendContent_P(content, strlen(content));
+}
+
+void ESP8266WebServer::sendContent_P(PGM_P content, size_t length)
+{
+  if(!chunked)
+  {
+    writeRaw(content, length);
+    return;
+  }
+  if(length == 0)
+  {
+    return;
+  }
+  char size[12];
+  writeRaw(size, snprintf(size, sizeof(size), "%zx\r\n", length));
+  writeRaw(content, length);
+  writeRaw("\r\n", 2);
+}
+
+void ESP8266WebServer::finishResponse()
+{
+  if(chunked)
+  {
+    writeRaw("0\r\n\r\n", 5);
+    chunked = false;
+  }
+}
@@ -0,0 +1,172 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    ESP8266WebServer.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the web server of the core 2.6, listening on 127.0.0.1 at the port mapped to the device port, see
+// hostPortMap()
+// Like the original it handles one request at a time from handleClient(), waits for the whole request, runs the
+// handler and closes the connection. The request is parsed into fixed buffers and the arguments are kept in Strings
+// that are reserved once, so that the server itself does not use the heap while it answers requests
+
+#ifndef ESP8266WEBSERVER_H
+#define ESP8266WEBSERVER_H
+
+#include <functional>
+
+#include "ESP8266WiFi.h"
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+enum HTTPAuthMethod { BASIC_AUTH, DIGEST_AUTH };
+
+#define HTTP_UPLOAD_BUFLEN 1460
+#define HTTP_MAX_DATA_WAIT 5000 // Time to wait for the rest of a request [ms]
+#define HTTP_MAX_ARGS 16
+#define HTTP_MAX_HEADERS 4
+#define HTTP_MAX_ROUTES 16
+#define HTTP_LINE_LENGTH 512
+#define HTTP_VALUE_LENGTH 128 // Capacity reserved for each argument and header value
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+struct HTTPUpload
+{
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+class ESP8266WebServer
+{
+  public:
+  typedef std::function<void(void)> THandlerFunction;
+  
+  private:
+  struct Route
+  {
+    String uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    THandlerFunction upload;
+  };
+  
+  struct Argument
+  {
+    String name;
+    String value;
+  };
+  
+  int listener = -1;
+  uint16_t port;
+  Route routes[HTTP_MAX_ROUTES];
+  uint8_t routeCount = 0;
+  THandlerFunction notFound;
+  THandlerFunction fileUpload;
+  
+  WiFiClient currentClient;
+  HTTPMethod currentMethod = HTTP_ANY;
+  String currentUri;
+  Argument arguments[HTTP_MAX_ARGS];
+  uint8_t argumentCount = 0;
+  Argument headers[HTTP_MAX_HEADERS];
+  uint8_t headerCount = 0;
+  char authorization[HTTP_VALUE_LENGTH];
+  char contentType[HTTP_VALUE_LENGTH];
+  size_t contentLength = 0;
+  HTTPUpload currentUpload;
+  
+  // Response
+  char responseHeaders[HTTP_LINE_LENGTH];
+  size_t responseHeadersLength = 0;
+  size_t responseLength = CONTENT_LENGTH_NOT_SET;
+  bool chunked = false;
+  
+  bool readLine(char *, size_t, uint32_t);
+  int readBody(uint8_t *, size_t, size_t &, uint32_t);
+  bool parseRequest();
+  void parseArguments(char *);
+  bool parseForm(size_t);
+  bool parseMultipart(const char *, size_t, const Route *);
+  void addArgument(const char *, const char *);
+  const Route * findRoute();
+  void sendStatus(int, const char *, size_t);
+  void writeRaw(const char *, size_t);
+  void finishResponse();
+  
+  public:
+  ESP8266WebServer(int = 80);
+  ~ESP8266WebServer();
+  
+  void begin();
+  void close();
+  void handleClient();
+  
+  void on(const String &, THandlerFunction);
+  void on(const String &, HTTPMethod, THandlerFunction);
+  void on(const String &, HTTPMethod, THandlerFunction, THandlerFunction);
+  void onNotFound(THandlerFunction handler) { notFound = handler; }
+  void onFileUpload(THandlerFunction handler) { fileUpload = handler; }
+  void collectHeaders(const char * [], const size_t);
+  
+  const String & uri() const { return currentUri; }
+  HTTPMethod method() const { return currentMethod; }
+  WiFiClient & client() { return currentClient; }
+  HTTPUpload & upload() { return currentUpload; }
+  
+  const String & arg(const String &) const;
+  const String & arg(int) const;
+  const String & argName(int) const;
+  int args() const { return argumentCount; }
+  bool hasArg(const String &) const;
+  const String & header(const String &) const;
+  bool hasHeader(const String &) const;
+  
+  bool authenticate(const char *, const char *);
+  void requestAuthentication(HTTPAuthMethod = BASIC_AUTH, const char * = NULL, const String & = String(""));
+  
+  void setContentLength(const size_t length) { responseLength = length; }
+  void sendHeader(const String &, const String &, bool = false);
+  void send(int, const char * = NULL, const String & = String(""));
+  void send(int, char *, const String &);
+  void send(int, const String &, const String &);
+  void send(int code, const char * type, const char * content) { send_P(code, type, content); }
+  void send(int code, const char * type, const char * content, size_t length) { send_P(code, type, content, length); }
+  void send_P(int, PGM_P, PGM_P);
+  void send_P(int, PGM_P, PGM_P, size_t);
+  void sendContent(const String &);
+  void sendContent(const char * content) { sendContent_P(content); }
+  void sendContent(const char * content, size_t length) { sendContent_P(content, length); }
+  void sendContent_P(PGM_P);
+  void sendContent_P(PGM_P, size_t);
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    ESP8266WiFi.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the WiFi of the core, the host is always connected and its address is 127.0.0.1
+
+#ifndef ESP8266WIFI_H
+#define ESP8266WIFI_H
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+#include "WiFiUdp.h"
+
+typedef enum {
+  WL_NO_SHIELD = 255,
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass
+{
+  private:
+  wl_status_t state = WL_IDLE_STATUS;
+  
+  public:
+  wl_status_t begin(const char *, const char * = NULL);
+  bool config(IPAddress, IPAddress, IPAddress);
+  bool disconnect(bool = false);
+  wl_status_t status();
+  IPAddress localIP();
+  int hostByName(const char *, IPAddress &);
+  int hostByName(const char * name, IPAddress & address, uint32_t) { return hostByName(name, address); }
+};
+
+extern WiFiClass WiFi;
+
+#endif
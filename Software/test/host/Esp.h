@@ -0,0 +1,65 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    Esp.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the ESP object of the core: the RTC user memory and the flash are kept in the memory of the host
+// program, so they survive a restart of the firmware within the same program but not the end of it
+
+#ifndef ESP_H
+#define ESP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+class EspClass
+{
+  public:
+  uint32_t getChipId();
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+  uint32_t getFreeContStack();
+  
+  // 128 blocks of 4 bytes for the user, the offset and the size are in blocks and bytes like on the ESP8266
+  bool rtcUserMemoryRead(uint32_t, uint32_t *, size_t);
+  bool rtcUserMemoryWrite(uint32_t, uint32_t *, size_t);
+  
+  bool flashEraseSector(uint32_t);
+  bool flashWrite(uint32_t, uint32_t *, size_t);
+  bool flashRead(uint32_t, uint32_t *, size_t);
+  
+  void restart();
+};
+
+extern EspClass ESP;
+
+// The flash sector of the EEPROM, see persist.cpp
+extern "C" uint32_t _EEPROM_start;
+
+#endif
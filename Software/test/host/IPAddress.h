@@ -0,0 +1,59 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    IPAddress.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the IPv4 address class of the core
+
+#ifndef IPADDRESS_H
+#define IPADDRESS_H
+
+#include <stdint.h>
+
+class IPAddress
+{
+  private:
+  union
+  {
+    uint8_t bytes[4];
+    uint32_t dword;
+  } address;
+  
+  public:
+  IPAddress() { address.dword = 0; }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { address.bytes[0] = a; address.bytes[1] = b; address.bytes[2] = c; address.bytes[3] = d; }
+  IPAddress(uint32_t dword) { address.dword = dword; }
+  IPAddress(const uint8_t * bytes) { for(uint8_t i = 0; i < 4; i++) address.bytes[i] = bytes[i]; }
+  
+  operator uint32_t() const { return address.dword; }
+  bool operator==(const IPAddress & other) const { return address.dword == other.address.dword; }
+  bool operator!=(const IPAddress & other) const { return address.dword != other.address.dword; }
+  uint8_t operator[](int index) const { return address.bytes[index]; }
+  uint8_t & operator[](int index) { return address.bytes[index]; }
+  bool isSet() const { return address.dword != 0; }
+};
+
+#endif
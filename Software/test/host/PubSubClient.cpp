@@ -0,0 +1,390 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    PubSubClient.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <time.h>
+#include <unistd.h>
+
+#include "PubSubClient.h"
+
+// Time of the host, the broker is waited for in real time [ms]
+static uint64_t wallMillis()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+PubSubClient & PubSubClient::setServer(IPAddress _ip, uint16_t _port)
+{
+  ip = _ip;
+  port = _port;
+  domain = NULL;
+  return *this;
+}
+
+PubSubClient & PubSubClient::setServer(const char * _domain, uint16_t _port)
+{
+  domain = _domain;
+  port = _port;
+  return *this;
+}
+
+PubSubClient & PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE)
+{
+  this->callback = callback;
+  return *this;
+}
+
+PubSubClient & PubSubClient::setClient(Client & _client)
+{
+  client = &_client;
+  return *this;
+}
+
+PubSubClient & PubSubClient::setKeepAlive(uint16_t _keepAlive)
+{
+  keepAlive = _keepAlive;
+  return *this;
+}
+
+PubSubClient & PubSubClient::setSocketTimeout(uint16_t timeout)
+{
+  socketTimeout = timeout;
+  return *this;
+}
+
+bool PubSubClient::waitAvailable()
+{
+  uint64_t deadline = wallMillis() + socketTimeout * 1000ULL;
+  while(!client->available())
+  {
+    if(!client->connected() || wallMillis() >= deadline)
+    {
+      return false;
+    }
+    usleep(50);
+  }
+  return true;
+}
+
+bool PubSubClient::readByte(uint8_t * result)
+{
+  if(!waitAvailable())
+  {
+    return false;
+  }
+  int c = client->read();
+  if(c < 0)
+  {
+    return false;
+  }
+  *result = c;
+  return true;
+}
+
+// Read a whole packet, the part that does not fit in the buffer is dropped, returns the length kept or 0
+uint32_t PubSubClient::readPacket(uint8_t * headerLength)
+{
+  uint32_t length = 0;
+  uint8_t c;
+  if(!readByte(&c))
+  {
+    return 0;
+  }
+  buffer[length++] = c;
+  
+  uint32_t remaining = 0;
+  uint32_t multiplier = 1;
+  do
+  {
+    if(length == 5 || !readByte(&c))
+    {
+      return 0;
+    }
+    buffer[length++] = c;
+    remaining += (c & 0x7f) * multiplier;
+    multiplier <<= 7;
+  } while(c & 0x80);
+  *headerLength = length;
+  
+  for(uint32_t i = 0; i < remaining; i++)
+  {
+    if(!readByte(&c))
+    {
+      return 0;
+    }
+    if(length < MQTT_MAX_PACKET_SIZE)
+    {
+      buffer[length++] = c;
+    }
+  }
+  return length;
+}
+
+// The packet is built from MQTT_MAX_HEADER_SIZE on, the fixed header is put right before it
+bool PubSubClient::write(uint8_t header, uint8_t * packet, uint16_t length)
+{
+  uint8_t lengthBytes[4];
+  uint8_t count = 0;
+  uint16_t remaining = length;
+  do
+  {
+    uint8_t digit = remaining & 0x7f;
+    remaining >>= 7;
+    lengthBytes[count++] = remaining ? digit | 0x80 : digit;
+  } while(remaining);
+  
+  uint8_t * start = packet + MQTT_MAX_HEADER_SIZE - 1 - count;
+  start[0] = header;
+  memcpy(start + 1, lengthBytes, count);
+  size_t total = 1 + count + length;
+  lastOutActivity = millis();
+  return client->write(start, total) == total;
+}
+
+uint16_t PubSubClient::writeString(const char * string, uint8_t * packet, uint16_t position)
+{
+  uint16_t length = strlen(string);
+  packet[position++] = length >> 8;
+  packet[position++] = length;
+  memcpy(packet + position, string, length);
+  return position + length;
+}
+
+bool PubSubClient::connect(const char * id)
+{
+  return connect(id, NULL, NULL);
+}
+
+bool PubSubClient::connect(const char * id, const char * user, const char * password)
+{
+  if(connected())
+  {
+    return true;
+  }
+  
+  int result = domain ? client->connect(domain, port) : client->connect(ip, port);
+  if(!result)
+  {
+    status = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  
+  nextMessageId = 1;
+  uint16_t length = MQTT_MAX_HEADER_SIZE;
+  static const uint8_t protocol[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', MQTT_VERSION_3_1_1};
+  memcpy(buffer + length, protocol, sizeof(protocol));
+  length += sizeof(protocol);
+  
+  // Clean session, user name and password
+  uint8_t flags = 0x02;
+  if(user)
+  {
+    flags |= 0x80;
+    if(password)
+    {
+      flags |= 0x40;
+    }
+  }
+  buffer[length++] = flags;
+  buffer[length++] = keepAlive >> 8;
+  buffer[length++] = keepAlive;
+  
+  if(MQTT_MAX_HEADER_SIZE + strlen(id) + 2 + (user ? strlen(user) + 2 : 0) + (password ? strlen(password) + 2 : 0) + length > MQTT_MAX_PACKET_SIZE)
+  {
+    client->stop();
+    status = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  length = writeString(id, buffer, length);
+  if(user)
+  {
+    length = writeString(user, buffer, length);
+    if(password)
+    {
+      length = writeString(password, buffer, length);
+    }
+  }
+  
+  write(MQTTCONNECT, buffer, length - MQTT_MAX_HEADER_SIZE);
+  lastInActivity = lastOutActivity = millis();
+  
+  uint8_t headerLength;
+  uint32_t received = readPacket(&headerLength);
+  if(received == 4 && buffer[0] == MQTTCONNACK && buffer[3] == 0)
+  {
+    lastInActivity = millis();
+    pingOutstanding = false;
+    status = MQTT_CONNECTED;
+    return true;
+  }
+  
+  status = received == 4 ? buffer[3] : MQTT_CONNECTION_TIMEOUT;
+  client->stop();
+  return false;
+}
+
+void PubSubClient::disconnect()
+{
+  buffer[0] = MQTTDISCONNECT;
+  buffer[1] = 0;
+  client->write(buffer, 2);
+  status = MQTT_DISCONNECTED;
+  client->flush();
+  client->stop();
+  lastInActivity = lastOutActivity = millis();
+}
+
+bool PubSubClient::publish(const char * topic, const char * payload)
+{
+  return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, false);
+}
+
+bool PubSubClient::publish(const char * topic, const char * payload, bool retained)
+{
+  return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char * topic, const uint8_t * payload, unsigned int length)
+{
+  return publish(topic, payload, length, false);
+}
+
+// Messages that do not fit in MQTT_MAX_PACKET_SIZE are refused, like the library does
+bool PubSubClient::publish(const char * topic, const uint8_t * payload, unsigned int plength, bool retained)
+{
+  if(!connected())
+  {
+    return false;
+  }
+  if(MQTT_MAX_HEADER_SIZE + 2 + strlen(topic) + plength > MQTT_MAX_PACKET_SIZE)
+  {
+    return false;
+  }
+  
+  uint16_t length = writeString(topic, buffer, MQTT_MAX_HEADER_SIZE);
+  memcpy(buffer + length, payload, plength);
+  length += plength;
+  return write(MQTTPUBLISH | (retained ? 1 : 0), buffer, length - MQTT_MAX_HEADER_SIZE);
+}
+
+bool PubSubClient::subscribe(const char * topic, uint8_t qos)
+{
+  if(!connected() || MQTT_MAX_HEADER_SIZE + 2 + 2 + strlen(topic) + 1 > MQTT_MAX_PACKET_SIZE)
+  {
+    return false;
+  }
+  
+  uint16_t length = MQTT_MAX_HEADER_SIZE;
+  nextMessageId = nextMessageId == 0xffff ? 1 : nextMessageId + 1;
+  buffer[length++] = nextMessageId >> 8;
+  buffer[length++] = nextMessageId;
+  length = writeString(topic, buffer, length);
+  buffer[length++] = qos;
+  return write(MQTTSUBSCRIBE | 0x02, buffer, length - MQTT_MAX_HEADER_SIZE);
+}
+
+// Keep the connection alive and hand the received messages to the callback
+bool PubSubClient::loop()
+{
+  if(!connected())
+  {
+    return false;
+  }
+  
+  uint32_t t = millis();
+  if(t - lastInActivity > keepAlive * 1000UL || t - lastOutActivity > keepAlive * 1000UL)
+  {
+    if(pingOutstanding)
+    {
+      status = MQTT_CONNECTION_TIMEOUT;
+      client->stop();
+      return false;
+    }
+    buffer[0] = MQTTPINGREQ;
+    buffer[1] = 0;
+    client->write(buffer, 2);
+    lastOutActivity = lastInActivity = t;
+    pingOutstanding = true;
+  }
+  
+  while(client->available())
+  {
+    uint8_t headerLength;
+    uint32_t length = readPacket(&headerLength);
+    if(length == 0)
+    {
+      status = MQTT_CONNECTION_LOST;
+      client->stop();
+      return false;
+    }
+    lastInActivity = millis();
+    
+    uint8_t type = buffer[0] & 0xf0;
+    if(type == MQTTPUBLISH && callback && length >= headerLength + 2u)
+    {
+      // The topic is made null terminated by moving it one byte to the front, over its length
+      uint16_t topicLength = buffer[headerLength] << 8 | buffer[headerLength + 1];
+      if(headerLength + 2u + topicLength > length)
+      {
+        continue;
+      }
+      memmove(buffer + headerLength - 1, buffer + headerLength + 2, topicLength);
+      buffer[headerLength - 1 + topicLength] = 0;
+      char * topic = (char *)buffer + headerLength - 1;
+      uint8_t * payload = buffer + headerLength + 2 + topicLength;
+      // Only QoS 0 is subscribed, so there is no message identifier
+      callback(topic, payload, length - headerLength - 2 - topicLength);
+    }
+    else if(type == MQTTPINGREQ)
+    {
+      buffer[0] = MQTTPINGRESP;
+      buffer[1] = 0;
+      client->write(buffer, 2);
+    }
+    else if(type == MQTTPINGRESP)
+    {
+      pingOutstanding = false;
+    }
+  }
+  return true;
+}
+
+bool PubSubClient::connected()
+{
+  if(!client->connected())
+  {
+    if(status == MQTT_CONNECTED)
+    {
+      status = MQTT_CONNECTION_LOST;
+      client->stop();
+    }
+    return false;
+  }
+  return status == MQTT_CONNECTED;
+}
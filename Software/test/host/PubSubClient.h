@@ -0,0 +1,116 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    PubSubClient.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the PubSubClient library (2.8), an MQTT 3.1.1 client over any Client with QoS 0 only
+// The waits for the broker are real ones, the keep alive follows the clock of the firmware like on the device
+
+#ifndef PUBSUBCLIENT_H
+#define PUBSUBCLIENT_H
+
+#include <functional>
+
+#include "Arduino.h"
+#include "Client.h"
+
+#define MQTT_VERSION_3_1_1 4
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 128
+#endif
+#define MQTT_MAX_HEADER_SIZE 5
+#define MQTT_KEEPALIVE 15 // [s]
+#define MQTT_SOCKET_TIMEOUT 15 // [s]
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_BAD_PROTOCOL    1
+#define MQTT_CONNECT_BAD_CLIENT_ID   2
+#define MQTT_CONNECT_UNAVAILABLE     3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED    5
+
+#define MQTTCONNECT     1 << 4
+#define MQTTCONNACK     2 << 4
+#define MQTTPUBLISH     3 << 4
+#define MQTTSUBSCRIBE   8 << 4
+#define MQTTSUBACK      9 << 4
+#define MQTTPINGREQ     12 << 4
+#define MQTTPINGRESP    13 << 4
+#define MQTTDISCONNECT  14 << 4
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char *, uint8_t *, unsigned int)> callback
+
+class PubSubClient
+{
+  private:
+  Client * client;
+  uint8_t buffer[MQTT_MAX_PACKET_SIZE];
+  uint16_t nextMessageId = 1;
+  uint32_t lastOutActivity = 0;
+  uint32_t lastInActivity = 0;
+  bool pingOutstanding = false;
+  MQTT_CALLBACK_SIGNATURE;
+  const char * domain = NULL;
+  IPAddress ip;
+  uint16_t port = 1883;
+  uint16_t keepAlive = MQTT_KEEPALIVE;
+  uint16_t socketTimeout = MQTT_SOCKET_TIMEOUT;
+  int status = MQTT_DISCONNECTED;
+  
+  bool waitAvailable();
+  bool readByte(uint8_t *);
+  uint32_t readPacket(uint8_t *);
+  bool write(uint8_t, uint8_t *, uint16_t);
+  uint16_t writeString(const char *, uint8_t *, uint16_t);
+  
+  public:
+  PubSubClient(Client & _client) : client(&_client) {}
+  
+  PubSubClient & setServer(IPAddress, uint16_t);
+  PubSubClient & setServer(const char *, uint16_t);
+  PubSubClient & setCallback(MQTT_CALLBACK_SIGNATURE);
+  PubSubClient & setClient(Client &);
+  PubSubClient & setKeepAlive(uint16_t);
+  PubSubClient & setSocketTimeout(uint16_t);
+  
+  bool connect(const char *);
+  bool connect(const char *, const char *, const char *);
+  void disconnect();
+  bool publish(const char *, const char *);
+  bool publish(const char *, const char *, bool);
+  bool publish(const char *, const uint8_t *, unsigned int);
+  bool publish(const char *, const uint8_t *, unsigned int, bool);
+  bool subscribe(const char *, uint8_t = 0);
+  bool loop();
+  bool connected();
+  int state() { return status; }
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    SD.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the SD library, the card is a directory of the host given to SD.begin()
+
+#ifndef SD_H
+#define SD_H
+
+#include <memory>
+#include "Arduino.h"
+
+#define FILE_READ 0
+#define FILE_WRITE 1 // Created if missing, every write goes to the end of the file like on the card
+
+struct FileHandle;
+
+class File : public Stream
+{
+  private:
+  std::shared_ptr<FileHandle> handle;
+  
+  public:
+  File() {}
+  File(std::shared_ptr<FileHandle> _handle) : handle(_handle) {}
+  operator bool() const;
+  int read() override;
+  int read(uint8_t *, size_t);
+  int peek() override;
+  int available() override;
+  using Print::write;
+  size_t write(uint8_t) override;
+  size_t write(const uint8_t *, size_t) override;
+  bool seek(uint32_t);
+  uint32_t position();
+  uint32_t size();
+  bool truncate(uint32_t);
+  void flush() override;
+  void close();
+  const char * name();
+  bool isDirectory();
+  File openNextFile();
+  void rewindDirectory();
+};
+
+class SDClass
+{
+  public:
+  bool begin(const char *);
+  // The firmware gives the chip select pin, the card is then the directory of the last begin() of the host
+  bool begin(uint8_t);
+  File open(const char *, uint8_t = FILE_READ);
+  bool exists(const char *);
+  bool remove(const char *);
+  bool mkdir(const char *);
+  bool rmdir(const char *);
+  bool rename(const char *, const char *);
+  // Writes succeed for this many more bytes, then they are cut short as on a full or failing card, negative for no limit
+  long writeLimit = -1;
+};
+
+extern SDClass SD;
+
+#endif
@@ -0,0 +1,205 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    Stream.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <stdio.h>
+
+#include "Arduino.h"
+#include "Stream.h"
+
+size_t Print::write(const uint8_t * buffer, size_t length)
+{
+  size_t written = 0;
+  while(length-- && write(*buffer++))
+  {
+    written++;
+  }
+  return written;
+}
+
+size_t Print::print(const char * string)
+{
+  return write(string);
+}
+
+size_t Print::print(const String & string)
+{
+  return write((const uint8_t *)string.c_str(), string.length());
+}
+
+size_t Print::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t Print::print(int number, int base)
+{
+  return print((long)number, base);
+}
+
+size_t Print::print(unsigned int number, int base)
+{
+  return print((unsigned long)number, base);
+}
+
+size_t Print::print(long number, int base)
+{
+  if(base == 10)
+  {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%ld", number);
+    return print(buffer);
+  }
+  return print((unsigned long)number, base);
+}
+
+size_t Print::print(unsigned long number, int base)
+{
+  String digits(number, base);
+  return print(digits);
+}
+
+size_t Print::println()
+{
+  return write((const uint8_t *)"\r\n", 2);
+}
+
+// Wait for the next character until the timeout, like the core
+int Stream::timedRead()
+{
+  uint32_t start = millis();
+  do
+  {
+    int c = read();
+    if(c >= 0)
+    {
+      return c;
+    }
+    yield();
+  } while(millis() - start < timeout);
+  return -1;
+}
+
+int Stream::timedPeek()
+{
+  uint32_t start = millis();
+  do
+  {
+    int c = peek();
+    if(c >= 0)
+    {
+      return c;
+    }
+    yield();
+  } while(millis() - start < timeout);
+  return -1;
+}
+
+bool Stream::find(const char * target)
+{
+  size_t length = strlen(target);
+  size_t matched = 0;
+  if(length == 0)
+  {
+    return true;
+  }
+  
+  int c;
+  while((c = timedRead()) >= 0)
+  {
+    if(c == target[matched])
+    {
+      if(++matched == length)
+      {
+        return true;
+      }
+    }
+    else
+    {
+      matched = c == target[0] ? 1 : 0;
+    }
+  }
+  return false;
+}
+
+// Skip to the first digit or minus sign and read the number, 0 if there is none before the timeout
+long Stream::parseInt()
+{
+  int c;
+  while((c = timedPeek()) >= 0 && c != '-' && !isDigit(c))
+  {
+    read();
+  }
+  if(c < 0)
+  {
+    return 0;
+  }
+  
+  bool negative = false;
+  long value = 0;
+  do
+  {
+    if(c == '-')
+    {
+      negative = true;
+    }
+    else
+    {
+      value = value * 10 + c - '0';
+    }
+    read();
+    c = timedPeek();
+  } while(c >= 0 && isDigit(c));
+  
+  return negative ? -value : value;
+}
+
+size_t Stream::readBytes(char * buffer, size_t length)
+{
+  size_t count = 0;
+  while(count < length)
+  {
+    int c = timedRead();
+    if(c < 0)
+    {
+      break;
+    }
+    buffer[count++] = c;
+  }
+  return count;
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  String string;
+  int c;
+  while((c = timedRead()) >= 0 && c != terminator)
+  {
+    string += (char)c;
+  }
+  return string;
+}
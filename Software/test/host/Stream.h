@@ -0,0 +1,81 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    Stream.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the Print and Stream classes of the core, with the parts the firmware uses
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "WString.h"
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *, size_t);
+  size_t write(const char * string) { return write((const uint8_t *)string, strlen(string)); }
+  
+  size_t print(const char *);
+  size_t print(const String &);
+  size_t print(char);
+  size_t print(int, int = 10);
+  size_t print(unsigned int, int = 10);
+  size_t print(long, int = 10);
+  size_t print(unsigned long, int = 10);
+  size_t println();
+  template<typename T> size_t println(T value) { return print(value) + println(); }
+  template<typename T> size_t println(T value, int base) { return print(value, base) + println(); }
+};
+
+class Stream : public Print
+{
+  protected:
+  unsigned long timeout = 1000; // [ms]
+  int timedRead();
+  int timedPeek();
+  
+  public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  
+  void setTimeout(unsigned long _timeout) { timeout = _timeout; }
+  bool find(const char *);
+  long parseInt();
+  size_t readBytes(char *, size_t);
+  size_t readBytes(uint8_t * buffer, size_t length) { return readBytes((char *)buffer, length); }
+  String readStringUntil(char);
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    TimeLib.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the TimeLib library, the same clock and calendar functions over the clock of the host
+
+#ifndef TIMELIB_H
+#define TIMELIB_H
+
+#include <time.h>
+#include "Arduino.h"
+
+typedef enum {
+  timeNotSet,
+  timeNeedsSync,
+  timeSet
+} timeStatus_t;
+
+typedef struct {
+  uint8_t Second;
+  uint8_t Minute;
+  uint8_t Hour;
+  uint8_t Wday; // Day of the week, Sunday is 1
+  uint8_t Day;
+  uint8_t Month;
+  uint8_t Year; // Years since 1970
+} tmElements_t;
+
+#define SECS_PER_MIN  ((time_t)60UL)
+#define SECS_PER_HOUR ((time_t)3600UL)
+#define SECS_PER_DAY  ((time_t)(SECS_PER_HOUR * 24UL))
+#define CalendarYrToTm(Y) ((Y) - 1970)
+#define tmYearToCalendar(Y) ((Y) + 1970)
+#define elapsedSecsToday(_time_) ((_time_) % SECS_PER_DAY)
+#define previousMidnight(_time_) (((_time_) / SECS_PER_DAY) * SECS_PER_DAY)
+
+typedef time_t (*getExternalTime)();
+
+time_t now();
+void setTime(time_t);
+void adjustTime(long);
+timeStatus_t timeStatus();
+void setSyncProvider(getExternalTime);
+void setSyncInterval(time_t);
+void breakTime(time_t, tmElements_t &);
+time_t makeTime(const tmElements_t &);
+
+int year(time_t);
+int month(time_t);
+int day(time_t);
+int hour(time_t);
+int minute(time_t);
+int second(time_t);
+int weekday(time_t);
+int year();
+int month();
+int day();
+int hour();
+int minute();
+int second();
+int weekday();
+
+#endif
@@ -0,0 +1,280 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    WString.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "WString.h"
+
+const String emptyString;
+
+void String::init()
+{
+  buffer = sso;
+  capacity = SSO_CAPACITY;
+  len = 0;
+  sso[0] = 0;
+}
+
+// Make room for a string of the given length, the content is kept
+bool String::reserve(unsigned int size)
+{
+  if(size <= capacity)
+  {
+    return true;
+  }
+  
+  char * grown = (char *)realloc(buffer == sso ? NULL : buffer, size + 1);
+  if(!grown)
+  {
+    return false;
+  }
+  if(buffer == sso)
+  {
+    memcpy(grown, sso, len + 1);
+  }
+  buffer = grown;
+  capacity = size;
+  return true;
+}
+
+bool String::copy(const char * string, unsigned int length)
+{
+  if(!reserve(length))
+  {
+    return false;
+  }
+  // The string may be a part of this one
+  memmove(buffer, string, length);
+  buffer[length] = 0;
+  len = length;
+  return true;
+}
+
+bool String::numberOf(unsigned long value, bool negative, unsigned char base)
+{
+  char digits[8 * sizeof(long) + 2];
+  char * digit = digits + sizeof(digits) - 1;
+  *digit = 0;
+  do
+  {
+    unsigned long rest = value % base;
+    *--digit = rest < 10 ? '0' + rest : 'a' + rest - 10;
+    value /= base;
+  } while(value);
+  if(negative)
+  {
+    *--digit = '-';
+  }
+  return copy(digit, digits + sizeof(digits) - 1 - digit);
+}
+
+String::String(const char * string)
+{
+  init();
+  if(string)
+  {
+    copy(string, strlen(string));
+  }
+}
+
+String::String(const String & string)
+{
+  init();
+  copy(string.buffer, string.len);
+}
+
+String::String(String && string)
+{
+  init();
+  *this = (String &&)string;
+}
+
+String::String(char c)
+{
+  init();
+  copy(&c, 1);
+}
+
+String::String(unsigned char value, unsigned char base)
+{
+  init();
+  numberOf(value, false, base);
+}
+
+String::String(int value, unsigned char base)
+{
+  init();
+  numberOf(value < 0 && base == 10 ? -(long)value : (unsigned int)value, value < 0 && base == 10, base);
+}
+
+String::String(unsigned int value, unsigned char base)
+{
+  init();
+  numberOf(value, false, base);
+}
+
+String::String(long value, unsigned char base)
+{
+  init();
+  numberOf(value < 0 && base == 10 ? -(unsigned long)value : (unsigned long)value, value < 0 && base == 10, base);
+}
+
+String::String(unsigned long value, unsigned char base)
+{
+  init();
+  numberOf(value, false, base);
+}
+
+String::~String()
+{
+  if(buffer != sso)
+  {
+    free(buffer);
+  }
+}
+
+String & String::operator=(const String & string)
+{
+  if(this != &string)
+  {
+    copy(string.buffer, string.len);
+  }
+  return *this;
+}
+
+String & String::operator=(String && string)
+{
+  if(this == &string)
+  {
+    return *this;
+  }
+  if(string.buffer == string.sso)
+  {
+    copy(string.sso, string.len);
+  }
+  else
+  {
+    // Take the buffer over
+    if(buffer != sso)
+    {
+      free(buffer);
+    }
+    buffer = string.buffer;
+    capacity = string.capacity;
+    len = string.len;
+    string.init();
+  }
+  return *this;
+}
+
+String & String::operator=(const char * string)
+{
+  copy(string ? string : "", string ? strlen(string) : 0);
+  return *this;
+}
+
+bool String::concat(const char * string, unsigned int length)
+{
+  if(!reserve(len + length))
+  {
+    return false;
+  }
+  memmove(buffer + len, string, length);
+  len += length;
+  buffer[len] = 0;
+  return true;
+}
+
+bool String::concat(const char * string)
+{
+  return string && concat(string, strlen(string));
+}
+
+bool String::concat(const String & string)
+{
+  return concat(string.buffer, string.len);
+}
+
+bool String::concat(char c)
+{
+  return concat(&c, 1);
+}
+
+bool String::concat(unsigned int number)
+{
+  String digits(number);
+  return concat(digits);
+}
+
+bool String::equals(const char * string) const
+{
+  return strcmp(buffer, string ? string : "") == 0;
+}
+
+bool String::equals(const String & string) const
+{
+  return len == string.len && memcmp(buffer, string.buffer, len) == 0;
+}
+
+bool String::equalsIgnoreCase(const String & string) const
+{
+  return len == string.len && strcasecmp(buffer, string.buffer) == 0;
+}
+
+bool String::startsWith(const char * prefix) const
+{
+  return strncmp(buffer, prefix, strlen(prefix)) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const
+{
+  if(from >= len)
+  {
+    return -1;
+  }
+  const char * found = strchr(buffer + from, c);
+  return found ? found - buffer : -1;
+}
+
+void String::toLowerCase()
+{
+  for(unsigned int i = 0; i < len; i++)
+  {
+    if(buffer[i] >= 'A' && buffer[i] <= 'Z')
+    {
+      buffer[i] += 'a' - 'A';
+    }
+  }
+}
+
+long String::toInt() const
+{
+  return atol(buffer);
+}
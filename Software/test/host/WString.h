@@ -0,0 +1,99 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    WString.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the String class of the ESP8266 core
+// Like the core since 2.5, strings of up to 10 characters are kept in the object and do not use the heap, longer ones
+// are allocated with realloc() and the buffer is kept when a shorter string is assigned
+
+#ifndef WSTRING_H
+#define WSTRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class String
+{
+  private:
+  enum { SSO_CAPACITY = 10 };
+  char * buffer;
+  unsigned int capacity;
+  unsigned int len;
+  char sso[SSO_CAPACITY + 1];
+  
+  void init();
+  bool copy(const char *, unsigned int);
+  bool numberOf(unsigned long, bool, unsigned char);
+  
+  public:
+  String(const char * = "");
+  String(const String &);
+  String(String &&);
+  explicit String(char);
+  explicit String(unsigned char, unsigned char = 10);
+  explicit String(int, unsigned char = 10);
+  explicit String(unsigned int, unsigned char = 10);
+  explicit String(long, unsigned char = 10);
+  explicit String(unsigned long, unsigned char = 10);
+  ~String();
+  
+  String & operator=(const String &);
+  String & operator=(String &&);
+  String & operator=(const char *);
+  
+  bool reserve(unsigned int);
+  unsigned int length() const { return len; }
+  const char * c_str() const { return buffer; }
+  
+  bool concat(const char *, unsigned int);
+  bool concat(const char *);
+  bool concat(const String &);
+  bool concat(char);
+  bool concat(unsigned int);
+  String & operator+=(const char * string) { concat(string); return *this; }
+  String & operator+=(const String & string) { concat(string); return *this; }
+  String & operator+=(char c) { concat(c); return *this; }
+  String & operator+=(unsigned int number) { concat(number); return *this; }
+  
+  bool equals(const char *) const;
+  bool equals(const String &) const;
+  bool equalsIgnoreCase(const String &) const;
+  bool startsWith(const char *) const;
+  bool operator==(const char * string) const { return equals(string); }
+  bool operator==(const String & string) const { return equals(string); }
+  bool operator!=(const char * string) const { return !equals(string); }
+  bool operator!=(const String & string) const { return !equals(string); }
+  
+  char operator[](unsigned int index) const { return index < len ? buffer[index] : 0; }
+  int indexOf(char, unsigned int = 0) const;
+  void toLowerCase();
+  long toInt() const;
+};
+
+extern const String emptyString;
+
+#endif
@@ -0,0 +1,72 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    WiFiClient.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the TCP client of the core over a socket of the host, see hostPortMap() for where it connects
+// Copies share the connection like on the ESP8266, it is closed when the last copy is gone or stop() is called
+
+#ifndef WIFICLIENT_H
+#define WIFICLIENT_H
+
+#include "Client.h"
+
+// Size of the send buffer of the network stack of the ESP8266 (2 * TCP_MSS), availableForWrite() never tells more
+#define TCP_SND_BUF 2920
+
+struct ClientContext;
+
+class WiFiClient : public Client
+{
+  protected:
+  ClientContext * context;
+  void release();
+  
+  public:
+  WiFiClient();
+  WiFiClient(int);
+  WiFiClient(const WiFiClient &);
+  WiFiClient & operator=(const WiFiClient &);
+  virtual ~WiFiClient();
+  
+  int connect(IPAddress, uint16_t) override;
+  int connect(const char *, uint16_t) override;
+  using Print::write;
+  size_t write(uint8_t) override;
+  size_t write(const uint8_t *, size_t) override;
+  size_t availableForWrite();
+  int available() override;
+  int read() override;
+  int read(uint8_t *, size_t) override;
+  int peek() override;
+  void flush() override;
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override;
+  void setNoDelay(bool);
+};
+
+#endif
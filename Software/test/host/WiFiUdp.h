@@ -0,0 +1,69 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    WiFiUdp.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Stand-in for the UDP class of the core, it only knows how to talk to the NTP server of hostNtp()
+
+#ifndef WIFIUDP_H
+#define WIFIUDP_H
+
+#include "Stream.h"
+#include "IPAddress.h"
+
+#define NTP_PORT 123
+#define NTP_SIZE 48
+
+class WiFiUDP : public Stream
+{
+  private:
+  bool open = false;
+  uint16_t remotePort = 0;
+  uint8_t packet[NTP_SIZE];
+  size_t packetLength = 0;
+  uint8_t reply[NTP_SIZE];
+  bool replyPending = false;
+  uint64_t replyTime = 0; // Time of the host clock at which the reply arrives [us]
+  size_t replyLength = 0;
+  size_t replyIndex = 0;
+  
+  public:
+  uint8_t begin(uint16_t);
+  void stop();
+  int beginPacket(IPAddress, uint16_t);
+  int beginPacket(const char *, uint16_t);
+  using Print::write;
+  size_t write(uint8_t) override;
+  size_t write(const uint8_t *, size_t) override;
+  int endPacket();
+  int parsePacket();
+  int available() override;
+  int read() override;
+  int read(uint8_t *, size_t);
+  int peek() override;
+};
+
+#endif
@@ -0,0 +1,692 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    host.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Host side of the stand-ins: clock, pins, ESP, calendar and SD card
+
+#include <map>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "TimeLib.h"
+#include "SD.h"
+#include "Wire.h"
+#include "ESP8266mDNS.h"
+#include "ArduinoOTA.h"
+
+// Clock
+
+static uint64_t clockMicros = 0;
+
+uint64_t hostMicros()
+{
+  return clockMicros;
+}
+
+void hostAdvanceMicros(uint64_t microseconds)
+{
+  clockMicros += microseconds;
+}
+
+void hostAdvance(uint32_t milliseconds)
+{
+  clockMicros += milliseconds * 1000ULL;
+}
+
+uint32_t micros()
+{
+  return clockMicros += 10;
+}
+
+uint32_t millis()
+{
+  return (clockMicros += 10) / 1000;
+}
+
+void yield()
+{
+}
+
+void delay(unsigned long milliseconds)
+{
+  hostAdvance(milliseconds);
+}
+
+// Pins
+
+struct HostPin
+{
+  int level = HIGH;
+  void (*handler)(void) = NULL;
+  int mode = 0;
+};
+
+static HostPin pins[17];
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pin < 17 ? pins[pin].level : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+  if(pin < 17)
+  {
+    pins[pin].level = level ? HIGH : LOW;
+  }
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+  if(pin < 17)
+  {
+    pins[pin].handler = handler;
+    pins[pin].mode = mode;
+  }
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  if(pin < 17)
+  {
+    pins[pin].handler = NULL;
+  }
+}
+
+void hostPin(uint8_t pin, int level)
+{
+  if(pin >= 17 || pins[pin].level == level)
+  {
+    return;
+  }
+  pins[pin].level = level;
+  
+  HostPin & state = pins[pin];
+  if(state.handler && (state.mode == CHANGE || (state.mode == RISING && level == HIGH) || (state.mode == FALLING && level == LOW)))
+  {
+    state.handler();
+  }
+}
+
+// Random numbers, a fixed sequence so that runs can be repeated
+
+static uint32_t randomState = 1;
+
+void randomSeed(unsigned long seed)
+{
+  randomState = seed ? seed : 1;
+}
+
+long random(long howBig)
+{
+  if(howBig <= 0)
+  {
+    return 0;
+  }
+  // xorshift32
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+  return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
+
+// ESP, the flash is kept sparse as only a few sectors are used
+// The sectors are numbered modulo the 4 GB that 32 bit addresses reach, as the address of _EEPROM_start is one of the host
+
+EspClass ESP;
+HostMemory hostMemory = {40000, 30000, 10, 3000};
+uint32_t _EEPROM_start;
+
+static uint32_t rtcMemory[128];
+static std::map<uint32_t, std::vector<uint8_t>> flash;
+
+uint32_t EspClass::getChipId()
+{
+  return 0x00c0ffee;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+  return hostMemory.heapFree;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize()
+{
+  return hostMemory.blockMax;
+}
+
+uint8_t EspClass::getHeapFragmentation()
+{
+  return hostMemory.fragmentation;
+}
+
+uint32_t EspClass::getFreeContStack()
+{
+  return hostMemory.stackFree;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size)
+{
+  if(offset * 4 + size > sizeof(rtcMemory))
+  {
+    return false;
+  }
+  memcpy(data, (uint8_t *)rtcMemory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size)
+{
+  if(offset * 4 + size > sizeof(rtcMemory))
+  {
+    return false;
+  }
+  memcpy((uint8_t *)rtcMemory + offset * 4, data, size);
+  return true;
+}
+
+static std::vector<uint8_t> & flashSector(uint32_t sector)
+{
+  std::vector<uint8_t> & data = flash[sector % (0x100000000ULL / SPI_FLASH_SEC_SIZE)];
+  if(data.empty())
+  {
+    data.assign(SPI_FLASH_SEC_SIZE, 0xff);
+  }
+  return data;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector)
+{
+  flashSector(sector).assign(SPI_FLASH_SEC_SIZE, 0xff);
+  return true;
+}
+
+// Writing can only clear bits, like on the flash chip
+bool EspClass::flashWrite(uint32_t address, uint32_t * data, size_t size)
+{
+  if(address % 4 || size % 4 || address % SPI_FLASH_SEC_SIZE + size > SPI_FLASH_SEC_SIZE)
+  {
+    return false;
+  }
+  std::vector<uint8_t> & sector = flashSector(address / SPI_FLASH_SEC_SIZE);
+  for(size_t i = 0; i < size; i++)
+  {
+    sector[address % SPI_FLASH_SEC_SIZE + i] &= ((uint8_t *)data)[i];
+  }
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t * data, size_t size)
+{
+  if(address % 4 || address % SPI_FLASH_SEC_SIZE + size > SPI_FLASH_SEC_SIZE)
+  {
+    return false;
+  }
+  memcpy(data, flashSector(address / SPI_FLASH_SEC_SIZE).data() + address % SPI_FLASH_SEC_SIZE, size);
+  return true;
+}
+
+void EspClass::restart()
+{
+  fprintf(stderr, "ESP.restart()\n");
+  exit(EXIT_FAILURE);
+}
+
+TwoWire Wire;
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+
+// Time, kept by millis() and synchronised with the provider like the TimeLib library does
+
+static uint32_t sysTime = 0;
+static uint32_t prevMillis = 0;
+static uint32_t nextSyncTime = 0;
+static uint32_t syncInterval = 300;
+static timeStatus_t status = timeNotSet;
+static getExternalTime syncProvider = NULL;
+
+time_t now()
+{
+  uint32_t current = millis();
+  while(current - prevMillis >= 1000)
+  {
+    sysTime++;
+    prevMillis += 1000;
+  }
+  if(nextSyncTime <= sysTime && syncProvider)
+  {
+    time_t timestamp = syncProvider();
+    if(timestamp != 0)
+    {
+      setTime(timestamp);
+    }
+    else
+    {
+      nextSyncTime = sysTime + syncInterval;
+      status = status == timeNotSet ? timeNotSet : timeNeedsSync;
+    }
+  }
+  return sysTime;
+}
+
+void setTime(time_t timestamp)
+{
+  sysTime = timestamp;
+  nextSyncTime = timestamp + syncInterval;
+  status = timeSet;
+  prevMillis = millis();
+}
+
+void adjustTime(long adjustment)
+{
+  sysTime += adjustment;
+}
+
+timeStatus_t timeStatus()
+{
+  now();
+  return status;
+}
+
+void setSyncProvider(getExternalTime provider)
+{
+  syncProvider = provider;
+  nextSyncTime = sysTime;
+  now();
+}
+
+void setSyncInterval(time_t interval)
+{
+  syncInterval = interval;
+  nextSyncTime = sysTime + syncInterval;
+}
+
+// Days since 1970-01-01 of a date and the other way around, valid for the whole Gregorian calendar
+static long daysFromCivil(int y, unsigned m, unsigned d)
+{
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  unsigned yoe = (unsigned)(y - era * 400);
+  unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + (long)doe - 719468;
+}
+
+static void civilFromDays(long z, int * y, unsigned * m, unsigned * d)
+{
+  z += 719468;
+  long era = (z >= 0 ? z : z - 146096) / 146097;
+  unsigned doe = (unsigned)(z - era * 146097);
+  unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  unsigned mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = (int)(yoe + era * 400) + (*m <= 2);
+}
+
+void breakTime(time_t timestamp, tmElements_t & elements)
+{
+  int y;
+  unsigned m, d;
+  long days = timestamp / SECS_PER_DAY;
+  civilFromDays(days, &y, &m, &d);
+  elements.Second = timestamp % 60;
+  elements.Minute = timestamp / 60 % 60;
+  elements.Hour = timestamp / 3600 % 24;
+  elements.Wday = (days + 4) % 7 + 1;
+  elements.Day = d;
+  elements.Month = m;
+  elements.Year = CalendarYrToTm(y);
+}
+
+time_t makeTime(const tmElements_t & elements)
+{
+  long days = daysFromCivil(tmYearToCalendar(elements.Year), elements.Month, elements.Day);
+  return days * SECS_PER_DAY + elements.Hour * SECS_PER_HOUR + elements.Minute * SECS_PER_MIN + elements.Second;
+}
+
+static tmElements_t elementsOf(time_t timestamp)
+{
+  tmElements_t elements;
+  breakTime(timestamp, elements);
+  return elements;
+}
+
+int year(time_t timestamp)
+{
+  return tmYearToCalendar(elementsOf(timestamp).Year);
+}
+
+int month(time_t timestamp)
+{
+  return elementsOf(timestamp).Month;
+}
+
+int day(time_t timestamp)
+{
+  return elementsOf(timestamp).Day;
+}
+
+int hour(time_t timestamp)
+{
+  return elementsOf(timestamp).Hour;
+}
+
+int minute(time_t timestamp)
+{
+  return elementsOf(timestamp).Minute;
+}
+
+int second(time_t timestamp)
+{
+  return elementsOf(timestamp).Second;
+}
+
+int weekday(time_t timestamp)
+{
+  return elementsOf(timestamp).Wday;
+}
+
+int year()
+{
+  return year(now());
+}
+
+int month()
+{
+  return month(now());
+}
+
+int day()
+{
+  return day(now());
+}
+
+int hour()
+{
+  return hour(now());
+}
+
+int minute()
+{
+  return minute(now());
+}
+
+int second()
+{
+  return second(now());
+}
+
+int weekday()
+{
+  return weekday(now());
+}
+
+// SD card
+
+SDClass SD;
+static std::string sdRoot;
+
+struct FileHandle
+{
+  std::string path; // On the host
+  std::string name;
+  FILE * file = NULL;
+  DIR * dir = NULL;
+  
+  ~FileHandle()
+  {
+    if(file)
+    {
+      fclose(file);
+    }
+    if(dir)
+    {
+      closedir(dir);
+    }
+  }
+};
+
+static std::string hostPath(const char * path)
+{
+  return sdRoot + (path[0] == '/' ? "" : "/") + path;
+}
+
+bool SDClass::begin(const char * root)
+{
+  sdRoot = root;
+  writeLimit = -1;
+  struct stat info;
+  return stat(root, &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+bool SDClass::begin(uint8_t)
+{
+  return !sdRoot.empty() && begin(std::string(sdRoot).c_str());
+}
+
+static File openHost(const std::string & path, uint8_t mode)
+{
+  std::shared_ptr<FileHandle> handle(new FileHandle);
+  handle->path = path;
+  size_t slash = path.find_last_of('/');
+  handle->name = slash == std::string::npos ? path : path.substr(slash + 1);
+  
+  struct stat info;
+  if(stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+  {
+    handle->dir = opendir(path.c_str());
+    return handle->dir ? File(handle) : File();
+  }
+  
+  handle->file = fopen(path.c_str(), mode == FILE_WRITE ? "a+b" : "rb");
+  return handle->file ? File(handle) : File();
+}
+
+File SDClass::open(const char * path, uint8_t mode)
+{
+  return openHost(hostPath(path), mode);
+}
+
+bool SDClass::exists(const char * path)
+{
+  struct stat info;
+  return stat(hostPath(path).c_str(), &info) == 0;
+}
+
+bool SDClass::remove(const char * path)
+{
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool SDClass::mkdir(const char * path)
+{
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool SDClass::rmdir(const char * path)
+{
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+// Like on the card, an existing file is not replaced
+bool SDClass::rename(const char * from, const char * to)
+{
+  return !exists(to) && ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+File::operator bool() const
+{
+  return handle != NULL;
+}
+
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::read(uint8_t * buffer, size_t length)
+{
+  if(!handle || !handle->file)
+  {
+    return -1;
+  }
+  return fread(buffer, 1, length, handle->file);
+}
+
+int File::peek()
+{
+  int c = read();
+  if(c >= 0)
+  {
+    fseek(handle->file, -1, SEEK_CUR);
+  }
+  return c;
+}
+
+int File::available()
+{
+  return handle && handle->file ? size() - position() : 0;
+}
+
+size_t File::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t * buffer, size_t length)
+{
+  if(!handle || !handle->file)
+  {
+    return 0;
+  }
+  if(SD.writeLimit >= 0 && (long)length > SD.writeLimit)
+  {
+    length = SD.writeLimit;
+  }
+  size_t written = fwrite(buffer, 1, length, handle->file);
+  fflush(handle->file);
+  if(SD.writeLimit >= 0)
+  {
+    SD.writeLimit -= written;
+  }
+  return written;
+}
+
+bool File::seek(uint32_t position)
+{
+  return handle && handle->file && position <= size() && fseek(handle->file, position, SEEK_SET) == 0;
+}
+
+uint32_t File::position()
+{
+  return handle && handle->file ? ftell(handle->file) : 0;
+}
+
+uint32_t File::size()
+{
+  struct stat info;
+  if(!handle || !handle->file || fstat(fileno(handle->file), &info) != 0)
+  {
+    return 0;
+  }
+  return info.st_size;
+}
+
+bool File::truncate(uint32_t size)
+{
+  if(!handle || !handle->file)
+  {
+    return false;
+  }
+  fflush(handle->file);
+  return ftruncate(fileno(handle->file), size) == 0;
+}
+
+void File::flush()
+{
+  if(handle && handle->file)
+  {
+    fflush(handle->file);
+  }
+}
+
+void File::close()
+{
+  handle.reset();
+}
+
+const char * File::name()
+{
+  return handle ? handle->name.c_str() : "";
+}
+
+bool File::isDirectory()
+{
+  return handle && handle->dir;
+}
+
+File File::openNextFile()
+{
+  if(!handle || !handle->dir)
+  {
+    return File();
+  }
+  
+  struct dirent * entry;
+  while((entry = readdir(handle->dir)) != NULL)
+  {
+    if(strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+    {
+      return openHost(handle->path + "/" + entry->d_name, FILE_READ);
+    }
+  }
+  return File();
+}
+
+void File::rewindDirectory()
+{
+  if(handle && handle->dir)
+  {
+    rewinddir(handle->dir);
+  }
+}
@@ -0,0 +1,73 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    host.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Host side controls of the stand-ins, used by the test programs and the tools to play the part of the hardware and
+// of the network around the firmware
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <time.h>
+
+// The clock moves forward a little on every call to micros(), hostAdvance() makes it jump
+// It runs on 64 bits, micros() rolls over after 71 minutes and millis() after 49 days like on the ESP8266
+void hostAdvance(uint32_t milliseconds);
+void hostAdvanceMicros(uint64_t microseconds);
+uint64_t hostMicros();
+
+// Change the level of a pin, the interrupt attached to it runs right away if the change matches its mode
+// All pins read HIGH until they are changed, like inputs with a pull-up
+void hostPin(uint8_t pin, int level);
+
+// Network: all connections go to 127.0.0.1, the port of the device is replaced by the host port mapped to it
+// A server listening on a device port that is mapped to 0 gets a free port, hostPortBound() tells which one
+void hostPortMap(uint16_t device, uint16_t host);
+uint16_t hostPort(uint16_t device);
+uint16_t hostPortBound(uint16_t device);
+
+// Called by the web server after every request with its target, "/api?request=live" for example, and the real time
+// handleClient() spent on it, which is how long the metering loop was held up [us]
+typedef void (*HostRequestHook)(const char * target, uint32_t duration);
+void hostRequestHook(HostRequestHook);
+
+// NTP requests sent with WiFiUDP are answered with this time plus the time elapsed on the host clock, 0 for no answer
+void hostNtp(time_t timeAtZero, uint32_t latency = 0);
+
+// Values returned by the memory functions of ESP
+struct HostMemory
+{
+  uint32_t heapFree;
+  uint32_t blockMax;
+  uint8_t fragmentation;
+  uint32_t stackFree;
+};
+
+extern HostMemory hostMemory;
+
+#endif
@@ -0,0 +1,498 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    network.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Host side of the network stand-ins: WiFi, TCP clients over sockets of the host and the NTP server of hostNtp()
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/sockios.h>
+
+#include "ESP8266WiFi.h"
+
+WiFiClass WiFi;
+
+// Ports of the device and of the host, see hostPortMap()
+#define HOST_PORTS 16
+
+static struct
+{
+  uint16_t device;
+  uint16_t host;
+  uint16_t bound;
+} hostPorts[HOST_PORTS];
+static uint8_t hostPortCount = 0;
+
+void hostPortMap(uint16_t device, uint16_t host)
+{
+  for(uint8_t i = 0; i < hostPortCount; i++)
+  {
+    if(hostPorts[i].device == device)
+    {
+      hostPorts[i].host = host;
+      return;
+    }
+  }
+  if(hostPortCount < HOST_PORTS)
+  {
+    hostPorts[hostPortCount].device = device;
+    hostPorts[hostPortCount].host = host;
+    hostPorts[hostPortCount].bound = 0;
+    hostPortCount++;
+  }
+}
+
+// Ports that are not mapped are used as they are
+uint16_t hostPort(uint16_t device)
+{
+  for(uint8_t i = 0; i < hostPortCount; i++)
+  {
+    if(hostPorts[i].device == device)
+    {
+      return hostPorts[i].host;
+    }
+  }
+  return device;
+}
+
+// Called by the web server once it listens
+void hostPortListening(uint16_t device, uint16_t bound)
+{
+  hostPortMap(device, hostPort(device));
+  for(uint8_t i = 0; i < hostPortCount; i++)
+  {
+    if(hostPorts[i].device == device)
+    {
+      hostPorts[i].bound = bound;
+    }
+  }
+}
+
+uint16_t hostPortBound(uint16_t device)
+{
+  for(uint8_t i = 0; i < hostPortCount; i++)
+  {
+    if(hostPorts[i].device == device)
+    {
+      return hostPorts[i].bound;
+    }
+  }
+  return 0;
+}
+
+// WiFi
+
+wl_status_t WiFiClass::begin(const char *, const char *)
+{
+  state = WL_CONNECTED;
+  return state;
+}
+
+bool WiFiClass::config(IPAddress, IPAddress, IPAddress)
+{
+  return true;
+}
+
+bool WiFiClass::disconnect(bool)
+{
+  state = WL_DISCONNECTED;
+  return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+  return state;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  return state == WL_CONNECTED ? IPAddress(127, 0, 0, 1) : IPAddress();
+}
+
+// Every name is the host itself
+int WiFiClass::hostByName(const char *, IPAddress & address)
+{
+  address = IPAddress(127, 0, 0, 1);
+  return 1;
+}
+
+// TCP connections are shared by the copies of a client, the contexts come from a fixed pool so that no heap is used
+// when a request is accepted, like the PCBs of the network stack of the ESP8266
+#define CLIENT_CONTEXTS 32
+
+struct ClientContext
+{
+  int fd;
+  int references;
+};
+
+static ClientContext clientContexts[CLIENT_CONTEXTS];
+
+static ClientContext * contextNew(int fd)
+{
+  for(uint8_t i = 0; i < CLIENT_CONTEXTS; i++)
+  {
+    if(clientContexts[i].references == 0)
+    {
+      clientContexts[i].fd = fd;
+      clientContexts[i].references = 1;
+      return &clientContexts[i];
+    }
+  }
+  return NULL;
+}
+
+WiFiClient::WiFiClient() : context(NULL)
+{
+}
+
+// Take over a connected socket, used by the web server
+WiFiClient::WiFiClient(int fd) : context(contextNew(fd))
+{
+  if(!context)
+  {
+    close(fd);
+  }
+}
+
+WiFiClient::WiFiClient(const WiFiClient & other) : Client(other), context(other.context)
+{
+  if(context)
+  {
+    context->references++;
+  }
+}
+
+WiFiClient & WiFiClient::operator=(const WiFiClient & other)
+{
+  if(other.context)
+  {
+    other.context->references++;
+  }
+  release();
+  context = other.context;
+  timeout = other.timeout;
+  return *this;
+}
+
+WiFiClient::~WiFiClient()
+{
+  release();
+}
+
+void WiFiClient::release()
+{
+  if(context && --context->references == 0 && context->fd >= 0)
+  {
+    close(context->fd);
+  }
+  context = NULL;
+}
+
+int WiFiClient::connect(IPAddress, uint16_t port)
+{
+  release();
+  uint16_t mapped = hostPort(port);
+  if(mapped == 0)
+  {
+    return 0;
+  }
+  
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if(fd < 0)
+  {
+    return 0;
+  }
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(mapped);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  
+  // Wait for the connection up to the timeout, like the core
+  if(::connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    struct pollfd event = {fd, POLLOUT, 0};
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if(errno != EINPROGRESS || poll(&event, 1, timeout) != 1 || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error)
+    {
+      close(fd);
+      return 0;
+    }
+  }
+  
+  context = contextNew(fd);
+  if(!context)
+  {
+    close(fd);
+    return 0;
+  }
+  setNoDelay(true);
+  return 1;
+}
+
+int WiFiClient::connect(const char *, uint16_t port)
+{
+  return connect(IPAddress(127, 0, 0, 1), port);
+}
+
+size_t WiFiClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+// Blocks until everything is handed to the network or the timeout, like the core
+size_t WiFiClient::write(const uint8_t * buffer, size_t length)
+{
+  size_t written = 0;
+  while(context && context->fd >= 0 && written < length)
+  {
+    ssize_t count = send(context->fd, buffer + written, length - written, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if(count > 0)
+    {
+      written += count;
+      continue;
+    }
+    struct pollfd event = {context->fd, POLLOUT, 0};
+    if(count < 0 && (errno != EAGAIN && errno != EWOULDBLOCK))
+    {
+      break;
+    }
+    if(poll(&event, 1, timeout) != 1 || !(event.revents & POLLOUT))
+    {
+      break;
+    }
+  }
+  return written;
+}
+
+// Free space of the send buffer, no more than the ESP8266 would have
+size_t WiFiClient::availableForWrite()
+{
+  if(!context || context->fd < 0)
+  {
+    return 0;
+  }
+  int size = 0, queued = 0;
+  socklen_t length = sizeof(size);
+  if(getsockopt(context->fd, SOL_SOCKET, SO_SNDBUF, &size, &length) != 0 || ioctl(context->fd, SIOCOUTQ, &queued) != 0)
+  {
+    return 0;
+  }
+  return size > queued ? min((size_t)(size - queued), (size_t)TCP_SND_BUF) : 0;
+}
+
+int WiFiClient::available()
+{
+  int count = 0;
+  if(!context || context->fd < 0 || ioctl(context->fd, FIONREAD, &count) != 0)
+  {
+    return 0;
+  }
+  return count;
+}
+
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t * buffer, size_t length)
+{
+  if(!context || context->fd < 0)
+  {
+    return -1;
+  }
+  ssize_t count = recv(context->fd, buffer, length, MSG_DONTWAIT);
+  return count > 0 ? count : -1;
+}
+
+int WiFiClient::peek()
+{
+  uint8_t c;
+  if(!context || context->fd < 0 || recv(context->fd, &c, 1, MSG_DONTWAIT | MSG_PEEK) != 1)
+  {
+    return -1;
+  }
+  return c;
+}
+
+void WiFiClient::flush()
+{
+}
+
+void WiFiClient::stop()
+{
+  if(context && context->fd >= 0)
+  {
+    close(context->fd);
+    context->fd = -1;
+  }
+  release();
+}
+
+// Connected as long as the other side did not close the connection, or there is still data to read
+uint8_t WiFiClient::connected()
+{
+  if(!context || context->fd < 0)
+  {
+    return 0;
+  }
+  uint8_t c;
+  ssize_t count = recv(context->fd, &c, 1, MSG_DONTWAIT | MSG_PEEK);
+  return count > 0 || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+WiFiClient::operator bool()
+{
+  return connected();
+}
+
+void WiFiClient::setNoDelay(bool noDelay)
+{
+  int value = noDelay;
+  if(context && context->fd >= 0)
+  {
+    setsockopt(context->fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+  }
+}
+
+// NTP server
+
+static time_t ntpTimeAtZero = 0;
+static uint32_t ntpLatency = 0; // [ms]
+
+void hostNtp(time_t timeAtZero, uint32_t latency)
+{
+  ntpTimeAtZero = timeAtZero;
+  ntpLatency = latency;
+}
+
+uint8_t WiFiUDP::begin(uint16_t)
+{
+  open = true;
+  replyPending = false;
+  replyLength = 0;
+  return 1;
+}
+
+void WiFiUDP::stop()
+{
+  open = false;
+  replyPending = false;
+  replyLength = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress, uint16_t port)
+{
+  remotePort = port;
+  packetLength = 0;
+  return 1;
+}
+
+int WiFiUDP::beginPacket(const char *, uint16_t port)
+{
+  return beginPacket(IPAddress(127, 0, 0, 1), port);
+}
+
+size_t WiFiUDP::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t WiFiUDP::write(const uint8_t * buffer, size_t length)
+{
+  length = min(length, sizeof(packet) - packetLength);
+  memcpy(packet + packetLength, buffer, length);
+  packetLength += length;
+  return length;
+}
+
+// A client request (mode 3) to the NTP port gets an answer after the latency, with the transmit time in seconds since 1900
+int WiFiUDP::endPacket()
+{
+  if(!open || remotePort != NTP_PORT || packetLength < NTP_SIZE || (packet[0] & 0x07) != 3 || ntpTimeAtZero == 0)
+  {
+    return 1;
+  }
+  
+  uint64_t time = hostMicros() + ntpLatency * 1000ULL;
+  uint32_t seconds = ntpTimeAtZero + time / 1000000 + 2208988800UL;
+  memset(reply, 0, sizeof(reply));
+  reply[0] = 0x24; // Version 4, server
+  reply[1] = 1;
+  for(uint8_t i = 0; i < 4; i++)
+  {
+    reply[40 + i] = seconds >> (24 - 8 * i);
+  }
+  replyPending = true;
+  replyTime = time;
+  return 1;
+}
+
+int WiFiUDP::parsePacket()
+{
+  if(!replyPending || hostMicros() < replyTime)
+  {
+    return 0;
+  }
+  replyPending = false;
+  replyLength = NTP_SIZE;
+  replyIndex = 0;
+  return replyLength;
+}
+
+int WiFiUDP::available()
+{
+  return replyLength - replyIndex;
+}
+
+int WiFiUDP::read()
+{
+  return replyIndex < replyLength ? reply[replyIndex++] : -1;
+}
+
+int WiFiUDP::read(uint8_t * buffer, size_t length)
+{
+  length = min(length, replyLength - replyIndex);
+  memcpy(buffer, reply + replyIndex, length);
+  replyIndex += length;
+  return length;
+}
+
+int WiFiUDP::peek()
+{
+  return replyIndex < replyLength ? reply[replyIndex] : -1;
+}
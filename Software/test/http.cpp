@@ -0,0 +1,163 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    http.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "http.h"
+
+#define HTTP_TIMEOUT 5 // [s]
+
+static uint16_t httpPort;
+static char authorization[96];
+
+static void base64(char * output, const char * input)
+{
+  static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t length = strlen(input);
+  for(size_t i = 0; i < length; i += 3)
+  {
+    uint32_t block = (uint8_t)input[i] << 16;
+    block |= i + 1 < length ? (uint8_t)input[i + 1] << 8 : 0;
+    block |= i + 2 < length ? (uint8_t)input[i + 2] : 0;
+    *output++ = digits[block >> 18 & 0x3f];
+    *output++ = digits[block >> 12 & 0x3f];
+    *output++ = i + 1 < length ? digits[block >> 6 & 0x3f] : '=';
+    *output++ = i + 2 < length ? digits[block & 0x3f] : '=';
+  }
+  *output = 0;
+}
+
+// Requests go to this port of 127.0.0.1, with the credentials of the configuration
+void httpBegin(uint16_t port)
+{
+  httpPort = port;
+  authorization[0] = 0;
+  #ifdef ENABLE_AUTHENTIFICATION
+  char credentials[48];
+  snprintf(credentials, sizeof(credentials), "%s:%s", http_username, http_password);
+  char encoded[68];
+  base64(encoded, credentials);
+  snprintf(authorization, sizeof(authorization), "Authorization: Basic %s\r\n", encoded);
+  #endif
+}
+
+// GET the target with extra header lines, each ending with "\r\n", the server closes the connection after the response
+// Returns false when the connection failed, timed out or the response could not be read
+bool httpGet(const char * target, const char * headers, uint8_t * body, size_t size, HttpResponse * response)
+{
+  response->status = 0;
+  response->length = 0;
+  
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0)
+  {
+    return false;
+  }
+  struct timeval timeout = {HTTP_TIMEOUT, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_port = htons(httpPort);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if(connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  
+  char buffer[16384];
+  int length = snprintf(buffer, sizeof(buffer), "GET %s HTTP/1.1\r\nHost: power\r\n%s%s\r\n", target, authorization, headers ? headers : "");
+  if(send(fd, buffer, length, MSG_NOSIGNAL) != length)
+  {
+    close(fd);
+    return false;
+  }
+  
+  // The head is kept until its end is found, the rest is the body
+  char head[1024];
+  size_t headLength = 0;
+  bool inBody = false;
+  ssize_t count;
+  while((count = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+  {
+    const char * data = buffer;
+    if(!inBody)
+    {
+      size_t copied = min((size_t)count, sizeof(head) - 1 - headLength);
+      memcpy(head + headLength, buffer, copied);
+      head[headLength + copied] = 0;
+      char * end = strstr(head, "\r\n\r\n");
+      if(!end)
+      {
+        headLength += copied;
+        if(headLength == sizeof(head) - 1)
+        {
+          break;
+        }
+        continue;
+      }
+      
+      // What follows the head in this block belongs to the body
+      size_t used = end + 4 - head - headLength;
+      data += used;
+      count -= used;
+      inBody = true;
+      
+      // "HTTP/1.1 200 OK"
+      if(sscanf(head, "HTTP/1.%*d %d", &response->status) != 1)
+      {
+        break;
+      }
+    }
+    
+    if(body && response->length < size)
+    {
+      memcpy(body + response->length, data, min((uint64_t)count, size - response->length));
+    }
+    response->length += count;
+  }
+  close(fd);
+  
+  if(count != 0 || !inBody)
+  {
+    response->status = 0;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,47 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    http.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Minimal HTTP client of the host tools, one request per connection like the browsers of the dashboard
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Response of httpGet(), the body is kept up to the size of the given buffer
+struct HttpResponse
+{
+  int status;      // 0 when the connection failed or timed out
+  uint64_t length; // Bytes of the body, including the ones that did not fit in the buffer
+};
+
+void httpBegin(uint16_t);
+bool httpGet(const char *, const char *, uint8_t *, size_t, HttpResponse *);
+
+#endif
@@ -0,0 +1,336 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    loadtest.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Load test of the web server of the SD firmware built on the host, while the firmware meters a replayed day
+// Concurrent clients request live values, today's values, static files of SD_root and directory listings.
+// For each type of request the tool reports the requests per second, the p50/p99 latency seen by the clients, the
+// errors and how long the metering loop was held up, as JSON or CSV for regression tracking.
+// The times are those of the host, they only compare with other runs on the same machine.
+// loadtest [--clients N] [--duration S] [--speed N] [--port P] [--output file.json|file.csv]
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <time.h>
+
+#include <Arduino.h>
+
+#include "test.h"
+#include "replay.h"
+#include "http.h"
+
+void loop();
+
+enum LoadType {
+  LOAD_LIVE,
+  LOAD_VALUES,
+  LOAD_FILE,
+  LOAD_LIST,
+  LOAD_TYPES
+};
+
+static const char * loadTypeNames[] = {"live", "values", "file", "list"};
+
+// Requests of each type, the clients go through them in turn
+static const char * loadTargets[LOAD_TYPES][4] = {
+  {"/api?request=live"},
+  {"/api?request=values"},
+  {"/index.htm", "/favicon.ico", "/edit/index.htm", "/log.txt"},
+  {"/list?dir=/", "/list?dir=/power"}
+};
+
+struct LoadResult
+{
+  std::vector<uint32_t> latencies; // [us]
+  std::vector<uint32_t> stalls; // [us]
+  uint32_t errors = 0;
+};
+
+static LoadResult results[LOAD_TYPES];
+static std::mutex resultsLock;
+static std::atomic<bool> running(true);
+static std::atomic<int> clientsActive(0);
+
+static uint64_t realMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static LoadType loadType(const char * target)
+{
+  if(strncmp(target, "/api?request=live", 17) == 0)
+  {
+    return LOAD_LIVE;
+  }
+  if(strncmp(target, "/api?request=values", 19) == 0)
+  {
+    return LOAD_VALUES;
+  }
+  if(strncmp(target, "/list", 5) == 0)
+  {
+    return LOAD_LIST;
+  }
+  return LOAD_FILE;
+}
+
+// Called by the web server on the firmware thread, with the time the request held up the metering loop
+static void requestDone(const char * target, uint32_t duration)
+{
+  std::lock_guard<std::mutex> lock(resultsLock);
+  results[loadType(target)].stalls.push_back(duration);
+}
+
+static void client(uint8_t index)
+{
+  uint32_t turn = index;
+  while(running)
+  {
+    LoadType type = (LoadType)(turn % LOAD_TYPES);
+    const char * const * targets = loadTargets[type];
+    uint8_t count = 0;
+    while(count < 4 && targets[count])
+    {
+      count++;
+    }
+    const char * target = targets[turn / LOAD_TYPES % count];
+    turn++;
+    
+    uint64_t timeStart = realMicros();
+    HttpResponse response;
+    bool ok = httpGet(target, NULL, NULL, 0, &response) && response.status / 100 == 2;
+    uint32_t latency = realMicros() - timeStart;
+    
+    std::lock_guard<std::mutex> lock(resultsLock);
+    if(ok)
+    {
+      results[type].latencies.push_back(latency);
+    }
+    else
+    {
+      results[type].errors++;
+    }
+  }
+  clientsActive--;
+}
+
+// Percentile of the samples [ms]
+static double percentile(std::vector<uint32_t> & samples, uint8_t percent)
+{
+  if(samples.empty())
+  {
+    return 0;
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t index = std::min(samples.size() - 1, samples.size() * percent / 100);
+  return samples[index] / 1000.0;
+}
+
+struct LoadSummary
+{
+  const char * type;
+  uint32_t requests;
+  uint32_t errors;
+  double rate; // [1/s]
+  double latency50, latency99; // [ms]
+  double stall50, stall99, stallMax; // [ms]
+};
+
+static LoadSummary summarize(const char * name, LoadResult & result, double seconds)
+{
+  LoadSummary summary;
+  summary.type = name;
+  summary.requests = result.latencies.size();
+  summary.errors = result.errors;
+  summary.rate = summary.requests / seconds;
+  summary.latency50 = percentile(result.latencies, 50);
+  summary.latency99 = percentile(result.latencies, 99);
+  summary.stall50 = percentile(result.stalls, 50);
+  summary.stall99 = percentile(result.stalls, 99);
+  summary.stallMax = result.stalls.empty() ? 0 : *std::max_element(result.stalls.begin(), result.stalls.end()) / 1000.0;
+  return summary;
+}
+
+static bool writeResults(const char * path, const std::vector<LoadSummary> & summaries, uint8_t clients, double seconds)
+{
+  FILE * file = fopen(path, "w");
+  if(!file)
+  {
+    return false;
+  }
+  
+  size_t length = strlen(path);
+  bool csv = length > 4 && strcmp(path + length - 4, ".csv") == 0;
+  if(csv)
+  {
+    fprintf(file, "Type,Requests,Errors,Requests per second,p50 [ms],p99 [ms],Stall p50 [ms],Stall p99 [ms],Stall max [ms]\n");
+    for(const LoadSummary & s : summaries)
+    {
+      fprintf(file, "%s,%u,%u,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n", s.type, s.requests, s.errors, s.rate, s.latency50, s.latency99, s.stall50, s.stall99, s.stallMax);
+    }
+  }
+  else
+  {
+    fprintf(file, "{\n  \"clients\": %u,\n  \"seconds\": %.2f,\n  \"types\": [\n", clients, seconds);
+    for(size_t i = 0; i < summaries.size(); i++)
+    {
+      const LoadSummary & s = summaries[i];
+      fprintf(file, "    {\"type\": \"%s\", \"requests\": %u, \"errors\": %u, \"rps\": %.1f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+        "\"stall_p50_ms\": %.3f, \"stall_p99_ms\": %.3f, \"stall_max_ms\": %.3f}%s\n",
+        s.type, s.requests, s.errors, s.rate, s.latency50, s.latency99, s.stall50, s.stall99, s.stallMax, i + 1 < summaries.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+  }
+  fclose(file);
+  return true;
+}
+
+int main(int argc, char ** argv)
+{
+  ReplayOptions options = {TEST_DATA_DIR "/power/20150728.CSV", 1000, 8080, 1883, 50};
+  uint8_t clients = 8;
+  double duration = 10;
+  const char * output = "loadtest.json";
+  
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--clients") == 0 && i + 1 < argc)
+    {
+      int value = atoi(argv[++i]);
+      clients = constrain(value, 1, 64);
+    }
+    else if(strcmp(argv[i], "--duration") == 0 && i + 1 < argc)
+    {
+      duration = atof(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+    {
+      options.speed = min(atoi(argv[++i]), 1000);
+    }
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+    {
+      options.port = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+    {
+      output = argv[++i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--clients N] [--duration S] [--speed N] [--port P] [--output file.json|file.csv]\n", argv[0]);
+      fprintf(stderr, "  --clients  concurrent clients, up to 64 (8)\n");
+      fprintf(stderr, "  --duration seconds of load (10)\n");
+      fprintf(stderr, "  --speed    times faster than real time the day is replayed meanwhile, 0 for as fast as possible (1000)\n");
+      fprintf(stderr, "  --port     host port of the web server, 0 for any free one (8080)\n");
+      fprintf(stderr, "  --output   results, CSV when the name ends with .csv (loadtest.json)\n");
+      return 2;
+    }
+  }
+  
+  hostRequestHook(requestDone);
+  if(!replayBegin(options))
+  {
+    return 2;
+  }
+  
+  // The firmware starts the web server once it is connected
+  while(!hostPortBound(80) && replayStep());
+  if(!hostPortBound(80))
+  {
+    fprintf(stderr, "The web server did not start\n");
+    return 2;
+  }
+  httpBegin(hostPortBound(80));
+  
+  std::vector<std::thread> threads;
+  clientsActive = clients;
+  for(uint8_t i = 0; i < clients; i++)
+  {
+    threads.push_back(std::thread(client, i));
+  }
+  
+  // The firmware runs on this thread, the loop goes on once the day is over
+  uint64_t timeStart = realMicros();
+  while(realMicros() - timeStart < duration * 1e6)
+  {
+    if(!replayStep())
+    {
+      loop();
+    }
+  }
+  running = false;
+  
+  // Serve the last requests of the clients, they give up after 5 s anyway
+  uint64_t timeStop = realMicros();
+  while(clientsActive > 0)
+  {
+    loop();
+  }
+  for(std::thread & thread : threads)
+  {
+    thread.join();
+  }
+  double seconds = (timeStop - timeStart) / 1e6;
+  
+  LoadResult total;
+  std::vector<LoadSummary> summaries;
+  for(uint8_t type = 0; type < LOAD_TYPES; type++)
+  {
+    summaries.push_back(summarize(loadTypeNames[type], results[type], seconds));
+    total.latencies.insert(total.latencies.end(), results[type].latencies.begin(), results[type].latencies.end());
+    total.stalls.insert(total.stalls.end(), results[type].stalls.begin(), results[type].stalls.end());
+    total.errors += results[type].errors;
+  }
+  summaries.push_back(summarize("all", total, seconds));
+  
+  printf("%u clients for %.1f s\n", clients, seconds);
+  printf("%-7s %9s %7s %9s %9s %9s %11s %11s %11s\n", "Type", "Requests", "Errors", "Req/s", "p50 [ms]", "p99 [ms]", "Stall p50", "Stall p99", "Stall max");
+  for(const LoadSummary & s : summaries)
+  {
+    printf("%-7s %9u %7u %9.1f %9.3f %9.3f %11.3f %11.3f %11.3f\n", s.type, s.requests, s.errors, s.rate, s.latency50, s.latency99, s.stall50, s.stall99, s.stallMax);
+  }
+  
+  if(!writeResults(output, summaries, clients, seconds))
+  {
+    fprintf(stderr, "%s could not be written\n", output);
+    return 2;
+  }
+  printf("Results written to %s\n", output);
+  
+  // As a test: every type was served and nothing failed
+  for(uint8_t type = 0; type < LOAD_TYPES; type++)
+  {
+    CHECK(summaries[type].requests > 0);
+  }
+  CHECK_EQUAL(0, total.errors);
+  return testResult("loadtest");
+}
@@ -0,0 +1,378 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    replay.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// The day is played to the firmware as LED blinks on the sensor pin, minute after minute, while loop() runs every few
+// milliseconds of the host clock. The blinks of a minute are spread evenly but kept REPLAY_GUARD away from its ends:
+// the firmware clock is set from NTP to the whole second and lags the host clock by up to a second.
+// A few minutes are played before the day so that the clock is set and the debounce has learnt the pulse width.
+// The firmware keeps its own clock, the replay never sets it.
+
+#include <string>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <TimeLib.h>
+#include <SD.h>
+
+#include "config.h"
+#ifdef REPLAY_MQTT
+#include "IoTPowerMeterMQTT.h"
+#else
+#include "IoTPowerMeter.h"
+#endif
+#include "series.h"
+#include "test.h"
+#include "replay.h"
+
+#define REPLAY_LEAD_MINUTES 3
+#define REPLAY_LEAD_POWER 60 // Wh per minute before the day, one blink per second at 1000 imp/kWh
+#define REPLAY_GUARD 2000000ULL // [us]
+#define REPLAY_PULSE 10000 // LED pulse width, shorter when the blinks come closer [us]
+#define REPLAY_END 5 // Seconds after midnight until the last minute is surely logged
+
+void setup();
+void loop();
+
+static ReplayOptions options;
+static uint16_t meterConstant;
+static time_t dayStart;
+static uint16_t source[MINUTES_PER_DAY];
+static uint32_t expected[MINUTES_PER_DAY]; // What the firmware should log after converting the blinks back [Wh]
+static uint32_t expectedToday;
+static uint32_t today;
+static bool todaySampled;
+static bool serverAnnounced;
+
+static uint64_t origin; // Host time of the start of the first minute played [us]
+static int32_t minuteIndex; // Minute of the day being played, negative before the day
+static uint32_t minuteBlinks;
+static uint32_t blink; // Next blink of the minute
+static uint64_t pulseEnd; // Host time at which the LED of the last blink turns off, 0 when it is off [us]
+static uint64_t nextLoop;
+static uint64_t cumulativeWh;
+static uint64_t cumulativeImpulses;
+static uint64_t blinks;
+static struct timespec realStart;
+
+static uint64_t realMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - realStart.tv_sec) * 1000000ULL + now.tv_nsec / 1000 - realStart.tv_nsec / 1000;
+}
+
+// Copy a directory of the host to the card, leaving out the day being played so that the firmware writes it anew
+static void copyTree(const std::string & from, const std::string & to, const char * skip)
+{
+  DIR * dir = opendir(from.c_str());
+  if(!dir)
+  {
+    return;
+  }
+  
+  struct dirent * entry;
+  while((entry = readdir(dir)) != NULL)
+  {
+    std::string name = entry->d_name;
+    if(name == "." || name == ".." || name.compare(0, 8, skip) == 0)
+    {
+      continue;
+    }
+    
+    std::string path = from + "/" + name;
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+    {
+      continue;
+    }
+    if(S_ISDIR(info.st_mode))
+    {
+      SD.mkdir((to + "/" + name).c_str());
+      copyTree(path, to + "/" + name, skip);
+    }
+    else
+    {
+      testCopy((path.substr(strlen(TEST_DATA_DIR))).c_str(), (to + "/" + name).c_str());
+    }
+  }
+  closedir(dir);
+}
+
+// Energy of a minute of the replay, the minutes before the day have a fixed power [Wh]
+static uint32_t minuteEnergy(int32_t index)
+{
+  return index < 0 ? REPLAY_LEAD_POWER : source[index];
+}
+
+// Start a minute: the Wh become blinks, the fraction of a blink is carried over so that the day total is exact
+static void minuteBegin(int32_t index)
+{
+  minuteIndex = index;
+  blink = 0;
+  if(index >= MINUTES_PER_DAY)
+  {
+    minuteBlinks = 0;
+    return;
+  }
+  
+  cumulativeWh += minuteEnergy(index);
+  uint64_t impulses = cumulativeWh * meterConstant / 1000;
+  minuteBlinks = impulses - cumulativeImpulses;
+  
+  // The firmware converts the blinks back with its own carry, the same sums give the same minutes
+  if(index >= 0)
+  {
+    expected[index] = impulses * 1000 / meterConstant - cumulativeImpulses * 1000 / meterConstant;
+    expectedToday += minuteBlinks;
+  }
+  cumulativeImpulses = impulses;
+}
+
+static uint64_t minuteStart(int32_t index)
+{
+  return origin + (uint64_t)(index + REPLAY_LEAD_MINUTES) * 60000000ULL;
+}
+
+// Host time of a blink of the current minute [us]
+static uint64_t blinkTime(uint32_t index)
+{
+  uint64_t length = 60000000ULL - 2 * REPLAY_GUARD;
+  return minuteStart(minuteIndex) + REPLAY_GUARD + length * (2 * index + 1) / (2 * minuteBlinks);
+}
+
+static bool readSource(const char * path)
+{
+  FILE * file = fopen(path, "rb");
+  if(!file)
+  {
+    return false;
+  }
+  
+  SeriesParser parser;
+  parser.begin(source);
+  uint8_t block[512];
+  size_t length;
+  while((length = fread(block, 1, sizeof(block), file)) > 0)
+  {
+    parser.feed(block, length);
+  }
+  parser.finish();
+  fclose(file);
+  return parser.rows > 0;
+}
+
+// The date comes from the file name, like the files of /power
+static bool readDate(const char * path)
+{
+  const char * name = strrchr(path, '/');
+  name = name ? name + 1 : path;
+  
+  int y, m, d;
+  if(strlen(name) < 8 || sscanf(name, "%4d%2d%2d", &y, &m, &d) != 3)
+  {
+    return false;
+  }
+  
+  tmElements_t elements = {0};
+  elements.Year = CalendarYrToTm(y);
+  elements.Month = m;
+  elements.Day = d;
+  dayStart = makeTime(elements);
+  return true;
+}
+
+bool replayBegin(const ReplayOptions & _options)
+{
+  options = _options;
+  if(!readDate(options.file))
+  {
+    fprintf(stderr, "%s: the file name must start with the date as YYYYMMDD\n", options.file);
+    return false;
+  }
+  if(!readSource(options.file))
+  {
+    fprintf(stderr, "%s: no rows could be read\n", options.file);
+    return false;
+  }
+  
+  // A copy of SD_root is the card, SD_root itself is never written
+  const char * card = testCard();
+  if(!card)
+  {
+    return false;
+  }
+  char skip[9];
+  snprintf(skip, sizeof(skip), "%04d%02d%02d", year(dayStart), month(dayStart), day(dayStart));
+  copyTree(TEST_DATA_DIR, "", skip);
+  
+  // The clock of the NTP server is at the start of the first minute played when the host clock is at origin
+  origin = hostMicros() - hostMicros() % 1000000;
+  hostNtp(dayStart - REPLAY_LEAD_MINUTES * 60 - origin / 1000000);
+  hostPortMap(80, options.port);
+  hostPortMap(1883, options.broker);
+  
+  setup();
+  
+  #ifdef REPLAY_MQTT
+  meterConstant = METER_IMPULSES_PER_KWH;
+  #else
+  meterConstant = getMeterConstant();
+  #endif
+  
+  cumulativeWh = 0;
+  cumulativeImpulses = 0;
+  expectedToday = 0;
+  todaySampled = false;
+  serverAnnounced = false;
+  blinks = 0;
+  pulseEnd = 0;
+  nextLoop = hostMicros();
+  minuteBegin(-REPLAY_LEAD_MINUTES);
+  clock_gettime(CLOCK_MONOTONIC, &realStart);
+  return true;
+}
+
+// Play the next blink edge or loop() call, returns false once the day has been played
+bool replayStep()
+{
+  uint64_t end = minuteStart(MINUTES_PER_DAY) + REPLAY_END * 1000000ULL;
+  uint64_t next = nextLoop;
+  if(pulseEnd)
+  {
+    next = min(next, pulseEnd);
+  }
+  else if(blink < minuteBlinks)
+  {
+    next = min(next, blinkTime(blink));
+  }
+  if(next >= end)
+  {
+    return false;
+  }
+  
+  // Keep to the speed, the host clock only moves forward
+  if(options.speed)
+  {
+    uint64_t real = (next - origin) / options.speed;
+    uint64_t elapsed = realMicros();
+    if(real > elapsed + 1000)
+    {
+      usleep(real - elapsed);
+    }
+  }
+  if(next > hostMicros())
+  {
+    hostAdvanceMicros(next - hostMicros());
+  }
+  
+  // Today's total once the last blink of the day is in, before the firmware sees midnight
+  if(!todaySampled && hostMicros() >= minuteStart(MINUTES_PER_DAY) - 1000000ULL)
+  {
+    todaySampled = true;
+    #ifdef REPLAY_MQTT
+    today = helper_power_today();
+    #else
+    today = todayPowerUsage();
+    #endif
+  }
+  
+  if(pulseEnd && next == pulseEnd)
+  {
+    pulseEnd = 0;
+    hostPin(SENSOR_PIN, HIGH);
+  }
+  else if(next == nextLoop)
+  {
+    loop();
+    nextLoop += options.step * 1000ULL;
+    
+    // The firmware starts its web server once it is connected
+    if(!serverAnnounced && hostPortBound(80))
+    {
+      serverAnnounced = true;
+      printf("Web server on http://127.0.0.1:%u/\n", hostPortBound(80));
+      fflush(stdout);
+    }
+  }
+  else
+  {
+    uint64_t width = (60000000ULL - 2 * REPLAY_GUARD) / minuteBlinks / 2;
+    hostPin(SENSOR_PIN, LOW);
+    pulseEnd = hostMicros() + min(width, (uint64_t)REPLAY_PULSE);
+    blink++;
+    blinks++;
+  }
+  
+  // Next minute once all its blinks are played
+  if(blink == minuteBlinks && !pulseEnd && minuteIndex < MINUTES_PER_DAY && hostMicros() >= minuteStart(minuteIndex + 1))
+  {
+    minuteBegin(minuteIndex + 1);
+  }
+  return true;
+}
+
+// Compare what the firmware counted with the file, returns the number of differences
+int replayCheck()
+{
+  int failures = 0;
+  double seconds = realMicros() / 1e6;
+  printf("%04d-%02d-%02d: %llu blinks in %.1f s, %.0f times real time\n", year(dayStart), month(dayStart), day(dayStart),
+    (unsigned long long)blinks, seconds, (minuteStart(MINUTES_PER_DAY) - origin) / 1e6 / seconds);
+  
+  uint32_t todayWh = (uint64_t)expectedToday * 1000 / meterConstant;
+  printf("Today: %u Wh, expected %u Wh\n", today, todayWh);
+  failures += today != todayWh;
+  
+  #ifndef REPLAY_MQTT
+  // The day log file written by the firmware, minute by minute
+  static uint16_t logged[MINUTES_PER_DAY];
+  uint16_t rows = readDay(dayStart, logged);
+  uint32_t loggedWh = 0;
+  uint32_t expectedWh = 0;
+  uint16_t differences = 0;
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    loggedWh += logged[i];
+    expectedWh += expected[i];
+    if(logged[i] != expected[i])
+    {
+      if(differences++ < 10)
+      {
+        printf("%02u:%02u: %u Wh logged, expected %u Wh\n", i / 60, i % 60, logged[i], expected[i]);
+      }
+    }
+  }
+  printf("Log: %u rows, %u Wh, expected %u Wh, %u minutes differ\n", rows, loggedWh, expectedWh, differences);
+  failures += differences + (rows != MINUTES_PER_DAY);
+  #endif
+  
+  return failures;
+}
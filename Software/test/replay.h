@@ -0,0 +1,49 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    replay.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Replay of a recorded day through the whole firmware built on the host, see replay_main.cpp
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+
+struct ReplayOptions
+{
+  const char * file;   // Day log file, its name starts with the date as YYYYMMDD like the files of /power
+  uint32_t speed;      // Times faster than real time, 0 for as fast as the host can
+  uint16_t port;       // Host port of the web server of the SD firmware, 0 for any free one
+  uint16_t broker;     // Host port of the MQTT broker of the MQTT firmware
+  uint32_t step;       // Time between two calls to loop() [ms]
+};
+
+bool replayBegin(const ReplayOptions &);
+bool replayStep();
+int replayCheck();
+
+#endif
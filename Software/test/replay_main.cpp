@@ -0,0 +1,89 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    replay_main.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Play a recorded day to the firmware built on the host, as fast as asked, then check what it counted and logged
+// replay [--speed N] [--port P] [--broker P] [--step MS] [file]
+// The web server of the SD firmware can be used while the day is played, see loadtest.cpp
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "replay.h"
+
+int main(int argc, char ** argv)
+{
+  ReplayOptions options = {TEST_DATA_DIR "/power/20150728.CSV", 1000, 8080, 1883, 50};
+  
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--speed") == 0 && i + 1 < argc)
+    {
+      options.speed = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+    {
+      options.port = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--broker") == 0 && i + 1 < argc)
+    {
+      options.broker = atoi(argv[++i]);
+    }
+    else if(strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+    {
+      options.step = atoi(argv[++i]);
+    }
+    else if(argv[i][0] != '-')
+    {
+      options.file = argv[i];
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--speed N] [--port P] [--broker P] [--step MS] [file]\n", argv[0]);
+      fprintf(stderr, "  --speed  times faster than real time, 1 to 1000, 0 for as fast as possible (1000)\n");
+      fprintf(stderr, "  --port   host port of the web server, 0 for any free one (8080)\n");
+      fprintf(stderr, "  --broker host port of the MQTT broker (1883)\n");
+      fprintf(stderr, "  --step   time between two calls to loop() (50 ms)\n");
+      return 2;
+    }
+  }
+  if(options.speed > 1000 || options.step == 0)
+  {
+    fprintf(stderr, "The speed goes up to 1000 and the step must be at least 1 ms\n");
+    return 2;
+  }
+  
+  if(!replayBegin(options))
+  {
+    return 2;
+  }
+  while(replayStep());
+  
+  testFailures = replayCheck();
+  return testResult("replay");
+}
@@ -0,0 +1,99 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <string>
+#include <stdlib.h>
+#include <ftw.h>
+
+#include "SD.h"
+#include "test.h"
+
+int testFailures = 0;
+static std::string root;
+
+static int removeEntry(const char * path, const struct stat *, int, struct FTW *)
+{
+  return remove(path);
+}
+
+// The previous card is removed
+static void removeCard()
+{
+  if(!root.empty())
+  {
+    nftw(root.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+    root.clear();
+  }
+}
+
+// Start with an empty SD card in a new temporary directory
+const char * testCard()
+{
+  removeCard();
+  char path[] = "/tmp/iotpowermeter-XXXXXX";
+  if(mkdtemp(path) == NULL)
+  {
+    return NULL;
+  }
+  root = path;
+  SD.begin(root.c_str());
+  return root.c_str();
+}
+
+// Copy a file of SD_root to the SD card
+bool testCopy(const char * from, const char * to)
+{
+  std::string path = std::string(TEST_DATA_DIR) + from;
+  FILE * source = fopen(path.c_str(), "rb");
+  File destination = SD.open(to, FILE_WRITE);
+  if(!source || !destination)
+  {
+    if(source)
+    {
+      fclose(source);
+    }
+    return false;
+  }
+  
+  uint8_t block[512];
+  size_t length;
+  while((length = fread(block, 1, sizeof(block), source)) > 0)
+  {
+    destination.write(block, length);
+  }
+  fclose(source);
+  destination.close();
+  return true;
+}
+
+int testResult(const char * name)
+{
+  removeCard();
+  printf("%s: %s, %d failed checks\n", name, testFailures ? "FAIL" : "OK", testFailures);
+  return testFailures ? 1 : 0;
+}
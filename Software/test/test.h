@@ -0,0 +1,64 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test.h
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+// Checks shared by the host tests, a test program returns the number of failed checks
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+extern int testFailures;
+
+#define CHECK(condition) \
+  do \
+  { \
+    if(!(condition)) \
+    { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      testFailures++; \
+    } \
+  } while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+  do \
+  { \
+    long long _expected = (expected); \
+    long long _actual = (actual); \
+    if(_expected != _actual) \
+    { \
+      printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, _actual, _expected); \
+      testFailures++; \
+    } \
+  } while(0)
+
+const char * testCard();
+bool testCopy(const char *, const char *);
+int testResult(const char *);
+
+#endif
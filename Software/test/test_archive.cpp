@@ -0,0 +1,178 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test_archive.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include "TimeLib.h"
+#include "SD.h"
+#include "config.h"
+#include "series.h"
+#include "archive.h"
+#include "test.h"
+#include "alloc.h"
+
+static time_t date(int y, int m, int d)
+{
+  tmElements_t elements = {0};
+  elements.Year = CalendarYrToTm(y);
+  elements.Month = m;
+  elements.Day = d;
+  return makeTime(elements);
+}
+
+static uint16_t original[MINUTES_PER_DAY];
+static uint16_t decoded[MINUTES_PER_DAY];
+static uint8_t encoded[MINUTES_PER_DAY * 3];
+
+// Encode a day the way the archive job does, returns the number of bytes
+static size_t encodeDay(const uint16_t * series)
+{
+  size_t length = 0;
+  uint16_t previous = 0;
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    length += archiveEncode(encoded + length, series[i], previous);
+    previous = series[i];
+  }
+  return length;
+}
+
+static void testCodec()
+{
+  uint8_t buffer[3];
+  
+  // Zigzag: 0, -1, 1, -2, 2... become 0, 1, 2, 3, 4...
+  CHECK_EQUAL(1, archiveEncode(buffer, 5, 5));
+  CHECK_EQUAL(0, buffer[0]);
+  CHECK_EQUAL(1, archiveEncode(buffer, 4, 5));
+  CHECK_EQUAL(1, buffer[0]);
+  CHECK_EQUAL(1, archiveEncode(buffer, 6, 5));
+  CHECK_EQUAL(2, buffer[0]);
+  
+  // Differences of up to 63 either way take one byte, the largest ones take three
+  CHECK_EQUAL(1, archiveEncode(buffer, 63, 0));
+  CHECK_EQUAL(2, archiveEncode(buffer, 64, 0));
+  CHECK_EQUAL(1, archiveEncode(buffer, 0, 64));
+  CHECK_EQUAL(3, archiveEncode(buffer, 0xffff, 0));
+  CHECK_EQUAL(3, archiveEncode(buffer, 0, 0xffff));
+  
+  // Round trip of random values and of the largest jumps, decoded in blocks of every size
+  srand(2);
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    original[i] = i < 720 ? rand() & 0xffff : (i & 1) * 0xffff;
+  }
+  size_t length = encodeDay(original);
+  
+  for(int block = 1; block <= 7; block++)
+  {
+    ArchiveDecoder decoder;
+    decoder.begin(decoded);
+    for(size_t offset = 0; offset < length; offset += block)
+    {
+      decoder.feed(encoded + offset, min((size_t)block, length - offset));
+    }
+    CHECK_EQUAL(MINUTES_PER_DAY, decoder.minutes);
+    CHECK(memcmp(original, decoded, sizeof(original)) == 0);
+  }
+  
+  // Bytes after a whole day are ignored, a cut short day gives fewer minutes
+  ArchiveDecoder decoder;
+  decoder.begin(decoded);
+  decoder.feed(encoded, length);
+  decoder.feed(encoded, length);
+  CHECK_EQUAL(MINUTES_PER_DAY, decoder.minutes);
+  decoder.begin(decoded);
+  decoder.feed(encoded, length - 1);
+  CHECK_EQUAL(MINUTES_PER_DAY - 1, decoder.minutes);
+  
+  // Encoding and decoding must not touch the heap
+  unsigned long allocationsBefore = allocations;
+  encodeDay(original);
+  decoder.begin(decoded);
+  decoder.feed(encoded, length);
+  CHECK_EQUAL(0, allocations - allocationsBefore);
+}
+
+// Run the archive job until it goes back to waiting, it does one slice per call
+static void runArchive()
+{
+  for(uint16_t i = 0; i < 1000; i++)
+  {
+    archiveStep();
+  }
+}
+
+static uint32_t fileSize(const char * path)
+{
+  File file = SD.open(path);
+  uint32_t size = file ? file.size() : 0;
+  file.close();
+  return size;
+}
+
+static void testJob()
+{
+  testCard();
+  SD.mkdir("/power");
+  CHECK(testCopy("/power/20150728.CSV", "/power/20150728.csv"));
+  readDay(date(2015, 7, 28), original);
+  setTime(date(2015, 8, 1) + 12 * SECS_PER_HOUR);
+  
+  // The card fills up while the day is written: nothing is indexed, the data is cut back and the log file stays
+  SD.writeLimit = 100;
+  runArchive();
+  CHECK(SD.exists("/power/20150728.csv"));
+  CHECK_EQUAL(0, fileSize("/archive/201507.bin"));
+  CHECK(!SD.exists("/archive/201507.idx"));
+  
+  // The next try, after ARCHIVE_PERIOD, archives the day
+  SD.writeLimit = -1;
+  hostAdvance(ARCHIVE_PERIOD);
+  runArchive();
+  CHECK(!SD.exists("/power/20150728.csv"));
+  CHECK_EQUAL(ARCHIVE_INDEX_ENTRY, fileSize("/archive/201507.idx"));
+  CHECK_EQUAL(encodeDay(original), fileSize("/archive/201507.bin"));
+  
+  CHECK_EQUAL(MINUTES_PER_DAY, readDay(date(2015, 7, 28), decoded));
+  CHECK(memcmp(original, decoded, sizeof(original)) == 0);
+  CHECK_EQUAL(721987, seriesSum(decoded, MINUTES_PER_DAY));
+  CHECK_EQUAL(0, readDay(date(2015, 7, 27), decoded));
+  
+  // A data file cut short gives the minutes that could be decoded
+  File data = SD.open("/archive/201507.bin", FILE_WRITE);
+  data.truncate(data.size() - 10);
+  data.close();
+  uint16_t minutes = readDay(date(2015, 7, 28), decoded);
+  CHECK(minutes > 0 && minutes < MINUTES_PER_DAY);
+}
+
+int main()
+{
+  testCodec();
+  testJob();
+  return testResult("archive");
+}
@@ -0,0 +1,127 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test_events.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include "TimeLib.h"
+#include "SD.h"
+#include "config.h"
+#include "events.h"
+#include "test.h"
+
+static uint32_t fileSize(const char * path)
+{
+  File file = SD.open(path);
+  uint32_t size = file ? file.size() : 0;
+  file.close();
+  return size;
+}
+
+// Sequence numbers must follow each other from the first one, without duplicates
+static bool consecutive(const EventRecord * records, uint16_t count, uint32_t first)
+{
+  for(uint16_t i = 0; i < count; i++)
+  {
+    if(records[i].sequence != first + i)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void testRealign()
+{
+  testCard();
+  setTime(1500000000);
+  
+  // Three records and the start of a fourth one that was cut short by a reset
+  File file = SD.open("/events0.bin", FILE_WRITE);
+  for(uint32_t sequence = 0; sequence < 3; sequence++)
+  {
+    EventRecord record = {sequence, 1500000000, EVENT_BOOT, 0, 0};
+    file.write((const uint8_t *)&record, sizeof(record));
+  }
+  file.write((const uint8_t *)"partial", 7);
+  file.close();
+  
+  // Events logged before the SD card is up are numbered after the saved ones
+  logEvent(EVENT_BOOT);
+  eventsBegin();
+  CHECK_EQUAL(3 * sizeof(EventRecord), fileSize("/events0.bin"));
+  
+  for(uint8_t i = 0; i < EVENTS_FLUSH_COUNT - 1; i++)
+  {
+    logEvent(EVENT_IP, i);
+  }
+  eventsStep();
+  CHECK_EQUAL((3 + EVENTS_FLUSH_COUNT) * sizeof(EventRecord), fileSize("/events0.bin"));
+  
+  EventRecord records[32];
+  uint16_t count = eventsRead(0, records, 32);
+  CHECK_EQUAL(3 + EVENTS_FLUSH_COUNT, count);
+  CHECK(consecutive(records, 3, 0));
+  CHECK(consecutive(records + 3, EVENTS_FLUSH_COUNT, EVENTS_RAM_RECORDS));
+  CHECK_EQUAL(EVENT_IP, records[4].code);
+  
+  // The card fails in the middle of a record: the file is cut back and the events stay in memory
+  uint32_t next = records[count - 1].sequence + 1;
+  for(uint8_t i = 0; i < EVENTS_FLUSH_COUNT; i++)
+  {
+    logEvent(EVENT_DAY_POWER, i);
+  }
+  SD.writeLimit = sizeof(EventRecord) + 5;
+  eventsStep();
+  CHECK_EQUAL((3 + EVENTS_FLUSH_COUNT) * sizeof(EventRecord), fileSize("/events0.bin"));
+  CHECK_EQUAL(EVENTS_FLUSH_COUNT, eventsRead(next, records, 32));
+  CHECK(consecutive(records, EVENTS_FLUSH_COUNT, next));
+  
+  // Written with the next batch
+  SD.writeLimit = -1;
+  hostAdvance(EVENTS_FLUSH_PERIOD);
+  eventsStep();
+  CHECK_EQUAL((3 + 2 * EVENTS_FLUSH_COUNT) * sizeof(EventRecord), fileSize("/events0.bin"));
+  count = eventsRead(0, records, 32);
+  CHECK_EQUAL(3 + 2 * EVENTS_FLUSH_COUNT, count);
+  CHECK(consecutive(records + 3, 2 * EVENTS_FLUSH_COUNT, EVENTS_RAM_RECORDS));
+}
+
+// Every event code has a name, the codes are stored on the SD card so new ones only go at the end
+static void testNames()
+{
+  CHECK(strcmp(eventName(EVENT_BOOT), "boot") == 0);
+  CHECK(strcmp(eventName(EVENT_ARCHIVE_FAILED), "archive failed") == 0);
+  CHECK(strcmp(eventName(EVENT_EDIT_UPLOAD_FAILED), "edit upload failed") == 0);
+  CHECK(strcmp(eventName(EVENT_TIME_FIRST), "time first") == 0);
+  CHECK(strcmp(eventName(EVENT_TYPES), "unknown") == 0);
+}
+
+int main()
+{
+  testRealign();
+  testNames();
+  return testResult("events");
+}
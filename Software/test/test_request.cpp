@@ -0,0 +1,190 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test_request.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include "Arduino.h"
+#include "config.h"
+#include "request.h"
+#include "test.h"
+#include "alloc.h"
+
+static void testStats()
+{
+  RequestStats stats = {0};
+  
+  // 90 fast requests under 1ms, 9 around 5ms and one slow 300ms request
+  for(uint8_t i = 0; i < 90; i++)
+  {
+    requestRecord(&stats, 400);
+  }
+  for(uint8_t i = 0; i < 9; i++)
+  {
+    requestRecord(&stats, 5000);
+  }
+  requestRecord(&stats, 300000);
+  
+  CHECK_EQUAL(100, stats.count);
+  CHECK_EQUAL(90 * 400 + 9 * 5000 + 300000, stats.timeTotal);
+  CHECK_EQUAL(300000, stats.timeMax);
+  CHECK_EQUAL(90, stats.histogram[0]);
+  CHECK_EQUAL(9, stats.histogram[3]);
+  CHECK_EQUAL(1, stats.histogram[9]);
+  
+  CHECK_EQUAL(1, requestPercentile(&stats, 50));
+  CHECK_EQUAL(8, requestPercentile(&stats, 99));
+  CHECK_EQUAL(512, requestPercentile(&stats, 100));
+  
+  // Requests longer than the histogram go to the last bucket
+  requestRecord(&stats, 0xffffffff);
+  CHECK_EQUAL(1, stats.histogram[REQUEST_STATS_BUCKETS - 1]);
+}
+
+static void testRange()
+{
+  uint32_t first = 0, last = 0;
+  
+  CHECK_EQUAL(206, parseRange("bytes=0-99", 1000, &first, &last));
+  CHECK_EQUAL(0, first);
+  CHECK_EQUAL(99, last);
+  
+  // Open ended and past the end of the file
+  CHECK_EQUAL(206, parseRange("bytes=900-", 1000, &first, &last));
+  CHECK_EQUAL(900, first);
+  CHECK_EQUAL(999, last);
+  CHECK_EQUAL(206, parseRange("bytes=900-5000", 1000, &first, &last));
+  CHECK_EQUAL(999, last);
+  
+  // Suffix ranges, longer than the file is the whole file
+  CHECK_EQUAL(206, parseRange("bytes=-100", 1000, &first, &last));
+  CHECK_EQUAL(900, first);
+  CHECK_EQUAL(999, last);
+  CHECK_EQUAL(206, parseRange("bytes=-5000", 1000, &first, &last));
+  CHECK_EQUAL(0, first);
+  CHECK_EQUAL(416, parseRange("bytes=-0", 1000, &first, &last));
+  CHECK_EQUAL(416, parseRange("bytes=-10", 0, &first, &last));
+  
+  // Outside of the file or reversed
+  CHECK_EQUAL(416, parseRange("bytes=1000-", 1000, &first, &last));
+  CHECK_EQUAL(416, parseRange("bytes=500-100", 1000, &first, &last));
+  
+  // Not understood, the whole file is sent
+  CHECK_EQUAL(200, parseRange("", 1000, &first, &last));
+  CHECK_EQUAL(200, parseRange("items=0-10", 1000, &first, &last));
+  CHECK_EQUAL(200, parseRange("bytes=0-10,20-30", 1000, &first, &last));
+  CHECK_EQUAL(200, parseRange("bytes=abc", 1000, &first, &last));
+}
+
+static void testMimeType()
+{
+  CHECK(strcmp(mimeType("/index.htm"), "text/html") == 0);
+  CHECK(strcmp(mimeType("/SCRIPT.JS"), "application/javascript") == 0);
+  CHECK(strcmp(mimeType("/img/logo.png"), "image/png") == 0);
+  CHECK(strcmp(mimeType("/power/20161030.csv"), "text/plain") == 0);
+  CHECK(strcmp(mimeType("/README"), "text/plain") == 0);
+}
+
+static void testCopyPath()
+{
+  char path[SERVER_PATH_LENGTH];
+  char argument[SERVER_PATH_LENGTH + 1];
+  
+  CHECK(copyPath(path, "/power/20161030.csv"));
+  CHECK(strcmp(path, "/power/20161030.csv") == 0);
+  CHECK(!copyPath(path, ""));
+  
+  // The longest path that fits and one character more
+  memset(argument, 'a', SERVER_PATH_LENGTH);
+  argument[SERVER_PATH_LENGTH - 1] = 0;
+  CHECK(copyPath(path, argument));
+  CHECK_EQUAL(SERVER_PATH_LENGTH - 1, strlen(path));
+  argument[SERVER_PATH_LENGTH - 1] = 'a';
+  argument[SERVER_PATH_LENGTH] = 0;
+  CHECK(!copyPath(path, argument));
+}
+
+static void testPaths()
+{
+  CHECK(pathIs("/power", "/power"));
+  CHECK(pathIs("/POWER/", "/power"));
+  CHECK(!pathIs("/power/20161030.csv", "/power"));
+  CHECK(!pathIs("/powerful", "/power"));
+  CHECK(pathIs("/EVENTS0.BIN", "/events0.bin"));
+  
+  CHECK(pathWithin("/power", "/power"));
+  CHECK(pathWithin("/power/", "/power"));
+  CHECK(pathWithin("/Power/20161030.csv", "/power"));
+  CHECK(!pathWithin("/powerful", "/power"));
+  CHECK(!pathWithin("/pow", "/power"));
+  CHECK(!pathWithin("/www/power", "/power"));
+}
+
+static void testJsonEscape()
+{
+  char buffer[16];
+  
+  CHECK_EQUAL(9, jsonEscape(buffer, sizeof(buffer), "INDEX.HTM"));
+  CHECK(strcmp(buffer, "INDEX.HTM") == 0);
+  
+  CHECK_EQUAL(13, jsonEscape(buffer, sizeof(buffer), "a\"b\\c\n"));
+  CHECK(strcmp(buffer, "a\\\"b\\\\c\\u000a") == 0);
+  
+  // A sequence that does not fit is left out whole and nothing is copied after it
+  CHECK_EQUAL(17, jsonEscape(buffer, sizeof(buffer), "0123456789\"\"\"x"));
+  CHECK(strcmp(buffer, "0123456789\\\"\\\"") == 0);
+  CHECK_EQUAL(16, jsonEscape(buffer, sizeof(buffer), "0123456789abcdef"));
+  CHECK(strcmp(buffer, "0123456789abcde") == 0);
+  CHECK_EQUAL(1, jsonEscape(buffer, 1, "x"));
+  CHECK_EQUAL(0, buffer[0]);
+}
+
+// The request helpers run for every request, they must not allocate
+static void testAllocations()
+{
+  char buffer[64];
+  uint32_t first, last;
+  unsigned long allocationsBefore = allocations;
+  
+  parseRange("bytes=100-199", 1000, &first, &last);
+  mimeType("/index.htm");
+  copyPath(buffer, "/power/20161030.csv");
+  jsonEscape(buffer, sizeof(buffer), "name \"quoted\"");
+  pathWithin("/power/20161030.csv", "/power");
+  
+  CHECK_EQUAL(0, allocations - allocationsBefore);
+}
+
+int main()
+{
+  testStats();
+  testRange();
+  testMimeType();
+  testCopyPath();
+  testPaths();
+  testJsonEscape();
+  testAllocations();
+  return testResult("request");
+}
@@ -0,0 +1,242 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test_series.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <string>
+
+#include "TimeLib.h"
+#include "SD.h"
+#include "series.h"
+#include "test.h"
+#include "alloc.h"
+
+// Midnight at the start of a date
+static time_t date(int y, int m, int d)
+{
+  tmElements_t elements = {0};
+  elements.Year = CalendarYrToTm(y);
+  elements.Month = m;
+  elements.Day = d;
+  return makeTime(elements);
+}
+
+static uint16_t series[MINUTES_PER_DAY];
+
+// The recorded day of SD_root, the same file the replay tool plays
+static void testRecordedDay()
+{
+  testCard();
+  SD.mkdir("/power");
+  CHECK(testCopy("/power/20150728.CSV", "/power/20150728.csv"));
+  
+  CHECK_EQUAL(1440, readDay(date(2015, 7, 28), series));
+  CHECK_EQUAL(897, series[0]);
+  CHECK_EQUAL(28, series[1]);
+  
+  // Same total as awk -F, 'NR>1{s+=$2}END{print s}'
+  uint32_t total = 0;
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    total += series[i];
+  }
+  CHECK_EQUAL(721987, total);
+  
+  // A day without a file or an archive is empty
+  CHECK_EQUAL(0, readDay(date(2015, 7, 29), series));
+  
+  // Todays copy is loaded from the same file when the first minute is logged after boot, then follows the logged
+  // minutes, reading it never uses the card
+  setTime(date(2015, 7, 28) + 12 * SECS_PER_HOUR);
+  unsigned long allocationsBefore = allocations;
+  CHECK_EQUAL(0, todaySeries()[0]);
+  CHECK_EQUAL(0, allocations - allocationsBefore);
+  todaySeriesUpdate(date(2015, 7, 28) + 1 * SECS_PER_MIN, 70000);
+  CHECK_EQUAL(897, todaySeries()[0]);
+  CHECK_EQUAL(0xffff, todaySeries()[1]);
+  
+  // The next day starts empty, without reading the card
+  allocationsBefore = allocations;
+  todaySeriesUpdate(date(2015, 7, 29), 5);
+  CHECK_EQUAL(0, allocations - allocationsBefore);
+  CHECK_EQUAL(5, seriesSum(todaySeries(), MINUTES_PER_DAY));
+}
+
+// Parse a text in blocks of the given size
+static uint16_t parse(const char * text, size_t block)
+{
+  SeriesParser parser;
+  parser.begin(series);
+  size_t length = strlen(text);
+  for(size_t offset = 0; offset < length; offset += block)
+  {
+    parser.feed((const uint8_t *)text + offset, min(block, length - offset));
+  }
+  parser.finish();
+  return parser.rows;
+}
+
+// Both dialects of the day log files, in blocks of any size so that rows are split anywhere
+static void testParser()
+{
+  const char * text =
+    "Timestamp,Power [W*min]\r\n"
+    "2015-07-28T00:00Z,897\r\n"
+    "2015-07-28T00:01Z,28\n"
+    "00:02,5\n"
+    "23:59,70000\n"
+    "\n"
+    "garbage\n"
+    "24:00,1\n"
+    "12:60,1\n"
+    "12:5,1\n"
+    "12:05,\n"
+    "1:30,7\n"
+    "12:03,42";
+  
+  for(size_t block = 1; block <= 32; block++)
+  {
+    CHECK_EQUAL(5, parse(text, block));
+    CHECK_EQUAL(897, series[0]);
+    CHECK_EQUAL(28, series[1]);
+    CHECK_EQUAL(5, series[2]);
+    CHECK_EQUAL(42, series[12 * 60 + 3]);
+    // Values are clamped to 16 bits
+    CHECK_EQUAL(0xffff, series[MINUTES_PER_DAY - 1]);
+    // Malformed rows are skipped
+    CHECK_EQUAL(0, series[12 * 60 + 5]);
+    CHECK_EQUAL(0, series[90]);
+  }
+  
+  // Only a header, or nothing at all
+  CHECK_EQUAL(0, parse("Time,Wh\n", 4));
+  CHECK_EQUAL(0, parse("", 4));
+}
+
+// Same results as the plain loops, for every length around the unrolling and for a whole day
+static void testRollups()
+{
+  static uint16_t values[MINUTES_PER_DAY];
+  static uint32_t total[MINUTES_PER_DAY];
+  srand(1);
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    values[i] = rand() & 0xffff;
+  }
+  
+  uint16_t lengths[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 60, 61, MINUTES_PER_DAY};
+  for(uint8_t n = 0; n < sizeof(lengths) / sizeof(lengths[0]); n++)
+  {
+    uint16_t length = lengths[n];
+    uint32_t sum = 0;
+    uint16_t minimum = 0xffff;
+    uint16_t maximum = 0;
+    for(uint16_t i = 0; i < length; i++)
+    {
+      sum += values[i];
+      minimum = min(minimum, values[i]);
+      maximum = max(maximum, values[i]);
+      total[i] = i;
+    }
+    
+    CHECK_EQUAL(sum, seriesSum(values, length));
+    CHECK_EQUAL(minimum, seriesMin(values, length));
+    CHECK_EQUAL(maximum, seriesMax(values, length));
+    
+    seriesAccumulate(total, values, length);
+    for(uint16_t i = 0; i < length; i++)
+    {
+      CHECK_EQUAL(i + values[i], total[i]);
+    }
+  }
+  
+  // The largest day still fits in the 32-bit sum
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    values[i] = 0xffff;
+  }
+  CHECK_EQUAL(0xffffUL * MINUTES_PER_DAY, seriesSum(values, MINUTES_PER_DAY));
+  
+  uint32_t hours[24];
+  for(uint16_t i = 0; i < MINUTES_PER_DAY; i++)
+  {
+    values[i] = i / 60;
+  }
+  seriesHourly(values, hours);
+  for(uint8_t hour = 0; hour < 24; hour++)
+  {
+    CHECK_EQUAL(hour * 60, hours[hour]);
+  }
+}
+
+// Parsing a day and the rollups must not touch the heap, the ESP8266 has little of it and it fragments
+static void testNoAllocation()
+{
+  FILE * file = fopen(TEST_DATA_DIR "/power/20150728.CSV", "rb");
+  CHECK(file != NULL);
+  if(!file)
+  {
+    return;
+  }
+  std::string data;
+  char block[512];
+  size_t length;
+  while((length = fread(block, 1, sizeof(block), file)) > 0)
+  {
+    data.append(block, length);
+  }
+  fclose(file);
+  
+  uint32_t hours[24];
+  uint32_t total[MINUTES_PER_DAY] = {0};
+  unsigned long allocationsBefore = allocations;
+  
+  SeriesParser parser;
+  parser.begin(series);
+  parser.feed((const uint8_t *)data.data(), data.size());
+  parser.finish();
+  seriesSum(series, MINUTES_PER_DAY);
+  seriesMin(series, MINUTES_PER_DAY);
+  seriesMax(series, MINUTES_PER_DAY);
+  seriesHourly(series, hours);
+  seriesAccumulate(total, series, MINUTES_PER_DAY);
+  
+  CHECK_EQUAL(0, allocations - allocationsBefore);
+  CHECK_EQUAL(1440, parser.rows);
+  
+  // The counter itself works
+  free(malloc(16));
+  CHECK_EQUAL(1, allocations - allocationsBefore);
+}
+
+int main()
+{
+  testRecordedDay();
+  testParser();
+  testRollups();
+  testNoAllocation();
+  return testResult("series");
+}
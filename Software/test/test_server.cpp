@@ -0,0 +1,133 @@
+/*
+  IoTPowerMeter - Software for the IoTPowerMeter based on the ESP8266
+
+  Copyright (c) 2016 Karl Kangur. All rights reserved.
+  This file is part of IoTPowerMeter.
+
+  IoTPowerMeter is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  IoTPowerMeter is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with IoTPowerMeter.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * File:    test_server.cpp
+ * Author:  Karl Kangur <karl.kangur@gmail.com>
+ * Licnece: GPL
+ * URL:     https://github.com/Nurgak/Internet-of-Things-Power-Meter
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <SD.h>
+#include <TimeLib.h>
+
+#include "request.h"
+#include "server.h"
+#include "test.h"
+#include "http.h"
+#include "alloc.h"
+
+// Requests sent by the client thread one at a time, the firmware answers them on the main thread like its loop does
+static const char * targets[] = {
+  "/api?request=live",
+  "/api?request=today",
+  "/api?request=constant",
+  "/api?request=values",
+  "/api?request=values&since=600&format=bin",
+  "/api?request=summary",
+  "/api?request=events",
+  "/api?request=events&since=1",
+  "/api?request=memory",
+  "/api?request=stats",
+  "/api?request=unknown",
+  "/api"
+};
+#define TARGET_COUNT (sizeof(targets) / sizeof(targets[0]))
+
+static std::atomic<int> next(-1);
+static std::atomic<bool> done(false);
+static int statuses[TARGET_COUNT];
+static uint8_t body[65536];
+
+// The client does not use the heap either, so every allocation counted comes from the firmware
+static void client()
+{
+  for(uint8_t i = 0; i < TARGET_COUNT; i++)
+  {
+    while(next != i)
+    {
+      std::this_thread::yield();
+    }
+    HttpResponse response;
+    httpGet(targets[i], NULL, body, sizeof(body), &response);
+    statuses[i] = response.status;
+    done = true;
+  }
+}
+
+// The API requests are answered from memory, they must not allocate anything, not even a String
+// Requests that open files on the card are left out, the SD library allocates every file it opens
+static void testApiAllocations()
+{
+  testCard();
+  setTime(1500000000);
+  hostPortMap(80, 0);
+  initServer();
+  httpBegin(hostPortBound(80));
+  
+  std::thread thread(client);
+  for(uint8_t i = 0; i < TARGET_COUNT; i++)
+  {
+    done = false;
+    next = i;
+    unsigned long counted = 0;
+    while(!done)
+    {
+      unsigned long allocationsBefore = allocations;
+      handleClient();
+      counted += allocations - allocationsBefore;
+    }
+    if(counted)
+    {
+      printf("%s: %lu allocations\n", targets[i], counted);
+    }
+    CHECK_EQUAL(0, counted);
+  }
+  thread.join();
+  
+  CHECK_EQUAL(200, statuses[0]);
+  CHECK_EQUAL(200, statuses[4]);
+  CHECK_EQUAL(200, statuses[9]);
+  CHECK_EQUAL(400, statuses[10]);
+  CHECK_EQUAL(400, statuses[11]);
+}
+
+// Dates of the range request
+static void testParseDate()
+{
+  CHECK_EQUAL(1500076800, parseDate("20170715"));
+  CHECK_EQUAL(0, parseDate("2017071"));
+  CHECK_EQUAL(0, parseDate("2017071x"));
+  CHECK_EQUAL(0, parseDate("20171315"));
+  CHECK_EQUAL(0, parseDate(""));
+}
+
+int main()
+{
+  testParseDate();
+  testApiAllocations();
+  return testResult("server");
+}